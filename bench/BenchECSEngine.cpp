@@ -0,0 +1,393 @@
+#include "Benchmark.h"
+
+#include <lazarus/ECS.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace lz;
+
+namespace
+{
+struct Position
+{
+    Position(float x, float y)
+        : x(x)
+        , y(y)
+    {
+    }
+
+    float x, y;
+};
+
+struct Velocity
+{
+    Velocity(float dx, float dy)
+        : dx(dx)
+        , dy(dy)
+    {
+    }
+
+    float dx, dy;
+};
+
+void populate(ECSEngine &engine, long long count)
+{
+    for (long long i = 0; i < count; ++i)
+    {
+        auto entity = engine.add_entity();
+        entity->add_component<Position>(0.f, 0.f);
+        entity->add_component<Velocity>(1.f, 0.5f);
+    }
+}
+
+struct Damage
+{
+    int amount;
+};
+
+template <int N>
+class DamageListener : public EventListener<Damage>
+{
+public:
+    void receive(ECSEngine &, const Damage &event) override
+    {
+        total += event.amount;
+    }
+
+    long long total = 0;
+};
+}  // namespace
+
+// Iterating through an std::function, called indirectly for every entity
+LZ_BENCHMARK(apply_to_each_std_function, 1000, 100000)
+{
+    using MoveFunction = std::function<void(Entity *, Position *, Velocity *)>;
+    ECSEngine engine;
+    populate(engine, state.arg());
+    auto move = [](Entity *, Position *position, Velocity *velocity) {
+        position->x += velocity->dx;
+        position->y += velocity->dy;
+    };
+
+    for (auto _ : state)
+        engine.apply_to_each<Position, Velocity>(MoveFunction(move));
+    state.set_items_processed(state.arg());
+}
+
+// Iterating through a lambda, which can be inlined into the loop
+LZ_BENCHMARK(apply_to_each_lambda, 1000, 100000, 1000000)
+{
+    ECSEngine engine;
+    populate(engine, state.arg());
+    auto move = [](Entity *, Position *position, Velocity *velocity) {
+        position->x += velocity->dx;
+        position->y += velocity->dy;
+    };
+
+    for (auto _ : state)
+        engine.apply_to_each<Position, Velocity>(move);
+    state.set_items_processed(state.arg());
+}
+
+LZ_BENCHMARK(apply_to_each_lambda_sparse_set, 1000, 100000)
+{
+    ECSEngine engine(StorageBackend::SparseSet);
+    populate(engine, state.arg());
+    auto move = [](Entity *, Position *position, Velocity *velocity) {
+        position->x += velocity->dx;
+        position->y += velocity->dy;
+    };
+
+    for (auto _ : state)
+        engine.apply_to_each<Position, Velocity>(move);
+    state.set_items_processed(state.arg());
+}
+
+// Spreading the same work over the thread pool of the engine
+LZ_BENCHMARK(parallel_apply_to_each, 1000, 100000, 1000000)
+{
+    ECSEngine engine;
+    populate(engine, state.arg());
+    auto move = [](Entity *, Position *position, Velocity *velocity) {
+        position->x += velocity->dx;
+        position->y += velocity->dy;
+    };
+
+    for (auto _ : state)
+        engine.parallel_apply_to_each<Position, Velocity>(move);
+    state.set_items_processed(state.arg());
+}
+
+// Creating entities and adding their components one at a time
+LZ_BENCHMARK(add_entities_one_by_one, 1000, 100000, 1000000)
+{
+    for (auto _ : state)
+    {
+        auto engine = std::make_unique<ECSEngine>();
+        populate(*engine, state.arg());
+        state.pause_timing();
+        engine.reset();
+        state.resume_timing();
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Same, with the components added to the blocks of the sparse set pools
+LZ_BENCHMARK(add_entities_one_by_one_sparse_set, 1000, 100000)
+{
+    for (auto _ : state)
+    {
+        auto engine = std::make_unique<ECSEngine>(StorageBackend::SparseSet);
+        populate(*engine, state.arg());
+        state.pause_timing();
+        engine.reset();
+        state.resume_timing();
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Creating entities with their components constructed in place
+LZ_BENCHMARK(spawn_entities, 1000, 100000, 1000000)
+{
+    for (auto _ : state)
+    {
+        auto engine = std::make_unique<ECSEngine>();
+        engine->spawn(state.arg(), Position(0.f, 0.f), Velocity(1.f, 0.5f));
+        state.pause_timing();
+        engine.reset();
+        state.resume_timing();
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Deleting every entity of an engine and collecting them
+LZ_BENCHMARK(delete_all_entities, 1000, 100000, 1000000)
+{
+    ECSEngine engine;
+    for (auto _ : state)
+    {
+        state.pause_timing();
+        std::vector<Entity *> entities =
+            engine.spawn(state.arg(), Position(0.f, 0.f), Velocity(1.f, 0.5f));
+        state.resume_timing();
+        for (Entity *entity : entities)
+            entity->mark_for_deletion();
+        engine.update();
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Collecting a few deleted entities from a large engine
+LZ_BENCHMARK(garbage_collect_ten_deleted, 1000, 100000)
+{
+    ECSEngine engine;
+    populate(engine, state.arg());
+    for (auto _ : state)
+    {
+        state.pause_timing();
+        for (int i = 0; i < 10; ++i)
+            engine.add_entity()->mark_for_deletion();
+        state.resume_timing();
+        engine.update();
+    }
+    state.set_items_processed(10);
+}
+
+// Emitting events to a few subscribed listeners
+LZ_BENCHMARK(emit_to_four_listeners, 1000, 100000)
+{
+    ECSEngine engine;
+    engine.add_system<DamageListener<0>, Damage>();
+    engine.add_system<DamageListener<1>, Damage>();
+    engine.add_system<DamageListener<2>, Damage>();
+    engine.add_system<DamageListener<3>, Damage>();
+
+    for (auto _ : state)
+    {
+        for (long long i = 0; i < state.arg(); ++i)
+            engine.emit(Damage{1});
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Queueing events and delivering them to the same listeners in a single batch
+LZ_BENCHMARK(emit_queued_to_four_listeners, 1000, 100000)
+{
+    ECSEngine engine;
+    engine.set_event_delivery<Damage>(EventDelivery::Queued);
+    engine.add_system<DamageListener<0>, Damage>();
+    engine.add_system<DamageListener<1>, Damage>();
+    engine.add_system<DamageListener<2>, Damage>();
+    engine.add_system<DamageListener<3>, Damage>();
+
+    for (auto _ : state)
+    {
+        for (long long i = 0; i < state.arg(); ++i)
+            engine.emit(Damage{1});
+        engine.deliver_queued_events();
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Emitting an event per entity from a parallel pass, delivered once it is over
+LZ_BENCHMARK(emit_from_parallel_pass, 1000, 100000)
+{
+    ECSEngine engine;
+    populate(engine, state.arg());
+    engine.add_system<DamageListener<0>, Damage>();
+
+    for (auto _ : state)
+    {
+        engine.parallel_apply_to_each<Position>(
+            [&](Entity *, Position *) { engine.emit(Damage{1}); });
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Adding a component to every entity through the command buffer of the engine
+LZ_BENCHMARK(command_buffer_add_component, 1000, 100000)
+{
+    struct Tag
+    {
+        int value;
+    };
+
+    for (auto _ : state)
+    {
+        state.pause_timing();
+        auto engine = std::make_unique<ECSEngine>();
+        populate(*engine, state.arg());
+        state.resume_timing();
+
+        for (Entity *entity : engine->view<Position>())
+            engine->commands().add_component<Tag>(*entity, Tag{1});
+        engine->apply_commands();
+
+        state.pause_timing();
+        engine.reset();
+        state.resume_timing();
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Finding the one percent of the positions changed since a tick, among all of them
+LZ_BENCHMARK(view_changed_one_percent, 1000, 100000)
+{
+    ECSEngine engine;
+    populate(engine, state.arg());
+    engine.update();
+    ChangeTick tick = engine.get_change_tick();
+    long long count = 0;
+    for (Entity *entity : engine.entities_with_components<Position>())
+    {
+        if (count++ % 100 == 0)
+            entity->get<Position>()->x = 1.f;
+    }
+
+    float sum = 0.f;
+    for (auto _ : state)
+        engine.view<Changed<const Position>>().since(tick).each(
+            [&](Entity *, const Position *position) { sum += position->x; });
+    state.set_items_processed(state.arg());
+}
+
+// Saving a snapshot of a world, with a position and a velocity for every entity
+LZ_BENCHMARK(save_snapshot, 1000, 100000, 500000)
+{
+    ECSEngine engine;
+    populate(engine, state.arg());
+    SnapshotRegistry registry;
+    registry.add<Position>("Position");
+    registry.add<Velocity>("Velocity");
+
+    size_t bytes = 0;
+    for (auto _ : state)
+        bytes += registry.save(engine).size();
+    state.set_items_processed(state.arg());
+}
+
+// Loading the same snapshot into an empty engine
+LZ_BENCHMARK(load_snapshot, 1000, 100000, 500000)
+{
+    SnapshotRegistry registry;
+    registry.add<Position>("Position");
+    registry.add<Velocity>("Velocity");
+    std::vector<char> snapshot;
+    {
+        ECSEngine engine;
+        populate(engine, state.arg());
+        snapshot = registry.save(engine);
+    }
+
+    for (auto _ : state)
+    {
+        auto engine = std::make_unique<ECSEngine>();
+        registry.load(*engine, snapshot.data(), snapshot.size());
+        state.pause_timing();
+        engine.reset();
+        state.resume_timing();
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Forking a world and moving one entity in a hundred of the fork, as a lookahead
+// which touches few chunks would
+LZ_BENCHMARK(fork_and_move_one_percent, 1000, 100000, 500000)
+{
+    ECSEngine engine;
+    populate(engine, state.arg());
+    std::vector<Identifier> moved;
+    engine.apply_to_each<Position>([&](Entity *entity, Position *) {
+        if (moved.size() * 100 < static_cast<size_t>(state.arg()))
+            moved.push_back(entity->get_id());
+    });
+
+    for (auto _ : state)
+    {
+        std::unique_ptr<ECSEngine> fork = engine.fork();
+        for (Identifier id : moved)
+            fork->get_entity(id)->get<Position>()->x += 1.f;
+        state.pause_timing();
+        fork.reset();
+        state.resume_timing();
+    }
+    state.set_items_processed(state.arg());
+}
+
+// Iterating like apply_to_each_lambda with the profiler enabled, which counts the
+// entities visited
+LZ_BENCHMARK(apply_to_each_profiled, 1000, 100000)
+{
+    ECSEngine engine;
+    engine.get_profiler().set_enabled(true);
+    populate(engine, state.arg());
+    auto move = [](Entity *, Position *position, Velocity *velocity) {
+        position->x += velocity->dx;
+        position->y += velocity->dy;
+    };
+
+    for (auto _ : state)
+        engine.apply_to_each<Position, Velocity>(move);
+    state.set_items_processed(state.arg());
+}
+
+// Emitting events like emit_to_four_listeners with the profiler enabled, which
+// measures every delivery as a whole
+LZ_BENCHMARK(emit_to_four_listeners_profiled, 1000, 100000)
+{
+    ECSEngine engine;
+    engine.get_profiler().set_enabled(true);
+    engine.add_system<DamageListener<0>, Damage>();
+    engine.add_system<DamageListener<1>, Damage>();
+    engine.add_system<DamageListener<2>, Damage>();
+    engine.add_system<DamageListener<3>, Damage>();
+
+    for (auto _ : state)
+    {
+        for (long long i = 0; i < state.arg(); ++i)
+            engine.emit(Damage{1});
+    }
+    state.set_items_processed(state.arg());
+}
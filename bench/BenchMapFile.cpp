@@ -0,0 +1,45 @@
+#include "Benchmark.h"
+
+#include <lazarus/MapFile.h>
+#include <lazarus/SquareGridMap.h>
+
+#include <cstdio>
+#include <string>
+
+using namespace lz;
+
+namespace
+{
+const std::string BENCH_MAP_PATH = "lazarus_bench_map.lzmap";
+
+SquareGridMap make_level(unsigned long size)
+{
+    SquareGridMap map(size, size);
+    map.carve_room(Position2D(1, 1), Position2D(size - 2, size - 2));
+    return map;
+}
+}  // namespace
+
+// Writing a square map of the given size to a file
+LZ_BENCHMARK(map_file_save, 1024, 4096)
+{
+    SquareGridMap map = make_level(state.arg());
+    for (auto _ : state)
+        MapFile::save(map, BENCH_MAP_PATH);
+    std::remove(BENCH_MAP_PATH.c_str());
+    state.set_items_processed(state.arg() * state.arg());
+}
+
+// Opening a map file of the given size and reading a tile of it
+LZ_BENCHMARK(map_file_open, 1024, 4096)
+{
+    MapFile::save(make_level(state.arg()), BENCH_MAP_PATH);
+    bool walkable = false;
+    for (auto _ : state)
+    {
+        SquareGridMap map = MapFile::open(BENCH_MAP_PATH);
+        walkable = map.is_walkable(state.arg() / 2, state.arg() / 2);
+        lzbench::do_not_optimize(walkable);
+    }
+    std::remove(BENCH_MAP_PATH.c_str());
+}
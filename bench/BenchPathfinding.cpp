@@ -0,0 +1,77 @@
+#include "Benchmark.h"
+#include "Maps.h"
+
+#include <lazarus/AStarSearch.h>
+#include <lazarus/ChunkedGridMap.h>
+#include <lazarus/SquareGridMap.h>
+
+using namespace lz;
+
+namespace
+{
+// Searches a path between the two positions with A* on every iteration, reporting
+// the time per step of the path
+template <typename Map>
+void search_paths(lzbench::State &state,
+                  const Map &map,
+                  const Position2D &origin,
+                  const Position2D &goal)
+{
+    size_t steps = 0;
+    for (auto _ : state)
+    {
+        AStarSearch<Position2D, Map> search(map, origin, goal);
+        search.execute();
+        steps = search.getPath().size();
+        lzbench::do_not_optimize(steps);
+    }
+    state.set_items_processed(steps);
+}
+}  // namespace
+
+// Crossing a map without obstacles from one corner to the opposite one
+LZ_BENCHMARK(astar_open_map, 32, 64, 128, 256)
+{
+    SquareGridMap map = lzbench::make_open_map(state.arg());
+    Position2D origin(1, 1);
+    search_paths(state, map, origin, Position2D(state.arg() - 2, state.arg() - 2));
+}
+
+// Finding the longest path of a maze, where the search explores most corridors
+LZ_BENCHMARK(astar_maze, 33, 65, 129, 257)
+{
+    SquareGridMap map = lzbench::make_maze(state.arg());
+    Position2D origin(1, 1);
+    search_paths(state, map, origin, lzbench::find_farthest(map, origin));
+}
+
+// Reaching the farthest corner of a cave from its center
+LZ_BENCHMARK(astar_cave, 32, 64, 128, 256)
+{
+    SquareGridMap map = lzbench::make_cave(state.arg());
+    Position2D origin = lzbench::find_center(map);
+    search_paths(state, map, origin, lzbench::find_farthest(map, origin));
+}
+
+// Same, on a chunked map made of the tiles of the cave which only keeps four chunks
+// in memory, so that the larger caves keep loading chunks while searching
+LZ_BENCHMARK(astar_chunked_cave, 128, 256)
+{
+    SquareGridMap cave = lzbench::make_cave(state.arg());
+    auto copy_cave = [&](const Position2D &chunk, SquareGridMap &tiles) {
+        long size = ChunkedGridMap::CHUNK_SIZE;
+        for (long y = 0; y < size; ++y)
+        {
+            for (long x = 0; x < size; ++x)
+            {
+                Position2D pos(chunk.x * size + x, chunk.y * size + y);
+                if (cave.is_walkable(pos))
+                    tiles.set_cost(x, y, cave.get_cost(pos));
+                tiles.set_transparency(x, y, cave.is_transparent(pos));
+            }
+        }
+    };
+    ChunkedGridMap map(copy_cave, 4 * ChunkedGridMap::CHUNK_BYTES);
+    Position2D origin = lzbench::find_center(cave);
+    search_paths(state, map, origin, lzbench::find_farthest(cave, origin));
+}
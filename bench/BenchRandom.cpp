@@ -0,0 +1,77 @@
+#include "Benchmark.h"
+
+#include <lazarus/Random.h>
+
+#include <vector>
+
+using namespace lz;
+
+// Each benchmark draws a thousand numbers per iteration
+
+LZ_BENCHMARK(random_range_int)
+{
+    Random::seed(1);
+    long long sum = 0;
+    for (auto _ : state)
+        for (int i = 0; i < 1000; ++i)
+            sum += Random::range(0, 100);
+    lzbench::do_not_optimize(sum);
+    state.set_items_processed(1000);
+}
+
+LZ_BENCHMARK(random_range_double)
+{
+    Random::seed(1);
+    double sum = 0;
+    for (auto _ : state)
+        for (int i = 0; i < 1000; ++i)
+            sum += Random::range(0., 1.);
+    lzbench::do_not_optimize(sum);
+    state.set_items_processed(1000);
+}
+
+// Rolling three six-sided dice
+LZ_BENCHMARK(random_roll)
+{
+    Random::seed(1);
+    unsigned long sum = 0;
+    for (auto _ : state)
+        for (int i = 0; i < 1000; ++i)
+            sum += Random::roll(6, 3);
+    lzbench::do_not_optimize(sum);
+    state.set_items_processed(1000);
+}
+
+LZ_BENCHMARK(random_one_in)
+{
+    Random::seed(1);
+    int hits = 0;
+    for (auto _ : state)
+        for (int i = 0; i < 1000; ++i)
+            hits += Random::one_in(10);
+    lzbench::do_not_optimize(hits);
+    state.set_items_processed(1000);
+}
+
+LZ_BENCHMARK(random_normal)
+{
+    Random::seed(1);
+    double sum = 0;
+    for (auto _ : state)
+        for (int i = 0; i < 1000; ++i)
+            sum += Random::normal(0., 1.);
+    lzbench::do_not_optimize(sum);
+    state.set_items_processed(1000);
+}
+
+LZ_BENCHMARK(random_choice)
+{
+    Random::seed(1);
+    std::vector<int> values(64, 1);
+    long long sum = 0;
+    for (auto _ : state)
+        for (int i = 0; i < 1000; ++i)
+            sum += Random::choice(values);
+    lzbench::do_not_optimize(sum);
+    state.set_items_processed(1000);
+}
@@ -0,0 +1,84 @@
+#include "Benchmark.h"
+#include "Maps.h"
+
+#include <lazarus/FOV.h>
+#include <lazarus/SquareGridMap.h>
+
+using namespace lz;
+
+// Listing the neighbours of every tile of a cave, without diagonals
+LZ_BENCHMARK(neighbours, 64, 256)
+{
+    SquareGridMap map = lzbench::make_cave(state.arg());
+    size_t found = 0;
+    for (auto _ : state)
+    {
+        for (long y = 0; y < state.arg(); ++y)
+            for (long x = 0; x < state.arg(); ++x)
+                found += map.neighbours(x, y).size();
+    }
+    lzbench::do_not_optimize(found);
+    state.set_items_processed(state.arg() * state.arg());
+}
+
+// Same, with diagonals
+LZ_BENCHMARK(neighbours_with_diagonals, 64, 256)
+{
+    SquareGridMap map = lzbench::make_cave(state.arg(), true);
+    size_t found = 0;
+    for (auto _ : state)
+    {
+        for (long y = 0; y < state.arg(); ++y)
+            for (long x = 0; x < state.arg(); ++x)
+                found += map.neighbours(x, y).size();
+    }
+    lzbench::do_not_optimize(found);
+    state.set_items_processed(state.arg() * state.arg());
+}
+
+// Visiting the neighbours of every tile of a cave, with diagonals, without listing
+// them
+LZ_BENCHMARK(for_each_neighbour, 64, 256)
+{
+    SquareGridMap map = lzbench::make_cave(state.arg(), true);
+    size_t found = 0;
+    for (auto _ : state)
+    {
+        for (long y = 0; y < state.arg(); ++y)
+            for (long x = 0; x < state.arg(); ++x)
+                map.for_each_neighbour(Position2D(x, y), [&](const Position2D &) {
+                    ++found;
+                });
+    }
+    lzbench::do_not_optimize(found);
+    state.set_items_processed(state.arg() * state.arg());
+}
+
+// Field of view of the given range from the center of an open map, where nothing
+// blocks the sight
+LZ_BENCHMARK(fov_open_map, 4, 8, 16, 32)
+{
+    SquareGridMap map = lzbench::make_open_map(128);
+    Position2D origin(64, 64);
+    size_t visible = 0;
+    for (auto _ : state)
+    {
+        visible = fov(origin, state.arg(), map).size();
+        lzbench::do_not_optimize(visible);
+    }
+    state.set_items_processed(visible);
+}
+
+// Field of view of the given range from the center of a cave
+LZ_BENCHMARK(fov_cave, 4, 8, 16, 32)
+{
+    SquareGridMap map = lzbench::make_cave(128);
+    Position2D origin = lzbench::find_center(map);
+    size_t visible = 0;
+    for (auto _ : state)
+    {
+        visible = fov(origin, state.arg(), map).size();
+        lzbench::do_not_optimize(visible);
+    }
+    state.set_items_processed(visible);
+}
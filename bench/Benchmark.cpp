@@ -0,0 +1,153 @@
+#include "Benchmark.h"
+
+#include <cstdio>
+#include <ctime>
+
+using namespace lzbench;
+
+namespace
+{
+struct Benchmark
+{
+    std::string name;
+    BenchmarkFunction function;
+    std::vector<long long> args;
+};
+
+std::vector<Benchmark> &get_benchmarks()
+{
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+// Minimum time a benchmark has to run for its timing to be reported
+constexpr double MIN_TIME = 0.5e9;
+constexpr size_t MAX_ITERATIONS = 1000000000;
+
+// Writes a string as a JSON string, escaping the characters which need it
+void write_json_string(const std::string &text, std::FILE *out)
+{
+    std::fputc('"', out);
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            std::fputc('\\', out);
+        std::fputc(c, out);
+    }
+    std::fputc('"', out);
+}
+}  // namespace
+
+bool lzbench::register_benchmark(const std::string &name,
+                                 BenchmarkFunction function,
+                                 std::vector<long long> args)
+{
+    if (args.empty())
+        args.push_back(0);
+    get_benchmarks().push_back({name, std::move(function), std::move(args)});
+    return true;
+}
+
+std::vector<Result> lzbench::run_benchmarks(const std::string &filter,
+                                            std::FILE *progress)
+{
+    std::vector<Result> results;
+    if (progress)
+        std::fprintf(progress,
+                     "%-48s %14s %12s %12s\n",
+                     "benchmark",
+                     "iterations",
+                     "ns/iter",
+                     "ns/item");
+    for (const auto &benchmark : get_benchmarks())
+    {
+        if (benchmark.name.find(filter) == std::string::npos)
+            continue;
+        for (long long arg : benchmark.args)
+        {
+            // Grow the number of iterations until the run is long enough
+            size_t iterations = 1;
+            State state(iterations, arg);
+            while (true)
+            {
+                state = State(iterations, arg);
+                benchmark.function(state);
+                double elapsed = state.get_elapsed();
+                if (elapsed >= MIN_TIME || iterations >= MAX_ITERATIONS)
+                    break;
+                double factor = elapsed > 0 ? 1.4 * MIN_TIME / elapsed : 10;
+                if (factor > 10)
+                    factor = 10;
+                iterations = static_cast<size_t>(iterations * factor) + 1;
+            }
+
+            double per_iteration = state.get_elapsed() / iterations;
+            double per_item = state.get_items_processed() > 0
+                                  ? per_iteration / state.get_items_processed()
+                                  : 0;
+            results.push_back({benchmark.name, arg, iterations, per_iteration, per_item});
+            if (!progress)
+                continue;
+            std::string name = benchmark.name + "/" + std::to_string(arg);
+            std::fprintf(
+                progress, "%-48s %14zu %12.1f", name.c_str(), iterations, per_iteration);
+            if (per_item > 0)
+                std::fprintf(progress, " %12.3f", per_item);
+            std::fprintf(progress, "\n");
+            std::fflush(progress);
+        }
+    }
+    return results;
+}
+
+void lzbench::write_json(const std::vector<Result> &results, std::FILE *out)
+{
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    std::fprintf(out, "{\n  \"context\": {\n    \"date\": \"%s\",\n", date);
+#if defined(__clang__)
+    std::fprintf(out, "    \"compiler\": ");
+    write_json_string(__VERSION__, out);
+    std::fprintf(out, ",\n");
+#elif defined(__GNUC__)
+    std::fprintf(out, "    \"compiler\": ");
+    write_json_string("GCC " __VERSION__, out);
+    std::fprintf(out, ",\n");
+#endif
+#if defined(NDEBUG)
+    std::fprintf(out, "    \"assertions\": false\n  },\n");
+#else
+    std::fprintf(out, "    \"assertions\": true\n  },\n");
+#endif
+    std::fprintf(out, "  \"benchmarks\": [");
+    for (size_t idx = 0; idx < results.size(); ++idx)
+    {
+        const Result &result = results[idx];
+        std::fprintf(out, "%s\n    {\"name\": ", idx == 0 ? "" : ",");
+        write_json_string(result.name, out);
+        std::fprintf(out,
+                     ", \"arg\": %lld, \"iterations\": %zu, \"ns_per_iteration\": %.3f, "
+                     "\"ns_per_item\": %.3f}",
+                     result.arg,
+                     result.iterations,
+                     result.ns_per_iteration,
+                     result.ns_per_item);
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+}
+
+void lzbench::write_csv(const std::vector<Result> &results, std::FILE *out)
+{
+    // Benchmark names are identifiers, so they never need quoting
+    std::fprintf(out, "name,arg,iterations,ns_per_iteration,ns_per_item\n");
+    for (const Result &result : results)
+        std::fprintf(out,
+                     "%s,%lld,%zu,%.3f,%.3f\n",
+                     result.name.c_str(),
+                     result.arg,
+                     result.iterations,
+                     result.ns_per_iteration,
+                     result.ns_per_item);
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Minimal benchmark harness for the Lazarus benchmarks.
+ *
+ * Benchmarks are registered with the LZ_BENCHMARK macro and receive a State, whose
+ * range-based loop runs the measured code as many times as needed to get a stable
+ * timing:
+ *
+ *     LZ_BENCHMARK(my_benchmark, 1000, 100000)
+ *     {
+ *         setup(state.arg());
+ *         for (auto _ : state)
+ *             measured_code();
+ *         state.set_items_processed(state.arg());
+ *     }
+ *
+ * Results can be written as JSON or CSV, to track them across versions.
+ */
+namespace lzbench
+{
+class State
+{
+public:
+    State(size_t iterations, long long arg)
+        : iterations(iterations)
+        , argument(arg)
+    {
+    }
+
+    /**
+     * Iterator over the measured iterations. Starting and finishing the loop starts
+     * and stops the timer.
+     */
+    class iterator
+    {
+    public:
+        // Not trivially destructible, so that unused loop variables do not warn
+        struct Iteration
+        {
+            ~Iteration()
+            {
+            }
+        };
+
+        iterator(State *state, size_t remaining)
+            : state(state)
+            , remaining(remaining)
+        {
+        }
+
+        Iteration operator*() const
+        {
+            return {};
+        }
+
+        iterator &operator++()
+        {
+            --remaining;
+            return *this;
+        }
+
+        bool operator!=(const iterator &) const
+        {
+            if (remaining != 0)
+                return true;
+            state->stop();
+            return false;
+        }
+
+    private:
+        State *state;
+        size_t remaining;
+    };
+
+    iterator begin()
+    {
+        start();
+        return iterator(this, iterations);
+    }
+
+    iterator end()
+    {
+        return iterator(this, 0);
+    }
+
+    /**
+     * Returns the argument the benchmark is being run with.
+     */
+    long long arg() const
+    {
+        return argument;
+    }
+
+    /**
+     * Returns the number of iterations of the measured loop.
+     */
+    size_t get_iterations() const
+    {
+        return iterations;
+    }
+
+    /**
+     * Sets the number of items processed by each iteration, so that the time per
+     * item can be reported.
+     */
+    void set_items_processed(size_t items)
+    {
+        items_per_iteration = items;
+    }
+
+    size_t get_items_processed() const
+    {
+        return items_per_iteration;
+    }
+
+    /**
+     * Stops the timer while running code which must not be measured.
+     */
+    void pause_timing()
+    {
+        stop();
+    }
+
+    void resume_timing()
+    {
+        start();
+    }
+
+    /**
+     * Returns the measured time in nanoseconds.
+     */
+    double get_elapsed() const
+    {
+        return std::chrono::duration<double, std::nano>(elapsed).count();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void start()
+    {
+        started = Clock::now();
+        running = true;
+    }
+
+    void stop()
+    {
+        if (running)
+            elapsed += Clock::now() - started;
+        running = false;
+    }
+
+    size_t iterations;
+    long long argument;
+    size_t items_per_iteration = 0;
+    bool running = false;
+    Clock::time_point started;
+    Clock::duration elapsed = Clock::duration::zero();
+};
+
+using BenchmarkFunction = std::function<void(State &)>;
+
+/**
+ * Registers a benchmark which will be run once for each of the arguments, or once
+ * with an argument of 0 if none are given.
+ */
+bool register_benchmark(const std::string &name,
+                        BenchmarkFunction function,
+                        std::vector<long long> args);
+
+/**
+ * Timing of a benchmark run with one of its arguments.
+ */
+struct Result
+{
+    std::string name;
+    long long arg;
+    size_t iterations;
+    double ns_per_iteration;
+    double ns_per_item;  // 0 if the benchmark does not count items
+};
+
+/**
+ * Runs the registered benchmarks whose name contains the filter, printing each
+ * result as a line of a table to the progress stream, if any, as soon as it is
+ * measured. Returns the results in the order they were run.
+ */
+std::vector<Result> run_benchmarks(const std::string &filter, std::FILE *progress);
+
+/**
+ * Writes the results as a JSON document, along with the date and the compiler.
+ */
+void write_json(const std::vector<Result> &results, std::FILE *out);
+
+/**
+ * Writes the results as CSV, with a header line.
+ */
+void write_csv(const std::vector<Result> &results, std::FILE *out);
+
+/**
+ * Prevents the compiler from optimizing away the computation of a value.
+ */
+template <typename T>
+inline void do_not_optimize(T &&value)
+{
+#if defined(__clang__) || defined(__GNUC__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+}  // namespace lzbench
+
+#define LZ_BENCHMARK(name, ...)                                                         \
+    static void name(lzbench::State &state);                                            \
+    static const bool name##_registered =                                               \
+        lzbench::register_benchmark(#name, name, {__VA_ARGS__});                        \
+    static void name(lzbench::State &state)
@@ -0,0 +1,189 @@
+#include "Maps.h"
+
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace lz;
+using namespace lzbench;
+
+namespace
+{
+using Tiles = std::vector<std::vector<int>>;  // 1 for floors, 0 for walls
+
+constexpr unsigned SEED = 1234;
+
+// Returns the number of steps from the origin to each tile, or -1 if unreachable
+std::vector<std::vector<long>> distances_from(const Tiles &tiles, long x, long y)
+{
+    long height = tiles.size();
+    long width = tiles[0].size();
+    std::vector<std::vector<long>> distances(height, std::vector<long>(width, -1));
+    std::queue<std::pair<long, long>> open;
+    distances[y][x] = 0;
+    open.emplace(x, y);
+    const long steps[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+    while (!open.empty())
+    {
+        auto [cx, cy] = open.front();
+        open.pop();
+        for (const auto &step : steps)
+        {
+            long nx = cx + step[0], ny = cy + step[1];
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height || !tiles[ny][nx] ||
+                distances[ny][nx] >= 0)
+                continue;
+            distances[ny][nx] = distances[cy][cx] + 1;
+            open.emplace(nx, ny);
+        }
+    }
+    return distances;
+}
+
+Tiles to_tiles(const SquareGridMap &map)
+{
+    Tiles tiles(map.get_height(), std::vector<int>(map.get_width(), 0));
+    for (long y = 0; y < static_cast<long>(map.get_height()); ++y)
+        for (long x = 0; x < static_cast<long>(map.get_width()); ++x)
+            tiles[y][x] = map.is_walkable(x, y) ? 1 : 0;
+    return tiles;
+}
+}  // namespace
+
+SquareGridMap lzbench::make_open_map(unsigned long size, bool diagonals)
+{
+    Tiles tiles(size, std::vector<int>(size, 0));
+    for (unsigned long y = 1; y + 1 < size; ++y)
+        for (unsigned long x = 1; x + 1 < size; ++x)
+            tiles[y][x] = 1;
+    return SquareGridMap(tiles, diagonals);
+}
+
+SquareGridMap lzbench::make_maze(unsigned long size, bool diagonals)
+{
+    // Depth-first search over the cells at odd coordinates, knocking down the
+    // wall between each cell and the next one visited
+    Tiles tiles(size, std::vector<int>(size, 0));
+    std::mt19937 generator(SEED);
+    std::vector<std::pair<long, long>> stack{{1, 1}};
+    tiles[1][1] = 1;
+    const long steps[4][2] = {{2, 0}, {-2, 0}, {0, 2}, {0, -2}};
+    long last = static_cast<long>(size) - 2;
+    while (!stack.empty())
+    {
+        auto [x, y] = stack.back();
+        std::vector<int> options;
+        for (int idx = 0; idx < 4; ++idx)
+        {
+            long nx = x + steps[idx][0], ny = y + steps[idx][1];
+            if (nx >= 1 && ny >= 1 && nx <= last && ny <= last && !tiles[ny][nx])
+                options.push_back(idx);
+        }
+        if (options.empty())
+        {
+            stack.pop_back();
+            continue;
+        }
+        const long *step = steps[options[generator() % options.size()]];
+        tiles[y + step[1] / 2][x + step[0] / 2] = 1;
+        tiles[y + step[1]][x + step[0]] = 1;
+        stack.emplace_back(x + step[0], y + step[1]);
+    }
+    return SquareGridMap(tiles, diagonals);
+}
+
+SquareGridMap lzbench::make_cave(unsigned long size, bool diagonals)
+{
+    long side = static_cast<long>(size);
+    Tiles tiles(size, std::vector<int>(size, 0));
+    std::mt19937 generator(SEED);
+    for (long y = 1; y + 1 < side; ++y)
+        for (long x = 1; x + 1 < side; ++x)
+            tiles[y][x] = generator() % 100 < 55 ? 1 : 0;
+
+    // A tile becomes a wall when most of its surroundings are walls
+    for (int pass = 0; pass < 4; ++pass)
+    {
+        Tiles next = tiles;
+        for (long y = 1; y + 1 < side; ++y)
+        {
+            for (long x = 1; x + 1 < side; ++x)
+            {
+                int walls = 0;
+                for (long dy = -1; dy <= 1; ++dy)
+                    for (long dx = -1; dx <= 1; ++dx)
+                        walls += tiles[y + dy][x + dx] ? 0 : 1;
+                next[y][x] = walls >= 5 ? 0 : 1;
+            }
+        }
+        tiles = std::move(next);
+    }
+
+    // Keep the largest cave only, so that every floor can be reached
+    std::vector<std::vector<long>> largest;
+    size_t largest_size = 0;
+    Tiles seen(size, std::vector<int>(size, 0));
+    for (long y = 0; y < side; ++y)
+    {
+        for (long x = 0; x < side; ++x)
+        {
+            if (!tiles[y][x] || seen[y][x])
+                continue;
+            auto distances = distances_from(tiles, x, y);
+            size_t cave_size = 0;
+            for (long cy = 0; cy < side; ++cy)
+            {
+                for (long cx = 0; cx < side; ++cx)
+                {
+                    if (distances[cy][cx] >= 0)
+                    {
+                        seen[cy][cx] = 1;
+                        ++cave_size;
+                    }
+                }
+            }
+            if (cave_size > largest_size)
+            {
+                largest = std::move(distances);
+                largest_size = cave_size;
+            }
+        }
+    }
+    for (long y = 0; y < side; ++y)
+        for (long x = 0; x < side; ++x)
+            tiles[y][x] = largest_size > 0 && largest[y][x] >= 0 ? 1 : 0;
+    return SquareGridMap(tiles, diagonals);
+}
+
+Position2D lzbench::find_farthest(const SquareGridMap &map, const Position2D &origin)
+{
+    auto distances = distances_from(to_tiles(map), origin.x, origin.y);
+    Position2D farthest = origin;
+    for (long y = 0; y < static_cast<long>(distances.size()); ++y)
+        for (long x = 0; x < static_cast<long>(distances[y].size()); ++x)
+            if (distances[y][x] > distances[farthest.y][farthest.x])
+                farthest = Position2D(x, y);
+    return farthest;
+}
+
+Position2D lzbench::find_center(const SquareGridMap &map)
+{
+    long cx = map.get_width() / 2, cy = map.get_height() / 2;
+    Position2D center(cx, cy);
+    long best = -1;
+    for (long y = 0; y < static_cast<long>(map.get_height()); ++y)
+    {
+        for (long x = 0; x < static_cast<long>(map.get_width()); ++x)
+        {
+            long distance = std::labs(x - cx) + std::labs(y - cy);
+            if (map.is_walkable(x, y) && (best < 0 || distance < best))
+            {
+                best = distance;
+                center = Position2D(x, y);
+            }
+        }
+    }
+    return center;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <lazarus/SquareGridMap.h>
+
+/**
+ * Maps used by the pathfinding and field of view benchmarks.
+ *
+ * Maps are generated from fixed seeds, so that every run measures the same maps.
+ * Floors are walkable and transparent, and walls are neither.
+ */
+namespace lzbench
+{
+/**
+ * Returns a square map of floors surrounded by walls.
+ */
+lz::SquareGridMap make_open_map(unsigned long size, bool diagonals = false);
+
+/**
+ * Returns a square maze of corridors one tile wide, where any two floors are
+ * joined by a single path. The floors are the tiles at odd coordinates and the
+ * tiles between them.
+ */
+lz::SquareGridMap make_maze(unsigned long size, bool diagonals = false);
+
+/**
+ * Returns a square map of winding caves, smoothed by a cellular automaton, where
+ * only the largest cave is kept.
+ */
+lz::SquareGridMap make_cave(unsigned long size, bool diagonals = false);
+
+/**
+ * Returns the floor which takes the most steps to reach from the origin.
+ */
+lz::Position2D find_farthest(const lz::SquareGridMap &map, const lz::Position2D &origin);
+
+/**
+ * Returns the floor closest to the center of the map.
+ */
+lz::Position2D find_center(const lz::SquareGridMap &map);
+}  // namespace lzbench
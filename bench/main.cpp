@@ -0,0 +1,78 @@
+#include "Benchmark.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace
+{
+void print_usage()
+{
+    std::fprintf(stderr,
+                 "Usage: lazarus_bench [filter] [--format=console|json|csv] "
+                 "[--out=file]\n");
+}
+}  // namespace
+
+/*
+ * Runs the Lazarus benchmarks. An optional argument only runs the benchmarks whose
+ * name contains it.
+ *
+ * The results are printed as a table by default. With --format=json or --format=csv
+ * they are written in that format to the file given by --out, or to the standard
+ * output, in which case the table goes to the standard error.
+ */
+int main(int argc, char **argv)
+{
+    std::string filter;
+    std::string format = "console";
+    std::string out_path;
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        const char *arg = argv[idx];
+        if (std::strncmp(arg, "--format=", 9) == 0)
+            format = arg + 9;
+        else if (std::strncmp(arg, "--out=", 6) == 0)
+            out_path = arg + 6;
+        else if (std::strncmp(arg, "--", 2) == 0 || !filter.empty())
+        {
+            print_usage();
+            return 1;
+        }
+        else
+            filter = arg;
+    }
+    if (format != "console" && format != "json" && format != "csv")
+    {
+        print_usage();
+        return 1;
+    }
+
+    std::FILE *out = stdout;
+    if (!out_path.empty())
+    {
+        out = std::fopen(out_path.c_str(), "w");
+        if (!out)
+        {
+            std::fprintf(stderr, "Cannot open \"%s\"\n", out_path.c_str());
+            return 1;
+        }
+    }
+
+    bool table_only = format == "console";
+    std::FILE *progress = table_only ? out : out == stdout ? stderr : stdout;
+    auto results = lzbench::run_benchmarks(filter, progress);
+    if (format == "json")
+        lzbench::write_json(results, out);
+    else if (format == "csv")
+        lzbench::write_csv(results, out);
+    if (out != stdout)
+        std::fclose(out);
+
+    if (results.empty())
+    {
+        std::fprintf(stderr, "No benchmark matches \"%s\"\n", filter.c_str());
+        return 1;
+    }
+    return 0;
+}
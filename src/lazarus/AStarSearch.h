@@ -16,7 +16,8 @@ namespace lz
  *
  * @tparam Position The type of position. Must implement the operators `==`, `!=` and `<`.
  * @tparam Map THe type of map that the algorithm will use. Must implement the methods
- * `get_cost(const Position&)` and `neighbours(const Position&)`.
+ * `get_cost(const Position&)` and either `for_each_neighbour(const Position&, Func)`,
+ * which is preferred, or `neighbours(const Position&)`.
  */
 template <typename Position, typename Map>
 class AStarSearch : public PathfindingAlg<Position, Map>
@@ -68,10 +69,9 @@ protected:
         }
 
         // Expand neighbours
-        // TODO: Document: Map needs neighbours and get_cost
-        for (Position neighbour : this->map.neighbours(node))
-        {
-            float cost = this->cost_to_node[node] + this->map.get_cost(neighbour);
+        float cost_to_current = this->cost_to_node[node];
+        __lz::for_each_neighbour(this->map, node, [&](const Position &neighbour) {
+            float cost = cost_to_current + this->map.get_cost(neighbour);
             // Also consider visited nodes which would have a
             // smaller cost from this new path
             if (this->previous.find(neighbour) == this->previous.end() ||
@@ -83,7 +83,7 @@ protected:
                 float f = cost + this->heuristic(node, neighbour);
                 this->open_list.emplace(f, neighbour);
             }
-        }
+        });
 
         return SearchState::SEARCHING;
     }
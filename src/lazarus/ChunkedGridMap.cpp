@@ -0,0 +1,243 @@
+#include <lazarus/ChunkedGridMap.h>
+#include <lazarus/common.h>
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+using namespace lz;
+
+namespace
+{
+// Division rounding towards negative infinity, so that negative positions fall in
+// the chunks before the origin
+long floor_divide(long value, long divisor)
+{
+    return value >= 0 ? value / divisor : -((-value - 1) / divisor) - 1;
+}
+}  // namespace
+
+ChunkedGridMap::ChunkedGridMap(ChunkProvider provider,
+                               size_t memory_budget,
+                               bool diagonals)
+    : diagonals(diagonals)
+    , capacity(std::max<size_t>(memory_budget / CHUNK_BYTES, 1))
+    , provider(std::move(provider))
+{
+    if (!this->provider)
+        throw __lz::LazarusException("ChunkedGridMap needs a chunk provider.");
+}
+
+void ChunkedGridMap::set_writer(ChunkWriter writer)
+{
+    this->writer = std::move(writer);
+}
+
+size_t ChunkedGridMap::get_chunk_capacity() const
+{
+    return capacity;
+}
+
+size_t ChunkedGridMap::get_loaded_chunk_count() const
+{
+    return chunks.size();
+}
+
+bool ChunkedGridMap::is_chunk_loaded(const Position2D &chunk) const
+{
+    return chunks_by_key.count(get_key(chunk)) > 0;
+}
+
+Position2D ChunkedGridMap::get_chunk_of(const Position2D &pos)
+{
+    return Position2D(floor_divide(pos.x, CHUNK_SIZE), floor_divide(pos.y, CHUNK_SIZE));
+}
+
+void ChunkedGridMap::flush()
+{
+    for (Chunk &chunk : chunks)
+        write_chunk(chunk);
+}
+
+void ChunkedGridMap::unload_all()
+{
+    flush();
+    last_chunk = nullptr;
+    chunks_by_key.clear();
+    chunks.clear();
+}
+
+bool ChunkedGridMap::is_walkable(const Position2D &pos) const
+{
+    Position2D local(0, 0);
+    return get_chunk(pos, local).tiles.is_walkable(local);
+}
+
+bool ChunkedGridMap::is_walkable(long x, long y) const
+{
+    return is_walkable(Position2D(x, y));
+}
+
+bool ChunkedGridMap::is_transparent(const Position2D &pos) const
+{
+    Position2D local(0, 0);
+    return get_chunk(pos, local).tiles.is_transparent(local);
+}
+
+bool ChunkedGridMap::is_transparent(long x, long y) const
+{
+    return is_transparent(Position2D(x, y));
+}
+
+bool ChunkedGridMap::is_out_of_bounds(const Position2D &) const
+{
+    return false;
+}
+
+bool ChunkedGridMap::is_out_of_bounds(long, long) const
+{
+    return false;
+}
+
+float ChunkedGridMap::get_cost(const Position2D &pos) const
+{
+    Position2D local(0, 0);
+    const Chunk &chunk = get_chunk(pos, local);
+    if (!chunk.tiles.is_walkable(local))
+    {
+        std::stringstream msg;
+        msg << "Tried to get cost of unwalkable tile at position (" << pos.x << ", "
+            << pos.y << ").";
+        throw __lz::LazarusException(msg.str());
+    }
+    return chunk.tiles.get_cost(local);
+}
+
+float ChunkedGridMap::get_cost(long x, long y) const
+{
+    return get_cost(Position2D(x, y));
+}
+
+void ChunkedGridMap::set_cost(const Position2D &pos, float cost)
+{
+    Position2D local(0, 0);
+    Chunk &chunk = get_chunk(pos, local);
+    chunk.tiles.set_cost(local, cost);
+    chunk.modified = true;
+}
+
+void ChunkedGridMap::set_cost(long x, long y, float cost)
+{
+    set_cost(Position2D(x, y), cost);
+}
+
+void ChunkedGridMap::set_walkable(const Position2D &pos, bool walkable)
+{
+    Position2D local(0, 0);
+    Chunk &chunk = get_chunk(pos, local);
+    chunk.tiles.set_walkable(local, walkable);
+    chunk.modified = true;
+}
+
+void ChunkedGridMap::set_walkable(long x, long y, bool walkable)
+{
+    set_walkable(Position2D(x, y), walkable);
+}
+
+void ChunkedGridMap::set_transparency(const Position2D &pos, bool transparent)
+{
+    Position2D local(0, 0);
+    Chunk &chunk = get_chunk(pos, local);
+    chunk.tiles.set_transparency(local, transparent);
+    chunk.modified = true;
+}
+
+void ChunkedGridMap::set_transparency(long x, long y, bool transparent)
+{
+    set_transparency(Position2D(x, y), transparent);
+}
+
+std::vector<Position2D> ChunkedGridMap::neighbours(const Position2D &pos) const
+{
+    std::vector<Position2D> result;
+    result.reserve(diagonals ? 8 : 4);
+    for_each_neighbour(pos, [&](const Position2D &neighbour) {
+        result.push_back(neighbour);
+    });
+    return result;
+}
+
+std::vector<Position2D> ChunkedGridMap::neighbours(long x, long y) const
+{
+    return neighbours(Position2D(x, y));
+}
+
+ChunkedGridMap::Chunk &ChunkedGridMap::get_chunk(const Position2D &pos,
+                                                 Position2D &local) const
+{
+    Position2D chunk_pos = get_chunk_of(pos);
+    local =
+        Position2D(pos.x - chunk_pos.x * CHUNK_SIZE, pos.y - chunk_pos.y * CHUNK_SIZE);
+
+    // Consecutive accesses usually fall in the same chunk, which is already the most
+    // recently used one
+    if (last_chunk && last_chunk->position == chunk_pos)
+        return *last_chunk;
+
+    auto found = chunks_by_key.find(get_key(chunk_pos));
+    if (found == chunks_by_key.end())
+        last_chunk = &load_chunk(chunk_pos);
+    else
+    {
+        chunks.splice(chunks.begin(), chunks, found->second);
+        last_chunk = &*found->second;
+    }
+    return *last_chunk;
+}
+
+ChunkedGridMap::Chunk &ChunkedGridMap::load_chunk(const Position2D &chunk_pos) const
+{
+    // Fill the tiles first, so that nothing changes if the provider throws
+    SquareGridMap tiles(CHUNK_SIZE, CHUNK_SIZE);
+    // The tiles keep no history of their changes, even if the provider replaces them
+    tiles.changes = __lz::ChangeLog(false);
+    provider(chunk_pos, tiles);
+    if (tiles.get_width() != CHUNK_SIZE || tiles.get_height() != CHUNK_SIZE)
+    {
+        std::stringstream msg;
+        msg << "The provider gave the chunk at (" << chunk_pos.x << ", " << chunk_pos.y
+            << ") tiles of size " << tiles.get_width() << " x " << tiles.get_height()
+            << ", rather than " << CHUNK_SIZE << " x " << CHUNK_SIZE << ".";
+        throw __lz::LazarusException(msg.str());
+    }
+    tiles.changes = __lz::ChangeLog(false);
+
+    if (chunks.size() >= capacity)
+    {
+        Chunk &evicted = chunks.back();
+        write_chunk(evicted);
+        chunks_by_key.erase(get_key(evicted.position));
+        if (last_chunk == &evicted)
+            last_chunk = nullptr;
+        chunks.pop_back();
+    }
+
+    chunks.push_front(Chunk{chunk_pos, std::move(tiles), false});
+    chunks_by_key[get_key(chunk_pos)] = chunks.begin();
+    return chunks.front();
+}
+
+void ChunkedGridMap::write_chunk(Chunk &chunk) const
+{
+    if (!chunk.modified)
+        return;
+    if (writer)
+        writer(chunk.position, chunk.tiles);
+    chunk.modified = false;
+}
+
+uint64_t ChunkedGridMap::get_key(const Position2D &chunk)
+{
+    return (static_cast<uint64_t>(static_cast<uint32_t>(chunk.x)) << 32) |
+           static_cast<uint32_t>(chunk.y);
+}
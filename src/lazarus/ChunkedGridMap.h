@@ -0,0 +1,243 @@
+#pragma once
+
+#include <lazarus/SquareGridMap.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace lz
+{
+/**
+ * Defines an unbounded map of square tiles, kept in memory in square chunks which are
+ * loaded when they are first accessed and unloaded when they have not been used for
+ * a while.
+ *
+ * The map offers the same interface as a SquareGridMap, and can be used by the
+ * pathfinding and FOV algorithms in the same way, but it has no boundaries: every
+ * position, including those with negative coordinates, belongs to some chunk.
+ *
+ * The tiles of a chunk are given by a provider, a function which fills a
+ * SquareGridMap of CHUNK_SIZE x CHUNK_SIZE tiles, either loading them from somewhere
+ * or generating them. Chunks are kept in memory while they fit in the memory budget
+ * of the map, after which the least recently used chunk is unloaded to make room for
+ * the next one. Chunks which were modified are passed to a writer, if set, before
+ * being unloaded, so that the changes are not lost.
+ *
+ * Since reading tiles can load and unload chunks, the map is not safe to use from
+ * several threads at the same time, even through its const methods. A search for a
+ * path which does not exist will not end unless the provider surrounds the area
+ * searched with walls.
+ */
+class ChunkedGridMap
+{
+public:
+    /**
+     * Width and height of the chunks, in tiles.
+     */
+    static constexpr long CHUNK_SIZE = 64;
+
+    /**
+     * Approximate memory taken by a chunk, with its costs, its walkable and
+     * transparent masks and the map holding them. The tiles of the chunks keep no
+     * history of their changes, so that it doesn't grow as they are modified.
+     */
+    static constexpr size_t CHUNK_BYTES = CHUNK_SIZE * CHUNK_SIZE * sizeof(float) +
+                                          2 * CHUNK_SIZE * CHUNK_SIZE / 8 +
+                                          sizeof(SquareGridMap);
+
+    /**
+     * Function which fills the tiles of the chunk at the given chunk coordinates.
+     * The chunk at (x, y) holds the tiles from (x * CHUNK_SIZE, y * CHUNK_SIZE) to
+     * ((x + 1) * CHUNK_SIZE - 1, (y + 1) * CHUNK_SIZE - 1). The tiles are given to it
+     * unwalkable and non-transparent, with the position of each tile relative to the
+     * top-left tile of the chunk. The provider may replace the tiles, but they must
+     * keep their size.
+     */
+    using ChunkProvider =
+        std::function<void(const Position2D &chunk, SquareGridMap &tiles)>;
+
+    /**
+     * Function which saves the tiles of the modified chunk at the given chunk
+     * coordinates, called before the chunk is unloaded.
+     */
+    using ChunkWriter =
+        std::function<void(const Position2D &chunk, const SquareGridMap &tiles)>;
+
+    /**
+     * Constructs a map whose chunks are filled by the given provider.
+     *
+     * @param provider Function which fills the tiles of the chunks.
+     * @param memory_budget Memory that the chunks in memory may take, in bytes. At
+     * least one chunk is kept in memory, whatever the budget.
+     * @param diagonals Whether or not to consider diagonals as adjacent tiles.
+     *
+     * @throws LazarusException If the provider is empty.
+     */
+    ChunkedGridMap(ChunkProvider provider, size_t memory_budget, bool diagonals = false);
+
+    ChunkedGridMap(const ChunkedGridMap &) = delete;
+    ChunkedGridMap &operator=(const ChunkedGridMap &) = delete;
+
+    /**
+     * Sets the function which saves the modified chunks before they are unloaded.
+     */
+    void set_writer(ChunkWriter writer);
+
+    /**
+     * Returns the maximum number of chunks kept in memory, given by the memory
+     * budget.
+     */
+    size_t get_chunk_capacity() const;
+
+    /**
+     * Returns the number of chunks currently in memory.
+     */
+    size_t get_loaded_chunk_count() const;
+
+    /**
+     * Returns whether the chunk at the given chunk coordinates is in memory.
+     */
+    bool is_chunk_loaded(const Position2D &chunk) const;
+
+    /**
+     * Returns the coordinates of the chunk which holds the tile at the given
+     * position.
+     */
+    static Position2D get_chunk_of(const Position2D &pos);
+
+    /**
+     * Passes the modified chunks in memory to the writer, after which they are no
+     * longer considered modified.
+     */
+    void flush();
+
+    /**
+     * Unloads all the chunks, passing the modified ones to the writer first.
+     */
+    void unload_all();
+
+    /**
+     * Returns whether the tile at the given position is walkable.
+     *
+     * @see SquareGridMap::is_walkable(const Position2D&) const
+     */
+    bool is_walkable(const Position2D &pos) const;
+
+    bool is_walkable(long x, long y) const;
+
+    /**
+     * Returns whether the tile at the given position is transparent.
+     *
+     * @see SquareGridMap::is_transparent(const Position2D&) const
+     */
+    bool is_transparent(const Position2D &pos) const;
+
+    bool is_transparent(long x, long y) const;
+
+    /**
+     * Always returns `false`, since the map has no boundaries.
+     */
+    bool is_out_of_bounds(const Position2D &pos) const;
+
+    bool is_out_of_bounds(long x, long y) const;
+
+    /**
+     * Gets the cost of the tile at the given position.
+     *
+     * @throws LazarusException If the tile is not walkable.
+     *
+     * @see SquareGridMap::get_cost(const Position2D&) const
+     */
+    float get_cost(const Position2D &pos) const;
+
+    float get_cost(long x, long y) const;
+
+    /**
+     * Sets the cost of the tile at the given position, making it walkable if the
+     * cost is not negative and unwalkable otherwise.
+     */
+    void set_cost(const Position2D &pos, float cost);
+
+    void set_cost(long x, long y, float cost);
+
+    /**
+     * Changes the walkability of the tile at the given position.
+     *
+     * @see SquareGridMap::set_walkable(const Position2D&, bool)
+     */
+    void set_walkable(const Position2D &pos, bool walkable);
+
+    void set_walkable(long x, long y, bool walkable);
+
+    /**
+     * Changes the transparency of the tile at the given position.
+     */
+    void set_transparency(const Position2D &pos, bool transparent);
+
+    void set_transparency(long x, long y, bool transparent);
+
+    /**
+     * Returns a vector with the walkable tiles adjacent to the tile at the given
+     * position.
+     *
+     * @see SquareGridMap::neighbours(const Position2D&) const
+     */
+    std::vector<Position2D> neighbours(const Position2D &pos) const;
+
+    std::vector<Position2D> neighbours(long x, long y) const;
+
+    /**
+     * Calls `func(const Position2D&)` for each walkable tile adjacent to the tile at
+     * the given position, in the same order as neighbours(), without allocating.
+     */
+    template <typename Func>
+    void for_each_neighbour(const Position2D &pos, Func &&func) const;
+
+private:
+    struct Chunk
+    {
+        Position2D position;
+        SquareGridMap tiles;
+        bool modified;
+    };
+
+    using ChunkList = std::list<Chunk>;  // From the most to the least recently used
+
+    // Returns the chunk holding the tile at the given position, loading it if needed,
+    // and sets local to the position of the tile in the chunk
+    Chunk &get_chunk(const Position2D &pos, Position2D &local) const;
+
+    Chunk &load_chunk(const Position2D &chunk) const;
+
+    void write_chunk(Chunk &chunk) const;
+
+    static uint64_t get_key(const Position2D &chunk);
+
+    bool diagonals;
+    size_t capacity;
+    ChunkProvider provider;
+    ChunkWriter writer;
+
+    // Chunks are loaded by const methods, as a cache of the tiles given by the provider
+    mutable ChunkList chunks;
+    mutable std::unordered_map<uint64_t, ChunkList::iterator> chunks_by_key;
+    mutable Chunk *last_chunk = nullptr;  // Most recently used chunk
+};
+
+template <typename Func>
+void ChunkedGridMap::for_each_neighbour(const Position2D &pos, Func &&func) const
+{
+    size_t count = diagonals ? 8 : 4;
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        Position2D neighbour(pos.x + __lz::NEIGHBOUR_OFFSETS[idx][0],
+                             pos.y + __lz::NEIGHBOUR_OFFSETS[idx][1]);
+        if (is_walkable(neighbour))
+            func(neighbour);
+    }
+}
+}  // namespace lz
@@ -2,5 +2,8 @@
 
 #include <lazarus/ECS/ECSEngine.h>
 #include <lazarus/ECS/Entity.h>
+#include <lazarus/ECS/Profiler.h>
+#include <lazarus/ECS/Snapshot.h>
 #include <lazarus/ECS/EventListener.h>
 #include <lazarus/ECS/Updateable.h>
+#include <lazarus/ECS/View.h>
@@ -0,0 +1,495 @@
+#include <lazarus/ECS/ArchetypeStorage.h>
+#include <lazarus/ECS/Entity.h>
+
+#include <algorithm>
+
+using namespace __lz;
+
+namespace
+{
+size_t align_up(size_t value, size_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+bool compare_components(const ComponentInfo *a, const ComponentInfo *b)
+{
+    return a->id < b->id;
+}
+
+template <typename T>
+void set_at(std::vector<T> &vec, TypeId id, T value, T empty)
+{
+    if (id >= vec.size())
+        vec.resize(id + 1, empty);
+    vec[id] = value;
+}
+}  // namespace
+
+Archetype::Archetype(std::vector<const ComponentInfo *> components)
+    : components(std::move(components))
+    , chunk_align(alignof(std::max_align_t))
+{
+    size_t row_bytes = 0;
+    for (size_t column = 0; column < this->components.size(); ++column)
+    {
+        const ComponentInfo *info = this->components[column];
+        mask.set(info->id);
+        set_at(columns, info->id, static_cast<int>(column), -1);
+        row_bytes += info->size + sizeof(TickSlot);
+        chunk_align = std::max(chunk_align, info->align);
+    }
+    chunk_capacity =
+        row_bytes == 0 ? CHUNK_SIZE : std::max<size_t>(1, CHUNK_SIZE / row_bytes);
+
+    // Lay out one column after the other, after the reference count, respecting the
+    // alignment of each type, each followed by the change ticks of its components
+    chunk_bytes = sizeof(RefCount);
+    for (const ComponentInfo *info : this->components)
+    {
+        chunk_bytes = align_up(chunk_bytes, info->align);
+        offsets.push_back(chunk_bytes);
+        chunk_bytes += info->size * chunk_capacity;
+        chunk_bytes = align_up(chunk_bytes, alignof(TickSlot));
+        tick_offsets.push_back(chunk_bytes);
+        chunk_bytes += sizeof(TickSlot) * chunk_capacity;
+    }
+}
+
+Archetype::~Archetype()
+{
+    for (size_t chunk = 0; chunk < chunks.size(); ++chunk)
+        release_chunk(chunks[chunk], rows_in_chunk(chunk));
+}
+
+size_t Archetype::push_back(lz::Entity *entity)
+{
+    if (entities.size() == chunks.size() * chunk_capacity)
+        allocate_chunk();
+    else
+        unshare(entities.size() / chunk_capacity);
+    entities.push_back(entity);
+    return entities.size() - 1;
+}
+
+void Archetype::reserve(size_t rows)
+{
+    while (chunks.size() * chunk_capacity < rows)
+        allocate_chunk();
+}
+
+void Archetype::pop_back_uninitialized()
+{
+    entities.pop_back();
+}
+
+void Archetype::remove_row(size_t row)
+{
+    unshare(row / chunk_capacity);
+    unshare((size() - 1) / chunk_capacity);
+    for (size_t column = 0; column < components.size(); ++column)
+        components[column]->destroy(get(column, row));
+
+    // Fill the gap with the last row to keep rows packed
+    size_t last = size() - 1;
+    if (row != last)
+    {
+        for (size_t column = 0; column < components.size(); ++column)
+        {
+            void *src = get(column, last);
+            components[column]->move_construct(get(column, row), src);
+            components[column]->destroy(src);
+            set_tick(column, row, get_tick(column, last));
+        }
+        entities[row] = entities[last];
+        entities[row]->location.index = row;
+    }
+    entities.pop_back();
+
+    // Release memory when there are at least two empty chunks at the end
+    while (chunks.size() > 1 && (chunks.size() - 2) * chunk_capacity >= size())
+    {
+        release_chunk(chunks.back(), 0);
+        chunks.pop_back();
+    }
+}
+
+void Archetype::share(const Archetype &source, std::vector<lz::Entity *> entities)
+{
+    for (char *chunk : chunks)
+        release_chunk(chunk, 0);
+    size_t used = (source.size() + chunk_capacity - 1) / chunk_capacity;
+    chunks.assign(source.chunks.begin(), source.chunks.begin() + used);
+    for (char *chunk : chunks)
+        ref_count(chunk).fetch_add(1, std::memory_order_relaxed);
+    this->entities = std::move(entities);
+}
+
+char *Archetype::new_chunk() const
+{
+    char *chunk = static_cast<char *>(::operator new(chunk_bytes,
+                                                    std::align_val_t(chunk_align)));
+    new (chunk) RefCount(1);
+    for (size_t offset : tick_offsets)
+    {
+        TickSlot *ticks = reinterpret_cast<TickSlot *>(chunk + offset);
+        for (size_t row = 0; row < chunk_capacity; ++row)
+            new (ticks + row) TickSlot(0);
+    }
+    return chunk;
+}
+
+void Archetype::allocate_chunk()
+{
+    chunks.push_back(new_chunk());
+}
+
+void Archetype::copy_chunk(size_t chunk)
+{
+    char *source = chunks[chunk];
+    char *copy = new_chunk();
+    size_t rows = rows_in_chunk(chunk);
+    size_t column = 0;
+    size_t row = 0;
+    try
+    {
+        for (; column < components.size(); ++column)
+        {
+            const ComponentInfo *info = components[column];
+            for (row = 0; row < rows; ++row)
+                info->copy_construct(copy + offsets[column] + row * info->size,
+                                     source + offsets[column] + row * info->size);
+        }
+    }
+    catch (...)
+    {
+        // Destroy the components copied so far: whole columns, then part of one
+        for (size_t done = 0; done <= column && done < components.size(); ++done)
+        {
+            const ComponentInfo *info = components[done];
+            for (size_t idx = 0; idx < (done < column ? rows : row); ++idx)
+                info->destroy(copy + offsets[done] + idx * info->size);
+        }
+        ::operator delete(copy, std::align_val_t(chunk_align));
+        throw;
+    }
+
+    for (size_t offset : tick_offsets)
+    {
+        TickSlot *from = reinterpret_cast<TickSlot *>(source + offset);
+        TickSlot *to = reinterpret_cast<TickSlot *>(copy + offset);
+        for (row = 0; row < rows; ++row)
+            to[row].store(from[row].load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+    }
+    chunks[chunk] = copy;
+    release_chunk(source, rows);
+}
+
+void Archetype::release_chunk(char *chunk, size_t rows)
+{
+    if (ref_count(chunk).fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    for (size_t column = 0; column < components.size(); ++column)
+    {
+        const ComponentInfo *info = components[column];
+        for (size_t row = 0; row < rows; ++row)
+            info->destroy(chunk + offsets[column] + row * info->size);
+    }
+    ::operator delete(chunk, std::align_val_t(chunk_align));
+}
+
+ArchetypeStorage::ArchetypeStorage()
+    : ComponentStorage(lz::StorageBackend::Archetype)
+{
+    root = find_or_create({});
+}
+
+void ArchetypeStorage::attach(lz::Entity &entity)
+{
+    place(entity, root, root->push_back(&entity));
+}
+
+void ArchetypeStorage::detach(lz::Entity &entity)
+{
+    entity.location.archetype->remove_row(entity.location.index);
+    entity.location = EntityLocation();
+    entity.storage = nullptr;
+}
+
+void ArchetypeStorage::remove(lz::Entity &entity, const ComponentInfo &info)
+{
+    Archetype *target = remove_target(entity.location.archetype, info);
+    size_t row = target->push_back(&entity);
+    move_entity(entity.location, target, row);
+}
+
+void ArchetypeStorage::collect(const lz::Entity &entity, ComponentList &list)
+{
+    Archetype *archetype = entity.location.archetype;
+    const auto &components = archetype->get_components();
+    for (size_t column = 0; column < components.size(); ++column)
+        list.emplace_back(components[column],
+                          archetype->get(column, entity.location.index));
+}
+
+void ArchetypeStorage::for_each_run(const std::function<void(const ComponentRun &)> &func)
+{
+    // Each chunk holds a column of components of each type
+    ComponentRun run;
+    for (const auto &archetype : archetypes)
+    {
+        const auto &components = archetype->get_components();
+        const auto &entities = archetype->get_entities();
+        size_t capacity = archetype->get_chunk_capacity();
+        run.mask = archetype->get_mask();
+        for (size_t first = 0; first < entities.size(); first += capacity)
+        {
+            run.entities = entities.data() + first;
+            run.count = std::min(capacity, entities.size() - first);
+            run.arrays.clear();
+            for (size_t column = 0; column < components.size(); ++column)
+                run.arrays.emplace_back(
+                    components[column],
+                    archetype->column_data<const char>(column, first / capacity));
+            func(run);
+        }
+    }
+}
+
+void ArchetypeStorage::copy_components(const lz::Entity &source, lz::Entity &entity)
+{
+    ComponentList source_components;
+    source.storage->collect(source, source_components);
+    check_copyable(source_components);
+    std::sort(source_components.begin(),
+              source_components.end(),
+              [](const auto &a, const auto &b) {
+                  return compare_components(a.first, b.first);
+              });
+
+    std::vector<const ComponentInfo *> components;
+    for (const auto &pair : source_components)
+        components.push_back(pair.first);
+
+    Archetype *target = find_or_create(components);
+    size_t row = target->push_back(&entity);
+    size_t copied = 0;
+    try
+    {
+        for (; copied < components.size(); ++copied)
+        {
+            components[copied]->copy_construct(target->get(copied, row),
+                                               source_components[copied].second);
+            target->set_tick(copied, row, get_change_tick());
+        }
+    }
+    catch (...)
+    {
+        for (size_t column = 0; column < copied; ++column)
+            components[column]->destroy(target->get(column, row));
+        target->pop_back_uninitialized();
+        throw;
+    }
+
+    move_entity(entity.location, target, row);
+}
+
+void ArchetypeStorage::spawn_copies(lz::Entity *const *entities,
+                                    size_t count,
+                                    const ComponentArrays &arrays)
+{
+    check_copyable(arrays);
+    std::vector<const ComponentInfo *> components;
+    for (const auto &array : arrays)
+        components.push_back(array.first);
+    std::sort(components.begin(), components.end(), compare_components);
+    Archetype *target = find_or_create(components);
+
+    std::vector<int> columns;
+    for (const auto &array : arrays)
+        columns.push_back(target->find_column(array.first->id));
+    target->reserve(target->size() + count);
+    lz::ChangeTick tick = get_change_tick();
+
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        size_t row = target->push_back(entities[idx]);
+        size_t copied = 0;
+        try
+        {
+            for (; copied < arrays.size(); ++copied)
+            {
+                const ComponentInfo *info = arrays[copied].first;
+                info->copy_construct(target->get(columns[copied], row),
+                                     arrays[copied].second + idx * info->size);
+                target->set_tick(columns[copied], row, tick);
+            }
+        }
+        catch (...)
+        {
+            for (size_t array = 0; array < copied; ++array)
+                arrays[array].first->destroy(target->get(columns[array], row));
+            target->pop_back_uninitialized();
+            throw;
+        }
+        place(*entities[idx], target, row);
+    }
+}
+
+Archetype *ArchetypeStorage::find_or_create(
+    const std::vector<const ComponentInfo *> &components)
+{
+    ComponentMask mask;
+    for (const ComponentInfo *info : components)
+        mask.set(info->id);
+
+    auto found = archetype_lookup.find(mask);
+    if (found != archetype_lookup.end())
+        return found->second;
+
+    archetypes.emplace_back(new Archetype(components));
+    Archetype *archetype = archetypes.back().get();
+    archetype_lookup[mask] = archetype;
+
+    // Add the new archetype to the queries it matches
+    for (auto &pair : queries)
+    {
+        ArchetypeQuery &query = *pair.second;
+        if ((mask & query.mask) == query.mask)
+        {
+            query.archetypes.push_back(archetype);
+            query.entity_lists.push_back(&archetype->get_entities());
+        }
+    }
+    return archetype;
+}
+
+const Query &ArchetypeStorage::query(const ComponentMask &mask)
+{
+    std::lock_guard<std::mutex> lock(queries_mutex);
+    auto found = queries.find(mask);
+    if (found != queries.end())
+        return *found->second;
+
+    std::unique_ptr<ArchetypeQuery> query(new ArchetypeQuery(mask));
+    for (auto &archetype : archetypes)
+    {
+        if ((archetype->get_mask() & mask) == mask)
+        {
+            query->archetypes.push_back(archetype.get());
+            query->entity_lists.push_back(&archetype->get_entities());
+        }
+    }
+    return *(queries[mask] = std::move(query));
+}
+
+void ArchetypeStorage::unshare_chunks()
+{
+    if (!shares_chunks)
+        return;
+    for (auto &archetype : archetypes)
+        archetype->unshare_rows(0, archetype->size());
+    shares_chunks = false;
+}
+
+void ArchetypeStorage::check_shareable(const ArchetypeStorage &source)
+{
+    for (const auto &archetype : source.archetypes)
+    {
+        if (archetype->size() == 0)
+            continue;
+        ComponentList components;
+        for (const ComponentInfo *info : archetype->get_components())
+            components.emplace_back(info, nullptr);
+        check_copyable(components);
+    }
+}
+
+void ArchetypeStorage::share_archetype(const Archetype &source,
+                                       std::vector<lz::Entity *> entities)
+{
+    Archetype *target = find_or_create(source.get_components());
+    target->share(source, std::move(entities));
+    for (size_t row = 0; row < target->size(); ++row)
+        place(*target->get_entities()[row], target, row);
+    shares_chunks = true;
+}
+
+std::vector<ArchetypeStorage::RowRange> ArchetypeStorage::split(
+    const ArchetypeQuery &query,
+    size_t grain_size)
+{
+    grain_size = std::max<size_t>(grain_size, 1);
+    std::vector<RowRange> ranges;
+    for (Archetype *archetype : query.archetypes)
+    {
+        for (size_t begin = 0; begin < archetype->size(); begin += grain_size)
+            ranges.push_back(
+                {archetype, begin, std::min(begin + grain_size, archetype->size())});
+    }
+    return ranges;
+}
+
+void ArchetypeStorage::place(lz::Entity &entity, Archetype *archetype, size_t row)
+{
+    entity.storage = this;
+    entity.location.archetype = archetype;
+    entity.location.index = row;
+}
+
+Archetype *ArchetypeStorage::add_target(Archetype *archetype, const ComponentInfo &info)
+{
+    if (info.id < archetype->add_edges.size() && archetype->add_edges[info.id])
+        return archetype->add_edges[info.id];
+
+    std::vector<const ComponentInfo *> components = archetype->get_components();
+    components.insert(
+        std::upper_bound(components.begin(), components.end(), &info, compare_components),
+        &info);
+    Archetype *target = find_or_create(components);
+    set_at<Archetype *>(archetype->add_edges, info.id, target, nullptr);
+    set_at<Archetype *>(target->remove_edges, info.id, archetype, nullptr);
+    return target;
+}
+
+Archetype *ArchetypeStorage::remove_target(Archetype *archetype,
+                                           const ComponentInfo &info)
+{
+    if (info.id < archetype->remove_edges.size() && archetype->remove_edges[info.id])
+        return archetype->remove_edges[info.id];
+
+    std::vector<const ComponentInfo *> components;
+    for (const ComponentInfo *component : archetype->get_components())
+        if (component->id != info.id)
+            components.push_back(component);
+    Archetype *target = find_or_create(components);
+    set_at<Archetype *>(archetype->remove_edges, info.id, target, nullptr);
+    set_at<Archetype *>(target->add_edges, info.id, archetype, nullptr);
+    return target;
+}
+
+void ArchetypeStorage::move_entity(EntityLocation &location,
+                                   Archetype *target,
+                                   size_t row)
+{
+    Archetype *source = location.archetype;
+    source->unshare(location.index / source->get_chunk_capacity());
+    const auto &components = source->get_components();
+    for (size_t column = 0; column < components.size(); ++column)
+    {
+        int target_column = target->find_column(components[column]->id);
+        if (target_column >= 0)
+        {
+            components[column]->move_construct(target->get(target_column, row),
+                                               source->get(column, location.index));
+            target->set_tick(
+                target_column, row, source->get_tick(column, location.index));
+        }
+    }
+
+    // Destroys the moved-from components and any component the target does not hold
+    source->remove_row(location.index);
+    location.archetype = target;
+    location.index = row;
+}
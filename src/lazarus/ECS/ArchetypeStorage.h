@@ -0,0 +1,648 @@
+#pragma once
+
+#include <lazarus/ECS/ComponentStorage.h>
+#include <lazarus/common.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Set of entities which hold exactly the same component types.
+ *
+ * Components are stored in structure-of-arrays chunks: each chunk holds a fixed
+ * number of rows, and within a chunk the components of each type are laid out
+ * contiguously, one column per component type. Rows are kept packed, so
+ * removing an entity moves the last row into the gap.
+ *
+ * Chunks are reference counted, so that the archetypes of a forked storage can share
+ * them. A shared chunk is never written to: it is copied by the archetype about to
+ * change it, which then releases its reference.
+ */
+class Archetype
+{
+public:
+    /**
+     * Size in bytes that a chunk aims to fill.
+     */
+    static constexpr size_t CHUNK_SIZE = 16 * 1024;
+
+    /**
+     * Creates an empty archetype for the given component types, which must be
+     * sorted by ID.
+     */
+    explicit Archetype(std::vector<const ComponentInfo *> components);
+
+    ~Archetype();
+
+    Archetype(const Archetype &) = delete;
+    Archetype &operator=(const Archetype &) = delete;
+
+    /**
+     * Returns the number of entities in the archetype.
+     */
+    size_t size() const
+    {
+        return entities.size();
+    }
+
+    /**
+     * Returns the maximum number of rows in each chunk.
+     */
+    size_t get_chunk_capacity() const
+    {
+        return chunk_capacity;
+    }
+
+    const std::vector<const ComponentInfo *> &get_components() const
+    {
+        return components;
+    }
+
+    /**
+     * Returns the set of component types held by the entities in the archetype.
+     */
+    const ComponentMask &get_mask() const
+    {
+        return mask;
+    }
+
+    const std::vector<lz::Entity *> &get_entities() const
+    {
+        return entities;
+    }
+
+    /**
+     * Returns the index of the column holding the components of the given type,
+     * or -1 if the archetype does not hold that component type.
+     */
+    int find_column(TypeId id) const
+    {
+        return id < columns.size() ? columns[id] : -1;
+    }
+
+    /**
+     * Returns a pointer to the component in the given column and row.
+     */
+    void *get(size_t column, size_t row)
+    {
+        return chunks[row / chunk_capacity] + offsets[column] +
+               (row % chunk_capacity) * components[column]->size;
+    }
+
+    /**
+     * Returns a pointer to the first component of a column in the given chunk.
+     */
+    template <typename Component>
+    Component *column_data(size_t column, size_t chunk)
+    {
+        return reinterpret_cast<Component *>(chunks[chunk] + offsets[column]);
+    }
+
+    /**
+     * Returns the change tick of the component in the given column and row.
+     */
+    TickSlot &tick(size_t column, size_t row)
+    {
+        return column_ticks(column, row / chunk_capacity)[row % chunk_capacity];
+    }
+
+    lz::ChangeTick get_tick(size_t column, size_t row)
+    {
+        return tick(column, row).load(std::memory_order_relaxed);
+    }
+
+    void set_tick(size_t column, size_t row, lz::ChangeTick value)
+    {
+        tick(column, row).store(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns a pointer to the change tick of the first component of a column in
+     * the given chunk.
+     */
+    TickSlot *column_ticks(size_t column, size_t chunk)
+    {
+        return reinterpret_cast<TickSlot *>(chunks[chunk] + tick_offsets[column]);
+    }
+
+    /**
+     * Returns whether the chunk is shared with archetypes of other storages.
+     */
+    bool is_shared(size_t chunk) const
+    {
+        return ref_count(chunks[chunk]).load(std::memory_order_acquire) > 1;
+    }
+
+    /**
+     * Copies the chunk if it is shared, so that its components can be changed.
+     */
+    void unshare(size_t chunk)
+    {
+        if (is_shared(chunk))
+            copy_chunk(chunk);
+    }
+
+    /**
+     * Makes sure that none of the chunks holding the given range of rows is shared.
+     */
+    void unshare_rows(size_t begin, size_t end)
+    {
+        for (size_t chunk = begin / chunk_capacity; chunk * chunk_capacity < end;
+             ++chunk)
+            unshare(chunk);
+    }
+
+    /**
+     * Appends a row for the entity and returns its index.
+     *
+     * The components of the new row are left uninitialized, and it is up to the
+     * caller to construct them and set their change ticks.
+     */
+    size_t push_back(lz::Entity *entity);
+
+    /**
+     * Allocates the chunks needed to hold the given number of rows.
+     */
+    void reserve(size_t rows);
+
+    /**
+     * Removes the last row without destroying its components.
+     *
+     * Used to roll back a push_back() whose components could not be constructed.
+     */
+    void pop_back_uninitialized();
+
+    /**
+     * Destroys the components in the given row and moves the last row into it,
+     * updating the location of the entity that was moved.
+     */
+    void remove_row(size_t row);
+
+    /**
+     * Takes a reference to the chunks of the source archetype, which must hold the
+     * same component types, and places the given entities in its rows. The
+     * archetype must be empty.
+     */
+    void share(const Archetype &source, std::vector<lz::Entity *> entities);
+
+private:
+    friend class ArchetypeStorage;
+
+    using RefCount = std::atomic<size_t>;  // Stored at the start of each chunk
+
+    static RefCount &ref_count(char *chunk)
+    {
+        return *reinterpret_cast<RefCount *>(chunk);
+    }
+
+    /**
+     * Returns the number of rows in use in the given chunk.
+     */
+    size_t rows_in_chunk(size_t chunk) const
+    {
+        size_t begin = chunk * chunk_capacity;
+        return size() > begin ? std::min(chunk_capacity, size() - begin) : 0;
+    }
+
+    /**
+     * Returns a new chunk, with a single reference and its change ticks set to 0.
+     */
+    char *new_chunk() const;
+
+    void allocate_chunk();
+
+    /**
+     * Replaces a shared chunk with a copy of its rows in use.
+     */
+    void copy_chunk(size_t chunk);
+
+    /**
+     * Drops a reference to the chunk. The last reference destroys the components
+     * in the given number of rows and frees the chunk.
+     */
+    void release_chunk(char *chunk, size_t rows);
+
+    std::vector<const ComponentInfo *> components;
+    ComponentMask mask;
+    std::vector<int> columns;  // Column of each component ID, or -1
+    std::vector<size_t> offsets;  // Offset of each column inside a chunk
+    std::vector<size_t> tick_offsets;  // Offset of the change ticks of each column
+    size_t chunk_capacity;
+    size_t chunk_bytes;
+    size_t chunk_align;
+    std::vector<char *> chunks;
+    std::vector<lz::Entity *> entities;
+    // Archetypes reached by adding or removing a single component type, indexed by
+    // component ID
+    std::vector<Archetype *> add_edges;
+    std::vector<Archetype *> remove_edges;
+};
+
+/**
+ * Query over the archetypes which include a set of component types.
+ */
+struct ArchetypeQuery : public Query
+{
+    using Query::Query;
+
+    std::vector<Archetype *> archetypes;
+};
+
+/**
+ * Component storage which groups entities by archetype.
+ *
+ * Every entity attached to the storage lives in the archetype matching its set of
+ * component types, starting with the archetype that holds no components. Adding or
+ * removing a component moves the entity, with all its components, to the
+ * corresponding archetype.
+ */
+class ArchetypeStorage : public ComponentStorage
+{
+public:
+    ArchetypeStorage();
+
+    void attach(lz::Entity &entity) override;
+
+    void detach(lz::Entity &entity) override;
+
+    /**
+     * Constructs a component for the entity, moving it to the archetype that
+     * includes the new component type.
+     */
+    template <typename Component, typename... Args>
+    Component *emplace(lz::Entity *entity, EntityLocation &location, Args &&... args);
+
+    /**
+     * Attaches entities which do not belong to any storage, giving each of them
+     * a copy of the given components.
+     *
+     * The entities are placed directly in the archetype of the component types.
+     * If a copy constructor throws, the entities before the failing one stay
+     * attached with all their components, and the rest are left unattached.
+     */
+    template <typename... Components>
+    void spawn(lz::Entity *const *entities,
+               size_t count,
+               const Components &... components);
+
+    /**
+     * Attaches entities like spawn(), copying the components of each entity from
+     * the tuple of references returned by source(idx), where idx is the position
+     * of the entity.
+     */
+    template <typename... Components, typename Source>
+    void spawn_from(lz::Entity *const *entities, size_t count, Source &&source);
+
+    /**
+     * Destroys a component of the entity, moving it to the archetype that
+     * excludes that component type.
+     */
+    void remove(lz::Entity &entity, const ComponentInfo &info) override;
+
+    /**
+     * Returns a pointer to a component of the entity, or a nullptr if the entity
+     * does not hold a component of that type.
+     */
+    static void *get(const EntityLocation &location, TypeId id)
+    {
+        int column = location.archetype->find_column(id);
+        return column < 0 ? nullptr : location.archetype->get(column, location.index);
+    }
+
+    /**
+     * Returns a pointer to a component of the entity like get(), giving the
+     * component the current change tick.
+     */
+    void *get_changed(const EntityLocation &location, TypeId id)
+    {
+        int column = location.archetype->find_column(id);
+        if (column < 0)
+            return nullptr;
+        location.archetype->unshare(location.index /
+                                    location.archetype->get_chunk_capacity());
+        touch(location.archetype->tick(column, location.index), get_change_tick());
+        return location.archetype->get(column, location.index);
+    }
+
+    void collect(const lz::Entity &entity, ComponentList &list) override;
+
+    void for_each_run(const std::function<void(const ComponentRun &)> &func) override;
+
+    void copy_components(const lz::Entity &source, lz::Entity &entity) override;
+
+    void spawn_copies(lz::Entity *const *entities,
+                      size_t count,
+                      const ComponentArrays &arrays) override;
+
+    const Query &query(const ComponentMask &mask) override;
+
+    /**
+     * Fills the storage, which must not hold any entity yet, with the entities of
+     * the source storage, sharing their chunks copy-on-write.
+     *
+     * Each entity of the source is replaced by the entity returned by
+     * copy_entity(entity), which must not belong to any storage. Chunks are copied
+     * by whichever storage first changes them, so the components of the two storages
+     * stay independent, and only the chunks written to are ever copied.
+     *
+     * @throws LazarusException If any of the components is not copy constructible.
+     */
+    template <typename CopyEntity>
+    void share(ArchetypeStorage &source, CopyEntity &&copy_entity);
+
+    /**
+     * Copies the chunks the storage still shares with other storages.
+     *
+     * Parallel passes call it beforehand, so that their tasks never copy chunks.
+     */
+    void unshare_chunks();
+
+    /**
+     * Calls the function on every entity matched by the query, which must include
+     * the component types of the view types, passing the entity and pointers to the
+     * components.
+     *
+     * Entities are visited archetype by archetype, walking their chunks linearly,
+     * and filtered and stamped according to the change ticks of the pass. The
+     * function must not add or remove components or entities.
+     */
+    template <typename... Types, typename Func>
+    static void each(const ArchetypeQuery &query,
+                     const TickPass<sizeof...(Types)> &pass,
+                     Func &&func);
+
+    /**
+     * Consecutive rows of an archetype, used to split the entities of a query into
+     * pieces which can be processed by different threads.
+     */
+    struct RowRange
+    {
+        Archetype *archetype;
+        size_t begin;
+        size_t end;
+    };
+
+    /**
+     * Splits the entities matched by the query into ranges of at most grain_size
+     * rows, each entity belonging to exactly one of them.
+     */
+    static std::vector<RowRange> split(const ArchetypeQuery &query, size_t grain_size);
+
+    /**
+     * Calls the function on every entity in the range of rows, like each() does for
+     * a whole query.
+     */
+    template <typename... Types, typename Func>
+    static void each(const RowRange &range,
+                     const TickPass<sizeof...(Types)> &pass,
+                     Func &&func);
+
+protected:
+    void prepare_parallel_pass() override
+    {
+        unshare_chunks();
+    }
+
+private:
+    static void check_shareable(const ArchetypeStorage &source);
+
+    /**
+     * Places the entities in the archetype holding the component types of the
+     * source archetype, sharing the chunks of the source.
+     */
+    void share_archetype(const Archetype &source, std::vector<lz::Entity *> entities);
+
+    /**
+     * Returns the archetype for the given set of component types, creating it if
+     * it does not exist yet. The component types must be sorted by ID.
+     */
+    Archetype *find_or_create(const std::vector<const ComponentInfo *> &components);
+
+    Archetype *add_target(Archetype *archetype, const ComponentInfo &info);
+
+    /**
+     * Sets the row of the archetype as the location of an entity attached to the
+     * storage.
+     */
+    void place(lz::Entity &entity, Archetype *archetype, size_t row);
+
+    Archetype *remove_target(Archetype *archetype, const ComponentInfo &info);
+
+    /**
+     * Moves the components of an entity to a new row in the target archetype,
+     * skipping those not held by the target, and frees its old row.
+     */
+    void move_entity(EntityLocation &location, Archetype *target, size_t row);
+
+    template <typename... Types, typename Func, size_t... Is>
+    static void each_in_chunk(Archetype *archetype,
+                              size_t chunk,
+                              size_t begin,
+                              size_t end,
+                              const std::array<int, sizeof...(Types)> &columns,
+                              const TickPass<sizeof...(Types)> &pass,
+                              Func &func,
+                              std::index_sequence<Is...>);
+
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::unordered_map<ComponentMask, Archetype *> archetype_lookup;
+    std::unordered_map<ComponentMask, std::unique_ptr<ArchetypeQuery>> queries;
+    std::mutex queries_mutex;  // Queries may be created during parallel passes
+    Archetype *root;  // Archetype without components
+    bool shares_chunks = false;  // Whether some chunks may be shared
+};
+
+template <typename CopyEntity>
+void ArchetypeStorage::share(ArchetypeStorage &source, CopyEntity &&copy_entity)
+{
+    check_shareable(source);
+    for (const auto &archetype : source.archetypes)
+    {
+        if (archetype->size() == 0)
+            continue;
+        std::vector<lz::Entity *> entities;
+        entities.reserve(archetype->size());
+        for (lz::Entity *entity : archetype->get_entities())
+            entities.push_back(copy_entity(entity));
+        share_archetype(*archetype, std::move(entities));
+    }
+    source.shares_chunks = true;
+}
+
+template <typename Component, typename... Args>
+Component *ArchetypeStorage::emplace(lz::Entity *entity,
+                                     EntityLocation &location,
+                                     Args &&... args)
+{
+    const ComponentInfo &info = get_component_info<Component>();
+    Archetype *target = add_target(location.archetype, info);
+
+    // Construct the new component first, so that nothing has moved yet if the
+    // constructor throws
+    size_t row = target->push_back(entity);
+    void *memory = target->get(target->find_column(info.id), row);
+    try
+    {
+        new (memory) Component(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        target->pop_back_uninitialized();
+        throw;
+    }
+
+    target->set_tick(target->find_column(info.id), row, get_change_tick());
+    move_entity(location, target, row);
+    return static_cast<Component *>(memory);
+}
+
+template <typename... Components>
+void ArchetypeStorage::spawn(lz::Entity *const *entities,
+                             size_t count,
+                             const Components &... components)
+{
+    spawn_from<Components...>(entities, count, [&](size_t) {
+        return std::tuple<const Components &...>(components...);
+    });
+}
+
+template <typename... Components, typename Source>
+void ArchetypeStorage::spawn_from(lz::Entity *const *entities,
+                                  size_t count,
+                                  Source &&source)
+{
+    constexpr size_t num_components = sizeof...(Components);
+    if (get_component_mask<Components...>().count() != num_components)
+        throw LazarusException("Entities cannot hold two components of the same type");
+
+    std::vector<const ComponentInfo *> infos{&get_component_info<Components>()...};
+    std::sort(infos.begin(), infos.end(), [](const auto *a, const auto *b) {
+        return a->id < b->id;
+    });
+    Archetype *target = find_or_create(infos);
+    std::array<int, num_components> columns{
+        target->find_column(get_component_id<Components>())...};
+    std::array<const ComponentInfo *, num_components> column_infos{
+        &get_component_info<Components>()...};
+    target->reserve(target->size() + count);
+    lz::ChangeTick tick = get_change_tick();
+
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        lz::Entity *entity = entities[idx];
+        // Addresses of the components of the entity, in the order of the types
+        [[maybe_unused]] auto components = std::apply(
+            [](const auto &... values) {
+                return std::array<const void *, num_components>{&values...};
+            },
+            source(idx));
+        size_t row = target->push_back(entity);
+        size_t constructed = 0;
+        try
+        {
+            ((new (target->get(columns[constructed], row))
+                  Components(*static_cast<const Components *>(components[constructed])),
+              ++constructed),
+             ...);
+        }
+        catch (...)
+        {
+            for (size_t column = 0; column < constructed; ++column)
+                column_infos[column]->destroy(target->get(columns[column], row));
+            target->pop_back_uninitialized();
+            throw;
+        }
+        for (int column : columns)
+            target->set_tick(column, row, tick);
+        place(*entity, target, row);
+    }
+}
+
+template <typename... Types, typename Func>
+void ArchetypeStorage::each(const ArchetypeQuery &query,
+                            const TickPass<sizeof...(Types)> &pass,
+                            Func &&func)
+{
+    // New archetypes are appended, so iterating by index is safe
+    for (size_t idx = 0; idx < query.archetypes.size(); ++idx)
+    {
+        Archetype *archetype = query.archetypes[idx];
+        if (archetype->size() > 0)
+            each<Types...>(RowRange{archetype, 0, archetype->size()}, pass, func);
+    }
+}
+
+template <typename... Types, typename Func>
+void ArchetypeStorage::each(const RowRange &range,
+                            const TickPass<sizeof...(Types)> &pass,
+                            Func &&func)
+{
+    Archetype *archetype = range.archetype;
+    if constexpr ((writes_component<Types> || ...))
+        archetype->unshare_rows(range.begin, range.end);
+    std::array<int, sizeof...(Types)> columns{
+        archetype->find_column(get_component_id<component_of<Types>>())...};
+
+    size_t capacity = archetype->get_chunk_capacity();
+    size_t row = range.begin;
+    while (row < range.end)
+    {
+        size_t chunk = row / capacity;
+        size_t end = std::min(range.end, (chunk + 1) * capacity);
+        each_in_chunk<Types...>(archetype,
+                                chunk,
+                                row - chunk * capacity,
+                                end - chunk * capacity,
+                                columns,
+                                pass,
+                                func,
+                                std::index_sequence_for<Types...>{});
+        row = end;
+    }
+}
+
+template <typename... Types, typename Func, size_t... Is>
+void ArchetypeStorage::each_in_chunk(Archetype *archetype,
+                                     size_t chunk,
+                                     size_t begin,
+                                     size_t end,
+                                     const std::array<int, sizeof...(Types)> &columns,
+                                     const TickPass<sizeof...(Types)> &pass,
+                                     Func &func,
+                                     std::index_sequence<Is...>)
+{
+    constexpr bool filtered = (is_changed_filter<Types> || ...);
+    std::tuple<component_of<Types> *...> data{
+        archetype->column_data<component_of<Types>>(columns[Is], chunk)...};
+    lz::Entity *const *entities =
+        archetype->get_entities().data() + chunk * archetype->get_chunk_capacity();
+    if (!filtered && !pass.stamps())
+    {
+        for (size_t row = begin; row < end; ++row)
+            func(entities[row], (std::get<Is>(data) + row)...);
+        return;
+    }
+
+    std::array<TickSlot *, sizeof...(Types)> ticks{
+        archetype->column_ticks(columns[Is], chunk)...};
+    for (size_t row = begin; row < end; ++row)
+    {
+        if (!((!is_changed_filter<Types> ||
+               is_changed_since(ticks[Is][row].load(std::memory_order_relaxed),
+                                pass.since)) &&
+              ...))
+            continue;
+        ((pass.stamped[Is] ? touch(ticks[Is][row], pass.tick) : void()), ...);
+        func(entities[row], (std::get<Is>(data) + row)...);
+    }
+}
+}  // namespace __lz
@@ -0,0 +1,130 @@
+#include <lazarus/ECS/CommandBuffer.h>
+#include <lazarus/ECS/ECSEngine.h>
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+
+using namespace lz;
+
+void CommandBuffer::destroy(const Entity &entity)
+{
+    commands.push_back({Kind::Destroy, entity.get_id(), 0, 0});
+}
+
+void CommandBuffer::append(CommandBuffer &other)
+{
+    if (&other == this)
+        return;
+
+    for (auto &entry : other.creations)
+        entry.second->move_to(*this);
+    for (const Command &command : other.commands)
+    {
+        if (command.kind == Kind::AddComponent)
+            other.component_commands[command.component_id]->move_to(
+                *this, command.entity, command.value);
+        else
+            commands.push_back(command);
+    }
+    // Removals need the type of their components
+    for (size_t id = 0; id < other.component_commands.size(); ++id)
+    {
+        if (!other.component_commands[id])
+            continue;
+        if (id >= component_commands.size())
+            component_commands.resize(id + 1);
+        if (!component_commands[id])
+            component_commands[id] = std::move(other.component_commands[id]);
+    }
+    other.clear();
+}
+
+void CommandBuffer::apply(ECSEngine &engine)
+{
+    std::exception_ptr error;
+    auto run = [&](auto &&command) {
+        try
+        {
+            command();
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+
+    for (auto &entry : creations)
+        run([&] { entry.second->spawn(engine); });
+
+    // Sort the commands by component type, then by the archetype the entity is in
+    // and by entity, so that each pool, and each edge between two archetypes, is
+    // modified in a single run: entities of the same archetype gaining or losing the
+    // same component all move to the same archetype. Commands on different
+    // components of an entity do not depend on each other, and the sort is stable,
+    // so commands on the same component of an entity keep their order.
+    std::vector<Entity *> entities(commands.size());
+    for (size_t idx = 0; idx < commands.size(); ++idx)
+        entities[idx] = engine.get_entity(commands[idx].entity);
+    std::vector<size_t> order(commands.size());
+    for (size_t idx = 0; idx < order.size(); ++idx)
+        order[idx] = idx;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        const Command &first = commands[a];
+        const Command &second = commands[b];
+        if ((first.kind == Kind::Destroy) != (second.kind == Kind::Destroy))
+            return second.kind == Kind::Destroy;
+        if (first.component_id != second.component_id)
+            return first.component_id < second.component_id;
+        // Entities which no longer exist are skipped, wherever they are
+        __lz::Archetype *first_archetype =
+            entities[a] ? entities[a]->location.archetype : nullptr;
+        __lz::Archetype *second_archetype =
+            entities[b] ? entities[b]->location.archetype : nullptr;
+        if (first_archetype != second_archetype)
+            return std::less<__lz::Archetype *>()(first_archetype, second_archetype);
+        return __lz::IdAllocator::index_of(first.entity) <
+               __lz::IdAllocator::index_of(second.entity);
+    });
+
+    for (size_t idx : order)
+    {
+        const Command &command = commands[idx];
+        Entity *entity = entities[idx];
+        if (!entity)
+            continue;
+
+        switch (command.kind)
+        {
+        case Kind::AddComponent:
+            run([&] {
+                component_commands[command.component_id]->add(*entity, command.value);
+            });
+            break;
+        case Kind::RemoveComponent:
+            run([&] { component_commands[command.component_id]->remove(*entity); });
+            break;
+        case Kind::Destroy:
+            entity->mark_for_deletion();
+            break;
+        }
+    }
+
+    clear();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void CommandBuffer::clear()
+{
+    commands.clear();
+    for (auto &components : component_commands)
+    {
+        if (components)
+            components->clear();
+    }
+    for (auto &entry : creations)
+        entry.second->clear();
+    created = 0;
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <lazarus/ECS/Entity.h>
+#include <lazarus/ECS/TypeId.h>
+
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace lz
+{
+class ECSEngine;
+
+/**
+ * Records changes to the entities and components of an engine, which are applied
+ * later as a single batch.
+ *
+ * Entities and components cannot be added or removed while the engine iterates in
+ * parallel over them, or while updateables run at the same time. Instead, the
+ * changes are recorded in the command buffer returned by ECSEngine::commands(),
+ * and the engine applies them once it is safe to do so.
+ *
+ * When applied, entities are created in a batch for each set of component types,
+ * and the components added or removed are grouped by type, by the archetype of the
+ * entity and by entity, so that each pool, or each move between two archetypes, is
+ * done in a single run. Commands on the same component of the same entity are
+ * applied in the order they were recorded.
+ *
+ * Entities created through the buffer only exist once it is applied, so the other
+ * commands of the same buffer can't refer to them: their components must all be
+ * given to create().
+ *
+ * @see ECSEngine::commands
+ */
+class CommandBuffer
+{
+public:
+    CommandBuffer() = default;
+
+    CommandBuffer(CommandBuffer &&) = default;
+    CommandBuffer &operator=(CommandBuffer &&) = default;
+
+    /**
+     * Records the creation of an entity holding a copy of each of the components.
+     */
+    template <typename... Components>
+    void create(const Components &... components);
+
+    /**
+     * Records the deletion of the entity, which is then marked for deletion.
+     */
+    void destroy(const Entity &entity);
+
+    /**
+     * Records the addition of a component to the entity.
+     *
+     * The component is constructed right away with the given arguments, and moved
+     * to the entity when the buffer is applied.
+     */
+    template <typename Component, typename... Args>
+    void add_component(const Entity &entity, Args &&... args);
+
+    /**
+     * Records the removal of the component of the given type from the entity.
+     */
+    template <typename Component>
+    void remove_component(const Entity &entity);
+
+    /**
+     * Returns the number of commands recorded.
+     */
+    size_t size() const
+    {
+        return commands.size() + created;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /**
+     * Moves the commands of the other buffer after the ones of this buffer.
+     */
+    void append(CommandBuffer &other);
+
+    /**
+     * Applies the commands to the engine and empties the buffer.
+     *
+     * Commands on entities which no longer exist in the engine are skipped. If a
+     * command fails, for example because the entity already holds the component it
+     * adds, the rest of the commands are still applied, and the first exception is
+     * rethrown afterwards.
+     */
+    void apply(ECSEngine &engine);
+
+    /**
+     * Discards the commands recorded.
+     */
+    void clear();
+
+private:
+    enum class Kind
+    {
+        AddComponent,
+        RemoveComponent,
+        Destroy
+    };
+
+    struct Command
+    {
+        Kind kind;
+        Identifier entity;
+        __lz::TypeId component_id;
+        size_t value;  // Position of the added component in its list
+    };
+
+    struct BaseComponentCommands
+    {
+        virtual ~BaseComponentCommands() = default;
+
+        virtual void add(Entity &entity, size_t value) = 0;
+
+        virtual void remove(Entity &entity) = 0;
+
+        // Records the addition in another buffer
+        virtual void move_to(CommandBuffer &buffer, Identifier entity, size_t value) = 0;
+
+        virtual void clear() = 0;
+    };
+
+    template <typename Component>
+    struct ComponentCommands : public BaseComponentCommands
+    {
+        void add(Entity &entity, size_t value) override
+        {
+            entity.add_component<Component>(std::move(values[value]));
+        }
+
+        void remove(Entity &entity) override
+        {
+            entity.remove_component<Component>();
+        }
+
+        void move_to(CommandBuffer &buffer, Identifier entity, size_t value) override
+        {
+            buffer.record_add<Component>(entity, std::move(values[value]));
+        }
+
+        void clear() override
+        {
+            values.clear();
+        }
+
+        std::vector<Component> values;
+    };
+
+    struct BaseCreations
+    {
+        virtual ~BaseCreations() = default;
+
+        virtual void spawn(ECSEngine &engine) = 0;
+
+        virtual void move_to(CommandBuffer &buffer) = 0;
+
+        virtual void clear() = 0;
+    };
+
+    template <typename... Components>
+    struct Creations : public BaseCreations
+    {
+        // Its address identifies the set of component types
+        static constexpr char tag = 0;
+
+        void spawn(ECSEngine &engine) override
+        {
+            spawn_created(engine, values);
+        }
+
+        void move_to(CommandBuffer &buffer) override
+        {
+            for (const auto &components : values)
+                std::apply([&](const auto &... each) { buffer.create(each...); },
+                           components);
+        }
+
+        void clear() override
+        {
+            values.clear();
+        }
+
+        std::vector<std::tuple<Components...>> values;
+    };
+
+    template <typename Component>
+    ComponentCommands<Component> &get_component_commands();
+
+    template <typename Component>
+    void record_add(Identifier entity, Component &&component);
+
+    /**
+     * Spawns the entities of a set of component types in the engine. Defined
+     * along with the engine.
+     */
+    template <typename... Components>
+    static void spawn_created(ECSEngine &engine,
+                              const std::vector<std::tuple<Components...>> &values);
+
+    std::vector<Command> commands;
+    // Components of the commands, indexed by component ID
+    std::vector<std::unique_ptr<BaseComponentCommands>> component_commands;
+    // Entities to create, for each set of component types in the order they appeared
+    std::vector<std::pair<const void *, std::unique_ptr<BaseCreations>>> creations;
+    size_t created = 0;
+};
+
+template <typename... Components>
+void CommandBuffer::create(const Components &... components)
+{
+    const void *tag = &Creations<Components...>::tag;
+    Creations<Components...> *group = nullptr;
+    for (auto &entry : creations)
+    {
+        if (entry.first == tag)
+        {
+            group = static_cast<Creations<Components...> *>(entry.second.get());
+            break;
+        }
+    }
+    if (!group)
+    {
+        auto new_group = std::make_unique<Creations<Components...>>();
+        group = new_group.get();
+        creations.emplace_back(tag, std::move(new_group));
+    }
+
+    group->values.emplace_back(components...);
+    ++created;
+}
+
+template <typename Component, typename... Args>
+void CommandBuffer::add_component(const Entity &entity, Args &&... args)
+{
+    record_add<Component>(entity.get_id(), Component(std::forward<Args>(args)...));
+}
+
+template <typename Component>
+void CommandBuffer::remove_component(const Entity &entity)
+{
+    get_component_commands<Component>();
+    commands.push_back({Kind::RemoveComponent,
+                        entity.get_id(),
+                        __lz::get_component_id<Component>(),
+                        0});
+}
+
+template <typename Component>
+CommandBuffer::ComponentCommands<Component> &CommandBuffer::get_component_commands()
+{
+    __lz::TypeId component_id = __lz::get_component_id<Component>();
+    if (component_id >= component_commands.size())
+        component_commands.resize(component_id + 1);
+    if (!component_commands[component_id])
+        component_commands[component_id] =
+            std::make_unique<ComponentCommands<Component>>();
+    return static_cast<ComponentCommands<Component> &>(
+        *component_commands[component_id]);
+}
+
+template <typename Component>
+void CommandBuffer::record_add(Identifier entity, Component &&component)
+{
+    auto &values = get_component_commands<Component>().values;
+    values.push_back(std::move(component));
+    commands.push_back({Kind::AddComponent,
+                        entity,
+                        __lz::get_component_id<Component>(),
+                        values.size() - 1});
+}
+}  // namespace lz
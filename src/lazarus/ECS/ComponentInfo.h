@@ -0,0 +1,117 @@
+#pragma once
+
+#include <lazarus/ECS/TypeId.h>
+
+#include <bitset>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Maximum number of component types, which sets the size of the component masks.
+// It is set by the LAZARUS_MAX_COMPONENTS CMake option, which defines it for the
+// library and the targets linking to it alike: defining it only for the code using
+// the library would give the classes holding masks a layout different from the
+// library's.
+#ifndef LAZARUS_MAX_COMPONENTS
+#define LAZARUS_MAX_COMPONENTS 64
+#endif
+
+namespace __lz  // Meant for internal use only
+{
+constexpr size_t MAX_COMPONENTS = LAZARUS_MAX_COMPONENTS;
+
+/**
+ * Set of component types, indexed by component ID.
+ */
+using ComponentMask = std::bitset<MAX_COMPONENTS>;
+
+/**
+ * Type-erased description of a component type.
+ *
+ * Component storages keep components in raw memory, so they rely on this
+ * table to construct, relocate and destroy them without knowing their type.
+ */
+struct ComponentInfo
+{
+    TypeId id;
+    const char *name;
+    size_t size;
+    size_t align;
+    // Move-constructs a component into uninitialized memory at dst
+    void (*move_construct)(void *dst, void *src);
+    // Copy-constructs a component into uninitialized memory at dst, or nullptr if
+    // the component type is not copy constructible
+    void (*copy_construct)(void *dst, const void *src);
+    void (*destroy)(void *ptr);
+};
+
+template <typename T>
+void move_construct_component(void *dst, void *src)
+{
+    new (dst) T(std::move(*static_cast<T *>(src)));
+}
+
+template <typename T>
+void copy_construct_component(void *dst, const void *src)
+{
+    new (dst) T(*static_cast<const T *>(src));
+}
+
+template <typename T>
+void destroy_component(void *ptr)
+{
+    static_cast<T *>(ptr)->~T();
+}
+
+template <typename T>
+constexpr void (*get_copy_constructor())(void *, const void *)
+{
+    if constexpr (std::is_copy_constructible<T>::value)
+        return &copy_construct_component<T>;
+    else
+        return nullptr;
+}
+
+template <typename T>
+const ComponentInfo &make_component_info()
+{
+    static const ComponentInfo info{next_component_id(),
+                                    get_type_name<T>().c_str(),
+                                    sizeof(T),
+                                    alignof(T),
+                                    &move_construct_component<T>,
+                                    get_copy_constructor<T>(),
+                                    &destroy_component<T>};
+    return info;
+}
+
+/**
+ * Returns the type-erased description of the component type T.
+ */
+template <typename T>
+const ComponentInfo &get_component_info()
+{
+    return make_component_info<std::remove_cv_t<T>>();
+}
+
+/**
+ * Returns the ID of the component type T.
+ */
+template <typename T>
+TypeId get_component_id()
+{
+    return get_component_info<T>().id;
+}
+
+/**
+ * Returns the mask with the bits of the given component types set.
+ */
+template <typename... Types>
+ComponentMask get_component_mask()
+{
+    ComponentMask mask;
+    (mask.set(get_component_id<Types>()), ...);
+    return mask;
+}
+}  // namespace __lz
@@ -0,0 +1,43 @@
+#include <lazarus/ECS/ArchetypeStorage.h>
+#include <lazarus/ECS/ComponentStorage.h>
+#include <lazarus/ECS/SparseSetStorage.h>
+#include <lazarus/common.h>
+
+#include <sstream>
+
+using namespace __lz;
+
+std::unique_ptr<ComponentStorage> ComponentStorage::create(lz::StorageBackend backend)
+{
+    switch (backend)
+    {
+    case lz::StorageBackend::Archetype:
+        return std::make_unique<ArchetypeStorage>();
+    case lz::StorageBackend::SparseSet:
+        return std::make_unique<SparseSetStorage>();
+    default:
+        throw LazarusException("Storage backend not implemented.");
+    }
+}
+
+void ComponentStorage::check_copyable(const ComponentList &components)
+{
+    for (const auto &pair : components)
+    {
+        if (!pair.first->copy_construct)
+        {
+            std::stringstream msg;
+            msg << "Component of type " << pair.first->name
+                << " is not copy constructible";
+            throw LazarusException(msg.str());
+        }
+    }
+}
+
+void ComponentStorage::check_copyable(const ComponentArrays &arrays)
+{
+    ComponentList components;
+    for (const auto &array : arrays)
+        components.emplace_back(array.first, nullptr);
+    check_copyable(components);
+}
@@ -0,0 +1,448 @@
+#pragma once
+
+#include <lazarus/ECS/ComponentInfo.h>
+#include <lazarus/common.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace lz
+{
+class Entity;
+
+/**
+ * Available layouts for storing the components of the entities of an engine.
+ */
+enum class StorageBackend
+{
+    /**
+     * Entities with the same set of component types are grouped together, and their
+     * components are stored contiguously. Iterating is fastest, but adding or removing
+     * components moves all the components of the entity.
+     */
+    Archetype,
+    /**
+     * Each component type has its own pool, indexed by entity. Adding and removing
+     * components is cheap and never moves the other components, but iterating over
+     * several component types requires looking up each pool.
+     */
+    SparseSet
+};
+
+/**
+ * Counter which orders the changes made to the components of an engine.
+ *
+ * @see ECSEngine::get_change_tick
+ */
+using ChangeTick = std::uint32_t;
+
+/**
+ * Component type of a view which only matches the entities whose component of type
+ * T was added or changed at or after the tick of the view.
+ *
+ * The view passes the component as a pointer to T, like it does for T itself.
+ *
+ * @see View::since
+ */
+template <typename T>
+struct Changed
+{
+};
+}  // namespace lz
+
+namespace __lz  // Meant for internal use only
+{
+class Archetype;
+
+/**
+ * Change tick of a component. Ticks are read and written with relaxed atomic
+ * operations, as several threads may access the same component during a parallel
+ * pass.
+ */
+using TickSlot = std::atomic<lz::ChangeTick>;
+
+/**
+ * Returns whether the tick is not earlier than since, taking into account that
+ * ticks wrap around.
+ */
+inline bool is_changed_since(lz::ChangeTick tick, lz::ChangeTick since)
+{
+    return static_cast<std::int32_t>(tick - since) >= 0;
+}
+
+/**
+ * Sets the tick, only writing it if it changed so that components which are just
+ * read keep their cache lines clean.
+ */
+inline void touch(TickSlot &slot, lz::ChangeTick tick)
+{
+    if (slot.load(std::memory_order_relaxed) != tick)
+        slot.store(tick, std::memory_order_relaxed);
+}
+
+/**
+ * Component type accessed by a type of a view, which is either the component type
+ * itself or a Changed<T> filter.
+ */
+template <typename T>
+struct ViewType
+{
+    using Component = T;
+    static constexpr bool changed = false;
+};
+
+template <typename T>
+struct ViewType<lz::Changed<T>>
+{
+    using Component = T;
+    static constexpr bool changed = true;
+};
+
+template <typename T>
+using component_of = typename ViewType<T>::Component;
+
+/**
+ * Whether the view type is a Changed<T> filter.
+ */
+template <typename T>
+constexpr bool is_changed_filter = ViewType<T>::changed;
+
+/**
+ * Whether a view of the type gives write access to the components.
+ */
+template <typename T>
+constexpr bool writes_component = !std::is_const<component_of<T>>::value;
+
+/**
+ * Returns the mask with the component types of the Changed<T> filters among the
+ * view types.
+ */
+template <typename... Types>
+ComponentMask get_changed_mask()
+{
+    ComponentMask mask;
+    ((is_changed_filter<Types> ? mask.set(get_component_id<component_of<Types>>())
+                               : mask),
+     ...);
+    return mask;
+}
+
+/**
+ * Change ticks used by a pass over the components of a view.
+ *
+ * Entities are only visited when the components of the view's Changed<T> types
+ * were changed since that tick, and the components marked in stamped are given the
+ * current tick as they are visited.
+ */
+template <size_t N>
+struct TickPass
+{
+    lz::ChangeTick since;
+    lz::ChangeTick tick;
+    std::array<bool, N> stamped;
+
+    bool stamps() const
+    {
+        for (bool stamp : stamped)
+            if (stamp)
+                return true;
+        return false;
+    }
+};
+
+/**
+ * Where the components of an entity live inside a component storage.
+ *
+ * For the archetype storage, it is the archetype of the entity and its row inside
+ * it. For the sparse set storage, the index is the entity's slot in the pools.
+ */
+struct EntityLocation
+{
+    Archetype *archetype = nullptr;
+    size_t index = 0;
+};
+
+/**
+ * Cached set of the entities which hold a certain set of component types.
+ *
+ * Storages keep their queries up to date as entities and components are added and
+ * removed, so iterating over a query only visits matching entities.
+ */
+struct Query
+{
+    explicit Query(const ComponentMask &mask)
+        : mask(mask)
+    {
+    }
+
+    virtual ~Query() = default;
+
+    ComponentMask mask;
+    // Lists with the matching entities
+    std::vector<const std::vector<lz::Entity *> *> entity_lists;
+};
+
+/**
+ * List of components of an entity, given by their type and address.
+ */
+using ComponentList = std::vector<std::pair<const ComponentInfo *, void *>>;
+
+/**
+ * Arrays of components of several types, given by their type and the address of
+ * the first component, with the components of each array stored one after the
+ * other.
+ */
+using ComponentArrays = std::vector<std::pair<const ComponentInfo *, const char *>>;
+
+/**
+ * Run of entities of a storage holding the same component types, whose components
+ * of each type are stored one after the other.
+ */
+struct ComponentRun
+{
+    lz::Entity *const *entities;
+    size_t count;
+    ComponentMask mask;
+    ComponentArrays arrays;  // Components of each type held, in order of entity
+};
+
+/**
+ * Base class for the component storages.
+ *
+ * Operations which depend on the component type are implemented as templates by each
+ * storage, and callers dispatch to them on the backend to avoid virtual calls in the
+ * hot paths.
+ */
+class ComponentStorage
+{
+public:
+    explicit ComponentStorage(lz::StorageBackend backend)
+        : backend(backend)
+    {
+    }
+
+    virtual ~ComponentStorage() = default;
+
+    ComponentStorage(const ComponentStorage &) = delete;
+    ComponentStorage &operator=(const ComponentStorage &) = delete;
+
+    lz::StorageBackend get_backend() const
+    {
+        return backend;
+    }
+
+    /**
+     * Adds an entity without components to the storage.
+     */
+    virtual void attach(lz::Entity &entity) = 0;
+
+    /**
+     * Removes an entity and destroys all its components.
+     */
+    virtual void detach(lz::Entity &entity) = 0;
+
+    /**
+     * Destroys the component of the given type held by the entity.
+     */
+    virtual void remove(lz::Entity &entity, const ComponentInfo &info) = 0;
+
+    /**
+     * Appends the type and address of each component of the entity to the list.
+     */
+    virtual void collect(const lz::Entity &entity, ComponentList &list) = 0;
+
+    /**
+     * Calls the function with every entity of the storage, as runs of entities
+     * holding the same component types, so that their components can be read as
+     * arrays. The run is only valid during the call.
+     */
+    virtual void for_each_run(const std::function<void(const ComponentRun &)> &func) = 0;
+
+    /**
+     * Copies all the components of the source entity, which may belong to another
+     * storage, to an entity without components attached to this storage.
+     *
+     * @throws LazarusException If any of the components is not copy constructible.
+     */
+    virtual void copy_components(const lz::Entity &source, lz::Entity &entity) = 0;
+
+    /**
+     * Attaches entities which do not belong to any storage, copying the components
+     * of the entity at position idx from position idx of each of the arrays. The
+     * arrays must hold different component types.
+     *
+     * If a copy constructor throws, the entities before the failing one stay
+     * attached with all their components, and the rest are left unattached.
+     *
+     * @throws LazarusException If any of the component types is not copy
+     * constructible.
+     */
+    virtual void spawn_copies(lz::Entity *const *entities,
+                              size_t count,
+                              const ComponentArrays &arrays) = 0;
+
+    /**
+     * Returns the query for the entities holding all the component types in the
+     * mask, creating it the first time it is requested.
+     *
+     * The query stays valid, and up to date, for the lifetime of the storage.
+     */
+    virtual const Query &query(const ComponentMask &mask) = 0;
+
+    /**
+     * Marks a pass as iterating over the storage for as long as it lives, so that
+     * entities and components are not added or removed, and the storage is not
+     * forked, while the pass walks its entities and writes through pointers to
+     * their components.
+     */
+    class PassScope
+    {
+    public:
+        explicit PassScope(ComponentStorage &storage)
+            : storage(storage)
+        {
+            ++storage.passes;
+        }
+
+        ~PassScope()
+        {
+            --storage.passes;
+        }
+
+        PassScope(const PassScope &) = delete;
+        PassScope &operator=(const PassScope &) = delete;
+
+    private:
+        ComponentStorage &storage;
+    };
+
+    /**
+     * Throws if a pass, serial or parallel, is iterating over the storage. Called
+     * before forking the storage.
+     */
+    void check_no_pass() const
+    {
+        if (passes.load(std::memory_order_relaxed) > 0 || is_frozen())
+            throw LazarusException("Engines cannot be forked during a pass");
+    }
+
+    /**
+     * Forbids adding or removing entities and components, while parallel passes
+     * iterate over the storage. Passes can be nested, and each call must be
+     * matched by a call to thaw().
+     */
+    void freeze()
+    {
+        if (frozen++ == 0)
+            prepare_parallel_pass();
+    }
+
+    void thaw()
+    {
+        --frozen;
+    }
+
+    bool is_frozen() const
+    {
+        return frozen.load(std::memory_order_relaxed) > 0;
+    }
+
+    /**
+     * Throws if the storage is frozen, or a serial pass is iterating over it, which
+     * could visit the entity again in the archetype it moves to. Called before any
+     * change to the entities or components of the storage.
+     */
+    void check_not_frozen() const
+    {
+        if (is_frozen())
+            throw LazarusException(
+                "Entities and components cannot be added or removed during a "
+                "parallel pass");
+        if (passes.load(std::memory_order_relaxed) > 0)
+            throw LazarusException(
+                "Entities and components cannot be added or removed during a pass, "
+                "record the changes with engine.commands() instead");
+    }
+
+    /**
+     * Returns the tick given to the components added or changed at this point.
+     */
+    lz::ChangeTick get_change_tick() const
+    {
+        return change_tick.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Moves on to the next change tick. Must not be called during parallel passes.
+     */
+    void advance_change_tick()
+    {
+        change_tick.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Starts tracking the changes made through views to the component types in the
+     * mask.
+     *
+     * Components always get the current tick when added or when accessed through
+     * Entity::get(), but iterating over a view with write access only stamps them
+     * once their type is tracked, so that views do not pay for the ticks unless
+     * some Changed<T> filter looks at them.
+     */
+    void track_changes(const ComponentMask &mask)
+    {
+        for (TypeId id = 0; id < MAX_COMPONENTS; ++id)
+            if (mask.test(id) && !tracked[id].load(std::memory_order_relaxed))
+                tracked[id].store(true, std::memory_order_relaxed);
+    }
+
+    bool is_tracked(TypeId id) const
+    {
+        return tracked[id].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the change tick and the tracked component types to those of another
+     * storage.
+     */
+    void copy_change_tracking(const ComponentStorage &other)
+    {
+        change_tick.store(other.get_change_tick(), std::memory_order_relaxed);
+        for (TypeId id = 0; id < MAX_COMPONENTS; ++id)
+            tracked[id].store(other.is_tracked(id), std::memory_order_relaxed);
+    }
+
+    /**
+     * Creates a new storage with the given backend.
+     */
+    static std::unique_ptr<ComponentStorage> create(lz::StorageBackend backend);
+
+protected:
+    /**
+     * Called by the outermost freeze(), before the parallel pass starts.
+     */
+    virtual void prepare_parallel_pass()
+    {
+    }
+
+    /**
+     * Throws if any of the components cannot be copied.
+     */
+    static void check_copyable(const ComponentList &components);
+
+    static void check_copyable(const ComponentArrays &arrays);
+
+private:
+    lz::StorageBackend backend;
+    std::atomic<int> frozen{0};
+    std::atomic<int> passes{0};  // Serial passes, parallel ones freeze the storage
+    std::atomic<lz::ChangeTick> change_tick{0};
+    std::array<std::atomic<bool>, MAX_COMPONENTS> tracked{};  // Indexed by ID
+};
+}  // namespace __lz
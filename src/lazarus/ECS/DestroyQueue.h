@@ -0,0 +1,85 @@
+#pragma once
+
+#include <lazarus/ECS/IdAllocator.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Thread-safe list of the entities of an engine which are pending destruction.
+ *
+ * Entities are added when they are marked for deletion, so the garbage collector
+ * only needs to visit the entities which were deleted.
+ */
+class DestroyQueue
+{
+public:
+    void push(lz::Identifier id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ids.push_back(id);
+    }
+
+    /**
+     * Moves up to max IDs from the front of the queue to the end of out, in the order
+     * they were added, and returns how many were moved.
+     */
+    size_t take(std::vector<lz::Identifier> &out, size_t max)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = std::min(max, ids.size() - head);
+        out.insert(out.end(), ids.begin() + head, ids.begin() + head + count);
+        head += count;
+        // Taken IDs are only dropped once they are half of the queue, so that taking
+        // from the front is constant on average
+        if (head == ids.size())
+        {
+            ids.clear();
+            head = 0;
+        }
+        else if (head > ids.size() / 2)
+        {
+            ids.erase(ids.begin(), ids.begin() + head);
+            head = 0;
+        }
+        return count;
+    }
+
+    /**
+     * Notes that one of the IDs in the queue no longer leads to an entity to destroy,
+     * since the entity was replaced, so that it is not counted anymore.
+     */
+    void add_stale()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++stale;
+    }
+
+    /**
+     * Notes that one of the stale IDs was taken.
+     */
+    void remove_stale()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --stale;
+    }
+
+    /**
+     * Returns the number of IDs in the queue which are not stale.
+     */
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ids.size() - head - stale;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<lz::Identifier> ids;
+    size_t head = 0;  // Index of the first ID not taken yet
+    size_t stale = 0;
+};
+}  // namespace __lz
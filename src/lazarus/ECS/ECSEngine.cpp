@@ -1,50 +1,323 @@
 #include <lazarus/ECS/ECSEngine.h>
 
+#include <algorithm>
+#include <thread>
+
 using namespace lz;
 
+namespace
+{
+// Updateable being run by the current thread, whose last run sets the tick of the
+// views it creates
+struct RunningUpdateable
+{
+    const ECSEngine *engine;
+    ChangeTick last_run;
+};
+
+thread_local const RunningUpdateable *running_updateable = nullptr;
+}  // namespace
+
+ECSEngine::ECSEngine(StorageBackend backend)
+    : storage(__lz::ComponentStorage::create(backend))
+    , thread_count(std::max(std::thread::hardware_concurrency(), 1u))
+{
+    dispatcher.set_profiler(&profiler);
+}
+
+ECSEngine::~ECSEngine()
+{
+    for_each_slot([this](Entity *&entity) { entity_pool.destroy(entity); });
+}
+
 Entity *ECSEngine::add_entity()
 {
-    Entity entity;
-    std::shared_ptr<Entity> ent_ptr = std::make_shared<Entity>(entity);
-    entities[entity.get_id()] = ent_ptr;
-    return ent_ptr.get();
+    storage->check_not_frozen();
+    Entity *entity = entity_pool.create();
+    storage->attach(*entity);
+    return insert(entity);
+}
+
+std::vector<Entity *> ECSEngine::create_entities(size_t count)
+{
+    return spawn<>(count);
 }
 
 void ECSEngine::add_entity(Entity &entity)
 {
     // TODO: Log the case when entity already exists in the map
-    entities[entity.get_id()] = std::make_shared<Entity>(entity);
+    storage->check_not_frozen();
+    Entity *copy = entity_pool.create(entity.get_id());
+    storage->attach(*copy);
+    try
+    {
+        if (entity.storage)
+            storage->copy_components(entity, *copy);
+    }
+    catch (...)
+    {
+        entity_pool.destroy(copy);
+        throw;
+    }
+    copy->deleted = entity.is_deleted();
+    insert(copy);
 }
 
 Entity *ECSEngine::get_entity(Identifier entity_id)
 {
-    auto found = entities.find(entity_id);
-    if (found == entities.end())
+    size_t index = __lz::IdAllocator::index_of(entity_id);
+    size_t page = index / ENTITY_PAGE_SIZE;
+    if (page >= entities.size() || !entities[page])
+        return nullptr;
+    Entity *entity = entities[page][index % ENTITY_PAGE_SIZE];
+    if (!entity || entity->get_id() != entity_id)
         return nullptr;
-    return found->second.get();
+    return entity;
+}
+
+std::unique_ptr<ECSEngine> ECSEngine::fork()
+{
+    storage->check_no_pass();
+    std::unique_ptr<ECSEngine> copy(new ECSEngine(storage->get_backend()));
+    copy->thread_count = thread_count;
+    copy->garbage_collection_budget = garbage_collection_budget;
+    copy->storage->copy_change_tracking(*storage);
+
+    switch (storage->get_backend())
+    {
+    case StorageBackend::Archetype:
+        static_cast<__lz::ArchetypeStorage &>(*copy->storage)
+            .share(static_cast<__lz::ArchetypeStorage &>(*storage),
+                   [&copy](const Entity *entity) {
+                       Entity *forked = copy->entity_pool.create(entity->get_id());
+                       forked->deleted = entity->is_deleted();
+                       return copy->insert(forked);
+                   });
+        break;
+    case StorageBackend::SparseSet:
+        for_each_slot([&copy](Entity *entity) { copy->add_entity(*entity); });
+        break;
+    }
+    return copy;
+}
+
+void ECSEngine::set_thread_count(size_t threads)
+{
+    storage->check_not_frozen();
+    thread_count = std::max<size_t>(threads, 1);
+    thread_pool.reset();
 }
 
 void ECSEngine::update()
 {
-    // Update all updateable systems
-    for (auto updateable : updateables)
+    bool profiling = profiler.is_enabled();
+    auto start = profiling ? Profiler::Clock::now() : Profiler::Clock::time_point();
+    storage->advance_change_tick();
+    apply_commands();
+    deliver_queued_events();
+
+    // Update all updateable systems, stage by stage
+    for (const auto &stage : scheduler.get_stages())
     {
-        updateable->update(*this);
+        storage->advance_change_tick();
+        for (__lz::TypeId id : stage.ids)
+            if (id >= last_runs.size())
+                last_runs.resize(id + 1, 0);
+
+        if (stage.exclusive)
+        {
+            run_updateable(stage, 0);
+        }
+        else
+        {
+            __lz::TaskContexts tasks(*this);
+            tasks.prepare(stage.updateables.size());
+            storage->freeze();
+            try
+            {
+                get_thread_pool().parallel_for(stage.updateables.size(), [&](size_t idx) {
+                    __lz::TaskContext::Scope scope = tasks.enter(idx);
+                    run_updateable(stage, idx);
+                });
+            }
+            catch (...)
+            {
+                storage->thaw();
+                throw;
+            }
+            storage->thaw();
+            tasks.finish(*this);
+        }
+
+        // Changes made from here on are seen by the next runs of the stage
+        storage->advance_change_tick();
+        for (__lz::TypeId id : stage.ids)
+            last_runs[id] = storage->get_change_tick();
+        apply_commands();
+        deliver_queued_events();
     }
 
     // Run garbage collector
     garbage_collect();
+
+    if (profiling)
+        profiler.record_frame(start);
+}
+
+ChangeTick ECSEngine::get_view_tick() const
+{
+    if (running_updateable && running_updateable->engine == this)
+        return running_updateable->last_run;
+    return 0;
+}
+
+void ECSEngine::run_updateable(const __lz::Scheduler::Stage &stage, size_t idx)
+{
+    RunningUpdateable running{this, last_runs[stage.ids[idx]]};
+    const RunningUpdateable *outer = running_updateable;
+    running_updateable = &running;
+    bool profiling = profiler.is_enabled();
+    __lz::TypeId outer_system = profiling ? Profiler::enter_system(stage.ids[idx])
+                                          : Profiler::NO_SYSTEM;
+    auto start = profiling ? Profiler::Clock::now() : Profiler::Clock::time_point();
+    try
+    {
+        stage.updateables[idx]->update(*this);
+    }
+    catch (...)
+    {
+        if (profiling)
+            Profiler::enter_system(outer_system);
+        running_updateable = outer;
+        throw;
+    }
+    if (profiling)
+        profiler.record_system(stage.ids[idx], start, outer_system);
+    running_updateable = outer;
+}
+
+CommandBuffer &ECSEngine::commands()
+{
+    if (__lz::TaskContext *context = __lz::TaskContext::current(*this))
+        return context->commands;
+    return command_buffer;
+}
+
+void ECSEngine::apply_commands()
+{
+    storage->check_not_frozen();
+    command_buffer.apply(*this);
+}
+
+void ECSEngine::deliver_queued_events()
+{
+    dispatcher.deliver_queued(*this);
+}
+
+void ECSEngine::set_garbage_collection_budget(std::chrono::nanoseconds budget)
+{
+    garbage_collection_budget = budget;
+}
+
+size_t ECSEngine::get_pending_deletions()
+{
+    return destroy_queue.size();
 }
 
 void ECSEngine::garbage_collect()
 {
-    auto it = entities.begin();
-    while (it != entities.end())
+    storage->check_not_frozen();
+    // The IDs are taken a few at a time, so that those left by the budget stay queued
+    constexpr size_t CHECK_INTERVAL = 64;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Identifier> deleted;
+    while (destroy_queue.take(deleted, CHECK_INTERVAL) > 0)
     {
-        Entity *entity = it->second.get();
-        if (entity->is_deleted())
-            it = entities.erase(it);
+        for (Identifier id : deleted)
+        {
+            // The entity may have been replaced by another one with the same ID
+            Entity *entity = get_entity(id);
+            if (entity && entity->is_deleted())
+                remove(entity);
+            else
+                destroy_queue.remove_stale();
+        }
+        deleted.clear();
+        if (garbage_collection_budget.count() > 0 &&
+            std::chrono::steady_clock::now() - start >= garbage_collection_budget)
+            break;
+    }
+}
+
+Entity *ECSEngine::insert(Entity *entity)
+{
+    size_t index = __lz::IdAllocator::index_of(entity->get_id());
+    size_t page = index / ENTITY_PAGE_SIZE;
+    if (page >= entities.size())
+        entities.resize(page + 1);
+    if (!entities[page])
+        entities[page].reset(new Entity *[ENTITY_PAGE_SIZE]());
+
+    Entity *&slot = entities[page][index % ENTITY_PAGE_SIZE];
+    if (slot)
+    {
+        // The ID queued for the replaced entity no longer leads to an entity to destroy
+        if (slot->is_deleted())
+            destroy_queue.add_stale();
+        entity_pool.destroy(slot);
+    }
+    slot = entity;
+    entity->destroy_queue = &destroy_queue;
+    if (entity->is_deleted())
+        destroy_queue.push(entity->get_id());
+    return entity;
+}
+
+void ECSEngine::remove(Entity *entity)
+{
+    size_t index = __lz::IdAllocator::index_of(entity->get_id());
+    entities[index / ENTITY_PAGE_SIZE][index % ENTITY_PAGE_SIZE] = nullptr;
+    entity_pool.destroy(entity);
+}
+
+std::vector<Entity *> ECSEngine::spawn_copies(size_t count,
+                                              const __lz::ComponentArrays &arrays)
+{
+    storage->check_not_frozen();
+    std::vector<Entity *> spawned(count);
+    std::vector<Identifier> ids(count);
+    __lz::IdAllocator::get().allocate(ids.data(), count);
+    entity_pool.reserve(count);
+    for (size_t idx = 0; idx < count; ++idx)
+        spawned[idx] = entity_pool.create(Entity::AllocatedId{ids[idx]});
+
+    try
+    {
+        storage->spawn_copies(spawned.data(), count, arrays);
+    }
+    catch (...)
+    {
+        insert_spawned(spawned);
+        throw;
+    }
+    insert_spawned(spawned);
+    return spawned;
+}
+
+void ECSEngine::insert_spawned(const std::vector<Entity *> &spawned)
+{
+    for (Entity *entity : spawned)
+    {
+        if (entity->storage)
+            insert(entity);
         else
-            ++it;
+            entity_pool.destroy(entity);
     }
 }
+
+__lz::ThreadPool &ECSEngine::get_thread_pool()
+{
+    if (!thread_pool)
+        thread_pool = std::make_unique<__lz::ThreadPool>(thread_count - 1);
+    return *thread_pool;
+}
@@ -1,11 +1,25 @@
 #pragma once
 
+#include <lazarus/ECS/CommandBuffer.h>
 #include <lazarus/ECS/Entity.h>
+#include <lazarus/ECS/EntityPool.h>
+#include <lazarus/ECS/EventDispatcher.h>
 #include <lazarus/ECS/EventListener.h>
+#include <lazarus/ECS/Profiler.h>
+#include <lazarus/ECS/Scheduler.h>
+#include <lazarus/ECS/SystemAccess.h>
+#include <lazarus/ECS/TaskContext.h>
+#include <lazarus/ECS/ThreadPool.h>
 #include <lazarus/ECS/Updateable.h>
+#include <lazarus/ECS/View.h>
 
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <sstream>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace lz
 {
@@ -27,11 +41,55 @@ namespace lz
 class ECSEngine
 {
 public:
+    /**
+     * Default maximum number of entities processed as a single task by the
+     * parallel passes.
+     */
+    static constexpr size_t DEFAULT_GRAIN_SIZE = 1024;
+
+    /**
+     * Creates an engine whose components are kept in the given storage backend.
+     *
+     * @see StorageBackend
+     */
+    ECSEngine(StorageBackend backend = StorageBackend::Archetype);
+
+    virtual ~ECSEngine();
+
+    ECSEngine(const ECSEngine &) = delete;
+    ECSEngine &operator=(const ECSEngine &) = delete;
+
     /**
      * Adds a new entity to the collection and returns a pointer to it.
+     *
+     * The entity is constructed in place in the memory kept by the engine, and the
+     * pointer stays valid until the entity is garbage collected.
      */
     Entity *add_entity();
 
+    /**
+     * Adds the given number of new entities, without components, to the collection
+     * and returns pointers to them.
+     */
+    std::vector<Entity *> create_entities(size_t count);
+
+    /**
+     * Adds the given number of new entities to the collection, each of them
+     * holding a copy of each of the components passed, and returns pointers to
+     * them.
+     *
+     * The components are constructed directly where they are stored, so this is
+     * much faster than adding the entities and their components one by one.
+     * For example:
+     *
+     *     engine.spawn(1000, Position(0, 0), Velocity(1, 0));
+     *
+     * If a component cannot be copied, the entities spawned before the failure
+     * are kept, and the exception is rethrown.
+     */
+    template <typename... Components>
+    std::vector<Entity *> spawn(size_t count, const Components &... components);
+
     /**
      * Adds an existing entity to the collection.
      *
@@ -44,19 +102,88 @@ public:
      * Gets a pointer to the entity from the collection with the given
      * ID, or a nullptr if an entity with such ID does not exist in the
      * collection.
+     *
+     * Entities are indexed by the index of their ID, so this takes constant time.
+     * IDs of destroyed entities are detected by their generation, and return a
+     * nullptr even if their index has been reused.
      */
     Entity *get_entity(Identifier entity_id);
 
+    /**
+     * Returns a new engine holding a copy of each of the entities of this one, with
+     * the same IDs, components and deletion marks, meant to simulate turns ahead,
+     * for instance by the AI, without changing the original.
+     *
+     * With the archetype backend, the forked engine shares the chunks of components
+     * copy-on-write: forking takes time proportional to the number of entities, and
+     * a chunk is only copied once either engine changes a component in it, adds or
+     * removes an entity from it, or runs a parallel pass over it. With the sparse
+     * set backend, components are copied right away.
+     *
+     * The engines can then be used from different threads. Systems, updateables,
+     * queued events and pending commands are not copied, and neither are the
+     * settings other than the thread count and the garbage collection budget.
+     *
+     * Pointers and references to components taken before forking may point into a
+     * chunk shared with the fork, so they must not be written through afterwards;
+     * get the components from their entities again instead.
+     *
+     * @throws LazarusException If any of the components is not copy constructible,
+     * or a pass over the entities of this engine is running.
+     */
+    std::unique_ptr<ECSEngine> fork();
+
     /**
      * Returns a vector with the entities that have the specified
      * components.
      *
+     * The entities are copied from the cached query of the view with the same
+     * component types, so the engine is not searched, and components can be added
+     * to or removed from the entities while walking the vector. Use view() to walk
+     * the matching entities without copying them.
+     *
      * If include_deleted is set to true, entities that are marked for
      * deletion will also be included.
+     *
+     * @see view
      */
     template <typename... Types>
     std::vector<Entity *> entities_with_components(bool include_deleted = false);
 
+    /**
+     * Returns a view of the entities that have the specified components.
+     *
+     * The first time a view of some component types is requested, the engine
+     * starts tracking the entities that match it, and keeps the list up to date
+     * as components are added or removed. Iterating over a view only visits the
+     * matching entities.
+     *
+     * If include_deleted is set to true, entities that are marked for
+     * deletion will also be included.
+     *
+     * The Changed<T> filters of a view created by an updateable match the
+     * components changed since the last time the updateable ran, or all of them
+     * the first time it runs. Outside of updateables, they match all the
+     * components unless View::since() is used.
+     *
+     * @see View
+     */
+    template <typename... Types>
+    View<Types...> view(bool include_deleted = false);
+
+    /**
+     * Returns the change tick of the engine, which is given to the components as
+     * they are added or changed.
+     *
+     * The tick advances when the engine updates, and before and after each stage
+     * of updateables, so it can be kept and passed to View::since() to find the
+     * components changed from then on.
+     */
+    ChangeTick get_change_tick() const
+    {
+        return storage->get_change_tick();
+    }
+
     /**
      * Applies a function to each of the entities from the collection that have the
      * specified component types.
@@ -66,12 +193,81 @@ public:
      *
      * If include_deleted is set to true, the function will also be applied to
      * entities that are marked for deletion.
+     *
+     * The order in which entities are visited depends on the storage backend.
+     * Entities may be marked for deletion during the pass, but adding or removing
+     * entities or components throws an exception until the pass is over; record
+     * those changes with commands() instead.
      */
     template <typename... Types>
     void apply_to_each(
         typename std::common_type<std::function<void(Entity *, Types *...)>>::type &&func,
         bool include_deleted = false);
 
+    /**
+     * Overloaded version of @ref apply_to_each which takes any callable object.
+     *
+     * The callable is passed on by its own type instead of being wrapped in an
+     * std::function, so the compiler can inline it into the iteration loop. This
+     * is the overload chosen when passing a lambda or a function.
+     */
+    template <typename... Types,
+              typename Func,
+              typename std::enable_if_t<!std::is_same<
+                  std::decay_t<Func>,
+                  std::function<void(Entity *, Types *...)>>::value> * = nullptr>
+    void apply_to_each(Func &&func, bool include_deleted = false);
+
+    /**
+     * Applies a function to each of the entities that have the specified component
+     * types, like @ref apply_to_each, spreading the work over the threads of the
+     * engine.
+     *
+     * The matching entities are split into ranges of at most grain_size entities,
+     * which are run as tasks on a work-stealing thread pool owned by the engine.
+     * The calling thread also runs tasks, and the call returns once every entity
+     * has been visited exactly once.
+     *
+     * The function may be called from several threads at the same time, so it must
+     * be safe to do so. Entities may be marked for deletion during the pass, as they
+     * are only removed by the garbage collector, but adding or removing entities or
+     * components throws an exception until the pass is over.
+     *
+     * @see set_thread_count
+     */
+    template <typename... Types, typename Func>
+    void parallel_apply_to_each(Func &&func,
+                                size_t grain_size = DEFAULT_GRAIN_SIZE,
+                                bool include_deleted = false);
+
+    /**
+     * Sets the number of threads used by the parallel passes, including the
+     * calling thread.
+     *
+     * By default, the engine uses as many threads as hardware threads are
+     * available. A value of 1 runs the parallel passes on the calling thread.
+     */
+    void set_thread_count(size_t threads);
+
+    /**
+     * Returns the number of threads used by the parallel passes.
+     */
+    size_t get_thread_count() const
+    {
+        return thread_count;
+    }
+
+    /**
+     * Returns the profiler of the engine, which measures its updates, updateables,
+     * listeners and passes over the entities once enabled.
+     *
+     * @see Profiler
+     */
+    Profiler &get_profiler()
+    {
+        return profiler;
+    }
+
     /**
      * Registers a system to listen to certain event types.
      *
@@ -100,14 +296,79 @@ public:
 
     /**
      * Emit an event to all listeners of that type of event.
+     *
+     * If the events of the type are queued, the event is only added to their
+     * queue, and the listeners receive it on the next delivery.
+     *
+     * Events may be emitted by the function of a parallel pass, or by updateables
+     * which run at the same time as others. Each of the tasks of the pass or stage
+     * records its events in a buffer of its own, without locking, and the events
+     * are emitted once all the tasks have finished. Tasks are replayed in order,
+     * that is, in the order of their entities or of the updateables in the stage,
+     * so the order of the events does not depend on the threads that ran them.
+     *
+     * Listeners may add and delete systems, or emit other events, while they
+     * receive the event. Systems added meanwhile will only receive later events,
+     * and systems deleted meanwhile will not receive it if they had not yet.
      */
     template <typename EventType>
     void emit(const EventType &event);
 
+    /**
+     * Returns the command buffer where changes to the entities and components of
+     * the engine can be recorded, to be applied later.
+     *
+     * Each task of a parallel pass, and each updateable which runs at the same
+     * time as others, gets a buffer of its own, so commands can be recorded from
+     * any of them without locking. Once the tasks finish, their commands are moved
+     * to the buffer of the engine in the order of the tasks. The buffer of the
+     * engine is applied when the engine updates, before the first updateables run
+     * and after each stage of updateables, or by calling apply_commands().
+     *
+     * Outside of parallel passes and stages, the buffer of the engine is returned,
+     * which must only be used by one thread at a time.
+     *
+     * @see CommandBuffer
+     */
+    CommandBuffer &commands();
+
+    /**
+     * Applies the commands recorded in the command buffer of the engine.
+     *
+     * @see CommandBuffer::apply
+     */
+    void apply_commands();
+
+    /**
+     * Chooses how the events of the given type are delivered to their listeners.
+     *
+     * Events are delivered immediately by default. Queued events are appended to
+     * a buffer of their type instead, and delivered when the engine updates,
+     * before the first updateables run and after each stage of updateables. Each
+     * listener then receives all the events of the type queued since the last
+     * delivery at once, through EventListener::receive_all.
+     *
+     * Events queued by the listeners while they receive a batch are delivered in
+     * a later batch of the same delivery.
+     *
+     * @see EventListener::receive_all
+     */
+    template <typename EventType>
+    void set_event_delivery(EventDelivery delivery);
+
+    /**
+     * Delivers the events queued so far, without waiting for the next update.
+     *
+     * Does nothing if called by a listener while receiving queued events.
+     */
+    void deliver_queued_events();
+
     /**
      * Adds a new updateable object to the engine.
      *
      * The update method on this object will be called when the engine is updated.
+     * As its access is not declared, it will run on its own, after the updateables
+     * added before it and before the ones added after it.
      *
      * If an updateable of the given type already exists in the engine, it will
      * not do anything.
@@ -115,19 +376,128 @@ public:
     template <typename Type>
     void add_updateable();
 
+    /**
+     * Adds a new updateable object to the engine, declaring the component types it
+     * reads and writes and the updateables it must run before or after.
+     *
+     * Updateables which do not conflict may run at the same time on the threads
+     * of the engine, so their update method must only access what they declared.
+     * Unless they are exclusive, they cannot add or remove entities or components.
+     *
+     * If an updateable of the given type already exists in the engine, it will
+     * not do anything.
+     *
+     * @see SystemAccess
+     */
+    template <typename Type>
+    void add_updateable(const SystemAccess &access);
+
+    /**
+     * Limits the time spent destroying deleted entities on each update.
+     *
+     * Once the budget is exceeded, the rest of the deleted entities are left for
+     * the next updates. They are still treated as deleted meanwhile. A budget of
+     * zero, the default, destroys all of them on every update.
+     */
+    void set_garbage_collection_budget(std::chrono::nanoseconds budget);
+
+    /**
+     * Returns the number of entities marked for deletion which have not been
+     * destroyed by the garbage collector yet.
+     */
+    size_t get_pending_deletions();
+
     /**
      * Updates all the updateable objects in the engine.
      *
+     * Updateables are run in stages, each of them holding the updateables which
+     * can run at the same time, which are spread over the threads of the engine.
+     * Commands are applied, and then queued events delivered, before the first
+     * stage and after each of them. The change tick of the engine advances first,
+     * and then before and after each stage.
+     *
      * Will also garbage collect deleted entities.
+     *
+     * @throws LazarusException If the ordering constraints of the updateables form
+     * a cycle.
      */
     virtual void update();
 
 private:
+    friend class CommandBuffer;
+    friend class SnapshotRegistry;
+
     /**
-     * Removes deleted entities.
+     * Destroys the entities marked for deletion, within the time budget.
+     *
+     * Only the entities in the destroy queue are visited, so the cost depends on
+     * the number of deleted entities rather than on the size of the collection.
      */
     void garbage_collect();
 
+    /**
+     * Adds the entity to the collection, replacing any entity with the same ID.
+     */
+    Entity *insert(Entity *entity);
+
+    /**
+     * Removes the entity from the collection and destroys it.
+     */
+    void remove(Entity *entity);
+
+    /**
+     * Calls the function with a reference to each non-empty slot of the collection
+     * of entities.
+     */
+    template <typename Func>
+    void for_each_slot(Func &&func);
+
+    /**
+     * Adds new entities like spawn(), copying the components of each of them from
+     * the tuple of references returned by source(idx), where idx is the position
+     * of the entity.
+     */
+    template <typename... Components, typename Source>
+    std::vector<Entity *> spawn_from(size_t count, Source &&source);
+
+    /**
+     * Adds new entities like spawn(), copying the components of the entity at
+     * position idx from position idx of each of the arrays.
+     */
+    std::vector<Entity *> spawn_copies(size_t count,
+                                       const __lz::ComponentArrays &arrays);
+
+    /**
+     * Adds the entities attached to the storage by a spawn to the collection, and
+     * destroys the rest.
+     */
+    void insert_spawned(const std::vector<Entity *> &spawned);
+
+    /**
+     * Returns the tick from which the Changed<T> filters of the views created by
+     * the calling thread match components: the tick following the last run of the
+     * updateable being run by the thread, or zero.
+     */
+    ChangeTick get_view_tick() const;
+
+    /**
+     * Runs the updateable of the stage at the given position.
+     */
+    void run_updateable(const __lz::Scheduler::Stage &stage, size_t idx);
+
+    /**
+     * Calls the function on each entity of the view, measuring the pass when the
+     * profiler is enabled.
+     */
+    template <typename... Types, typename Func>
+    void apply_to_view(const View<Types...> &entities, Func &&func);
+
+    /**
+     * Returns the thread pool of the engine, starting its threads the first time
+     * it is needed.
+     */
+    __lz::ThreadPool &get_thread_pool();
+
     /**
      * Checks that the system is a listener of the event type.
      */
@@ -141,7 +511,7 @@ private:
     static bool verify_listener();
 
     /**
-     * Searches for the system in the list of subscribers to events,
+     * Searches for the system among the subscribers to events,
      * and returns a pointer to it if it is found, or a nullptr if it
      * does not exist in the engine.
      */
@@ -156,28 +526,113 @@ private:
     bool is_listener() const;
 
     /**
-     * Checks if a system of the given type id is already listening
-     * to a certain event type.
+     * Checks if a system of the given type is already listening
+     * to the event type with the given ID.
      */
     template <typename System>
-    bool is_listener(std::type_index type_id) const;
+    bool is_listener(__lz::TypeId event_id) const;
+
+    /**
+     * Subscribes the system to the event type, unless it is already subscribed.
+     */
+    template <typename System, typename EventType>
+    void subscribe(const std::shared_ptr<System> &system);
 
 private:
-    std::unordered_map<Identifier, std::shared_ptr<Entity>> entities;
-    std::vector<std::shared_ptr<Updateable>> updateables;
-    // Maps event type index -> list of event listeners for that event type
-    std::unordered_map<std::type_index,
-                       std::vector<std::shared_ptr<__lz::BaseEventListener>>>
-        subscribers;
+    // Declared before the entities, which detach from it when destroyed
+    std::unique_ptr<__lz::ComponentStorage> storage;
+    __lz::EntityPool entity_pool;
+    // Pages of ENTITY_PAGE_SIZE entities, indexed by the index of their ID. IDs are
+    // shared by all engines, so the pages of the indices not used are not allocated.
+    static constexpr size_t ENTITY_PAGE_SIZE = 4096;
+    std::vector<std::unique_ptr<Entity *[]>> entities;
+    __lz::DestroyQueue destroy_queue;
+    std::chrono::nanoseconds garbage_collection_budget{0};
+    __lz::Scheduler scheduler;  // Updateables of the engine
+    // Change tick of the last run of each updateable, indexed by system ID
+    std::vector<ChangeTick> last_runs;
+    Profiler profiler;
+    __lz::EventDispatcher dispatcher;  // Systems subscribed to events
+    CommandBuffer command_buffer;
+    size_t thread_count;
+    std::unique_ptr<__lz::ThreadPool> thread_pool;
 };
 
+template <typename Func>
+void ECSEngine::for_each_slot(Func &&func)
+{
+    for (auto &page : entities)
+    {
+        if (!page)
+            continue;
+        for (size_t idx = 0; idx < ENTITY_PAGE_SIZE; ++idx)
+        {
+            if (page[idx])
+                func(page[idx]);
+        }
+    }
+}
+
+template <typename... Components>
+std::vector<Entity *> ECSEngine::spawn(size_t count, const Components &... components)
+{
+    return spawn_from<Components...>(count, [&](size_t) {
+        return std::tuple<const Components &...>(components...);
+    });
+}
+
+template <typename... Components, typename Source>
+std::vector<Entity *> ECSEngine::spawn_from(size_t count, Source &&source)
+{
+    storage->check_not_frozen();
+    std::vector<Entity *> spawned(count);
+    std::vector<Identifier> ids(count);
+    __lz::IdAllocator::get().allocate(ids.data(), count);
+    entity_pool.reserve(count);
+    for (size_t idx = 0; idx < count; ++idx)
+        spawned[idx] = entity_pool.create(Entity::AllocatedId{ids[idx]});
+
+    try
+    {
+        switch (storage->get_backend())
+        {
+        case StorageBackend::Archetype:
+            static_cast<__lz::ArchetypeStorage &>(*storage).spawn_from<Components...>(
+                spawned.data(), count, source);
+            break;
+        case StorageBackend::SparseSet:
+            static_cast<__lz::SparseSetStorage &>(*storage).spawn_from<Components...>(
+                spawned.data(), count, source);
+            break;
+        }
+    }
+    catch (...)
+    {
+        insert_spawned(spawned);
+        throw;
+    }
+    insert_spawned(spawned);
+    return spawned;
+}
+
 template <typename... Types>
 std::vector<Entity *> ECSEngine::entities_with_components(bool include_deleted)
 {
-    std::vector<Entity *> result;
-    apply_to_each<Types...>([&](Entity *ent, Types *... comp) { result.push_back(ent); },
-                            include_deleted);
-    return result;
+    EntityRange entities = view<Types...>(include_deleted);
+    return std::vector<Entity *>(entities.begin(), entities.end());
+}
+
+template <typename... Types>
+View<Types...> ECSEngine::view(bool include_deleted)
+{
+    __lz::ComponentMask changed = __lz::get_changed_mask<Types...>();
+    if (changed.any())
+        storage->track_changes(changed);
+    return View<Types...>(
+        *storage,
+        storage->query(__lz::get_component_mask<__lz::component_of<Types>...>()),
+        include_deleted,
+        get_view_tick());
 }
 
 template <typename... Types>
@@ -185,16 +640,73 @@ void ECSEngine::apply_to_each(
     typename std::common_type<std::function<void(Entity *, Types *...)>>::type &&func,
     bool include_deleted)
 {
-    for (auto it = entities.begin(); it != entities.end(); ++it)
+    apply_to_view(view<Types...>(include_deleted), func);
+}
+
+template <typename... Types,
+          typename Func,
+          typename std::enable_if_t<!std::is_same<
+              std::decay_t<Func>,
+              std::function<void(Entity *, Types *...)>>::value> *>
+void ECSEngine::apply_to_each(Func &&func, bool include_deleted)
+{
+    apply_to_view(view<Types...>(include_deleted), std::forward<Func>(func));
+}
+
+template <typename... Types, typename Func>
+void ECSEngine::apply_to_view(const View<Types...> &entities, Func &&func)
+{
+    if (!profiler.is_enabled())
     {
-        Entity *entity = it->second.get();
+        entities.each(std::forward<Func>(func));
+        return;
+    }
 
-        if (!include_deleted && entity->is_deleted())
-            continue;
+    auto start = Profiler::Clock::now();
+    size_t visited = 0;
+    entities.each([&](Entity *entity, __lz::component_of<Types> *... components) {
+        ++visited;
+        func(entity, components...);
+    });
+    profiler.record_pass(__lz::get_pass_name<Types...>(), visited, start);
+}
 
-        if (entity->has<Types...>())
-            func(entity, entity->get<Types>()...);
+template <typename... Types, typename Func>
+void ECSEngine::parallel_apply_to_each(Func &&func,
+                                       size_t grain_size,
+                                       bool include_deleted)
+{
+    View<Types...> entities = view<Types...>(include_deleted);
+    __lz::ThreadPool &pool = get_thread_pool();
+    __lz::TaskContexts tasks(*this);
+    bool profiling = profiler.is_enabled();
+    auto start = profiling ? Profiler::Clock::now() : Profiler::Clock::time_point();
+    storage->freeze();
+    try
+    {
+        if (!profiling)
+        {
+            entities.parallel_each(pool, grain_size, func, tasks);
+        }
+        else
+        {
+            auto count = [&](Entity *entity, __lz::component_of<Types> *... components) {
+                ++__lz::TaskContext::current(*this)->visited;
+                func(entity, components...);
+            };
+            entities.parallel_each(pool, grain_size, count, tasks);
+        }
     }
+    catch (...)
+    {
+        storage->thaw();
+        throw;
+    }
+    storage->thaw();
+    if (profiling)
+        profiler.record_pass(
+            __lz::get_pass_name<Types...>(), tasks.count_visited(), start);
+    tasks.finish(*this);
 }
 
 template <typename System, typename... EventTypes>
@@ -204,79 +716,65 @@ void ECSEngine::add_system()
         throw __lz::LazarusException(
             "System is not a listener to some of the event types");
 
-    // Put all event types in a vector
-    std::vector<std::type_index> types{__lz::get_type_index<EventTypes>()...};
-
     // Search for the system, and if it exists, use it
     std::shared_ptr<System> new_system = find_system<System>();
     // If the system does not exist, create a new one
     if (!new_system)
         new_system = std::make_shared<System>();
 
-    for (std::type_index type_id : types)
-    {
-        auto found = subscribers.find(type_id);
-        if (found == subscribers.end())
-        {
-            // No subscribers to this type of event yet, create vector
-            std::vector<std::shared_ptr<__lz::BaseEventListener>> vec;
-            vec.push_back(new_system);
-            subscribers[type_id] = vec;
-        }
-        else
-        {
-            // There already exists a list of subscribers to this event type
-            if (!is_listener<System>(type_id))
-                found->second.push_back(new_system);
-        }
-    }
+    (subscribe<System, EventTypes>(new_system), ...);
+    profiler.name_system(__lz::get_system_id<System>(), __lz::get_type_name<System>());
 }
 
 template <typename System>
 void ECSEngine::delete_system()
 {
-    // Remove the system from all the event listeners
-    for (auto &pair : subscribers)
-    {
-        auto &systems = pair.second;
-        for (auto it = systems.begin(); it != systems.end(); ++it)
-        {
-            if (dynamic_cast<System *>(it->get()))
-            {
-                systems.erase(it);
-                break;
-            }
-        }
-    }
+    dispatcher.remove_system(__lz::get_system_id<System>());
 }
 
 template <typename EventType>
 void ECSEngine::emit(const EventType &event)
 {
     // TODO: Log case in which an event is emitted but no listeners for that type exist
-    auto found = subscribers.find(__lz::get_type_index<EventType>());
-    if (found != subscribers.end())
+    if (__lz::TaskContext *context = __lz::TaskContext::current(*this))
     {
-        auto event_listeners = found->second;
-        for (auto it = event_listeners.begin(); it != event_listeners.end(); ++it)
-        {
-            auto *listener = dynamic_cast<EventListener<EventType> *>(it->get());
-            listener->receive(*this, event);
-        }
+        // Emitted by a task of a parallel pass, so it is emitted after the pass
+        context->events.record<EventType>(
+            event, [](ECSEngine &engine, const EventType &event) { engine.emit(event); });
+    }
+    else
+    {
+        if (profiler.is_enabled())
+            profiler.record_emit(__lz::get_event_id<EventType>(),
+                                 __lz::get_type_name<EventType>());
+        if (dispatcher.is_queued(__lz::get_event_id<EventType>()))
+            dispatcher.enqueue(event);
+        else
+            dispatcher.dispatch(*this, event);
     }
 }
 
-// TODO: Add priority to updateables
+template <typename EventType>
+void ECSEngine::set_event_delivery(EventDelivery delivery)
+{
+    dispatcher.set_queued(__lz::get_event_id<EventType>(),
+                          delivery == EventDelivery::Queued);
+}
+
 template <typename Type>
 void ECSEngine::add_updateable()
 {
-    // Check if it already exists
-    for (auto updateable : updateables)
-    {
-        if (std::dynamic_pointer_cast<Type>(updateable))
-            return;  // Updateable already exists
-    }
-    updateables.emplace_back(new Type);
+    add_updateable<Type>(SystemAccess().exclusive());
+}
+
+template <typename Type>
+void ECSEngine::add_updateable(const SystemAccess &access)
+{
+    __lz::TypeId type_id = __lz::get_system_id<Type>();
+    if (scheduler.contains(type_id))
+        return;  // Updateable already exists
+    scheduler.add(type_id, std::make_shared<Type>(), access);
+    profiler.name_system(type_id, __lz::get_type_name<Type>());
 }
 
 template <typename System, typename EventType>
@@ -294,41 +792,41 @@ bool ECSEngine::verify_listener()
 template <typename System>
 std::shared_ptr<System> ECSEngine::find_system()
 {
-    for (auto &pair : subscribers)
-    {
-        auto &systems = pair.second;
-        for (auto it = systems.begin(); it != systems.end(); ++it)
-        {
-            std::shared_ptr<System> sp_system = std::dynamic_pointer_cast<System>(*it);
-            if (sp_system)
-                return sp_system;
-        }
-    }
-    // System not found, return empty shared pointer
-    return std::shared_ptr<System>();
+    return std::static_pointer_cast<System>(
+        dispatcher.find_system(__lz::get_system_id<System>()));
 }
 
 template <typename System, typename EventType>
 bool ECSEngine::is_listener() const
 {
-    std::type_index type_id = __lz::get_type_index<EventType>();
-    return is_listener<System>(type_id);
+    return is_listener<System>(__lz::get_event_id<EventType>());
 }
 
 template <typename System>
-bool ECSEngine::is_listener(std::type_index type_id) const
+bool ECSEngine::is_listener(__lz::TypeId event_id) const
 {
-    auto found = subscribers.find(type_id);
-    if (found != subscribers.end())
-    {
-        // Search for this system in the listeners list
-        auto listeners = found->second;
-        for (auto it = listeners.begin(); it != listeners.end(); ++it)
-        {
-            if (std::dynamic_pointer_cast<System>(*it))
-                return true;  // System found
-        }
-    }
-    return false;
+    return dispatcher.is_subscribed(event_id, __lz::get_system_id<System>());
+}
+
+template <typename System, typename EventType>
+void ECSEngine::subscribe(const std::shared_ptr<System> &system)
+{
+    // The conversion to the listener is done once, so emitting needs no casts
+    EventListener<EventType> *listener = system.get();
+    dispatcher.subscribe(
+        __lz::get_event_id<EventType>(), __lz::get_system_id<System>(), system, listener);
+}
+
+template <typename... Components>
+void CommandBuffer::spawn_created(ECSEngine &engine,
+                                  const std::vector<std::tuple<Components...>> &values)
+{
+    engine.spawn_from<Components...>(values.size(), [&](size_t idx) {
+        return std::apply(
+            [](const Components &... components) {
+                return std::tuple<const Components &...>(components...);
+            },
+            values[idx]);
+    });
 }
 }  // namespace lz
@@ -2,11 +2,35 @@
 
 using namespace lz;
 
-Identifier Entity::entity_count = 0;
-
 Entity::Entity()
-    : entity_id(++entity_count)
+    : entity_id(__lz::IdAllocator::get().allocate())
+{
+}
+
+Entity::Entity(Identifier id)
+    : entity_id(id)
+{
+    __lz::IdAllocator::get().acquire(id);
+}
+
+Entity::Entity(AllocatedId allocated)
+    : entity_id(allocated.id)
+{
+}
+
+Entity::Entity(const Entity &other)
+    : Entity(other.entity_id)
+{
+    deleted = other.is_deleted();
+    if (other.storage)
+        get_storage().copy_components(other, *this);
+}
+
+Entity::~Entity()
 {
+    if (storage)
+        storage->detach(*this);
+    __lz::IdAllocator::get().release(entity_id);
 }
 
 bool Entity::operator==(const Entity &other)
@@ -23,3 +47,13 @@ bool Entity::operator<(const Entity &other)
 {
     return get_id() < other.get_id();
 }
+
+__lz::ComponentStorage &Entity::get_storage()
+{
+    if (!storage)
+    {
+        own_storage = std::make_unique<__lz::ArchetypeStorage>();
+        own_storage->attach(*this);
+    }
+    return *storage;
+}
@@ -1,54 +1,33 @@
 #pragma once
 
+#include <lazarus/ECS/ArchetypeStorage.h>
+#include <lazarus/ECS/DestroyQueue.h>
+#include <lazarus/ECS/IdAllocator.h>
+#include <lazarus/ECS/SparseSetStorage.h>
 #include <lazarus/common.h>
 
+#include <atomic>
 #include <memory>
 #include <sstream>
-#include <typeindex>
-#include <unordered_map>
-#include <vector>
+#include <type_traits>
 
-namespace __lz  // Meant for internal use only
+namespace __lz
 {
-template <typename T>
-std::type_index get_type_index()
-{
-    return std::type_index(typeid(T));
-}
-
-class BaseComponentHandle
-{
-public:
-    virtual ~BaseComponentHandle() = default;
-};
-
-template <typename Component>
-class ComponentHandle : public BaseComponentHandle
-{
-public:
-    ComponentHandle(std::shared_ptr<Component> comp)
-        : component(std::move(comp))
-    {
-    }
-
-    Component *get()
-    {
-        return component.get();
-    }
-
-private:
-    std::shared_ptr<Component> component;
-};
+class EntityPool;
 }  // namespace __lz
 
 namespace lz
 {
-using Identifier = size_t;
+class CommandBuffer;
 
 /**
  * An Entity is a collection of components with a unique ID.
  *
  * An Entity can only have one component of each type at the same time.
+ *
+ * The components of an entity are kept in the component storage of the engine the
+ * entity belongs to. An entity created outside of an engine keeps its components in
+ * an archetype storage of its own.
  */
 class Entity
 {
@@ -56,10 +35,21 @@ public:
     /**
      * Default constructor.
      *
-     * Sets the ID of the entity to the next available ID.
+     * Sets the ID of the entity to a new identifier. Entities can be created from
+     * several threads at the same time.
      */
     Entity();
 
+    /**
+     * Creates an entity with the same ID and a copy of each of the components of
+     * the other entity.
+     *
+     * @throws LazarusException If any of the components is not copy constructible.
+     */
+    Entity(const Entity &other);
+
+    ~Entity();
+
     /**
      * Returns the ID of the entity.
      */
@@ -89,6 +79,11 @@ public:
      *
      * If the entity already has a component of the specified type, an exception
      * will be thrown.
+     *
+     * Adding or removing components may move other components in the storage,
+     * which invalidates the pointers to components previously returned by get().
+     * With the sparse set backend, components never move, so their pointers stay
+     * valid until the components themselves are removed.
      */
     template <typename Component, typename... Args>
     void add_component(Args &&... args);
@@ -106,17 +101,28 @@ public:
      * Returns a pointer to the entity's component of the specified type.
      *
      * If the entity does not hold a component of that type, a nullptr will be returned.
+     *
+     * As the component may be modified through the pointer, it is marked as changed
+     * for the views with a Changed<Component> filter. Use the const overload, or a
+     * const component type, to only read it.
      */
     template <typename Component>
     Component *get();
 
+    /**
+     * Returns a pointer to the entity's component of the specified type, without
+     * marking it as changed.
+     */
+    template <typename Component>
+    const Component *get() const;
+
     /**
      * Returns whether this entity is marked for deletion upon the next pass of
      * the garbage collector.
      */
     bool is_deleted() const
     {
-        return deleted;
+        return deleted.load(std::memory_order_relaxed);
     }
 
     /**
@@ -124,10 +130,14 @@ public:
      *
      * An entity marked for deletion will be cleared from memory on the next pass of the
      * ECS engine garbage collector.
+     *
+     * Entities can be marked for deletion from any thread, including during a
+     * parallel pass of the engine.
      */
     void mark_for_deletion()
     {
-        deleted = true;
+        if (!deleted.exchange(true, std::memory_order_relaxed) && destroy_queue)
+            destroy_queue->push(entity_id);
     }
 
     /**
@@ -146,18 +156,63 @@ public:
     bool operator<(const Entity &other);
 
 private:
+    friend class CommandBuffer;
+    friend class ECSEngine;
+    friend class __lz::Archetype;
+    friend class __lz::ArchetypeStorage;
+    friend class __lz::EntityPool;
+    friend class __lz::SparseSetStorage;
+
+    /**
+     * Creates an entity sharing the ID of an existing entity, used by the engine
+     * to take over existing entities.
+     */
+    explicit Entity(Identifier id);
+
+    /**
+     * Identifier just allocated for a new entity.
+     */
+    struct AllocatedId
+    {
+        Identifier id;
+    };
+
+    /**
+     * Creates an entity with an identifier allocated for it in advance.
+     */
+    explicit Entity(AllocatedId allocated);
+
+    /**
+     * Returns the storage holding the components of the entity, creating a storage
+     * of its own if the entity does not belong to any.
+     */
+    __lz::ComponentStorage &get_storage();
+
+    /**
+     * Returns a pointer to the component described by info, or a nullptr if the
+     * entity does not have one.
+     */
+    void *find_component(const __lz::ComponentInfo &info) const;
+
+    /**
+     * Returns a pointer to the component like find_component(), giving it the
+     * current change tick of the storage.
+     */
+    void *find_changed_component(const __lz::ComponentInfo &info);
+
     const Identifier entity_id;
-    static Identifier
-        entity_count;  // Keep track of the number of entities to assign new IDs
-    std::unordered_map<std::type_index, std::shared_ptr<__lz::BaseComponentHandle>>
-        components;
-    bool deleted = false;
+    std::atomic<bool> deleted{false};
+    __lz::ComponentStorage *storage = nullptr;
+    std::unique_ptr<__lz::ComponentStorage> own_storage;
+    __lz::EntityLocation location;
+    // Queue of the engine the entity belongs to, if any
+    __lz::DestroyQueue *destroy_queue = nullptr;
 };
 
 template <typename Component>
 bool Entity::has() const
 {
-    return components.find(__lz::get_type_index<Component>()) != components.end();
+    return find_component(__lz::get_component_info<Component>()) != nullptr;
 }
 
 template <typename T, typename V, typename... Types>
@@ -169,19 +224,31 @@ bool Entity::has() const
 template <typename Component, typename... Args>
 void Entity::add_component(Args &&... args)
 {
+    static_assert(std::is_move_constructible<Component>::value,
+                  "Components must be move constructible");
+
     // Check if the entity already holds a component T
     if (has<Component>())
     {
         std::stringstream msg;
         msg << "Entity " << get_id() << " already holds a component of type "
-            << typeid(Component).name();
+            << __lz::get_type_name<Component>();
         throw __lz::LazarusException(msg.str());
     }
 
-    // Construct component and add it to the map
-    std::shared_ptr<__lz::BaseComponentHandle> handle(
-        new __lz::ComponentHandle<Component>(std::make_shared<Component>(args...)));
-    components[__lz::get_type_index<Component>()] = std::move(handle);
+    __lz::ComponentStorage &components = get_storage();
+    components.check_not_frozen();
+    switch (components.get_backend())
+    {
+    case StorageBackend::Archetype:
+        static_cast<__lz::ArchetypeStorage &>(components).emplace<Component>(
+            this, location, std::forward<Args>(args)...);
+        break;
+    case StorageBackend::SparseSet:
+        static_cast<__lz::SparseSetStorage &>(components).emplace<Component>(
+            this, location, std::forward<Args>(args)...);
+        break;
+    }
 }
 
 template <typename Component>
@@ -191,21 +258,48 @@ void Entity::remove_component()
     {
         std::stringstream msg;
         msg << "Entity " << get_id() << " does not have a component of type "
-            << typeid(Component).name();
+            << __lz::get_type_name<Component>();
         throw __lz::LazarusException(msg.str());
     }
 
-    components.erase(__lz::get_type_index<Component>());
+    storage->check_not_frozen();
+    storage->remove(*this, __lz::get_component_info<Component>());
 }
 
 template <typename Component>
 Component *Entity::get()
 {
-    auto found = components.find(__lz::get_type_index<Component>());
-    if (found == components.end())
-        return nullptr;  // TODO: Log this case
-    auto comp_handle =
-        dynamic_cast<__lz::ComponentHandle<Component> *>(found->second.get());
-    return comp_handle->get();
+    // TODO: Log the case in which the component does not exist
+    const __lz::ComponentInfo &info = __lz::get_component_info<Component>();
+    if constexpr (std::is_const<Component>::value)
+        return static_cast<Component *>(find_component(info));
+    else
+        return static_cast<Component *>(find_changed_component(info));
+}
+
+template <typename Component>
+const Component *Entity::get() const
+{
+    return static_cast<const Component *>(
+        find_component(__lz::get_component_info<Component>()));
+}
+
+inline void *Entity::find_component(const __lz::ComponentInfo &info) const
+{
+    if (!storage)
+        return nullptr;
+    if (storage->get_backend() == StorageBackend::Archetype)
+        return __lz::ArchetypeStorage::get(location, info.id);
+    return static_cast<__lz::SparseSetStorage *>(storage)->get(location, info);
+}
+
+inline void *Entity::find_changed_component(const __lz::ComponentInfo &info)
+{
+    if (!storage)
+        return nullptr;
+    if (storage->get_backend() == StorageBackend::Archetype)
+        return static_cast<__lz::ArchetypeStorage *>(storage)->get_changed(location,
+                                                                           info.id);
+    return static_cast<__lz::SparseSetStorage *>(storage)->get_changed(location, info);
 }
 }  // namespace lz
@@ -0,0 +1,45 @@
+#include <lazarus/ECS/EntityPool.h>
+
+using namespace __lz;
+
+void EntityPool::destroy(lz::Entity *entity)
+{
+    entity->~Entity();
+    free_slots.push_back(entity);
+}
+
+void EntityPool::reserve(size_t entities)
+{
+    size_t available = free_slots.size() + (BLOCK_SIZE - next_slot);
+    if (entities <= available)
+        return;
+
+    // The slots of new blocks go to the free list, so the current block is kept
+    size_t missing = entities - available;
+    free_slots.reserve(free_slots.size() + missing);
+    while (missing > 0)
+    {
+        blocks.emplace_back(new Slot[BLOCK_SIZE]);
+        Slot *block = blocks.back().get();
+        for (size_t slot = BLOCK_SIZE; slot-- > 0;)
+            free_slots.push_back(&block[slot]);
+        missing = missing > BLOCK_SIZE ? missing - BLOCK_SIZE : 0;
+    }
+}
+
+void *EntityPool::allocate()
+{
+    if (!free_slots.empty())
+    {
+        void *memory = free_slots.back();
+        free_slots.pop_back();
+        return memory;
+    }
+    if (next_slot == BLOCK_SIZE)
+    {
+        blocks.emplace_back(new Slot[BLOCK_SIZE]);
+        current_block = blocks.back().get();
+        next_slot = 0;
+    }
+    return &current_block[next_slot++];
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <lazarus/ECS/Entity.h>
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Slab allocator for the entities of an engine.
+ *
+ * Entities are constructed in place inside blocks of memory which are never moved,
+ * so pointers to entities stay valid while they are alive. The memory of destroyed
+ * entities is kept in a free list and reused by the next entities created.
+ */
+class EntityPool
+{
+public:
+    /**
+     * Number of entities in each block.
+     */
+    static constexpr size_t BLOCK_SIZE = 1024;
+
+    EntityPool() = default;
+
+    EntityPool(const EntityPool &) = delete;
+    EntityPool &operator=(const EntityPool &) = delete;
+
+    /**
+     * Constructs an entity with the given constructor arguments.
+     */
+    template <typename... Args>
+    lz::Entity *create(Args &&... args);
+
+    /**
+     * Destroys an entity created by this pool, keeping its memory for reuse.
+     */
+    void destroy(lz::Entity *entity);
+
+    /**
+     * Allocates the memory needed to create the given number of entities without
+     * allocating any more.
+     */
+    void reserve(size_t entities);
+
+private:
+    using Slot = std::aligned_storage_t<sizeof(lz::Entity), alignof(lz::Entity)>;
+
+    void *allocate();
+
+    std::vector<std::unique_ptr<Slot[]>> blocks;
+    Slot *current_block = nullptr;  // Block which new entities are taken from
+    size_t next_slot = BLOCK_SIZE;  // First unused slot of the current block
+    std::vector<void *> free_slots;
+};
+
+template <typename... Args>
+lz::Entity *EntityPool::create(Args &&... args)
+{
+    void *memory = allocate();
+    try
+    {
+        return new (memory) lz::Entity(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        free_slots.push_back(memory);
+        throw;
+    }
+}
+}  // namespace __lz
@@ -0,0 +1,28 @@
+#include <lazarus/ECS/EventBuffer.h>
+
+using namespace __lz;
+
+void EventBuffer::replay(lz::ECSEngine &engine)
+{
+    try
+    {
+        for (TypeId event_id : order)
+            events[event_id]->emit_next(engine);
+    }
+    catch (...)
+    {
+        clear();
+        throw;
+    }
+    clear();
+}
+
+void EventBuffer::clear()
+{
+    for (auto &typed_events : events)
+    {
+        if (typed_events)
+            typed_events->clear();
+    }
+    order.clear();
+}
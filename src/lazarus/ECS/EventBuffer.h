@@ -0,0 +1,94 @@
+#pragma once
+
+#include <lazarus/ECS/TypeId.h>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace lz
+{
+class ECSEngine;
+}  // namespace lz
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Events emitted by a task of a parallel pass of an engine, recorded so that they
+ * are emitted once the pass is over.
+ *
+ * Each task records into a buffer of its own, so events are emitted from several
+ * threads without any locking. As the buffers are replayed in the order of their
+ * tasks, the order of the events does not depend on which threads ran the tasks.
+ *
+ * @see TaskContext
+ */
+class EventBuffer
+{
+public:
+    /**
+     * Adds the event to the buffer, along with the function which emits it.
+     */
+    template <typename EventType>
+    void record(const EventType &event,
+                void (*emit)(lz::ECSEngine &, const EventType &));
+
+    /**
+     * Emits the recorded events in the order they were recorded, and empties the
+     * buffer.
+     */
+    void replay(lz::ECSEngine &engine);
+
+private:
+    struct BaseEvents
+    {
+        virtual ~BaseEvents() = default;
+
+        virtual void emit_next(lz::ECSEngine &engine) = 0;
+
+        virtual void clear() = 0;
+    };
+
+    template <typename EventType>
+    struct Events : public BaseEvents
+    {
+        void emit_next(lz::ECSEngine &engine) override
+        {
+            emit(engine, events[next++]);
+        }
+
+        void clear() override
+        {
+            events.clear();
+            next = 0;
+        }
+
+        void (*emit)(lz::ECSEngine &, const EventType &);
+        std::vector<EventType> events;
+        size_t next = 0;  // Next event to replay
+    };
+
+    void clear();
+
+    std::vector<std::unique_ptr<BaseEvents>> events;  // Indexed by event ID
+    std::vector<TypeId> order;  // Type of each event, in the order they were recorded
+};
+
+template <typename EventType>
+void EventBuffer::record(const EventType &event,
+                         void (*emit)(lz::ECSEngine &, const EventType &))
+{
+    TypeId event_id = get_event_id<EventType>();
+    if (event_id >= events.size())
+        events.resize(event_id + 1);
+    if (!events[event_id])
+    {
+        auto typed_events = std::make_unique<Events<EventType>>();
+        typed_events->emit = emit;
+        events[event_id] = std::move(typed_events);
+    }
+
+    static_cast<Events<EventType> &>(*events[event_id]).events.push_back(event);
+    order.push_back(event_id);
+}
+}  // namespace __lz
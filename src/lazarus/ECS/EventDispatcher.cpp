@@ -0,0 +1,133 @@
+#include <lazarus/ECS/EventDispatcher.h>
+
+#include <algorithm>
+
+using namespace __lz;
+
+std::shared_ptr<void> EventDispatcher::find_system(TypeId system_id) const
+{
+    if (system_id >= systems.size())
+        return std::shared_ptr<void>();
+    return systems[system_id];
+}
+
+bool EventDispatcher::is_subscribed(TypeId event_id, TypeId system_id) const
+{
+    if (event_id >= listeners.size())
+        return false;
+    for (const Listener &entry : listeners[event_id])
+    {
+        if (entry.system_id == system_id && entry.listener)
+            return true;
+    }
+    return false;
+}
+
+void EventDispatcher::subscribe(TypeId event_id,
+                                TypeId system_id,
+                                const std::shared_ptr<void> &system,
+                                void *listener)
+{
+    if (is_subscribed(event_id, system_id))
+        return;
+
+    if (event_id >= listeners.size())
+        listeners.resize(event_id + 1);
+    if (system_id >= systems.size())
+        systems.resize(system_id + 1);
+    systems[system_id] = system;
+    listeners[event_id].push_back({system_id, listener});
+}
+
+void EventDispatcher::remove_system(TypeId system_id)
+{
+    if (system_id >= systems.size() || !systems[system_id])
+        return;
+
+    bool deferred = dispatching.load(std::memory_order_relaxed) > 0;
+    for (auto &event_listeners : listeners)
+    {
+        if (deferred)
+        {
+            // Entries are only unlinked, so that the ongoing dispatches can go on
+            for (Listener &entry : event_listeners)
+            {
+                if (entry.system_id == system_id)
+                    entry.listener = nullptr;
+            }
+        }
+        else
+        {
+            auto subscribed = [system_id](const Listener &entry) {
+                return entry.system_id == system_id;
+            };
+            event_listeners.erase(std::remove_if(event_listeners.begin(),
+                                                 event_listeners.end(),
+                                                 subscribed),
+                                  event_listeners.end());
+        }
+    }
+
+    if (deferred)
+    {
+        // The system may be the one receiving the event
+        removed_systems.push_back(std::move(systems[system_id]));
+        needs_compaction = true;
+    }
+    systems[system_id].reset();
+}
+
+void EventDispatcher::end_dispatch()
+{
+    if (dispatching.fetch_sub(1, std::memory_order_relaxed) == 1 && needs_compaction)
+        compact();
+}
+
+void EventDispatcher::compact()
+{
+    for (auto &event_listeners : listeners)
+    {
+        event_listeners.erase(
+            std::remove_if(event_listeners.begin(),
+                           event_listeners.end(),
+                           [](const Listener &entry) { return !entry.listener; }),
+            event_listeners.end());
+    }
+    needs_compaction = false;
+    // Systems may delete or add others from their destructor
+    std::vector<std::shared_ptr<void>> released;
+    released.swap(removed_systems);
+}
+
+void EventDispatcher::set_queued(TypeId event_id, bool queued)
+{
+    if (event_id >= queued_types.size())
+        queued_types.resize(event_id + 1);
+    queued_types[event_id] = queued;
+}
+
+void EventDispatcher::deliver_queued(lz::ECSEngine &engine)
+{
+    if (delivering)
+        return;
+
+    // Queues which get new events while delivering are scheduled again at the end
+    // of the list, so the loop goes on until every queue is empty
+    delivering = true;
+    size_t idx = 0;
+    try
+    {
+        for (; idx < scheduled_queues.size(); ++idx)
+            queues[scheduled_queues[idx]]->deliver(engine, *this);
+    }
+    catch (...)
+    {
+        // The queues after the failed one are still scheduled
+        scheduled_queues.erase(scheduled_queues.begin(),
+                               scheduled_queues.begin() + idx + 1);
+        delivering = false;
+        throw;
+    }
+    scheduled_queues.clear();
+    delivering = false;
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <lazarus/ECS/EventListener.h>
+#include <lazarus/ECS/Profiler.h>
+#include <lazarus/ECS/TypeId.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace __lz  // Meant for internal use only
+{
+class EventDispatcher;
+
+/**
+ * Events of a single type waiting to be delivered, with the type erased.
+ */
+class BaseEventQueue
+{
+public:
+    virtual ~BaseEventQueue() = default;
+
+    /**
+     * Delivers the events queued so far to the listeners of their type as a single
+     * batch. Events queued meanwhile are left for the next delivery.
+     */
+    virtual void deliver(lz::ECSEngine &engine, EventDispatcher &dispatcher) = 0;
+
+    // Whether the queue is in the dispatcher's list of queues to deliver
+    bool scheduled = false;
+};
+
+/**
+ * Dispatch table of the event listeners of an engine, indexed by event ID.
+ *
+ * Each entry keeps the system already converted to the listener of its event type,
+ * so emitting an event is a loop of direct calls to receive(), without copying the
+ * list or touching the reference counts of the systems.
+ *
+ * Listeners may add or delete systems while they receive an event. Systems deleted
+ * during a dispatch are only unlinked from the table, and are compacted away and
+ * destroyed once the outermost dispatch finishes. Systems subscribed during a
+ * dispatch do not receive the events being dispatched.
+ *
+ * Event types can also be queued, so that their events are delivered in batches
+ * when deliver_queued() is called.
+ */
+class EventDispatcher
+{
+public:
+    EventDispatcher() = default;
+
+    EventDispatcher(const EventDispatcher &) = delete;
+    EventDispatcher &operator=(const EventDispatcher &) = delete;
+
+    /**
+     * Returns the system with the given ID, or a nullptr if it is not subscribed
+     * to any event type.
+     */
+    std::shared_ptr<void> find_system(TypeId system_id) const;
+
+    /**
+     * Returns whether the system is subscribed to the event type.
+     */
+    bool is_subscribed(TypeId event_id, TypeId system_id) const;
+
+    /**
+     * Subscribes the system to the event type, unless it is already subscribed.
+     *
+     * The listener must point to the system, converted to the listener of the
+     * event type.
+     */
+    void subscribe(TypeId event_id,
+                   TypeId system_id,
+                   const std::shared_ptr<void> &system,
+                   void *listener);
+
+    /**
+     * Unsubscribes the system from all the event types and releases it.
+     */
+    void remove_system(TypeId system_id);
+
+    /**
+     * Calls the receive method of every listener subscribed to the event type.
+     */
+    template <typename EventType>
+    void dispatch(lz::ECSEngine &engine, const EventType &event);
+
+    /**
+     * Calls the receive_all method of every listener subscribed to the event type.
+     */
+    template <typename EventType>
+    void dispatch_all(lz::ECSEngine &engine, lz::EventSpan<EventType> events);
+
+    void set_queued(TypeId event_id, bool queued);
+
+    /**
+     * Sets the profiler which measures the listeners, if enabled.
+     */
+    void set_profiler(lz::Profiler *profiler)
+    {
+        this->profiler = profiler;
+    }
+
+    bool is_queued(TypeId event_id) const
+    {
+        return event_id < queued_types.size() && queued_types[event_id];
+    }
+
+    /**
+     * Adds the event to the queue of its type, to be delivered by deliver_queued().
+     */
+    template <typename EventType>
+    void enqueue(const EventType &event);
+
+    /**
+     * Delivers the queued events, a batch per event type, until no events are
+     * left. Types are delivered in the order their first event was queued.
+     *
+     * Does nothing if called while the queued events are being delivered.
+     */
+    void deliver_queued(lz::ECSEngine &engine);
+
+private:
+    struct Listener
+    {
+        TypeId system_id;
+        void *listener;  // nullptr once unsubscribed during a dispatch
+    };
+
+    /**
+     * Calls the function with each listener of the event type, which delivers the
+     * given number of events to it.
+     */
+    template <typename EventType, typename Func>
+    void for_each_listener(size_t events, Func &&func);
+
+    void end_dispatch();
+
+    // Removes the entries unlinked during dispatches and releases their systems
+    void compact();
+
+    std::vector<std::vector<Listener>> listeners;  // Indexed by event ID
+    std::vector<std::shared_ptr<void>> systems;  // Indexed by system ID
+    // Systems deleted during a dispatch, kept alive until it finishes
+    std::vector<std::shared_ptr<void>> removed_systems;
+    std::atomic<size_t> dispatching{0};
+    bool needs_compaction = false;
+
+    std::vector<bool> queued_types;  // Indexed by event ID
+    std::vector<std::unique_ptr<BaseEventQueue>> queues;  // Indexed by event ID
+    std::vector<TypeId> scheduled_queues;  // Queues with events, in order
+    bool delivering = false;
+    lz::Profiler *profiler = nullptr;
+};
+
+/**
+ * Queue of the events of a type.
+ *
+ * Events are kept in a buffer which is swapped with a second one when they are
+ * delivered, so listeners can queue new events while receiving a batch, and the
+ * memory of both buffers is reused from one delivery to the next.
+ */
+template <typename EventType>
+class EventQueue : public BaseEventQueue
+{
+public:
+    void push(const EventType &event)
+    {
+        pending.push_back(event);
+    }
+
+    void deliver(lz::ECSEngine &engine, EventDispatcher &dispatcher) override
+    {
+        batch.swap(pending);
+        scheduled = false;
+        try
+        {
+            dispatcher.dispatch_all(
+                engine, lz::EventSpan<EventType>(batch.data(), batch.size()));
+        }
+        catch (...)
+        {
+            batch.clear();
+            throw;
+        }
+        batch.clear();
+    }
+
+private:
+    std::vector<EventType> pending;
+    std::vector<EventType> batch;
+};
+
+template <typename EventType>
+void EventDispatcher::dispatch(lz::ECSEngine &engine, const EventType &event)
+{
+    for_each_listener<EventType>(1, [&](lz::EventListener<EventType> *listener) {
+        listener->receive(engine, event);
+    });
+}
+
+template <typename EventType>
+void EventDispatcher::dispatch_all(lz::ECSEngine &engine,
+                                   lz::EventSpan<EventType> events)
+{
+    for_each_listener<EventType>(
+        events.size(), [&](lz::EventListener<EventType> *listener) {
+            listener->receive_all(engine, events);
+        });
+}
+
+template <typename EventType>
+void EventDispatcher::enqueue(const EventType &event)
+{
+    TypeId event_id = get_event_id<EventType>();
+    if (event_id >= queues.size())
+        queues.resize(event_id + 1);
+    if (!queues[event_id])
+        queues[event_id] = std::make_unique<EventQueue<EventType>>();
+
+    auto &queue = static_cast<EventQueue<EventType> &>(*queues[event_id]);
+    queue.push(event);
+    if (!queue.scheduled)
+    {
+        scheduled_queues.push_back(event_id);
+        queue.scheduled = true;
+    }
+}
+
+template <typename EventType, typename Func>
+void EventDispatcher::for_each_listener(size_t events, Func &&func)
+{
+    TypeId event_id = get_event_id<EventType>();
+    if (event_id >= listeners.size())
+        return;
+
+    // The list is indexed on every step, as listeners may subscribe new systems
+    // and reallocate it. Those are appended after the initial count.
+    dispatching.fetch_add(1, std::memory_order_relaxed);
+    size_t count = listeners[event_id].size();
+    bool profiling = profiler && profiler->is_enabled() && count > 0;
+    bool per_listener = profiling && profiler->is_listener_timing();
+    // With listener timing, each listener is measured from the end of the previous one
+    lz::Profiler::Clock::time_point start;
+    if (profiling)
+        start = lz::Profiler::Clock::now();
+    size_t delivered = 0;
+    try
+    {
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            Listener entry = listeners[event_id][idx];
+            if (!entry.listener)
+                continue;
+            auto *listener = static_cast<lz::EventListener<EventType> *>(entry.listener);
+            func(listener);
+            ++delivered;
+            if (per_listener)
+                start = profiler->record_listener(
+                    entry.system_id, event_id, get_type_name<EventType>(), events, start);
+        }
+    }
+    catch (...)
+    {
+        end_dispatch();
+        throw;
+    }
+    end_dispatch();
+    if (profiling && !per_listener)
+        profiler->record_delivery(
+            event_id, get_type_name<EventType>(), events, delivered, start);
+}
+}  // namespace __lz
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 namespace __lz  // Meant for internal use only
 {
 class BaseEventListener
@@ -14,6 +16,64 @@ namespace lz
 {
 class ECSEngine;
 
+/**
+ * Ways in which the ECS engine can deliver the events of a type to its listeners.
+ *
+ * @see ECSEngine::set_event_delivery
+ */
+enum class EventDelivery
+{
+    // Events are received as soon as they are emitted
+    Immediate,
+    // Events are queued, and received in batches when the engine updates
+    Queued
+};
+
+/**
+ * Read-only view of a contiguous batch of events of the same type.
+ *
+ * @see EventListener::receive_all
+ */
+template <typename EventType>
+class EventSpan
+{
+public:
+    EventSpan(const EventType *events, size_t count)
+        : events(events)
+        , count(count)
+    {
+    }
+
+    const EventType *begin() const
+    {
+        return events;
+    }
+
+    const EventType *end() const
+    {
+        return events + count;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    const EventType &operator[](size_t idx) const
+    {
+        return events[idx];
+    }
+
+private:
+    const EventType *events;
+    size_t count;
+};
+
 /**
  * Interface for objects that react to events of a certain type.
  *
@@ -42,5 +102,23 @@ public:
      * @param event The event that is emitted by the ECS engine and received by this.
      */
     virtual void receive(ECSEngine &engine, const EventType &event) = 0;
+
+    /**
+     * Called with a batch of events when the queued events of the type are
+     * delivered by the ECS engine, in the order they were emitted.
+     *
+     * By default it calls receive() for each of them. Listeners can override it
+     * to process the whole batch at once.
+     *
+     * @param engine Reference to the ECS engine the listener lives in.
+     * @param events The events emitted since the last delivery.
+     *
+     * @see ECSEngine::set_event_delivery
+     */
+    virtual void receive_all(ECSEngine &engine, EventSpan<EventType> events)
+    {
+        for (const EventType &event : events)
+            receive(engine, event);
+    }
 };
 }  // namespace lz
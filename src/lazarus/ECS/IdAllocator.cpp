@@ -0,0 +1,76 @@
+#include <lazarus/ECS/IdAllocator.h>
+#include <lazarus/common.h>
+
+#include <limits>
+
+using namespace __lz;
+
+IdAllocator &IdAllocator::get()
+{
+    static IdAllocator allocator;
+    return allocator;
+}
+
+lz::Identifier IdAllocator::allocate()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocate_locked();
+}
+
+void IdAllocator::allocate(lz::Identifier *ids, size_t count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t idx = 0; idx < count; ++idx)
+        ids[idx] = allocate_locked();
+}
+
+lz::Identifier IdAllocator::allocate_locked()
+{
+    std::uint32_t index;
+    if (!free_indices.empty())
+    {
+        index = free_indices.back();
+        free_indices.pop_back();
+    }
+    else
+    {
+        // Index 0 is never used, so that no identifier is 0
+        if (generations.empty())
+        {
+            generations.push_back(0);
+            holders.push_back(0);
+        }
+        if (generations.size() > std::numeric_limits<std::uint32_t>::max())
+            throw LazarusException("Too many entities, ran out of entity indices");
+        index = static_cast<std::uint32_t>(generations.size());
+        generations.push_back(0);
+        holders.push_back(0);
+    }
+    holders[index] = 1;
+    return make_id(index, generations[index]);
+}
+
+void IdAllocator::acquire(lz::Identifier id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++holders[index_of(id)];
+}
+
+void IdAllocator::release(lz::Identifier id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uint32_t index = index_of(id);
+    if (--holders[index] == 0)
+    {
+        ++generations[index];
+        free_indices.push_back(index);
+    }
+}
+
+bool IdAllocator::is_alive(lz::Identifier id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uint32_t index = index_of(id);
+    return index < generations.size() && holders[index] > 0 &&
+           generations[index] == generation_of(id);
+}
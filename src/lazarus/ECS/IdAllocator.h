@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace lz
+{
+/**
+ * Generational handle which identifies an entity.
+ *
+ * The low 32 bits hold the index of the entity, and the high 32 bits its
+ * generation. Indices are recycled once no entity uses them anymore, and the
+ * generation is increased every time, so identifiers of destroyed entities never
+ * match the identifiers of newer ones. No entity is ever given the identifier 0.
+ */
+using Identifier = std::uint64_t;
+}  // namespace lz
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Thread-safe allocator of entity identifiers, with a free list of indices.
+ *
+ * Entities which are copies of each other share the same identifier, so the
+ * allocator counts the entities holding each identifier, and only recycles its
+ * index once the last of them releases it.
+ */
+class IdAllocator
+{
+public:
+    static std::uint32_t index_of(lz::Identifier id)
+    {
+        return static_cast<std::uint32_t>(id);
+    }
+
+    static std::uint32_t generation_of(lz::Identifier id)
+    {
+        return static_cast<std::uint32_t>(id >> 32);
+    }
+
+    static lz::Identifier make_id(std::uint32_t index, std::uint32_t generation)
+    {
+        return (static_cast<lz::Identifier>(generation) << 32) | index;
+    }
+
+    /**
+     * Returns the allocator shared by all the entities.
+     */
+    static IdAllocator &get();
+
+    /**
+     * Returns a new identifier, held by a single entity.
+     */
+    lz::Identifier allocate();
+
+    /**
+     * Writes count new identifiers to ids, taking the lock only once.
+     */
+    void allocate(lz::Identifier *ids, size_t count);
+
+    /**
+     * Registers another entity holding the identifier.
+     */
+    void acquire(lz::Identifier id);
+
+    /**
+     * Unregisters an entity holding the identifier, recycling its index if no
+     * other entity holds it.
+     */
+    void release(lz::Identifier id);
+
+    /**
+     * Returns whether any entity holds the identifier.
+     */
+    bool is_alive(lz::Identifier id);
+
+private:
+    IdAllocator() = default;
+
+    lz::Identifier allocate_locked();
+
+    std::mutex mutex;
+    std::vector<std::uint32_t> generations;  // Current generation of each index
+    std::vector<std::uint32_t> holders;  // Number of entities holding each index
+    std::vector<std::uint32_t> free_indices;
+};
+}  // namespace __lz
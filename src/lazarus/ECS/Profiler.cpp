@@ -0,0 +1,405 @@
+#include <lazarus/ECS/Profiler.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+
+using namespace lz;
+
+namespace
+{
+// System being run by the calling thread, whose passes are counted for it
+thread_local __lz::TypeId running_system = Profiler::NO_SYSTEM;
+
+const std::string frame_name = "update";
+
+std::atomic<uint32_t> thread_count{0};
+
+std::atomic<uint64_t> profiler_count{0};
+
+// Index of the calling thread in the traces, given on its first measured call
+uint32_t get_thread_index()
+{
+    thread_local const uint32_t index = thread_count.fetch_add(1);
+    return index;
+}
+
+double to_millis(std::chrono::nanoseconds time)
+{
+    return std::chrono::duration<double, std::milli>(time).count();
+}
+
+double to_micros(std::chrono::nanoseconds time)
+{
+    return std::chrono::duration<double, std::micro>(time).count();
+}
+
+void write_json_string(std::ostream &out, const std::string &text)
+{
+    out << '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << ' ';
+        else
+            out << c;
+    }
+    out << '"';
+}
+}  // namespace
+
+Profiler::Profiler(size_t trace_capacity)
+    : instance(profiler_count.fetch_add(1) + 1)
+    , epoch(Clock::now())
+    , trace_capacity(std::max<size_t>(trace_capacity, 1))
+{
+}
+
+void Profiler::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    epoch = Clock::now();
+    // The records are kept, since the threads which recorded keep pointers to them
+    for (auto &record : records)
+    {
+        std::fill(record->systems.begin(), record->systems.end(), SystemProfile());
+        std::fill(record->events.begin(), record->events.end(), EventProfile());
+        record->trace_events.clear();
+        record->trace_next = 0;
+    }
+    frames = 0;
+    frame_times.clear();
+}
+
+uint64_t Profiler::get_frame_count() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames;
+}
+
+std::vector<std::chrono::nanoseconds> Profiler::get_frame_times() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::chrono::nanoseconds> times;
+    size_t oldest = frames % FRAME_HISTORY;
+    if (frame_times.size() < FRAME_HISTORY)
+        oldest = 0;
+    for (size_t idx = 0; idx < frame_times.size(); ++idx)
+        times.push_back(frame_times[(oldest + idx) % frame_times.size()]);
+    return times;
+}
+
+void Profiler::write_report(std::ostream &out) const
+{
+    std::vector<std::chrono::nanoseconds> times = get_frame_times();
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<SystemProfile> systems;
+    std::vector<EventProfile> events;
+    std::vector<const std::string *> event_names;
+    merge(systems, events, event_names);
+
+    out << std::fixed << std::setprecision(3);
+    out << "Frames: " << frames << "\n";
+    if (!times.empty())
+    {
+        std::chrono::nanoseconds total{0};
+        for (auto time : times)
+            total += time;
+        out << "Last " << times.size() << " frames: average "
+            << to_millis(total / times.size()) << " ms, min "
+            << to_millis(*std::min_element(times.begin(), times.end())) << " ms, max "
+            << to_millis(*std::max_element(times.begin(), times.end())) << " ms\n";
+    }
+
+    out << "\n"
+        << std::left << std::setw(40) << "System" << std::right << std::setw(10)
+        << "Calls" << std::setw(14) << "Total ms" << std::setw(14) << "Avg us"
+        << std::setw(12) << "Entities" << "\n";
+    std::vector<size_t> order;
+    for (size_t id = 0; id < systems.size(); ++id)
+        if (systems[id].calls > 0)
+            order.push_back(id);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return systems[a].time > systems[b].time;
+    });
+    for (size_t id : order)
+    {
+        const SystemProfile &profile = systems[id];
+        out << std::left << std::setw(40) << get_system_name(id) << std::right
+            << std::setw(10) << profile.calls << std::setw(14)
+            << to_millis(profile.time) << std::setw(14)
+            << to_micros(profile.time) / profile.calls << std::setw(12)
+            << profile.entities << "\n";
+    }
+
+    out << "\n"
+        << std::left << std::setw(40) << "Event" << std::right << std::setw(10)
+        << "Emitted" << std::setw(14) << "Received" << std::setw(14) << "Total ms"
+        << "\n";
+    order.clear();
+    for (size_t id = 0; id < events.size(); ++id)
+        if (events[id].emitted > 0 || events[id].received > 0)
+            order.push_back(id);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return events[a].time > events[b].time;
+    });
+    for (size_t id : order)
+    {
+        const EventProfile &profile = events[id];
+        out << std::left << std::setw(40) << *event_names[id] << std::right
+            << std::setw(10) << profile.emitted << std::setw(14) << profile.received
+            << std::setw(14) << to_millis(profile.time) << "\n";
+    }
+}
+
+void Profiler::write_chrome_trace(std::ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // The last calls of all the threads, of which the newest ones are kept
+    std::vector<TraceEvent> trace_events;
+    for (const auto &record : records)
+        trace_events.insert(trace_events.end(),
+                            record->trace_events.begin(),
+                            record->trace_events.end());
+    std::stable_sort(trace_events.begin(),
+                     trace_events.end(),
+                     [](const TraceEvent &a, const TraceEvent &b) {
+                         return a.start < b.start;
+                     });
+    size_t first = trace_events.size() - std::min(trace_events.size(), trace_capacity);
+
+    out << "{\"traceEvents\":[";
+    for (size_t idx = first; idx < trace_events.size(); ++idx)
+    {
+        const TraceEvent &event = trace_events[idx];
+        out << (idx == first ? "\n" : ",\n") << "{\"name\":";
+        write_json_string(out,
+                          event.name ? *event.name : get_system_name(event.system_id));
+        out << ",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"ts\":"
+            << to_micros(event.start - epoch) << ",\"dur\":"
+            << to_micros(event.duration) << ",\"pid\":0,\"tid\":" << event.thread
+            << "}";
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+void Profiler::name_system(__lz::TypeId system_id, const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (system_id >= system_names.size())
+        system_names.resize(system_id + 1, nullptr);
+    system_names[system_id] = &name;
+}
+
+void Profiler::record_frame(Clock::time_point start)
+{
+    Clock::time_point end = Clock::now();
+    get_thread_record().trace(&frame_name, 0, "frame", start, end, trace_capacity);
+    std::lock_guard<std::mutex> lock(mutex);
+    std::chrono::nanoseconds duration = end - start;
+    if (frame_times.size() < FRAME_HISTORY)
+        frame_times.push_back(duration);
+    else
+        frame_times[frames % FRAME_HISTORY] = duration;
+    ++frames;
+}
+
+__lz::TypeId Profiler::enter_system(__lz::TypeId system_id)
+{
+    __lz::TypeId outer = running_system;
+    running_system = system_id;
+    return outer;
+}
+
+void Profiler::record_system(__lz::TypeId system_id,
+                             Clock::time_point start,
+                             __lz::TypeId outer)
+{
+    Clock::time_point end = Clock::now();
+    running_system = outer;
+    ThreadRecord &record = get_thread_record();
+    SystemProfile &profile = record.system_at(system_id);
+    ++profile.calls;
+    profile.time += end - start;
+    record.trace(nullptr, system_id, "updateable", start, end, trace_capacity);
+}
+
+Profiler::Clock::time_point Profiler::record_listener(__lz::TypeId system_id,
+                                                      __lz::TypeId event_id,
+                                                      const std::string &event_name,
+                                                      size_t count,
+                                                      Clock::time_point start)
+{
+    Clock::time_point end = Clock::now();
+    ThreadRecord &record = get_thread_record();
+    SystemProfile &system = record.system_at(system_id);
+    ++system.calls;
+    system.time += end - start;
+    EventProfile &event = record.event_at(event_id, event_name);
+    event.received += count;
+    event.time += end - start;
+    record.trace(nullptr, system_id, "listener", start, end, trace_capacity);
+    return end;
+}
+
+void Profiler::record_delivery(__lz::TypeId event_id,
+                               const std::string &event_name,
+                               size_t count,
+                               size_t listeners,
+                               Clock::time_point start)
+{
+    Clock::time_point end = Clock::now();
+    ThreadRecord &record = get_thread_record();
+    EventProfile &event = record.event_at(event_id, event_name);
+    event.received += count * listeners;
+    event.time += end - start;
+    record.trace(&event_name, 0, "delivery", start, end, trace_capacity);
+}
+
+void Profiler::record_emit(__lz::TypeId event_id, const std::string &event_name)
+{
+    ++get_thread_record().event_at(event_id, event_name).emitted;
+}
+
+void Profiler::record_pass(const std::string &name,
+                           size_t entities,
+                           Clock::time_point start)
+{
+    Clock::time_point end = Clock::now();
+    ThreadRecord &record = get_thread_record();
+    if (running_system != NO_SYSTEM)
+        record.system_at(running_system).entities += entities;
+    record.trace(&name, 0, "pass", start, end, trace_capacity);
+}
+
+Profiler::SystemProfile Profiler::get_system_profile(__lz::TypeId system_id) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    SystemProfile total;
+    for (const auto &record : records)
+    {
+        if (system_id >= record->systems.size())
+            continue;
+        const SystemProfile &profile = record->systems[system_id];
+        total.calls += profile.calls;
+        total.time += profile.time;
+        total.entities += profile.entities;
+    }
+    return total;
+}
+
+Profiler::EventProfile Profiler::get_event_profile(__lz::TypeId event_id) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    EventProfile total;
+    for (const auto &record : records)
+    {
+        if (event_id >= record->events.size())
+            continue;
+        const EventProfile &profile = record->events[event_id];
+        total.emitted += profile.emitted;
+        total.received += profile.received;
+        total.time += profile.time;
+    }
+    return total;
+}
+
+const std::string &Profiler::get_system_name(__lz::TypeId system_id) const
+{
+    static const std::string unnamed = "system";
+    if (system_id < system_names.size() && system_names[system_id])
+        return *system_names[system_id];
+    return unnamed;
+}
+
+void Profiler::merge(std::vector<SystemProfile> &systems,
+                     std::vector<EventProfile> &events,
+                     std::vector<const std::string *> &event_names) const
+{
+    for (const auto &record : records)
+    {
+        if (systems.size() < record->systems.size())
+            systems.resize(record->systems.size());
+        for (size_t id = 0; id < record->systems.size(); ++id)
+        {
+            systems[id].calls += record->systems[id].calls;
+            systems[id].time += record->systems[id].time;
+            systems[id].entities += record->systems[id].entities;
+        }
+
+        if (events.size() < record->events.size())
+        {
+            events.resize(record->events.size());
+            event_names.resize(record->events.size(), nullptr);
+        }
+        for (size_t id = 0; id < record->events.size(); ++id)
+        {
+            events[id].emitted += record->events[id].emitted;
+            events[id].received += record->events[id].received;
+            events[id].time += record->events[id].time;
+            if (record->event_names[id])
+                event_names[id] = record->event_names[id];
+        }
+    }
+}
+
+Profiler::ThreadRecord &Profiler::get_thread_record()
+{
+    // Threads mostly record for a single profiler, whose record is cached
+    thread_local uint64_t cached_instance = 0;
+    thread_local ThreadRecord *cached_record = nullptr;
+    if (cached_instance == instance)
+        return *cached_record;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::thread::id owner = std::this_thread::get_id();
+    auto found = std::find_if(records.begin(), records.end(), [&](const auto &record) {
+        return record->owner == owner;
+    });
+    if (found == records.end())
+    {
+        records.emplace_back(new ThreadRecord());
+        records.back()->owner = owner;
+        records.back()->thread = get_thread_index();
+        found = records.end() - 1;
+    }
+    cached_instance = instance;
+    cached_record = found->get();
+    return *cached_record;
+}
+
+Profiler::SystemProfile &Profiler::ThreadRecord::system_at(__lz::TypeId system_id)
+{
+    if (system_id >= systems.size())
+        systems.resize(system_id + 1);
+    return systems[system_id];
+}
+
+Profiler::EventProfile &Profiler::ThreadRecord::event_at(__lz::TypeId event_id,
+                                                         const std::string &event_name)
+{
+    if (event_id >= events.size())
+    {
+        events.resize(event_id + 1);
+        event_names.resize(event_id + 1, nullptr);
+    }
+    event_names[event_id] = &event_name;
+    return events[event_id];
+}
+
+void Profiler::ThreadRecord::trace(const std::string *name,
+                                   __lz::TypeId system_id,
+                                   const char *category,
+                                   Clock::time_point start,
+                                   Clock::time_point end,
+                                   size_t capacity)
+{
+    TraceEvent event{name, system_id, category, start, end - start, thread};
+    if (trace_events.size() < capacity)
+        trace_events.push_back(event);
+    else
+        trace_events[trace_next] = event;
+    trace_next = (trace_next + 1) % capacity;
+}
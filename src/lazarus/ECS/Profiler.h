@@ -0,0 +1,286 @@
+#pragma once
+
+#include <lazarus/ECS/TypeId.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace lz
+{
+/**
+ * Instrumentation of an engine, which measures the time taken by each frame and by
+ * each updateable, delivery of events and pass over the entities.
+ *
+ * The profiler is disabled by default, and costs a single check per measured call
+ * while disabled. Once enabled, it keeps:
+ *
+ * - The number of calls, the time spent and the entities processed by each system,
+ *   counting the runs of updateables, and the events received by listeners if
+ *   listener timing is enabled.
+ * - The number of events emitted and received, and the time spent delivering
+ *   them, for each event type.
+ * - The duration of the last frames, that is, of the last calls to update().
+ * - A trace of the last measured calls, kept in a ring buffer, which can be
+ *   exported in the trace event format of Chrome (chrome://tracing or Perfetto).
+ *
+ * Each delivery of events is measured as a whole, from before the first listener
+ * to after the last one, so that the cost of profiling does not grow with the
+ * number of listeners. Listener timing measures each listener on its own instead,
+ * which takes a reading of the clock and a trace entry per listener.
+ *
+ * Times are taken with a steady clock, and include the time of the nested calls,
+ * such as the listeners of the events emitted by an updateable. Measurements may
+ * be recorded from several threads at the same time: each thread records into its
+ * own buffers, without locking, and these are merged when the measurements are read.
+ * The profiler must not be enabled, disabled, reset, read or exported while the
+ * engine updates.
+ */
+class Profiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Default number of calls kept in the trace, for each thread and once merged.
+     */
+    static constexpr size_t DEFAULT_TRACE_CAPACITY = 1 << 12;
+
+    /**
+     * Number of frames whose duration is kept.
+     */
+    static constexpr size_t FRAME_HISTORY = 256;
+
+    /**
+     * Measurements of a system.
+     */
+    struct SystemProfile
+    {
+        uint64_t calls = 0;
+        std::chrono::nanoseconds time{0};
+        uint64_t entities = 0;  // Entities visited by its passes
+    };
+
+    /**
+     * Measurements of an event type.
+     */
+    struct EventProfile
+    {
+        uint64_t emitted = 0;
+        uint64_t received = 0;  // Deliveries to listeners
+        std::chrono::nanoseconds time{0};  // Spent by the listeners
+    };
+
+    explicit Profiler(size_t trace_capacity = DEFAULT_TRACE_CAPACITY);
+
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+
+    void set_enabled(bool enabled)
+    {
+        this->enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool is_enabled() const
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets whether each listener is measured on its own, rather than each delivery
+     * of events as a whole. Disabled by default.
+     */
+    void set_listener_timing(bool listener_timing)
+    {
+        this->listener_timing.store(listener_timing, std::memory_order_relaxed);
+    }
+
+    bool is_listener_timing() const
+    {
+        return listener_timing.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Discards all the measurements.
+     */
+    void reset();
+
+    template <typename System>
+    SystemProfile get_system_profile() const
+    {
+        return get_system_profile(__lz::get_system_id<System>());
+    }
+
+    template <typename EventType>
+    EventProfile get_event_profile() const
+    {
+        return get_event_profile(__lz::get_event_id<EventType>());
+    }
+
+    /**
+     * Returns the number of frames measured.
+     */
+    uint64_t get_frame_count() const;
+
+    /**
+     * Returns the durations of the last frames, up to FRAME_HISTORY of them, from
+     * the oldest to the newest.
+     */
+    std::vector<std::chrono::nanoseconds> get_frame_times() const;
+
+    /**
+     * Writes a human readable report of the measurements, with the frame times and
+     * the systems and event types sorted by the time spent on them.
+     */
+    void write_report(std::ostream &out) const;
+
+    /**
+     * Writes the trace as a JSON document in the trace event format of Chrome.
+     */
+    void write_chrome_trace(std::ostream &out) const;
+
+    /**
+     * Gives a name to a system, used in the reports and the trace. Called by the
+     * engine when systems are added.
+     */
+    void name_system(__lz::TypeId system_id, const std::string &name);
+
+    /**
+     * Records a frame which started at the given time and ends now.
+     */
+    void record_frame(Clock::time_point start);
+
+    /**
+     * Makes the system the one running on the calling thread, so that the passes
+     * it makes are counted for it, and returns the system which was running.
+     */
+    static __lz::TypeId enter_system(__lz::TypeId system_id);
+
+    /**
+     * Records a run of the system which started at the given time and ends now,
+     * and makes the given system the one running again.
+     */
+    void record_system(__lz::TypeId system_id,
+                       Clock::time_point start,
+                       __lz::TypeId outer);
+
+    /**
+     * Records the delivery of count events to a listener which started at
+     * the given time and ends now, and returns the time it ended, so that the
+     * delivery to the next listener can start from there. The name of the event
+     * type must outlive the profiler.
+     */
+    Clock::time_point record_listener(__lz::TypeId system_id,
+                                      __lz::TypeId event_id,
+                                      const std::string &event_name,
+                                      size_t count,
+                                      Clock::time_point start);
+
+    /**
+     * Records the delivery of count events to each of the given number of
+     * listeners, which started at the given time and ends now. The name of the
+     * event type must outlive the profiler.
+     */
+    void record_delivery(__lz::TypeId event_id,
+                         const std::string &event_name,
+                         size_t count,
+                         size_t listeners,
+                         Clock::time_point start);
+
+    void record_emit(__lz::TypeId event_id, const std::string &event_name);
+
+    /**
+     * Records a pass over the entities which started at the given time and ends
+     * now, counting the entities for the system running on the calling thread.
+     * The name must outlive the profiler.
+     */
+    void record_pass(const std::string &name, size_t entities, Clock::time_point start);
+
+    /**
+     * Value of enter_system() when no system runs on the thread.
+     */
+    static constexpr __lz::TypeId NO_SYSTEM = static_cast<__lz::TypeId>(-1);
+
+private:
+    struct TraceEvent
+    {
+        const std::string *name;  // Or nullptr for the name of the system
+        __lz::TypeId system_id;
+        const char *category;
+        Clock::time_point start;
+        std::chrono::nanoseconds duration;
+        uint32_t thread;
+    };
+
+    // Measurements recorded by a single thread
+    struct ThreadRecord
+    {
+        std::thread::id owner;
+        uint32_t thread;  // Index of the thread in the traces
+        std::vector<SystemProfile> systems;  // Indexed by system ID
+        std::vector<EventProfile> events;  // Indexed by event ID
+        std::vector<const std::string *> event_names;  // Indexed by event ID
+        std::vector<TraceEvent> trace_events;  // Ring buffer
+        size_t trace_next = 0;  // Position of the next event in the ring buffer
+
+        SystemProfile &system_at(__lz::TypeId system_id);
+        EventProfile &event_at(__lz::TypeId event_id, const std::string &event_name);
+        void trace(const std::string *name,
+                   __lz::TypeId system_id,
+                   const char *category,
+                   Clock::time_point start,
+                   Clock::time_point end,
+                   size_t capacity);
+    };
+
+    SystemProfile get_system_profile(__lz::TypeId system_id) const;
+
+    EventProfile get_event_profile(__lz::TypeId event_id) const;
+
+    // Must be called with the mutex held
+    const std::string &get_system_name(__lz::TypeId system_id) const;
+    void merge(std::vector<SystemProfile> &systems,
+               std::vector<EventProfile> &events,
+               std::vector<const std::string *> &event_names) const;
+
+    // Returns the record of the calling thread, which only locks the first time the
+    // thread records for the profiler
+    ThreadRecord &get_thread_record();
+
+    std::atomic<bool> enabled{false};
+    std::atomic<bool> listener_timing{false};
+    const uint64_t instance;  // Tells the profilers apart in the cache of each thread
+    mutable std::mutex mutex;  // Guards the records, the names and the frames
+    Clock::time_point epoch;  // Origin of the times of the trace
+    std::vector<std::unique_ptr<ThreadRecord>> records;  // Of each thread
+    std::vector<const std::string *> system_names;  // Indexed by system ID
+    uint64_t frames = 0;
+    std::vector<std::chrono::nanoseconds> frame_times;  // Ring buffer
+    size_t trace_capacity;
+};
+}  // namespace lz
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Returns the name of a pass over the entities with the given component types,
+ * like "apply_to_each<Position, Velocity>".
+ */
+template <typename... Types>
+const std::string &get_pass_name()
+{
+    static const std::string name = [] {
+        std::string types;
+        ((types += (types.empty() ? "" : ", ") + get_type_name<Types>()), ...);
+        return "apply_to_each<" + types + ">";
+    }();
+    return name;
+}
+}  // namespace __lz
@@ -0,0 +1,131 @@
+#include <lazarus/ECS/Scheduler.h>
+#include <lazarus/common.h>
+
+#include <algorithm>
+
+using namespace __lz;
+
+namespace
+{
+bool contains_id(const std::vector<TypeId> &ids, TypeId id)
+{
+    return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+}  // namespace
+
+bool Scheduler::contains(TypeId id) const
+{
+    for (const auto &entry : entries)
+    {
+        if (entry.id == id)
+            return true;
+    }
+    return false;
+}
+
+void Scheduler::add(TypeId id,
+                    std::shared_ptr<lz::Updateable> updateable,
+                    const lz::SystemAccess &access)
+{
+    entries.push_back({id, std::move(updateable), access});
+    dirty = true;
+}
+
+const std::vector<Scheduler::Stage> &Scheduler::get_stages()
+{
+    if (dirty)
+        build();
+    return stages;
+}
+
+bool Scheduler::precedes(const Entry &first, const Entry &second)
+{
+    return contains_id(first.access.get_run_before(), second.id) ||
+           contains_id(second.access.get_run_after(), first.id);
+}
+
+void Scheduler::build()
+{
+    size_t count = entries.size();
+    std::vector<std::vector<size_t>> successors(count);
+    std::vector<size_t> num_predecessors(count, 0);
+    // reaches[first][second] holds whether first has to run before second
+    std::vector<std::vector<bool>> reaches(count, std::vector<bool>(count, false));
+    auto add_edge = [&](size_t from, size_t to) {
+        successors[from].push_back(to);
+        ++num_predecessors[to];
+        for (size_t before = 0; before < count; ++before)
+        {
+            if (before != from && !reaches[before][from])
+                continue;
+            reaches[before][to] = true;
+            for (size_t after = 0; after < count; ++after)
+            {
+                if (reaches[to][after])
+                    reaches[before][after] = true;
+            }
+        }
+    };
+
+    // Explicit constraints first, so that they take precedence over the order of
+    // insertion even when they only order a pair through other updateables
+    for (size_t first = 0; first < count; ++first)
+    {
+        for (size_t second = 0; second < count; ++second)
+        {
+            if (first != second && precedes(entries[first], entries[second]))
+                add_edge(first, second);
+        }
+    }
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        if (reaches[idx][idx])
+            throw LazarusException(
+                "The ordering constraints of the updateables form a cycle");
+    }
+
+    // Conflicting updateables follow their order of insertion unless the
+    // constraints order them the other way. Edges are only added along the
+    // current order, so the graph stays acyclic
+    for (size_t first = 0; first < count; ++first)
+    {
+        for (size_t second = first + 1; second < count; ++second)
+        {
+            if (reaches[first][second] || reaches[second][first])
+                continue;
+            if (entries[first].access.conflicts_with(entries[second].access))
+                add_edge(first, second);
+        }
+    }
+
+    // Topological sort, placing each updateable after its last dependency
+    std::vector<size_t> level(count, 0);
+    std::vector<size_t> ready;
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        if (num_predecessors[idx] == 0)
+            ready.push_back(idx);
+    }
+    size_t num_levels = 0;
+    while (!ready.empty())
+    {
+        size_t current = ready.back();
+        ready.pop_back();
+        num_levels = std::max(num_levels, level[current] + 1);
+        for (size_t next : successors[current])
+        {
+            level[next] = std::max(level[next], level[current] + 1);
+            if (--num_predecessors[next] == 0)
+                ready.push_back(next);
+        }
+    }
+    stages.assign(num_levels, Stage{false, {}, {}});
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        Stage &stage = stages[level[idx]];
+        stage.exclusive = stage.exclusive || entries[idx].access.get_exclusive();
+        stage.updateables.push_back(entries[idx].updateable.get());
+        stage.ids.push_back(entries[idx].id);
+    }
+    dirty = false;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <lazarus/ECS/SystemAccess.h>
+#include <lazarus/ECS/TypeId.h>
+
+#include <memory>
+#include <vector>
+
+namespace lz
+{
+class Updateable;
+}  // namespace lz
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Orders the updateables of an engine into stages of updateables which can run at
+ * the same time.
+ *
+ * A dependency graph is built from the declared access of each updateable: there
+ * is an edge for every ordering constraint, and an edge between every pair of
+ * conflicting updateables, following their order of insertion unless the
+ * constraints already order them the other way, directly or through other
+ * updateables. Each updateable is then placed in the stage after the last of its
+ * dependencies, so updateables in the same stage never conflict.
+ */
+class Scheduler
+{
+public:
+    /**
+     * Group of updateables which can run at the same time.
+     *
+     * An exclusive stage holds a single exclusive updateable.
+     */
+    struct Stage
+    {
+        bool exclusive;
+        std::vector<lz::Updateable *> updateables;
+        std::vector<TypeId> ids;  // System ID of each of the updateables
+    };
+
+    /**
+     * Returns whether an updateable with the given system ID has been added.
+     */
+    bool contains(TypeId id) const;
+
+    void add(TypeId id,
+             std::shared_ptr<lz::Updateable> updateable,
+             const lz::SystemAccess &access);
+
+    /**
+     * Returns the stages in the order they must run, building them again if
+     * updateables were added since the last call.
+     *
+     * @throws LazarusException If the ordering constraints form a cycle.
+     */
+    const std::vector<Stage> &get_stages();
+
+private:
+    struct Entry
+    {
+        TypeId id;
+        std::shared_ptr<lz::Updateable> updateable;
+        lz::SystemAccess access;
+    };
+
+    /**
+     * Returns whether the first updateable has to run before the second one.
+     */
+    static bool precedes(const Entry &first, const Entry &second);
+
+    void build();
+
+    std::vector<Entry> entries;  // In order of insertion
+    std::vector<Stage> stages;
+    bool dirty = false;
+};
+}  // namespace __lz
@@ -0,0 +1,354 @@
+#include <lazarus/ECS/ECSEngine.h>
+#include <lazarus/ECS/Snapshot.h>
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace lz;
+
+/*
+ * Layout of a snapshot, with every field in the byte order of the machine:
+ *
+ *   Header
+ *   For each type:  uint32 size, uint32 name length, name, padding to 8 bytes
+ *   For each group: uint64 entity count, uint32 type count, uint32 padding,
+ *                   uint32 type of each array, padding to 8 bytes,
+ *                   uint64 saved identifier of each entity,
+ *                   for each type, padding to BLOCK_ALIGN and its components
+ */
+namespace
+{
+constexpr char MAGIC[8] = {'L', 'Z', 'S', 'N', 'A', 'P', 'S', 'H'};
+constexpr std::uint32_t VERSION = 1;
+constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr size_t BLOCK_ALIGN = alignof(std::max_align_t);
+
+struct Header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t type_count;
+    std::uint32_t padding;
+    std::uint64_t group_count;
+};
+
+// Entities holding the same set of registered types, while saving
+struct Group
+{
+    std::vector<size_t> entries;  // Entries of the types held, in order of entry
+    std::vector<int> slot_of_entry;  // Position of each entry in entries, or -1
+    std::vector<Identifier> ids;
+    std::vector<std::vector<char>> blocks;  // Components of each type
+};
+
+class Writer
+{
+public:
+    template <typename T>
+    void put(const T &value)
+    {
+        put_bytes(&value, sizeof(T));
+    }
+
+    void put_bytes(const void *bytes, size_t size)
+    {
+        const char *begin = static_cast<const char *>(bytes);
+        buffer.insert(buffer.end(), begin, begin + size);
+    }
+
+    void align(size_t alignment)
+    {
+        buffer.resize((buffer.size() + alignment - 1) / alignment * alignment, 0);
+    }
+
+    std::vector<char> buffer;
+};
+
+class Reader
+{
+public:
+    Reader(const char *data, size_t size)
+        : data(data)
+        , size(size)
+    {
+    }
+
+    template <typename T>
+    T get()
+    {
+        T value;
+        std::memcpy(&value, get_bytes(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    const char *get_bytes(size_t count)
+    {
+        if (count > size - position)
+            throw __lz::LazarusException("The snapshot is truncated");
+        const char *bytes = data + position;
+        position += count;
+        return bytes;
+    }
+
+    void align(size_t alignment)
+    {
+        get_bytes((alignment - position % alignment) % alignment);
+    }
+
+private:
+    const char *data;
+    size_t size;
+    size_t position = 0;
+};
+}  // namespace
+
+void SnapshotRegistry::add(const std::string &name, const __lz::ComponentInfo &info)
+{
+    for (const Entry &entry : entries)
+    {
+        if (entry.name == name || entry.info == &info)
+        {
+            std::stringstream msg;
+            msg << "Component type " << info.name << " is already registered as "
+                << entry.name;
+            throw __lz::LazarusException(msg.str());
+        }
+    }
+
+    if (info.id >= entry_of_type.size())
+        entry_of_type.resize(info.id + 1, -1);
+    entry_of_type[info.id] = static_cast<int>(entries.size());
+    entries.push_back({name, &info});
+}
+
+std::vector<char> SnapshotRegistry::save(ECSEngine &engine) const
+{
+    __lz::ComponentMask registered;
+    for (const Entry &entry : entries)
+        registered.set(entry.info->id);
+
+    // The storage is walked directly, so that no query is kept for it afterwards
+    std::vector<Group> groups;
+    std::unordered_map<__lz::ComponentMask, size_t> group_of_mask;
+    __lz::ComponentMask last_mask;
+    size_t last_group = 0;
+    engine.storage->for_each_run([&](const __lz::ComponentRun &run) {
+        __lz::ComponentMask mask = run.mask & registered;
+        // Runs of the same set of types tend to come one after the other
+        if (groups.empty() || mask != last_mask)
+        {
+            auto found = group_of_mask.find(mask);
+            if (found == group_of_mask.end())
+            {
+                Group group;
+                group.slot_of_entry.assign(entries.size(), -1);
+                for (size_t entry = 0; entry < entries.size(); ++entry)
+                {
+                    if (mask.test(entries[entry].info->id))
+                    {
+                        group.slot_of_entry[entry] = group.entries.size();
+                        group.entries.push_back(entry);
+                    }
+                }
+                group.blocks.resize(group.entries.size());
+                found = group_of_mask.emplace(mask, groups.size()).first;
+                groups.push_back(std::move(group));
+            }
+            last_mask = mask;
+            last_group = found->second;
+        }
+
+        // The components of each range of entities not deleted are copied at once
+        Group &group = groups[last_group];
+        size_t first = 0;
+        while (first < run.count)
+        {
+            if (run.entities[first]->is_deleted())
+            {
+                ++first;
+                continue;
+            }
+            size_t last = first;
+            while (last < run.count && !run.entities[last]->is_deleted())
+                group.ids.push_back(run.entities[last++]->get_id());
+            for (const auto &array : run.arrays)
+            {
+                if (!mask.test(array.first->id))
+                    continue;
+                int entry = entry_of_type[array.first->id];
+                auto &block = group.blocks[group.slot_of_entry[entry]];
+                size_t size = array.first->size;
+                block.insert(
+                    block.end(), array.second + first * size, array.second + last * size);
+            }
+            first = last;
+        }
+    });
+
+    Writer writer;
+    Header header{{}, VERSION, BYTE_ORDER_MARK, 0, 0, groups.size()};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.type_count = static_cast<std::uint32_t>(entries.size());
+    writer.put(header);
+    for (const Entry &entry : entries)
+    {
+        writer.put(static_cast<std::uint32_t>(entry.info->size));
+        writer.put(static_cast<std::uint32_t>(entry.name.size()));
+        writer.put_bytes(entry.name.data(), entry.name.size());
+        writer.align(8);
+    }
+    for (const Group &group : groups)
+    {
+        writer.put(static_cast<std::uint64_t>(group.ids.size()));
+        writer.put(static_cast<std::uint32_t>(group.entries.size()));
+        writer.put(std::uint32_t(0));
+        for (size_t entry : group.entries)
+            writer.put(static_cast<std::uint32_t>(entry));
+        writer.align(8);
+        writer.put_bytes(group.ids.data(), group.ids.size() * sizeof(Identifier));
+        for (const auto &block : group.blocks)
+        {
+            writer.align(BLOCK_ALIGN);
+            writer.put_bytes(block.data(), block.size());
+        }
+    }
+    return std::move(writer.buffer);
+}
+
+void SnapshotRegistry::save(ECSEngine &engine, std::ostream &out) const
+{
+    std::vector<char> snapshot = save(engine);
+    out.write(snapshot.data(), static_cast<std::streamsize>(snapshot.size()));
+}
+
+std::vector<SnapshotRegistry::LoadedEntity> SnapshotRegistry::load(ECSEngine &engine,
+                                                                   const char *data,
+                                                                   size_t size) const
+{
+    Reader reader(data, size);
+    Header header = reader.get<Header>();
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        throw __lz::LazarusException("The data is not a snapshot");
+    if (header.version != VERSION || header.byte_order != BYTE_ORDER_MARK)
+        throw __lz::LazarusException(
+            "The snapshot was saved in a version or byte order not supported");
+
+    // Entry of each type of the snapshot, or nullptr if it is not registered
+    std::vector<const Entry *> types;
+    std::vector<size_t> saved_sizes;
+    std::unordered_set<std::string> names;
+    for (std::uint32_t type = 0; type < header.type_count; ++type)
+    {
+        std::uint32_t type_size = reader.get<std::uint32_t>();
+        std::uint32_t name_size = reader.get<std::uint32_t>();
+        std::string name(reader.get_bytes(name_size), name_size);
+        reader.align(8);
+        // Each type is saved once, so that a group can't hold two arrays of it
+        if (!names.insert(name).second)
+            throw __lz::LazarusException("The snapshot is corrupted");
+
+        const Entry *found = nullptr;
+        for (const Entry &entry : entries)
+            if (entry.name == name)
+                found = &entry;
+        if (found && found->info->size != type_size)
+        {
+            std::stringstream msg;
+            msg << "Component type " << name << " was saved with a size of "
+                << type_size << " bytes, but its size is " << found->info->size;
+            throw __lz::LazarusException(msg.str());
+        }
+        types.push_back(found);
+        saved_sizes.push_back(type_size);
+    }
+
+    // The whole snapshot is read before adding any entity, so that nothing is added
+    // if it is not valid
+    struct GroupData
+    {
+        size_t count;
+        const char *ids;
+        __lz::ComponentArrays arrays;
+    };
+    std::vector<GroupData> groups;
+    std::vector<std::unique_ptr<std::max_align_t[]>> copies;
+    std::vector<bool> in_group(types.size(), false);
+    for (std::uint64_t group = 0; group < header.group_count; ++group)
+    {
+        size_t count = reader.get<std::uint64_t>();
+        std::uint32_t type_count = reader.get<std::uint32_t>();
+        reader.get<std::uint32_t>();
+        std::vector<std::uint32_t> group_types;
+        for (std::uint32_t idx = 0; idx < type_count; ++idx)
+        {
+            std::uint32_t type = reader.get<std::uint32_t>();
+            if (type >= types.size() || in_group[type])
+                throw __lz::LazarusException("The snapshot is corrupted");
+            in_group[type] = true;
+            group_types.push_back(type);
+        }
+        for (std::uint32_t type : group_types)
+            in_group[type] = false;
+        reader.align(8);
+        if (count > size / sizeof(Identifier))
+            throw __lz::LazarusException("The snapshot is truncated");
+        const char *ids = reader.get_bytes(count * sizeof(Identifier));
+
+        __lz::ComponentArrays arrays;
+        for (std::uint32_t type : group_types)
+        {
+            reader.align(BLOCK_ALIGN);
+            size_t type_size = saved_sizes[type];
+            if (type_size > 0 && count > size / type_size)
+                throw __lz::LazarusException("The snapshot is truncated");
+            const char *block = reader.get_bytes(count * type_size);
+            const Entry *entry = types[type];
+            if (!entry)
+                continue;
+            if (reinterpret_cast<std::uintptr_t>(block) % entry->info->align != 0)
+            {
+                // The data given is not aligned, so the components are copied
+                size_t words = (count * type_size + sizeof(std::max_align_t) - 1) /
+                               sizeof(std::max_align_t);
+                copies.emplace_back(new std::max_align_t[words]);
+                std::memcpy(copies.back().get(), block, count * type_size);
+                block = reinterpret_cast<const char *>(copies.back().get());
+            }
+            arrays.emplace_back(entry->info, block);
+        }
+
+        groups.push_back({count, ids, std::move(arrays)});
+    }
+
+    std::vector<LoadedEntity> loaded;
+    for (const GroupData &group : groups)
+    {
+        std::vector<Entity *> spawned = engine.spawn_copies(group.count, group.arrays);
+        for (size_t idx = 0; idx < group.count; ++idx)
+        {
+            Identifier saved_id;
+            std::memcpy(&saved_id,
+                        group.ids + idx * sizeof(Identifier),
+                        sizeof(Identifier));
+            loaded.push_back({saved_id, spawned[idx]});
+        }
+    }
+    return loaded;
+}
+
+std::vector<SnapshotRegistry::LoadedEntity> SnapshotRegistry::load(ECSEngine &engine,
+                                                                   std::istream &in) const
+{
+    std::vector<char> snapshot;
+    char chunk[64 * 1024];
+    while (in.read(chunk, sizeof(chunk)) || in.gcount() > 0)
+        snapshot.insert(snapshot.end(), chunk, chunk + in.gcount());
+    return load(engine, snapshot.data(), snapshot.size());
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <lazarus/ECS/ComponentInfo.h>
+#include <lazarus/ECS/IdAllocator.h>
+#include <lazarus/common.h>
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace lz
+{
+class ECSEngine;
+class Entity;
+
+/**
+ * Registry of the component types which are saved in the snapshots of an engine,
+ * and writer and reader of the snapshots.
+ *
+ * A snapshot is a compact binary image of the entities of an engine which are not
+ * marked for deletion, along with their components of the registered types.
+ * Entities are grouped by the set of registered types they hold, and the
+ * components of each type of a group are stored as a contiguous block, so saving
+ * copies blocks of memory and loading spawns each group in a single batch, without
+ * adding components one by one. Components of types which are not registered are
+ * not saved.
+ *
+ * Registered types are identified by name in the snapshot, so a snapshot can be
+ * loaded by another program which registers the same types under the same names,
+ * in any order. Components are saved as raw bytes in the byte order of the machine,
+ * so they must be trivially copyable, and any identifier they hold must be remapped
+ * after loading.
+ */
+class SnapshotRegistry
+{
+public:
+    /**
+     * Entity created by loading a snapshot, along with the identifier the entity
+     * had when the snapshot was saved.
+     */
+    struct LoadedEntity
+    {
+        Identifier saved_id;
+        Entity *entity;
+    };
+
+    /**
+     * Registers a component type to be saved under the given name.
+     *
+     * @throws LazarusException If the type or the name is already registered.
+     */
+    template <typename Component>
+    void add(const std::string &name);
+
+    /**
+     * Returns a snapshot of the engine.
+     */
+    std::vector<char> save(ECSEngine &engine) const;
+
+    /**
+     * Writes a snapshot of the engine to the stream, with a single write.
+     */
+    void save(ECSEngine &engine, std::ostream &out) const;
+
+    /**
+     * Adds the entities of the snapshot to the engine, with new identifiers, and
+     * returns them in the order they were saved.
+     *
+     * Components of types which are not registered are skipped. The snapshot is
+     * validated before adding any entity.
+     *
+     * @throws LazarusException If the data is not a valid snapshot, or the size of
+     * a registered type does not match the size it was saved with.
+     */
+    std::vector<LoadedEntity> load(ECSEngine &engine,
+                                   const char *data,
+                                   size_t size) const;
+
+    /**
+     * Reads a snapshot from the stream until its end, and adds its entities to
+     * the engine like load() does.
+     */
+    std::vector<LoadedEntity> load(ECSEngine &engine, std::istream &in) const;
+
+private:
+    struct Entry
+    {
+        std::string name;
+        const __lz::ComponentInfo *info;
+    };
+
+    void add(const std::string &name, const __lz::ComponentInfo &info);
+
+    std::vector<Entry> entries;  // In order of registration
+    std::vector<int> entry_of_type;  // Index of the entry of each component ID, or -1
+};
+
+template <typename Component>
+void SnapshotRegistry::add(const std::string &name)
+{
+    static_assert(std::is_trivially_copyable<Component>::value,
+                  "Components saved in snapshots must be trivially copyable");
+    add(name, __lz::get_component_info<Component>());
+}
+}  // namespace lz
@@ -0,0 +1,375 @@
+#include <lazarus/ECS/Entity.h>
+#include <lazarus/ECS/SparseSetStorage.h>
+
+#include <algorithm>
+
+using namespace __lz;
+
+ComponentPool::ComponentPool(const ComponentInfo &info)
+    : info(info)
+    , block_shift(0)
+    , block_align(std::max(info.align, alignof(TickSlot)))
+{
+    // Largest power of two that keeps the components of a block within its size
+    size_t row_bytes = info.size + sizeof(TickSlot);
+    while ((size_t(2) << block_shift) * row_bytes <= BLOCK_BYTES)
+        ++block_shift;
+    block_mask = (size_t(1) << block_shift) - 1;
+    size_t components_bytes = (size_t(1) << block_shift) * info.size;
+    ticks_offset = (components_bytes + alignof(TickSlot) - 1) / alignof(TickSlot) *
+                   alignof(TickSlot);
+}
+
+ComponentPool::~ComponentPool()
+{
+    for (size_t position = 0; position < indices.size(); ++position)
+    {
+        if (indices[position] != NOT_FOUND)
+            info.destroy(at(position));
+    }
+    for (char *block : blocks)
+        ::operator delete(block, std::align_val_t(block_align));
+}
+
+void *ComponentPool::add(size_t index, lz::ChangeTick tick)
+{
+    size_t position = take_free_position();
+    if (position == NOT_FOUND)
+    {
+        position = indices.size();
+        if (position == blocks.size() << block_shift)
+            allocate_block();
+        indices.push_back(index);
+    }
+    else
+    {
+        indices[position] = index;
+    }
+    sparse_entry(index) = position;
+    tick_at(position).store(tick, std::memory_order_relaxed);
+    ++count;
+    return at(position);
+}
+
+void ComponentPool::reserve(size_t components)
+{
+    while ((blocks.size() << block_shift) < components)
+        allocate_block();
+    indices.reserve(components);
+}
+
+void ComponentPool::remove(size_t index)
+{
+    info.destroy(at(find(index)));
+    remove_uninitialized(index);
+}
+
+void ComponentPool::remove_uninitialized(size_t index)
+{
+    size_t position = find(index);
+    sparse_entry(index) = NOT_FOUND;
+    indices[position] = NOT_FOUND;
+    --count;
+
+    // Holes at the end are dropped, their stale free positions are skipped later
+    if (position + 1 == indices.size())
+    {
+        while (!indices.empty() && indices.back() == NOT_FOUND)
+            indices.pop_back();
+        if (indices.empty())
+            free_positions.clear();
+    }
+    else
+    {
+        free_positions.push_back(position);
+    }
+
+    // Release memory when there are at least two empty blocks at the end
+    while (blocks.size() > 1 && (blocks.size() - 2) << block_shift >= indices.size())
+    {
+        ::operator delete(blocks.back(), std::align_val_t(block_align));
+        blocks.pop_back();
+    }
+}
+
+size_t ComponentPool::take_free_position()
+{
+    while (!free_positions.empty())
+    {
+        size_t position = free_positions.back();
+        free_positions.pop_back();
+        // Skips positions dropped from the end, or filled again since they were freed
+        if (position < indices.size() && indices[position] == NOT_FOUND)
+            return position;
+    }
+    return NOT_FOUND;
+}
+
+void ComponentPool::allocate_block()
+{
+    size_t capacity = block_mask + 1;
+    char *block = static_cast<char *>(::operator new(
+        ticks_offset + capacity * sizeof(TickSlot), std::align_val_t(block_align)));
+    TickSlot *ticks = reinterpret_cast<TickSlot *>(block + ticks_offset);
+    for (size_t position = 0; position < capacity; ++position)
+        new (ticks + position) TickSlot(0);
+    blocks.push_back(block);
+}
+
+size_t &ComponentPool::sparse_entry(size_t index)
+{
+    size_t page = index / PAGE_SIZE;
+    if (page >= sparse.size())
+        sparse.resize(page + 1);
+    if (!sparse[page])
+    {
+        sparse[page].reset(new size_t[PAGE_SIZE]);
+        std::fill(sparse[page].get(), sparse[page].get() + PAGE_SIZE, NOT_FOUND);
+    }
+    return sparse[page][index % PAGE_SIZE];
+}
+
+SparseSetStorage::SparseSetStorage()
+    : ComponentStorage(lz::StorageBackend::SparseSet)
+{
+}
+
+void SparseSetStorage::attach(lz::Entity &entity)
+{
+    size_t index = allocate_index(entity);
+    update_queries(index, nullptr, &masks[index]);
+}
+
+void SparseSetStorage::detach(lz::Entity &entity)
+{
+    size_t index = entity.location.index;
+    update_queries(index, &masks[index], nullptr);
+    for (TypeId id = 0; masks[index].any(); ++id)
+    {
+        if (masks[index].test(id))
+        {
+            pools[id]->remove(index);
+            masks[index].reset(id);
+        }
+    }
+    release_index(entity);
+}
+
+void SparseSetStorage::remove(lz::Entity &entity, const ComponentInfo &info)
+{
+    size_t index = entity.location.index;
+    pools[info.id]->remove(index);
+    ComponentMask old_mask = masks[index];
+    masks[index].reset(info.id);
+    update_queries(index, &old_mask, &masks[index]);
+}
+
+void SparseSetStorage::collect(const lz::Entity &entity, ComponentList &list)
+{
+    size_t index = entity.location.index;
+    for (TypeId id = 0; id < pools.size(); ++id)
+        if (masks[index].test(id))
+            list.emplace_back(&pools[id]->get_info(), pools[id]->get(index));
+}
+
+void SparseSetStorage::for_each_run(const std::function<void(const ComponentRun &)> &func)
+{
+    // Pools keep their components in the order they were added, so the components
+    // of consecutive entities are not next to each other
+    ComponentRun run;
+    run.count = 1;
+    for (size_t index = 0; index < entities.size(); ++index)
+    {
+        if (!entities[index])
+            continue;
+        run.entities = &entities[index];
+        run.mask = masks[index];
+        run.arrays.clear();
+        for (TypeId id = 0; id < pools.size(); ++id)
+            if (masks[index].test(id))
+                run.arrays.emplace_back(&pools[id]->get_info(),
+                                        static_cast<const char *>(pools[id]->get(index)));
+        func(run);
+    }
+}
+
+void SparseSetStorage::copy_components(const lz::Entity &source, lz::Entity &entity)
+{
+    ComponentList components;
+    source.storage->collect(source, components);
+    check_copyable(components);
+    ComponentMask old_mask = masks[entity.location.index];
+
+    size_t copied = 0;
+    try
+    {
+        for (; copied < components.size(); ++copied)
+        {
+            ComponentPool &pool = get_pool(*components[copied].first);
+            void *memory = pool.add(entity.location.index, get_change_tick());
+            try
+            {
+                components[copied].first->copy_construct(memory,
+                                                         components[copied].second);
+            }
+            catch (...)
+            {
+                pool.remove_uninitialized(entity.location.index);
+                throw;
+            }
+            masks[entity.location.index].set(components[copied].first->id);
+        }
+    }
+    catch (...)
+    {
+        for (size_t i = 0; i < copied; ++i)
+        {
+            pools[components[i].first->id]->remove(entity.location.index);
+            masks[entity.location.index].reset(components[i].first->id);
+        }
+        throw;
+    }
+    update_queries(entity.location.index, &old_mask, &masks[entity.location.index]);
+}
+
+size_t SparseSetStorage::allocate_index(lz::Entity &entity)
+{
+    size_t index;
+    if (free_indices.empty())
+    {
+        index = entities.size();
+        entities.push_back(&entity);
+        masks.emplace_back();
+    }
+    else
+    {
+        index = free_indices.back();
+        free_indices.pop_back();
+        entities[index] = &entity;
+    }
+    entity.storage = this;
+    entity.location.archetype = nullptr;
+    entity.location.index = index;
+    return index;
+}
+
+void SparseSetStorage::release_index(lz::Entity &entity)
+{
+    entities[entity.location.index] = nullptr;
+    free_indices.push_back(entity.location.index);
+    entity.location = EntityLocation();
+    entity.storage = nullptr;
+}
+
+void SparseSetStorage::spawn_copies(lz::Entity *const *entities,
+                                    size_t count,
+                                    const ComponentArrays &arrays)
+{
+    check_copyable(arrays);
+    ComponentMask mask;
+    std::vector<ComponentPool *> array_pools;
+    for (const auto &array : arrays)
+    {
+        mask.set(array.first->id);
+        array_pools.push_back(&get_pool(*array.first));
+        array_pools.back()->reserve(array_pools.back()->size() + count);
+    }
+    lz::ChangeTick tick = get_change_tick();
+
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        size_t index = allocate_index(*entities[idx]);
+        size_t copied = 0;
+        try
+        {
+            for (; copied < arrays.size(); ++copied)
+            {
+                const ComponentInfo *info = arrays[copied].first;
+                void *memory = array_pools[copied]->add(index, tick);
+                try
+                {
+                    info->copy_construct(memory,
+                                         arrays[copied].second + idx * info->size);
+                }
+                catch (...)
+                {
+                    array_pools[copied]->remove_uninitialized(index);
+                    throw;
+                }
+            }
+        }
+        catch (...)
+        {
+            for (size_t array = 0; array < copied; ++array)
+                array_pools[array]->remove(index);
+            release_index(*entities[idx]);
+            throw;
+        }
+        masks[index] = mask;
+        update_queries(index, nullptr, &masks[index]);
+    }
+}
+
+const Query &SparseSetStorage::query(const ComponentMask &mask)
+{
+    std::lock_guard<std::mutex> lock(queries_mutex);
+    auto found = queries.find(mask);
+    if (found != queries.end())
+        return *found->second;
+
+    std::unique_ptr<SparseSetQuery> query(new SparseSetQuery(mask));
+    query->positions.resize(entities.size(), ComponentPool::NOT_FOUND);
+    for (size_t index = 0; index < entities.size(); ++index)
+    {
+        if (entities[index] && (masks[index] & mask) == mask)
+        {
+            query->positions[index] = query->entities.size();
+            query->entities.push_back(entities[index]);
+            query->indices.push_back(index);
+        }
+    }
+    return *(queries[mask] = std::move(query));
+}
+
+ComponentPool &SparseSetStorage::get_pool(const ComponentInfo &info)
+{
+    if (info.id >= pools.size())
+        pools.resize(info.id + 1);
+    if (!pools[info.id])
+        pools[info.id].reset(new ComponentPool(info));
+    return *pools[info.id];
+}
+
+void SparseSetStorage::update_queries(size_t index,
+                                      const ComponentMask *old_mask,
+                                      const ComponentMask *new_mask)
+{
+    for (auto &pair : queries)
+    {
+        SparseSetQuery &query = *pair.second;
+        bool matched = old_mask && (*old_mask & query.mask) == query.mask;
+        bool matches = new_mask && (*new_mask & query.mask) == query.mask;
+        if (matched == matches)
+            continue;
+
+        if (index >= query.positions.size())
+            query.positions.resize(index + 1, ComponentPool::NOT_FOUND);
+        if (matches)
+        {
+            query.positions[index] = query.entities.size();
+            query.entities.push_back(entities[index]);
+            query.indices.push_back(index);
+        }
+        else
+        {
+            // Fill the gap with the last entity to keep the list packed
+            size_t position = query.positions[index];
+            query.entities[position] = query.entities.back();
+            query.indices[position] = query.indices.back();
+            query.positions[query.indices[position]] = position;
+            query.entities.pop_back();
+            query.indices.pop_back();
+            query.positions[index] = ComponentPool::NOT_FOUND;
+        }
+    }
+}
@@ -0,0 +1,477 @@
+#pragma once
+
+#include <lazarus/ECS/ComponentStorage.h>
+#include <lazarus/common.h>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Pool of the components of a single type.
+ *
+ * Components are kept in a dense array, next to the index of the entity that owns
+ * each of them. A paged sparse array maps entity indices to positions in the dense
+ * array, so that looking up the component of an entity takes constant time.
+ *
+ * The dense array is split in blocks of a power of two components, along with their
+ * change ticks, which are never moved once allocated. Growing the pool only adds
+ * blocks, and removing a component leaves a hole which is filled by the next
+ * component added, so components never move while they are in the pool.
+ */
+class ComponentPool
+{
+public:
+    /**
+     * Number of entries in each page of the sparse array.
+     */
+    static constexpr size_t PAGE_SIZE = 4096;
+
+    static constexpr size_t NOT_FOUND = std::numeric_limits<size_t>::max();
+
+    /**
+     * Size in bytes that a block of components aims to fill.
+     */
+    static constexpr size_t BLOCK_BYTES = 16 * 1024;
+
+    explicit ComponentPool(const ComponentInfo &info);
+
+    ~ComponentPool();
+
+    ComponentPool(const ComponentPool &) = delete;
+    ComponentPool &operator=(const ComponentPool &) = delete;
+
+    const ComponentInfo &get_info() const
+    {
+        return info;
+    }
+
+    /**
+     * Returns the number of components in the pool.
+     */
+    size_t size() const
+    {
+        return count;
+    }
+
+    /**
+     * Returns the position in the dense array of the component of the entity
+     * with the given index, or NOT_FOUND.
+     */
+    size_t find(size_t index) const
+    {
+        size_t page = index / PAGE_SIZE;
+        if (page >= sparse.size() || !sparse[page])
+            return NOT_FOUND;
+        return sparse[page][index % PAGE_SIZE];
+    }
+
+    bool contains(size_t index) const
+    {
+        return find(index) != NOT_FOUND;
+    }
+
+    /**
+     * Returns a pointer to the component at the given position in the dense array.
+     */
+    void *at(size_t position)
+    {
+        return blocks[position >> block_shift] + (position & block_mask) * info.size;
+    }
+
+    /**
+     * Returns the change tick of the component at the given position.
+     */
+    TickSlot &tick_at(size_t position)
+    {
+        return reinterpret_cast<TickSlot *>(blocks[position >> block_shift] +
+                                            ticks_offset)[position & block_mask];
+    }
+
+    lz::ChangeTick get_tick(size_t position)
+    {
+        return tick_at(position).load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns a pointer to the component of the entity with the given index, or a
+     * nullptr if the entity does not have one.
+     */
+    void *get(size_t index)
+    {
+        size_t position = find(index);
+        return position == NOT_FOUND ? nullptr : at(position);
+    }
+
+    /**
+     * Adds an uninitialized component for the entity with the given index, with
+     * the given change tick, returning a pointer to its memory.
+     *
+     * The component takes the position most recently freed, if any, and is
+     * appended otherwise.
+     */
+    void *add(size_t index, lz::ChangeTick tick);
+
+    /**
+     * Allocates memory for at least the given number of components.
+     */
+    void reserve(size_t components);
+
+    /**
+     * Destroys the component of the entity with the given index, leaving a hole
+     * in its place so that no other component moves.
+     */
+    void remove(size_t index);
+
+    /**
+     * Removes the component of the entity with the given index without destroying
+     * it.
+     *
+     * Used to roll back an add() whose component could not be constructed.
+     */
+    void remove_uninitialized(size_t index);
+
+private:
+    void allocate_block();
+
+    /**
+     * Returns a freed position in the dense array, or NOT_FOUND if there is none.
+     */
+    size_t take_free_position();
+
+    size_t &sparse_entry(size_t index);
+
+    const ComponentInfo &info;
+    size_t block_shift;  // Log2 of the number of components in a block
+    size_t block_mask;
+    size_t ticks_offset;  // Offset of the change ticks inside a block
+    size_t block_align;
+    std::vector<char *> blocks;
+    std::vector<size_t> indices;  // Entity index of each position, NOT_FOUND for holes
+    std::vector<size_t> free_positions;  // May hold positions which are no longer holes
+    size_t count = 0;  // Number of components, not counting the holes
+    std::vector<std::unique_ptr<size_t[]>> sparse;
+};
+
+/**
+ * Query over the entities which hold a set of component types, kept as a packed list.
+ */
+struct SparseSetQuery : public Query
+{
+    explicit SparseSetQuery(const ComponentMask &mask)
+        : Query(mask)
+    {
+        entity_lists.push_back(&entities);
+    }
+
+    std::vector<lz::Entity *> entities;
+    std::vector<size_t> indices;  // Index of each of the entities
+    std::vector<size_t> positions;  // Position in the lists of each entity index
+};
+
+/**
+ * Component storage which keeps one sparse set per component type.
+ *
+ * Each entity attached to the storage gets a small index, which is reused once the
+ * entity is detached. Pools are indexed by component ID, so finding the component of
+ * an entity is a couple of array lookups.
+ */
+class SparseSetStorage : public ComponentStorage
+{
+public:
+    SparseSetStorage();
+
+    void attach(lz::Entity &entity) override;
+
+    void detach(lz::Entity &entity) override;
+
+    /**
+     * Constructs a component for the entity in the pool of its type.
+     */
+    template <typename Component, typename... Args>
+    Component *emplace(lz::Entity *entity, EntityLocation &location, Args &&... args);
+
+    /**
+     * Attaches entities which do not belong to any storage, giving each of them
+     * a copy of the given components.
+     *
+     * If a copy constructor throws, the entities before the failing one stay
+     * attached with all their components, and the rest are left unattached.
+     */
+    template <typename... Components>
+    void spawn(lz::Entity *const *entities,
+               size_t count,
+               const Components &... components);
+
+    /**
+     * Attaches entities like spawn(), copying the components of each entity from
+     * the tuple of references returned by source(idx), where idx is the position
+     * of the entity.
+     */
+    template <typename... Components, typename Source>
+    void spawn_from(lz::Entity *const *entities, size_t count, Source &&source);
+
+    void remove(lz::Entity &entity, const ComponentInfo &info) override;
+
+    /**
+     * Returns a pointer to a component of the entity, or a nullptr if the entity
+     * does not hold a component of that type.
+     */
+    void *get(const EntityLocation &location, const ComponentInfo &info)
+    {
+        if (!masks[location.index].test(info.id))
+            return nullptr;
+        return pools[info.id]->get(location.index);
+    }
+
+    /**
+     * Returns a pointer to a component of the entity like get(), giving the
+     * component the current change tick.
+     */
+    void *get_changed(const EntityLocation &location, const ComponentInfo &info)
+    {
+        if (!masks[location.index].test(info.id))
+            return nullptr;
+        ComponentPool &pool = *pools[info.id];
+        size_t position = pool.find(location.index);
+        touch(pool.tick_at(position), get_change_tick());
+        return pool.at(position);
+    }
+
+    void collect(const lz::Entity &entity, ComponentList &list) override;
+
+    void for_each_run(const std::function<void(const ComponentRun &)> &func) override;
+
+    void copy_components(const lz::Entity &source, lz::Entity &entity) override;
+
+    void spawn_copies(lz::Entity *const *entities,
+                      size_t count,
+                      const ComponentArrays &arrays) override;
+
+    const Query &query(const ComponentMask &mask) override;
+
+    /**
+     * Calls the function on every entity matched by the query, which must include
+     * the component types of the view types, passing the entity and pointers to the
+     * components.
+     *
+     * Entities are filtered and stamped according to the change ticks of the pass.
+     * The function must not add or remove components or entities.
+     */
+    template <typename... Types, typename Func>
+    void each(const SparseSetQuery &query,
+              const TickPass<sizeof...(Types)> &pass,
+              Func &&func);
+
+    /**
+     * Calls the function on the entities of the query between the positions begin
+     * and end of its list, which can be used to split a query between threads.
+     */
+    template <typename... Types, typename Func>
+    void each(const SparseSetQuery &query,
+              size_t begin,
+              size_t end,
+              const TickPass<sizeof...(Types)> &pass,
+              Func &&func);
+
+private:
+    ComponentPool &get_pool(const ComponentInfo &info);
+
+    /**
+     * Gives an index to the entity, without adding it to any query.
+     */
+    size_t allocate_index(lz::Entity &entity);
+
+    /**
+     * Frees the index of an entity without components which is not in any query.
+     */
+    void release_index(lz::Entity &entity);
+
+    template <typename... Types, typename Func, size_t... Is>
+    void each_in_query(const SparseSetQuery &query,
+                       size_t begin,
+                       size_t end,
+                       const TickPass<sizeof...(Types)> &pass,
+                       Func &func,
+                       std::index_sequence<Is...>);
+
+    /**
+     * Adds the entity to, or removes it from, the queries whose match changed.
+     *
+     * A nullptr mask means that the entity is not attached to the storage.
+     */
+    void update_queries(size_t index,
+                        const ComponentMask *old_mask,
+                        const ComponentMask *new_mask);
+
+    std::vector<std::unique_ptr<ComponentPool>> pools;  // Indexed by component ID
+    std::vector<lz::Entity *> entities;  // Indexed by entity index
+    std::vector<ComponentMask> masks;  // Component types of each entity
+    std::vector<size_t> free_indices;
+    std::unordered_map<ComponentMask, std::unique_ptr<SparseSetQuery>> queries;
+    std::mutex queries_mutex;  // Queries may be created during parallel passes
+};
+
+template <typename Component, typename... Args>
+Component *SparseSetStorage::emplace([[maybe_unused]] lz::Entity *entity,
+                                     EntityLocation &location,
+                                     Args &&... args)
+{
+    const ComponentInfo &info = get_component_info<Component>();
+    ComponentPool &pool = get_pool(info);
+    void *memory = pool.add(location.index, get_change_tick());
+    try
+    {
+        new (memory) Component(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        pool.remove_uninitialized(location.index);
+        throw;
+    }
+    ComponentMask old_mask = masks[location.index];
+    masks[location.index].set(info.id);
+    update_queries(location.index, &old_mask, &masks[location.index]);
+    return static_cast<Component *>(memory);
+}
+
+template <typename... Components>
+void SparseSetStorage::spawn(lz::Entity *const *entities,
+                             size_t count,
+                             const Components &... components)
+{
+    spawn_from<Components...>(entities, count, [&](size_t) {
+        return std::tuple<const Components &...>(components...);
+    });
+}
+
+template <typename... Components, typename Source>
+void SparseSetStorage::spawn_from(lz::Entity *const *entities,
+                                  size_t count,
+                                  Source &&source)
+{
+    constexpr size_t num_components = sizeof...(Components);
+    ComponentMask mask = get_component_mask<Components...>();
+    if (mask.count() != num_components)
+        throw LazarusException("Entities cannot hold two components of the same type");
+
+    std::array<ComponentPool *, num_components> type_pools{
+        &get_pool(get_component_info<Components>())...};
+    for (ComponentPool *pool : type_pools)
+        pool->reserve(pool->size() + count);
+
+    lz::ChangeTick tick = get_change_tick();
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        size_t index = allocate_index(*entities[idx]);
+        [[maybe_unused]] auto construct = [index, tick](ComponentPool *pool,
+                                                        const auto &component) {
+            using Component = std::decay_t<decltype(component)>;
+            void *memory = pool->add(index, tick);
+            try
+            {
+                new (memory) Component(component);
+            }
+            catch (...)
+            {
+                pool->remove_uninitialized(index);
+                throw;
+            }
+        };
+
+        // Addresses of the components of the entity, in the order of the types
+        [[maybe_unused]] auto components = std::apply(
+            [](const auto &... values) {
+                return std::array<const void *, num_components>{&values...};
+            },
+            source(idx));
+        size_t constructed = 0;
+        try
+        {
+            ((construct(type_pools[constructed],
+                        *static_cast<const Components *>(components[constructed])),
+              ++constructed),
+             ...);
+        }
+        catch (...)
+        {
+            for (size_t pool = 0; pool < constructed; ++pool)
+                type_pools[pool]->remove(index);
+            release_index(*entities[idx]);
+            throw;
+        }
+        masks[index] = mask;
+        update_queries(index, nullptr, &masks[index]);
+    }
+}
+
+template <typename... Types, typename Func>
+void SparseSetStorage::each(const SparseSetQuery &query,
+                            const TickPass<sizeof...(Types)> &pass,
+                            Func &&func)
+{
+    each_in_query<Types...>(
+        query, 0, query.entities.size(), pass, func, std::index_sequence_for<Types...>{});
+}
+
+template <typename... Types, typename Func>
+void SparseSetStorage::each(const SparseSetQuery &query,
+                            size_t begin,
+                            size_t end,
+                            const TickPass<sizeof...(Types)> &pass,
+                            Func &&func)
+{
+    each_in_query<Types...>(
+        query, begin, end, pass, func, std::index_sequence_for<Types...>{});
+}
+
+template <typename... Types, typename Func, size_t... Is>
+void SparseSetStorage::each_in_query(const SparseSetQuery &query,
+                                     size_t begin,
+                                     size_t end,
+                                     const TickPass<sizeof...(Types)> &pass,
+                                     Func &func,
+                                     std::index_sequence<Is...>)
+{
+    if (begin >= end)
+        return;
+
+    // Every entity in the query holds all the component types, so their pools exist
+    constexpr bool filtered = (is_changed_filter<Types> || ...);
+    std::array<ComponentPool *, sizeof...(Types)> type_pools{
+        pools[get_component_id<component_of<Types>>()].get()...};
+    if (!filtered && !pass.stamps())
+    {
+        for (size_t position = begin; position < end; ++position)
+        {
+            size_t index = query.indices[position];
+            func(query.entities[position],
+                 static_cast<component_of<Types> *>(type_pools[Is]->get(index))...);
+        }
+        return;
+    }
+
+    for (size_t position = begin; position < end; ++position)
+    {
+        size_t index = query.indices[position];
+        std::array<size_t, sizeof...(Types)> found{type_pools[Is]->find(index)...};
+        if (!((!is_changed_filter<Types> ||
+               is_changed_since(type_pools[Is]->get_tick(found[Is]), pass.since)) &&
+              ...))
+            continue;
+        ((pass.stamped[Is] ? touch(type_pools[Is]->tick_at(found[Is]), pass.tick)
+                           : void()),
+         ...);
+        func(query.entities[position],
+             static_cast<component_of<Types> *>(type_pools[Is]->at(found[Is]))...);
+    }
+}
+}  // namespace __lz
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <lazarus/ECS/ComponentInfo.h>
+#include <lazarus/ECS/TypeId.h>
+
+#include <vector>
+
+namespace lz
+{
+/**
+ * Declaration of the component types an updateable reads and writes, and of the
+ * updateables it must run before or after.
+ *
+ * The engine uses these declarations to run updateables which do not conflict at
+ * the same time. Two updateables conflict if one of them writes a component type
+ * the other reads or writes, and conflicting updateables run in the order they
+ * were added, unless ordering constraints say otherwise, either between them or
+ * through other updateables.
+ *
+ * An exclusive updateable conflicts with all the others, and is the only one
+ * allowed to add or remove entities and components. Updateables added without a
+ * declaration of their access are exclusive.
+ *
+ * For example:
+ *
+ *     engine.add_updateable<MovementSystem>(
+ *         SystemAccess().reads<Velocity>().writes<Position>().after<InputSystem>());
+ *
+ * @see ECSEngine::add_updateable
+ */
+class SystemAccess
+{
+public:
+    /**
+     * Declares that the updateable reads the components of the given types.
+     */
+    template <typename... Types>
+    SystemAccess &reads()
+    {
+        read_mask |= __lz::get_component_mask<Types...>();
+        return *this;
+    }
+
+    /**
+     * Declares that the updateable modifies the components of the given types.
+     */
+    template <typename... Types>
+    SystemAccess &writes()
+    {
+        write_mask |= __lz::get_component_mask<Types...>();
+        return *this;
+    }
+
+    /**
+     * Makes the updateable run after the updateables of the given types.
+     */
+    template <typename... Systems>
+    SystemAccess &after()
+    {
+        (run_after.push_back(__lz::get_system_id<Systems>()), ...);
+        return *this;
+    }
+
+    /**
+     * Makes the updateable run before the updateables of the given types.
+     */
+    template <typename... Systems>
+    SystemAccess &before()
+    {
+        (run_before.push_back(__lz::get_system_id<Systems>()), ...);
+        return *this;
+    }
+
+    /**
+     * Makes the updateable run on its own, so that it can access anything and
+     * add or remove entities and components.
+     */
+    SystemAccess &exclusive()
+    {
+        is_exclusive = true;
+        return *this;
+    }
+
+    bool get_exclusive() const
+    {
+        return is_exclusive;
+    }
+
+    /**
+     * Returns whether both updateables must not run at the same time.
+     */
+    bool conflicts_with(const SystemAccess &other) const
+    {
+        return is_exclusive || other.is_exclusive ||
+               (write_mask & (other.read_mask | other.write_mask)).any() ||
+               (other.write_mask & read_mask).any();
+    }
+
+    /**
+     * Returns the system IDs of the updateables this one must run after.
+     */
+    const std::vector<__lz::TypeId> &get_run_after() const
+    {
+        return run_after;
+    }
+
+    /**
+     * Returns the system IDs of the updateables this one must run before.
+     */
+    const std::vector<__lz::TypeId> &get_run_before() const
+    {
+        return run_before;
+    }
+
+private:
+    __lz::ComponentMask read_mask;
+    __lz::ComponentMask write_mask;
+    std::vector<__lz::TypeId> run_after;
+    std::vector<__lz::TypeId> run_before;
+    bool is_exclusive = false;
+};
+}  // namespace lz
@@ -0,0 +1,53 @@
+#include <lazarus/ECS/ECSEngine.h>
+#include <lazarus/ECS/TaskContext.h>
+
+using namespace __lz;
+
+namespace
+{
+thread_local TaskContext *current_context = nullptr;
+}  // namespace
+
+TaskContext::Scope::Scope(TaskContext *context)
+    : previous(current_context)
+{
+    current_context = context;
+}
+
+TaskContext::Scope::~Scope()
+{
+    current_context = previous;
+}
+
+TaskContext *TaskContext::current(const lz::ECSEngine &engine)
+{
+    if (current_context && current_context->engine == &engine)
+        return current_context;
+    return nullptr;
+}
+
+void TaskContexts::prepare(size_t tasks)
+{
+    contexts.clear();
+    contexts.reserve(tasks);
+    for (size_t task = 0; task < tasks; ++task)
+        contexts.emplace_back(*engine);
+}
+
+void TaskContexts::finish(lz::ECSEngine &engine)
+{
+    for (TaskContext &context : contexts)
+    {
+        context.events.replay(engine);
+        // The buffer of the engine, or that of the task running this pass
+        engine.commands().append(context.commands);
+    }
+}
+
+size_t TaskContexts::count_visited() const
+{
+    size_t visited = 0;
+    for (const TaskContext &context : contexts)
+        visited += context.visited;
+    return visited;
+}
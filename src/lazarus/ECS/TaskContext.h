@@ -0,0 +1,98 @@
+#pragma once
+
+#include <lazarus/ECS/CommandBuffer.h>
+#include <lazarus/ECS/EventBuffer.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace lz
+{
+class ECSEngine;
+}  // namespace lz
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Buffers of a task of a parallel pass of an engine, where the events emitted and
+ * the structural changes requested by the task are recorded.
+ */
+struct TaskContext
+{
+    /**
+     * Makes a context the current one of the calling thread, restoring the previous
+     * one when destroyed.
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(TaskContext *context);
+
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        TaskContext *previous;
+    };
+
+    explicit TaskContext(const lz::ECSEngine &engine)
+        : engine(&engine)
+    {
+    }
+
+    /**
+     * Returns the context of the task of the engine which runs on the calling
+     * thread, or a nullptr if the thread is not running one.
+     */
+    static TaskContext *current(const lz::ECSEngine &engine);
+
+    const lz::ECSEngine *engine;
+    EventBuffer events;
+    lz::CommandBuffer commands;
+    size_t visited = 0;  // Entities visited by the task, counted when profiling
+};
+
+/**
+ * Contexts of the tasks of a parallel pass, one per task.
+ *
+ * @see View::parallel_each
+ */
+class TaskContexts
+{
+public:
+    explicit TaskContexts(const lz::ECSEngine &engine)
+        : engine(&engine)
+    {
+    }
+
+    /**
+     * Creates a context for each task. Must be called before the tasks start.
+     */
+    void prepare(size_t tasks);
+
+    /**
+     * Makes the context of the task the current one of the thread which runs it.
+     */
+    TaskContext::Scope enter(size_t task)
+    {
+        return TaskContext::Scope(&contexts[task]);
+    }
+
+    /**
+     * Emits the events of each of the tasks, and moves their commands to the
+     * command buffer of the engine, in the order of the tasks.
+     */
+    void finish(lz::ECSEngine &engine);
+
+    /**
+     * Returns the number of entities visited by the tasks.
+     */
+    size_t count_visited() const;
+
+private:
+    const lz::ECSEngine *engine;
+    std::vector<TaskContext> contexts;
+};
+}  // namespace __lz
@@ -0,0 +1,143 @@
+#include <lazarus/ECS/ThreadPool.h>
+
+using namespace __lz;
+
+namespace
+{
+// Pool and queue of the worker running on the current thread, if any
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local size_t current_queue = 0;
+}  // namespace
+
+ThreadPool::ThreadPool(size_t workers)
+{
+    for (size_t idx = 0; idx <= workers; ++idx)
+        queues.push_back(std::make_unique<Queue>());
+    for (size_t idx = 0; idx < workers; ++idx)
+        threads.emplace_back(&ThreadPool::work, this, idx);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake_up.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void ThreadPool::run(Batch &batch, size_t count)
+{
+    size_t own = current_pool == this ? current_queue : queues.size() - 1;
+
+    if (!threads.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            queued += count;
+        }
+        // Give each queue a contiguous block of tasks, starting with our own
+        size_t num_queues = queues.size();
+        for (size_t idx = 0; idx < num_queues; ++idx)
+        {
+            Queue &queue = *queues[(own + idx) % num_queues];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            for (size_t task = idx * count / num_queues;
+                 task < (idx + 1) * count / num_queues;
+                 ++task)
+                queue.tasks.push_back({&batch, task});
+        }
+        wake_up.notify_all();
+    }
+    else
+    {
+        for (size_t task = 0; task < count; ++task)
+            execute({&batch, task});
+    }
+
+    // Help with any pending task, then sleep until the last one is done elsewhere
+    while (batch.pending.load(std::memory_order_acquire) > 0)
+    {
+        if (!run_one(own))
+            break;
+    }
+    std::unique_lock<std::mutex> lock(batch.done_mutex);
+    batch.done.wait(lock, [&batch] { return batch.finished; });
+
+    if (batch.error)
+        std::rethrow_exception(batch.error);
+}
+
+bool ThreadPool::run_one(size_t queue)
+{
+    Task task;
+    bool found = false;
+    {
+        Queue &own = *queues[queue];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    for (size_t idx = 1; !found && idx < queues.size(); ++idx)
+    {
+        Queue &other = *queues[(queue + idx) % queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty())
+        {
+            task = other.tasks.front();
+            other.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (!found)
+        return false;
+
+    --queued;
+    execute(task);
+    return true;
+}
+
+void ThreadPool::execute(const Task &task)
+{
+    Batch &batch = *task.batch;
+    try
+    {
+        batch.invoke(batch.func, task.index);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(batch.error_mutex);
+        if (!batch.error)
+            batch.error = std::current_exception();
+    }
+    // The batch may be destroyed as soon as the submitter sees it finished, so it
+    // is not touched after the lock is released
+    if (batch.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        std::lock_guard<std::mutex> lock(batch.done_mutex);
+        batch.finished = true;
+        batch.done.notify_all();
+    }
+}
+
+void ThreadPool::work(size_t queue)
+{
+    current_pool = this;
+    current_queue = queue;
+    while (true)
+    {
+        if (run_one(queue))
+            continue;
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake_up.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping)
+            return;
+    }
+}
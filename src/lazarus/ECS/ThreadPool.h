@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Pool of worker threads which run batches of tasks, balancing the load by work
+ * stealing.
+ *
+ * Each worker has its own queue of tasks. Workers take tasks from the back of their
+ * own queue, and once it is empty they steal tasks from the front of the others'.
+ * The thread which submits a batch also runs tasks until the whole batch is done,
+ * so a pool without workers runs everything on the calling thread, and batches can
+ * be submitted from within a task.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * Creates a pool with the given number of worker threads.
+     */
+    explicit ThreadPool(size_t workers);
+
+    /**
+     * Waits for the workers to finish their current task and joins them.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * Returns the number of worker threads, not counting the threads which submit
+     * batches to the pool.
+     */
+    size_t get_worker_count() const
+    {
+        return threads.size();
+    }
+
+    /**
+     * Calls func(task) for every task in [0, count), spread over the workers, and
+     * blocks until all of them have finished.
+     *
+     * Each task is run exactly once. If any of them throws, the remaining tasks
+     * still run and the first exception is rethrown afterwards.
+     */
+    template <typename Func>
+    void parallel_for(size_t count, Func &&func);
+
+private:
+    struct Batch
+    {
+        void (*invoke)(void *func, size_t task);
+        void *func;
+        std::atomic<size_t> pending;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        // Signalled by the last task, so that the submitter can sleep until then
+        std::mutex done_mutex;
+        std::condition_variable done;
+        bool finished = false;
+    };
+
+    struct Task
+    {
+        Batch *batch;
+        size_t index;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    /**
+     * Queues the tasks of the batch and runs tasks until there are none left, then
+     * waits for the tasks run by other threads to finish.
+     */
+    void run(Batch &batch, size_t count);
+
+    /**
+     * Runs one task, taken from the given queue if possible, or stolen from
+     * another one. Returns false if there were no tasks left.
+     */
+    bool run_one(size_t queue);
+
+    void execute(const Task &task);
+
+    void work(size_t queue);
+
+    // One queue per worker, plus a last one shared by the threads outside the pool
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued{0};
+    std::mutex sleep_mutex;
+    std::condition_variable wake_up;
+    bool stopping = false;
+};
+
+template <typename Func>
+void ThreadPool::parallel_for(size_t count, Func &&func)
+{
+    if (count == 0)
+        return;
+
+    Batch batch;
+    batch.invoke = [](void *func, size_t task) {
+        (*static_cast<std::remove_reference_t<Func> *>(func))(task);
+    };
+    batch.func = const_cast<void *>(static_cast<const void *>(&func));
+    batch.pending = count;
+    run(batch, count);
+}
+}  // namespace __lz
@@ -0,0 +1,57 @@
+#include <lazarus/ECS/ComponentInfo.h>
+#include <lazarus/ECS/TypeId.h>
+#include <lazarus/common.h>
+
+#include <atomic>
+#include <sstream>
+
+using namespace __lz;
+
+TypeId __lz::next_component_id()
+{
+    static std::atomic<TypeId> component_count{0};
+    TypeId id = component_count++;
+    if (id >= MAX_COMPONENTS)
+    {
+        std::stringstream msg;
+        msg << "Too many component types, at most " << MAX_COMPONENTS
+            << " are supported. Build Lazarus with the CMake option "
+               "LAZARUS_MAX_COMPONENTS set higher to raise the limit.";
+        throw LazarusException(msg.str());
+    }
+    return id;
+}
+
+TypeId __lz::next_event_id()
+{
+    static std::atomic<TypeId> event_count{0};
+    return event_count++;
+}
+
+TypeId __lz::next_system_id()
+{
+    static std::atomic<TypeId> system_count{0};
+    return system_count++;
+}
+
+std::string __lz::parse_type_name(const std::string &signature)
+{
+    // GCC and Clang: "... get_type_name() [with T = Name]" or "[T = Name]"
+    size_t start = signature.find("T = ");
+    if (start != std::string::npos)
+    {
+        start += 4;
+        size_t end = signature.find_first_of(";]", start);
+        return signature.substr(start, end - start);
+    }
+
+    // MSVC: "... get_type_name<struct Name>(void)"
+    start = signature.find("get_type_name<");
+    size_t end = signature.rfind(">(");
+    if (start != std::string::npos && end != std::string::npos)
+    {
+        start += 14;
+        return signature.substr(start, end - start);
+    }
+    return signature;
+}
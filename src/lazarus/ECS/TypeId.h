@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Small integer which identifies a type within a family of types (components,
+ * events or systems).
+ *
+ * IDs are handed out in order the first time each type is used, so they stay dense
+ * and can index flat arrays. They do not rely on RTTI, and may differ between runs.
+ */
+using TypeId = size_t;
+
+TypeId next_component_id();
+
+TypeId next_event_id();
+
+TypeId next_system_id();
+
+template <typename EventType>
+TypeId get_event_id()
+{
+    static const TypeId id = next_event_id();
+    return id;
+}
+
+template <typename System>
+TypeId get_system_id()
+{
+    static const TypeId id = next_system_id();
+    return id;
+}
+
+/**
+ * Extracts the name of the template argument from the signature of
+ * get_type_name<T>().
+ */
+std::string parse_type_name(const std::string &signature);
+
+/**
+ * Returns a human readable name of the type, for error messages.
+ */
+template <typename T>
+const std::string &get_type_name()
+{
+#if defined(__clang__) || defined(__GNUC__)
+    static const std::string name = parse_type_name(__PRETTY_FUNCTION__);
+#elif defined(_MSC_VER)
+    static const std::string name = parse_type_name(__FUNCSIG__);
+#else
+    static const std::string name = "unknown type";
+#endif
+    return name;
+}
+}  // namespace __lz
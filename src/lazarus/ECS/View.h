@@ -0,0 +1,373 @@
+#pragma once
+
+#include <lazarus/ECS/ArchetypeStorage.h>
+#include <lazarus/ECS/Entity.h>
+#include <lazarus/ECS/SparseSetStorage.h>
+#include <lazarus/ECS/ThreadPool.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Hooks of the tasks of a parallel pass which do nothing.
+ *
+ * Hooks are told the number of tasks with prepare() before they start, and enter()
+ * is called by each task before it visits its entities, keeping what it returns
+ * until it is done.
+ */
+struct NoTaskHooks
+{
+    void prepare(size_t)
+    {
+    }
+
+    int enter(size_t)
+    {
+        return 0;
+    }
+};
+}  // namespace __lz
+
+namespace lz
+{
+/**
+ * Lightweight range over the entities matched by a query of the ECS engine.
+ *
+ * The range does not copy the entities; it walks the lists kept up to date by the
+ * engine's storage, so it reflects the entities that match when it is iterated.
+ * Adding or removing components or entities while iterating moves other entities
+ * under the iterator, which then skips them; use ECSEngine::entities_with_components
+ * to get a copy of the entities which can be changed while walking it.
+ *
+ * @see ECSEngine::view
+ */
+class EntityRange
+{
+public:
+    /**
+     * Forward iterator over the entities of the range.
+     */
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Entity *;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Entity *const *;
+        using reference = Entity *const &;
+
+        iterator(const __lz::Query *query, size_t list, bool include_deleted)
+            : query(query)
+            , list(list)
+            , include_deleted(include_deleted)
+        {
+            skip();
+        }
+
+        reference operator*() const
+        {
+            return (*query->entity_lists[list])[position];
+        }
+
+        iterator &operator++()
+        {
+            ++position;
+            skip();
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator old = *this;
+            ++(*this);
+            return old;
+        }
+
+        bool operator==(const iterator &other) const
+        {
+            return list == other.list && position == other.position;
+        }
+
+        bool operator!=(const iterator &other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        // Advances until a valid entity or the end of the range is reached
+        void skip()
+        {
+            while (list < query->entity_lists.size())
+            {
+                const auto &entities = *query->entity_lists[list];
+                while (position < entities.size() && !include_deleted &&
+                       entities[position]->is_deleted())
+                    ++position;
+                if (position < entities.size())
+                    return;
+                ++list;
+                position = 0;
+            }
+        }
+
+        const __lz::Query *query;
+        size_t list;
+        size_t position = 0;
+        bool include_deleted;
+    };
+
+    EntityRange(const __lz::Query &query, bool include_deleted = false)
+        : query(&query)
+        , include_deleted(include_deleted)
+    {
+    }
+
+    iterator begin() const
+    {
+        return iterator(query, 0, include_deleted);
+    }
+
+    iterator end() const
+    {
+        return iterator(query, query->entity_lists.size(), include_deleted);
+    }
+
+    /**
+     * Returns the number of entities in the range.
+     *
+     * Unless deleted entities are included, this needs to walk the whole range.
+     */
+    size_t size() const
+    {
+        size_t count = 0;
+        if (include_deleted)
+        {
+            for (const auto *entities : query->entity_lists)
+                count += entities->size();
+        }
+        else
+        {
+            for (auto it = begin(); it != end(); ++it)
+                ++count;
+        }
+        return count;
+    }
+
+    bool empty() const
+    {
+        return begin() == end();
+    }
+
+private:
+    const __lz::Query *query;
+    bool include_deleted;
+};
+
+/**
+ * Persistent query over the entities which hold all the given component types.
+ *
+ * Views are obtained from ECSEngine::view(). The matching entities are cached by the
+ * engine and updated as components are added and removed, so iterating over a view
+ * only visits the entities that match.
+ *
+ * A type can be wrapped in Changed<T> to only visit the entities whose component of
+ * type T was added or changed at or after the tick of the view, which is the tick
+ * following the last run of the updateable creating the view. Components are changed when
+ * added, when accessed through a non-const Entity::get(), or when visited by a view
+ * with write access to them, that is, with a non-const component type. Views with
+ * Changed<T> filters can only be iterated with each() and parallel_each().
+ *
+ * @tparam Types The component types the entities must hold.
+ *
+ * @see ECSEngine::view
+ */
+template <typename... Types>
+class View
+{
+public:
+    View(__lz::ComponentStorage &storage,
+         const __lz::Query &query,
+         bool include_deleted = false,
+         ChangeTick since_tick = 0)
+        : storage(&storage)
+        , query(&query)
+        , include_deleted(include_deleted)
+        , since_tick(since_tick)
+    {
+    }
+
+    /**
+     * Returns a copy of the view whose Changed<T> filters match the components
+     * changed at or after the given tick.
+     *
+     * @see ECSEngine::get_change_tick
+     */
+    View since(ChangeTick tick) const
+    {
+        View view = *this;
+        view.since_tick = tick;
+        return view;
+    }
+
+    /**
+     * Calls the function on each entity of the view, passing the entity and pointers
+     * to each of its components of the view's types.
+     *
+     * Adding or removing components or entities from the function throws an
+     * exception.
+     */
+    template <typename Func>
+    void each(Func &&func) const;
+
+    /**
+     * Calls the function on each entity of the view like each(), splitting the
+     * entities in ranges of at most grain_size entities which are processed
+     * concurrently by the thread pool.
+     *
+     * Every entity is visited exactly once, but the function may be called from
+     * several threads at the same time. Entities may be marked for deletion, but
+     * the storage must be frozen so that no components or entities are added or
+     * removed until the call returns.
+     */
+    template <typename Func>
+    void parallel_each(__lz::ThreadPool &pool, size_t grain_size, Func &&func) const
+    {
+        __lz::NoTaskHooks hooks;
+        parallel_each(pool, grain_size, func, hooks);
+    }
+
+    /**
+     * Calls the function on each entity of the view like parallel_each(), calling
+     * the hooks of the tasks the entities are split in.
+     *
+     * @see __lz::NoTaskHooks
+     */
+    template <typename Func, typename Hooks>
+    void parallel_each(__lz::ThreadPool &pool,
+                       size_t grain_size,
+                       Func &&func,
+                       Hooks &hooks) const;
+
+    EntityRange::iterator begin() const
+    {
+        return EntityRange(*this).begin();
+    }
+
+    EntityRange::iterator end() const
+    {
+        return EntityRange(*this).end();
+    }
+
+    /**
+     * Returns the number of entities in the view.
+     *
+     * @see EntityRange::size
+     */
+    size_t size() const
+    {
+        return EntityRange(*this).size();
+    }
+
+    operator EntityRange() const
+    {
+        static_assert(!filtered,
+                      "Views with Changed<T> filters can only be iterated with each()");
+        return EntityRange(*query, include_deleted);
+    }
+
+private:
+    static constexpr bool filtered = (__lz::is_changed_filter<Types> || ...);
+
+    /**
+     * Returns the change ticks of a pass over the view.
+     */
+    __lz::TickPass<sizeof...(Types)> get_pass() const
+    {
+        return {since_tick,
+                storage->get_change_tick(),
+                {(__lz::writes_component<Types> &&
+                  storage->is_tracked(
+                      __lz::get_component_id<__lz::component_of<Types>>()))...}};
+    }
+
+    __lz::ComponentStorage *storage;
+    const __lz::Query *query;
+    bool include_deleted;
+    ChangeTick since_tick;
+};
+
+template <typename... Types>
+template <typename Func>
+void View<Types...>::each(Func &&func) const
+{
+    auto visit = [&](Entity *entity, __lz::component_of<Types> *... components) {
+        if (include_deleted || !entity->is_deleted())
+            func(entity, components...);
+    };
+
+    auto pass = get_pass();
+    __lz::ComponentStorage::PassScope scope(*storage);
+    switch (storage->get_backend())
+    {
+    case StorageBackend::Archetype:
+        __lz::ArchetypeStorage::each<Types...>(
+            static_cast<const __lz::ArchetypeQuery &>(*query), pass, visit);
+        break;
+    case StorageBackend::SparseSet:
+        static_cast<__lz::SparseSetStorage *>(storage)->each<Types...>(
+            static_cast<const __lz::SparseSetQuery &>(*query), pass, visit);
+        break;
+    }
+}
+
+template <typename... Types>
+template <typename Func, typename Hooks>
+void View<Types...>::parallel_each(__lz::ThreadPool &pool,
+                                   size_t grain_size,
+                                   Func &&func,
+                                   Hooks &hooks) const
+{
+    auto visit = [&](Entity *entity, __lz::component_of<Types> *... components) {
+        if (include_deleted || !entity->is_deleted())
+            func(entity, components...);
+    };
+
+    auto pass = get_pass();
+    grain_size = std::max<size_t>(grain_size, 1);
+    switch (storage->get_backend())
+    {
+    case StorageBackend::Archetype:
+    {
+        // Tasks must not copy shared chunks concurrently
+        if constexpr ((__lz::writes_component<Types> || ...))
+            static_cast<__lz::ArchetypeStorage *>(storage)->unshare_chunks();
+        auto ranges = __lz::ArchetypeStorage::split(
+            static_cast<const __lz::ArchetypeQuery &>(*query), grain_size);
+        hooks.prepare(ranges.size());
+        pool.parallel_for(ranges.size(), [&](size_t task) {
+            [[maybe_unused]] auto scope = hooks.enter(task);
+            __lz::ArchetypeStorage::each<Types...>(ranges[task], pass, visit);
+        });
+        break;
+    }
+    case StorageBackend::SparseSet:
+    {
+        auto *sparse_set = static_cast<__lz::SparseSetStorage *>(storage);
+        const auto &sparse_query = static_cast<const __lz::SparseSetQuery &>(*query);
+        size_t count = sparse_query.entities.size();
+        size_t tasks = (count + grain_size - 1) / grain_size;
+        hooks.prepare(tasks);
+        pool.parallel_for(tasks, [&](size_t task) {
+            [[maybe_unused]] auto scope = hooks.enter(task);
+            size_t begin = task * grain_size;
+            sparse_set->each<Types...>(
+                sparse_query, begin, std::min(begin + grain_size, count), pass, visit);
+        });
+        break;
+    }
+    }
+}
+}  // namespace lz
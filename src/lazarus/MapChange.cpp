@@ -0,0 +1,120 @@
+#include <lazarus/MapChange.h>
+#include <lazarus/SquareGridMap.h>
+#include <lazarus/common.h>
+
+#include <algorithm>
+
+using namespace lz;
+
+bool MapChange::intersects(const Position2D &top_left,
+                           const Position2D &bottom_right) const
+{
+    return left <= bottom_right.x && top_left.x <= right && top <= bottom_right.y &&
+           top_left.y <= bottom;
+}
+
+__lz::ChangeLog::ChangeLog(bool keep_history)
+    : keep_history(keep_history)
+{
+}
+
+__lz::ChangeLog::ChangeLog(const ChangeLog &other)
+    : generation(other.generation)
+    , keep_history(other.keep_history)
+    , history(other.history)
+{
+}
+
+__lz::ChangeLog &__lz::ChangeLog::operator=(const ChangeLog &other)
+{
+    generation = other.generation;
+    keep_history = other.keep_history;
+    history = other.history;
+    listeners.clear();
+    return *this;
+}
+
+void __lz::ChangeLog::record(MapChange change)
+{
+    change.generation = ++generation;
+    if (keep_history)
+    {
+        // Drop the oldest half at once, so that keeping them is constant on average
+        if (history.size() == 2 * HISTORY)
+            history.erase(history.begin(), history.begin() + HISTORY);
+        history.push_back(change);
+    }
+
+    if (listeners.empty())
+        return;
+    // The list is indexed on every step, as listeners may subscribe others and
+    // reallocate it. Those are appended after the initial count.
+    ++dispatching;
+    size_t count = listeners.size();
+    try
+    {
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            if (!listeners[idx].removed)
+                (*listeners[idx].function)(change);
+        }
+    }
+    catch (...)
+    {
+        end_dispatch();
+        throw;
+    }
+    end_dispatch();
+}
+
+bool __lz::ChangeLog::get_changes_since(uint64_t since,
+                                        std::vector<MapChange> &out) const
+{
+    if (since > generation)
+        throw LazarusException("Tried to get changes from a future generation.");
+    if (since == generation)
+        return true;
+    // The change right after the given generation must still be kept
+    if (history.empty() || history.front().generation > since + 1)
+        return false;
+    out.insert(out.end(), history.end() - (generation - since), history.end());
+    return true;
+}
+
+size_t __lz::ChangeLog::subscribe(MapChangeListener listener)
+{
+    listeners.push_back({next_listener_id,
+                         std::make_unique<MapChangeListener>(std::move(listener)),
+                         false});
+    return next_listener_id++;
+}
+
+void __lz::ChangeLog::unsubscribe(size_t id)
+{
+    if (dispatching > 0)
+    {
+        // Listeners are only marked, as the one removed may be the one being called
+        for (Listener &listener : listeners)
+        {
+            if (listener.id == id)
+            {
+                listener.removed = true;
+                needs_compaction = true;
+            }
+        }
+        return;
+    }
+    auto has_id = [&](const Listener &listener) { return listener.id == id; };
+    listeners.erase(std::remove_if(listeners.begin(), listeners.end(), has_id),
+                    listeners.end());
+}
+
+void __lz::ChangeLog::end_dispatch()
+{
+    if (--dispatching > 0 || !needs_compaction)
+        return;
+    auto is_removed = [](const Listener &listener) { return listener.removed; };
+    listeners.erase(std::remove_if(listeners.begin(), listeners.end(), is_removed),
+                    listeners.end());
+    needs_compaction = false;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace lz
+{
+struct Position2D;
+
+/**
+ * Change made to a rectangle of tiles of a map.
+ *
+ * The rectangle holds every tile changed, but may also hold tiles which were left
+ * as they were. The flags tell which properties of the tiles may have changed.
+ */
+struct MapChange
+{
+    /**
+     * Returns whether the rectangle changed overlaps the rectangle between the given
+     * corners, both included.
+     */
+    bool intersects(const Position2D &top_left, const Position2D &bottom_right) const;
+
+    long left, top, right, bottom;  // Corners of the rectangle, both included
+    uint64_t generation;  // Generation of the map after the change
+    bool costs;
+    bool walkability;
+    bool transparency;
+};
+
+/**
+ * Function called with each change made to a map.
+ */
+using MapChangeListener = std::function<void(const MapChange &change)>;
+}  // namespace lz
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Record of the changes made to a map, with its generation, the last changes and the
+ * listeners subscribed to them.
+ *
+ * Copies have the generation and the changes of the original, but no listeners, since
+ * these were subscribed to the original map.
+ *
+ * Logs may also keep no changes, only counting the generations, for maps which
+ * nobody queries, like the chunks of a ChunkedGridMap.
+ */
+class ChangeLog
+{
+public:
+    /**
+     * Number of changes kept to be queried.
+     */
+    static constexpr size_t HISTORY = 1024;
+
+    ChangeLog() = default;
+
+    explicit ChangeLog(bool keep_history);
+
+    ChangeLog(const ChangeLog &other);
+
+    ChangeLog &operator=(const ChangeLog &other);
+
+    ChangeLog(ChangeLog &&) = default;
+
+    ChangeLog &operator=(ChangeLog &&) = default;
+
+    uint64_t get_generation() const
+    {
+        return generation;
+    }
+
+    /**
+     * Gives the change the next generation, keeps it and passes it to the listeners.
+     *
+     * Listeners may subscribe and unsubscribe others while they are called. Those
+     * subscribed then are not called with the change, and those unsubscribed are
+     * not called anymore.
+     */
+    void record(lz::MapChange change);
+
+    bool get_changes_since(uint64_t since, std::vector<lz::MapChange> &out) const;
+
+    size_t subscribe(lz::MapChangeListener listener);
+
+    void unsubscribe(size_t id);
+
+private:
+    struct Listener
+    {
+        size_t id;
+        std::unique_ptr<lz::MapChangeListener> function;  // Doesn't move when called
+        bool removed;  // Unsubscribed while the listeners were called
+    };
+
+    void end_dispatch();
+
+    uint64_t generation = 0;
+    bool keep_history = true;
+    std::vector<lz::MapChange> history;  // From the oldest to the newest
+    std::vector<Listener> listeners;
+    size_t next_listener_id = 0;
+    size_t dispatching = 0;  // Number of changes being passed to the listeners
+    bool needs_compaction = false;  // Whether listeners were removed while called
+};
+}  // namespace __lz
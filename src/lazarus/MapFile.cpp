@@ -0,0 +1,200 @@
+#include <lazarus/MapFile.h>
+#include <lazarus/common.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LZ_HAS_MMAP
+#endif
+
+using namespace lz;
+
+/*
+ * Layout of a map file, with every field in the byte order of the machine:
+ *
+ *   Header
+ *   Padding to LAYER_ALIGN, float cost of each tile, row by row
+ *   Padding to LAYER_ALIGN, walkable mask as uint64 words, each row padded to words
+ *   Padding to LAYER_ALIGN, transparent mask, laid out as the walkable one
+ */
+namespace
+{
+constexpr char MAGIC[8] = {'L', 'Z', 'G', 'R', 'I', 'D', 'M', 'P'};
+constexpr std::uint32_t VERSION = 1;
+constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+constexpr size_t LAYER_ALIGN = 64;
+
+struct Header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t diagonals;
+    std::uint32_t padding;
+    std::uint64_t width;
+    std::uint64_t height;
+};
+
+// Offsets of the layers of a map file, and its size
+struct Layout
+{
+    size_t tiles, words;  // Of each layer
+    size_t costs, walkable, transparent, end;
+};
+
+size_t align_up(size_t offset)
+{
+    return (offset + LAYER_ALIGN - 1) / LAYER_ALIGN * LAYER_ALIGN;
+}
+
+Layout get_layout(std::uint64_t width, std::uint64_t height)
+{
+    // Bounded so that none of the sizes below overflows
+    constexpr std::uint64_t max_tiles = std::numeric_limits<size_t>::max() / 32;
+    if (width == 0 || height == 0 || width > max_tiles / height)
+        throw __lz::LazarusException("The map file has invalid dimensions.");
+
+    Layout layout;
+    layout.tiles = width * height;
+    layout.words = (width + 63) / 64 * height;
+    layout.costs = align_up(sizeof(Header));
+    layout.walkable = align_up(layout.costs + layout.tiles * sizeof(float));
+    layout.transparent = align_up(layout.walkable + layout.words * sizeof(uint64_t));
+    layout.end = layout.transparent + layout.words * sizeof(uint64_t);
+    return layout;
+}
+
+void write_padding(std::ostream &out, size_t from, size_t to)
+{
+    static const char zeros[LAYER_ALIGN] = {};
+    out.write(zeros, to - from);
+}
+}  // namespace
+
+void MapFile::save(const SquareGridMap &map, const std::string &path)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw __lz::LazarusException("Couldn't open the map file " + path +
+                                     " for writing.");
+    save(map, out);
+    out.close();
+    if (!out)
+        throw __lz::LazarusException("Couldn't write the map file " + path + ".");
+}
+
+void MapFile::save(const SquareGridMap &map, std::ostream &out)
+{
+    Header header{{}, VERSION, BYTE_ORDER_MARK, map.diagonals, 0, map.width, map.height};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    Layout layout = get_layout(map.width, map.height);
+
+    // Every layer is written as it is kept in memory, one after the other
+    out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    write_padding(out, sizeof(Header), layout.costs);
+    out.write(reinterpret_cast<const char *>(map.costs.data()),
+              layout.tiles * sizeof(float));
+    write_padding(out, layout.costs + layout.tiles * sizeof(float), layout.walkable);
+    out.write(reinterpret_cast<const char *>(map.walkable_tiles.words.data()),
+              layout.words * sizeof(uint64_t));
+    write_padding(
+        out, layout.walkable + layout.words * sizeof(uint64_t), layout.transparent);
+    out.write(reinterpret_cast<const char *>(map.transparent_tiles.words.data()),
+              layout.words * sizeof(uint64_t));
+    if (!out)
+        throw __lz::LazarusException("Couldn't write the map file.");
+}
+
+SquareGridMap MapFile::open(const std::string &path)
+{
+#ifdef LZ_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw __lz::LazarusException("Couldn't open the map file " + path + ".");
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        throw __lz::LazarusException("Couldn't read the map file " + path + ".");
+    }
+    size_t size = info.st_size;
+    void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);  // The mapping stays valid without the descriptor
+    if (address == MAP_FAILED)
+        throw __lz::LazarusException("Couldn't map the map file " + path + ".");
+
+    std::shared_ptr<const void> mapping(address, [size](const void *address) {
+        munmap(const_cast<void *>(address), size);
+    });
+    return view(static_cast<const char *>(address), size, std::move(mapping));
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw __lz::LazarusException("Couldn't open the map file " + path + ".");
+    auto contents = std::make_shared<std::vector<char>>(
+        std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return view(contents->data(), contents->size(), contents);
+#endif
+}
+
+SquareGridMap MapFile::load(std::istream &in)
+{
+    auto contents = std::make_shared<std::vector<char>>(
+        std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (in.bad())
+        throw __lz::LazarusException("Couldn't read the map file.");
+    // Copies of read-only maps own their tiles
+    SquareGridMap map = view(contents->data(), contents->size(), contents);
+    return SquareGridMap(map);
+}
+
+SquareGridMap MapFile::view(const char *data,
+                            size_t size,
+                            std::shared_ptr<const void> owner)
+{
+    Header header;
+    if (size < sizeof(Header))
+        throw __lz::LazarusException("The map file is truncated.");
+    std::memcpy(&header, data, sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        throw __lz::LazarusException("The file is not a map file.");
+    if (header.version != VERSION || header.byte_order != BYTE_ORDER_MARK)
+        throw __lz::LazarusException(
+            "The map file was saved in a version or byte order not supported.");
+    Layout layout = get_layout(header.width, header.height);
+    if (size < layout.end)
+        throw __lz::LazarusException("The map file is truncated.");
+    // The layers are read in place, so they must be aligned as in memory
+    if (reinterpret_cast<std::uintptr_t>(data) % alignof(uint64_t) != 0)
+        throw __lz::LazarusException("The map file is not aligned in memory.");
+
+    __lz::TileBuffer<float> costs(
+        reinterpret_cast<const float *>(data + layout.costs), layout.tiles, owner);
+    auto words = [&](size_t offset) {
+        return __lz::TileBuffer<uint64_t>(
+            reinterpret_cast<const uint64_t *>(data + offset), layout.words, owner);
+    };
+    TileMask walkable(header.width, header.height, words(layout.walkable));
+    TileMask transparent(header.width, header.height, words(layout.transparent));
+    // Set padding bits would be counted as tiles, and break the comparisons of masks
+    if (!walkable.is_padding_clear() || !transparent.is_padding_clear())
+        throw __lz::LazarusException("The file is not a valid map file.");
+    return SquareGridMap(header.width,
+                         header.height,
+                         header.diagonals != 0,
+                         std::move(costs),
+                         std::move(walkable),
+                         std::move(transparent));
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <lazarus/SquareGridMap.h>
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+namespace lz
+{
+/**
+ * Binary file format for square grid maps, holding the costs, the walkability and the
+ * transparency of their tiles as they are kept in memory.
+ *
+ * The layers of a map file are laid out and aligned as the map keeps them, so that
+ * opening a file maps it in memory and views it as a read-only map without reading
+ * or copying it: its pages are only read when the tiles in them are accessed.
+ *
+ * Files are written in the byte order of the machine, and can only be opened on
+ * machines with the same byte order. The format is versioned, and files of other
+ * versions are rejected.
+ */
+class MapFile
+{
+public:
+    MapFile() = delete;
+
+    /**
+     * Writes the map to the file at the given path, replacing it if it exists.
+     *
+     * @throws LazarusException If the file can't be written.
+     */
+    static void save(const SquareGridMap &map, const std::string &path);
+
+    /**
+     * Writes the map to the given stream.
+     *
+     * @throws LazarusException If the stream fails.
+     */
+    static void save(const SquareGridMap &map, std::ostream &out);
+
+    /**
+     * Opens the map file at the given path as a read-only map, which views the file
+     * mapped in memory. The mapping is released when the map and the maps moved from
+     * it are destroyed, and the file must not be modified until then.
+     *
+     * On systems without memory mapping, the file is read into memory instead. The
+     * last word of each row of the masks is read to validate the file.
+     *
+     * @throws LazarusException If the file can't be read or is not a valid map file.
+     */
+    static SquareGridMap open(const std::string &path);
+
+    /**
+     * Reads a map written with save() from the given stream. Unlike open(), the map
+     * is read into memory and can be modified.
+     *
+     * @throws LazarusException If the stream fails or does not hold a valid map file.
+     */
+    static SquareGridMap load(std::istream &in);
+
+private:
+    // Returns a read-only map viewing the map file at data, kept in memory by owner
+    static SquareGridMap view(const char *data,
+                              size_t size,
+                              std::shared_ptr<const void> owner);
+};
+}  // namespace lz
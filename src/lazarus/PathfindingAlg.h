@@ -7,12 +7,47 @@
 #include <map>
 #include <queue>
 #include <set>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace __lz  // Meant for internal use only
 {
 template <typename Position>
 using QueuePair = std::pair<float, Position>;
+
+template <typename Map, typename Position, typename = void>
+struct HasForEachNeighbour : std::false_type
+{
+};
+
+template <typename Map, typename Position>
+struct HasForEachNeighbour<
+    Map,
+    Position,
+    std::void_t<decltype(std::declval<const Map &>().for_each_neighbour(
+        std::declval<const Position &>(), std::declval<void (*)(const Position &)>()))>>
+    : std::true_type
+{
+};
+
+/**
+ * Calls func with each neighbour of the position in the map, through the method
+ * `for_each_neighbour(const Position&, Func)` of the map if it has one, which
+ * doesn't allocate, or else through the list returned by `neighbours(const
+ * Position&)`.
+ */
+template <typename Map, typename Position, typename Func>
+void for_each_neighbour(const Map &map, const Position &pos, Func &&func)
+{
+    if constexpr (HasForEachNeighbour<Map, Position>::value)
+        map.for_each_neighbour(pos, func);
+    else
+    {
+        for (const Position &neighbour : map.neighbours(pos))
+            func(neighbour);
+    }
+}
 }  // namespace __lz
 
 namespace lz
@@ -1,11 +1,71 @@
 #include <lazarus/SquareGridMap.h>
 #include <lazarus/common.h>
 
-#include <array>
+#include <algorithm>
 #include <sstream>
+#include <utility>
 
 using namespace lz;
 
+namespace
+{
+size_t popcount(uint64_t word)
+{
+#if defined(__clang__) || defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (word * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+// Index of the lowest and highest bits set in a word which is not zero
+size_t lowest_bit(uint64_t word)
+{
+#if defined(__clang__) || defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    size_t bit = 0;
+    while (!((word >> bit) & 1))
+        ++bit;
+    return bit;
+#endif
+}
+
+size_t highest_bit(uint64_t word)
+{
+#if defined(__clang__) || defined(__GNUC__)
+    return 63 - __builtin_clzll(word);
+#else
+    size_t bit = 63;
+    while (!((word >> bit) & 1))
+        --bit;
+    return bit;
+#endif
+}
+
+/*
+ * Calls func(word, bits) for each word of a row holding the tiles from first_x to
+ * last_x, both included, where bits has set the bits of those tiles in the word.
+ */
+template <typename Func>
+void for_each_word(long first_x, long last_x, Func func)
+{
+    size_t first_word = first_x >> 6, last_word = last_x >> 6;
+    for (size_t word = first_word; word <= last_word; ++word)
+    {
+        uint64_t bits = ~0ULL;
+        if (word == first_word)
+            bits &= ~0ULL << (first_x & 63);
+        if (word == last_word)
+            bits &= ~0ULL >> (63 - (last_x & 63));
+        func(word, bits);
+    }
+}
+}  // namespace
+
 void __lz::throw_out_of_bounds_exception(const Position2D &pos)
 {
     std::stringstream msg;
@@ -36,17 +96,210 @@ bool Position2D::operator<(const Position2D &other) const
     return y < other.y;
 }
 
+TileMask::TileMask(unsigned long width, unsigned long height, bool value)
+    : width(width)
+    , height(height)
+    , words_per_row((width + 63) / 64)
+    , words(words_per_row * height, value ? ~0ULL : 0)
+{
+    clear_padding();
+}
+
+TileMask::TileMask(unsigned long width,
+                   unsigned long height,
+                   __lz::TileBuffer<uint64_t> words)
+    : width(width)
+    , height(height)
+    , words_per_row((width + 63) / 64)
+    , words(std::move(words))
+{
+}
+
+void TileMask::set(const Position2D &pos, bool value)
+{
+    // Negative coordinates wrap around to values greater than the dimensions
+    if (static_cast<unsigned long>(pos.x) >= width ||
+        static_cast<unsigned long>(pos.y) >= height)
+        __lz::throw_out_of_bounds_exception(pos);
+
+    uint64_t bit = 1ULL << (pos.x & 63);
+    uint64_t &word = words.mutable_data()[pos.y * words_per_row + (pos.x >> 6)];
+    word = value ? word | bit : word & ~bit;
+}
+
+void TileMask::fill(const Position2D &top_left,
+                    const Position2D &bottom_right,
+                    bool value)
+{
+    if (bottom_right.x < top_left.x || bottom_right.y < top_left.y)
+        return;
+    if (top_left.x < 0 || top_left.y < 0)
+        __lz::throw_out_of_bounds_exception(top_left);
+    if (static_cast<unsigned long>(bottom_right.x) >= width ||
+        static_cast<unsigned long>(bottom_right.y) >= height)
+        __lz::throw_out_of_bounds_exception(bottom_right);
+
+    uint64_t *data = words.mutable_data();
+    for (long y = top_left.y; y <= bottom_right.y; ++y)
+    {
+        uint64_t *row = data + y * words_per_row;
+        for_each_word(top_left.x, bottom_right.x, [&](size_t word, uint64_t bits) {
+            row[word] = value ? row[word] | bits : row[word] & ~bits;
+        });
+    }
+}
+
+size_t TileMask::count() const
+{
+    size_t total = 0;
+    for (size_t idx = 0; idx < words.size(); ++idx)
+        total += popcount(words.data()[idx]);
+    return total;
+}
+
+size_t TileMask::count(const Position2D &top_left, const Position2D &bottom_right) const
+{
+    long first_x = std::max(top_left.x, 0L);
+    long first_y = std::max(top_left.y, 0L);
+    long last_x = std::min(bottom_right.x, static_cast<long>(width) - 1);
+    long last_y = std::min(bottom_right.y, static_cast<long>(height) - 1);
+    if (last_x < first_x || last_y < first_y)
+        return 0;
+
+    size_t total = 0;
+    for (long y = first_y; y <= last_y; ++y)
+    {
+        const uint64_t *row = words.data() + y * words_per_row;
+        for_each_word(first_x, last_x, [&](size_t word, uint64_t bits) {
+            total += popcount(row[word] & bits);
+        });
+    }
+    return total;
+}
+
+bool TileMask::find_bounds(Position2D &top_left, Position2D &bottom_right) const
+{
+    bool found = false;
+    long left = static_cast<long>(width), right = -1;
+    for (long y = 0; y < static_cast<long>(height); ++y)
+    {
+        const uint64_t *row = words.data() + y * words_per_row;
+        for (size_t word = 0; word < words_per_row; ++word)
+        {
+            if (row[word] == 0)
+                continue;
+            left = std::min<long>(left, word * 64 + lowest_bit(row[word]));
+            right = std::max<long>(right, word * 64 + highest_bit(row[word]));
+            if (!found)
+                top_left.y = y;
+            bottom_right.y = y;
+            found = true;
+        }
+    }
+    if (found)
+    {
+        top_left.x = left;
+        bottom_right.x = right;
+    }
+    return found;
+}
+
+TileMask &TileMask::operator&=(const TileMask &other)
+{
+    check_same_dimensions(other);
+    uint64_t *data = words.mutable_data();
+    for (size_t idx = 0; idx < words.size(); ++idx)
+        data[idx] &= other.words.data()[idx];
+    return *this;
+}
+
+TileMask &TileMask::operator|=(const TileMask &other)
+{
+    check_same_dimensions(other);
+    uint64_t *data = words.mutable_data();
+    for (size_t idx = 0; idx < words.size(); ++idx)
+        data[idx] |= other.words.data()[idx];
+    return *this;
+}
+
+void TileMask::invert()
+{
+    uint64_t *data = words.mutable_data();
+    for (size_t idx = 0; idx < words.size(); ++idx)
+        data[idx] = ~data[idx];
+    clear_padding();
+}
+
+bool TileMask::operator==(const TileMask &other) const
+{
+    return width == other.width && height == other.height && words == other.words;
+}
+
+bool TileMask::operator!=(const TileMask &other) const
+{
+    return !(*this == other);
+}
+
+void TileMask::check_same_dimensions(const TileMask &other) const
+{
+    if (width != other.width || height != other.height)
+    {
+        std::stringstream msg;
+        msg << "Tile masks of different dimensions (" << width << "x" << height
+            << " and " << other.width << "x" << other.height << ") can't be combined.";
+        throw __lz::LazarusException(msg.str());
+    }
+}
+
+void TileMask::clear_padding()
+{
+    if (width % 64 == 0)
+        return;
+    uint64_t bits = ~0ULL >> (64 - width % 64);
+    uint64_t *data = words.mutable_data();
+    for (size_t row = 0; row < height; ++row)
+        data[row * words_per_row + words_per_row - 1] &= bits;
+}
+
+bool TileMask::is_padding_clear() const
+{
+    if (width % 64 == 0)
+        return true;
+    uint64_t padding = ~0ULL << (width % 64);
+    const uint64_t *data = words.data();
+    for (size_t row = 0; row < height; ++row)
+        if (data[row * words_per_row + words_per_row - 1] & padding)
+            return false;
+    return true;
+}
+
 SquareGridMap::SquareGridMap(unsigned long width, unsigned long height, bool diagonals)
     : diagonals(diagonals)
     , width(width)
     , height(height)
     , costs(width * height, -1.)
-    , transparencies(width * height, false)
+    , walkable_tiles(width, height)
+    , transparent_tiles(width, height)
 {
     if (width == 0 || height == 0)
         throw __lz::LazarusException("SquareGridMap width and height must be positive.");
 }
 
+SquareGridMap::SquareGridMap(unsigned long width,
+                             unsigned long height,
+                             bool diagonals,
+                             __lz::TileBuffer<float> costs,
+                             TileMask walkable_tiles,
+                             TileMask transparent_tiles)
+    : diagonals(diagonals)
+    , width(width)
+    , height(height)
+    , costs(std::move(costs))
+    , walkable_tiles(std::move(walkable_tiles))
+    , transparent_tiles(std::move(transparent_tiles))
+{
+}
+
 SquareGridMap::SquareGridMap(const std::vector<std::vector<int>> &prefab, bool diagonals)
     : diagonals(diagonals)
 {
@@ -63,16 +316,20 @@ SquareGridMap::SquareGridMap(const std::vector<std::vector<int>> &prefab, bool d
     // Generate map from prefab
     // Tiles equal to 0 are walls (non-walkable, non-transparent)
     // The rest is walkable (with cost 1) and transparent
-    costs = std::vector<float>(width * height, -1.);
-    transparencies = std::vector<bool>(width * height, false);
+    // The tiles are filled directly, so that a new map has no history of changes
+    costs = __lz::TileBuffer<float>(width * height, -1.);
+    walkable_tiles = TileMask(width, height);
+    transparent_tiles = TileMask(width, height);
+    float *tile_costs = costs.mutable_data();
     for (long y = 0; y < height; ++y)
     {
         for (long x = 0; x < width; ++x)
         {
             if (x < prefab[y].size() && prefab[y][x] != 0)
             {
-                set_walkable({x, y}, true);
-                set_transparency({x, y}, true);
+                tile_costs[y * width + x] = 1.;
+                walkable_tiles.set({x, y}, true);
+                transparent_tiles.set({x, y}, true);
             }
         }
     }
@@ -88,28 +345,29 @@ unsigned long SquareGridMap::get_height() const
     return height;
 }
 
+bool SquareGridMap::is_read_only() const
+{
+    return costs.is_read_only();
+}
+
 bool SquareGridMap::is_walkable(const Position2D &pos) const
 {
-    if (is_out_of_bounds(pos))
-        return false;  // TODO: Log this case
-    return costs[pos.y * width + pos.x] >= 0.;
+    return walkable_tiles.test(pos.x, pos.y);  // TODO: Log out of bounds positions
 }
 
 bool SquareGridMap::is_walkable(long x, long y) const
 {
-    return is_walkable(Position2D(x, y));
+    return walkable_tiles.test(x, y);
 }
 
 bool SquareGridMap::is_transparent(const Position2D &pos) const
 {
-    if (is_out_of_bounds(pos))
-        return false;  // TODO: Log this case
-    return transparencies[pos.y * width + pos.x];
+    return transparent_tiles.test(pos.x, pos.y);  // TODO: Log out of bounds positions
 }
 
 bool SquareGridMap::is_transparent(long x, long y) const
 {
-    return is_transparent(Position2D(x, y));
+    return transparent_tiles.test(x, y);
 }
 
 bool SquareGridMap::is_out_of_bounds(const Position2D &pos) const
@@ -138,7 +396,7 @@ float SquareGridMap::get_cost(const Position2D &pos) const
         throw __lz::LazarusException(msg.str());
     }
 
-    return costs[pos.y * width + pos.x];
+    return costs.data()[pos.y * width + pos.x];
 }
 
 float SquareGridMap::get_cost(long x, long y) const
@@ -148,38 +406,11 @@ float SquareGridMap::get_cost(long x, long y) const
 
 std::vector<Position2D> SquareGridMap::neighbours(const Position2D &pos) const
 {
-    if (is_out_of_bounds(pos))
-        // TODO: Log this case
-        __lz::throw_out_of_bounds_exception(pos);
-
     std::vector<Position2D> result;
-    long x = pos.x, y = pos.y;
-
-    std::array<Position2D, 4> neighbour_positions{Position2D(x - 1, y),
-                                                  Position2D(x + 1, y),
-                                                  Position2D(x, y - 1),
-                                                  Position2D(x, y + 1)};
-
-    for (Position2D neighbour : neighbour_positions)
-    {
-        if (is_walkable(neighbour))
-            result.push_back(neighbour);
-    }
-
-    if (diagonals)
-    {
-        std::array<Position2D, 4> diagonal_positions{Position2D(x - 1, y - 1),
-                                                     Position2D(x + 1, y + 1),
-                                                     Position2D(x + 1, y - 1),
-                                                     Position2D(x - 1, y + 1)};
-
-        for (Position2D neighbour : diagonal_positions)
-        {
-            if (is_walkable(neighbour))
-                result.push_back(neighbour);
-        }
-    }
-
+    result.reserve(diagonals ? 8 : 4);
+    for_each_neighbour(pos, [&](const Position2D &neighbour) {
+        result.push_back(neighbour);
+    });
     return result;
 }
 
@@ -196,7 +427,17 @@ void SquareGridMap::set_cost(const Position2D &pos, float cost)
         __lz::throw_out_of_bounds_exception(pos);
     }
 
-    costs[pos.y * width + pos.x] = cost;
+    float &tile_cost = costs.mutable_data()[pos.y * width + pos.x];
+    bool was_walkable = walkable_tiles.test_in_bounds(pos.x, pos.y);
+    bool walkable = cost >= 0.;
+    // The costs of unwalkable tiles don't matter
+    bool cost_changed = walkable && (!was_walkable || tile_cost != cost);
+    tile_cost = cost;
+    if (walkable == was_walkable && !cost_changed)
+        return;
+    walkable_tiles.set(pos, walkable);
+    changes.record(
+        {pos.x, pos.y, pos.x, pos.y, 0, cost_changed, walkable != was_walkable, false});
 }
 
 void SquareGridMap::set_cost(long x, long y, float cost)
@@ -224,7 +465,10 @@ void SquareGridMap::set_transparency(const Position2D &pos, bool transparent)
         __lz::throw_out_of_bounds_exception(pos);
     }
 
-    transparencies[pos.y * width + pos.x] = transparent;
+    bool was_transparent = transparent_tiles.test_in_bounds(pos.x, pos.y);
+    transparent_tiles.set(pos, transparent);
+    if (transparent != was_transparent)
+        changes.record({pos.x, pos.y, pos.x, pos.y, 0, false, false, true});
 }
 
 void SquareGridMap::set_transparency(long x, long y, bool transparent)
@@ -236,13 +480,103 @@ void SquareGridMap::carve_room(const Position2D &top_left,
                                const Position2D &bottom_right,
                                float cost)
 {
-    for (long x = top_left.x; x <= bottom_right.x; ++x)
+    // Filling the masks first checks the corners before anything changes
+    walkable_tiles.fill(top_left, bottom_right, cost >= 0.);
+    transparent_tiles.fill(top_left, bottom_right, true);
+    float *data = costs.mutable_data();
+    for (long y = top_left.y; y <= bottom_right.y; ++y)
     {
-        for (long y = top_left.y; y <= bottom_right.y; ++y)
-        {
-            Position2D pos(x, y);
-            set_cost(pos, cost);
-            set_transparency(pos, true);
-        }
+        for (long x = top_left.x; x <= bottom_right.x; ++x)
+            data[y * width + x] = cost;
     }
+    if (bottom_right.x >= top_left.x && bottom_right.y >= top_left.y)
+        changes.record({top_left.x,
+                        top_left.y,
+                        bottom_right.x,
+                        bottom_right.y,
+                        0,
+                        cost >= 0.,
+                        true,
+                        true});
+}
+
+size_t SquareGridMap::count_walkable(const Position2D &top_left,
+                                     const Position2D &bottom_right) const
+{
+    return walkable_tiles.count(top_left, bottom_right);
+}
+
+size_t SquareGridMap::count_transparent(const Position2D &top_left,
+                                        const Position2D &bottom_right) const
+{
+    return transparent_tiles.count(top_left, bottom_right);
+}
+
+const TileMask &SquareGridMap::get_walkable_mask() const
+{
+    return walkable_tiles;
+}
+
+const TileMask &SquareGridMap::get_transparent_mask() const
+{
+    return transparent_tiles;
+}
+
+void SquareGridMap::mask_walkable(const TileMask &mask)
+{
+    TileMask removed = mask;
+    removed.invert();
+    removed &= walkable_tiles;
+    walkable_tiles &= mask;
+
+    Position2D top_left(0, 0), bottom_right(0, 0);
+    if (removed.find_bounds(top_left, bottom_right))
+        changes.record({top_left.x,
+                        top_left.y,
+                        bottom_right.x,
+                        bottom_right.y,
+                        0,
+                        false,
+                        true,
+                        false});
+}
+
+void SquareGridMap::mask_transparency(const TileMask &mask)
+{
+    TileMask removed = mask;
+    removed.invert();
+    removed &= transparent_tiles;
+    transparent_tiles &= mask;
+
+    Position2D top_left(0, 0), bottom_right(0, 0);
+    if (removed.find_bounds(top_left, bottom_right))
+        changes.record({top_left.x,
+                        top_left.y,
+                        bottom_right.x,
+                        bottom_right.y,
+                        0,
+                        false,
+                        false,
+                        true});
+}
+
+uint64_t SquareGridMap::get_generation() const
+{
+    return changes.get_generation();
+}
+
+bool SquareGridMap::get_changes_since(uint64_t generation,
+                                      std::vector<MapChange> &changes) const
+{
+    return this->changes.get_changes_since(generation, changes);
+}
+
+size_t SquareGridMap::subscribe(MapChangeListener listener)
+{
+    return changes.subscribe(std::move(listener));
+}
+
+void SquareGridMap::unsubscribe(size_t id)
+{
+    changes.unsubscribe(id);
 }
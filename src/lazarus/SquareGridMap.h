@@ -1,5 +1,10 @@
 #pragma once
 
+#include <lazarus/MapChange.h>
+#include <lazarus/TileBuffer.h>
+
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 namespace lz
@@ -27,6 +32,146 @@ struct Position2D
     long x, y;
 };
 
+/**
+ * Grid of bits with one bit per tile, used to hold a boolean property of the tiles
+ * of a map, like their walkability or transparency.
+ *
+ * Bits are packed in 64-bit words, and each row starts at a new word, so that
+ * testing a tile takes a shift and a mask, and operations over whole masks or
+ * rectangles of tiles handle 64 tiles at a time. The bits of the padding at the end
+ * of each row are always zero.
+ */
+class TileMask
+{
+public:
+    /**
+     * Constructs an empty mask, with no tiles.
+     */
+    TileMask() = default;
+
+    /**
+     * Constructs a mask of the given dimensions with all its tiles set to the given
+     * value.
+     */
+    TileMask(unsigned long width, unsigned long height, bool value = false);
+
+    unsigned long get_width() const
+    {
+        return width;
+    }
+
+    unsigned long get_height() const
+    {
+        return height;
+    }
+
+    /**
+     * Returns whether the tile at the given position is set, or `false` if the
+     * position is out of the boundaries of the mask.
+     */
+    bool test(long x, long y) const
+    {
+        // Negative coordinates wrap around to values greater than the dimensions
+        if (static_cast<unsigned long>(x) >= width ||
+            static_cast<unsigned long>(y) >= height)
+            return false;
+        return (words.data()[y * words_per_row + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    bool test(const Position2D &pos) const
+    {
+        return test(pos.x, pos.y);
+    }
+
+    /**
+     * Same as test(long, long) const, for positions which are known to be within
+     * the boundaries of the mask.
+     */
+    bool test_in_bounds(long x, long y) const
+    {
+        return (words.data()[y * words_per_row + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    /**
+     * Sets the tile at the given position to the given value.
+     *
+     * @throws LazarusException If the position is outside of the boundaries of the
+     * mask.
+     */
+    void set(const Position2D &pos, bool value);
+
+    /**
+     * Sets all the tiles in the rectangle between the two corners, both included, to
+     * the given value. Nothing changes if a coordinate of the bottom-right corner is
+     * less than the top-left one.
+     *
+     * @throws LazarusException If the rectangle is not empty and a corner is outside
+     * of the boundaries of the mask.
+     */
+    void fill(const Position2D &top_left, const Position2D &bottom_right, bool value);
+
+    /**
+     * Returns the number of tiles which are set.
+     */
+    size_t count() const;
+
+    /**
+     * Returns the number of tiles which are set in the rectangle between the two
+     * corners, both included. The parts of the rectangle out of the boundaries of
+     * the mask are ignored.
+     */
+    size_t count(const Position2D &top_left, const Position2D &bottom_right) const;
+
+    /**
+     * Finds the smallest rectangle which holds all the tiles which are set.
+     *
+     * @return `false` if no tile is set, in which case the corners are left as they
+     * were.
+     */
+    bool find_bounds(Position2D &top_left, Position2D &bottom_right) const;
+
+    /**
+     * Keeps set only the tiles which are also set in the other mask.
+     *
+     * @throws LazarusException If the masks have different dimensions.
+     */
+    TileMask &operator&=(const TileMask &other);
+
+    /**
+     * Sets the tiles which are set in the other mask.
+     *
+     * @throws LazarusException If the masks have different dimensions.
+     */
+    TileMask &operator|=(const TileMask &other);
+
+    /**
+     * Flips the value of every tile.
+     */
+    void invert();
+
+    bool operator==(const TileMask &other) const;
+
+    bool operator!=(const TileMask &other) const;
+
+private:
+    // Mask with the given words, with the rows padded to whole words
+    TileMask(unsigned long width, unsigned long height, __lz::TileBuffer<uint64_t> words);
+
+    void check_same_dimensions(const TileMask &other) const;
+
+    // Clears the padding bits at the end of each row
+    void clear_padding();
+
+    // Returns whether the padding bits at the end of each row are all clear
+    bool is_padding_clear() const;
+
+    unsigned long width = 0, height = 0;
+    size_t words_per_row = 0;
+    __lz::TileBuffer<uint64_t> words;
+
+    friend class MapFile;
+};
+
 /**
  * Defines a map consisting of square tiles in a rectangular grid.
  *
@@ -45,6 +190,9 @@ struct Position2D
  * primarily used by FOV algorithms, to determine which tiles an entity can see. A
  * non-transparent tile will be visible, but will block light, so no tiles behind it will
  * be visible when casting a light ray.
+ *
+ * Walkability and transparency are kept in a TileMask each, next to the costs of the
+ * tiles, so they can be checked and combined with other masks cheaply.
  */
 class SquareGridMap
 {
@@ -83,6 +231,13 @@ public:
      */
     unsigned long get_height() const;
 
+    /**
+     * Returns whether the map is a read-only view of a map file, opened with
+     * MapFile::open(). Trying to modify a read-only map throws a LazarusException,
+     * but copies of it can be modified.
+     */
+    bool is_read_only() const;
+
     /**
      * Returns whether the tile at the given position is walkable.
      *
@@ -268,7 +423,7 @@ public:
      *
      * @see neighbours(long, long) const
      */
-    virtual std::vector<Position2D> neighbours(const Position2D &pos) const;
+    std::vector<Position2D> neighbours(const Position2D &pos) const;
 
     /**
      * Overloaded version of @ref neighbours(const Position2D& pos) const
@@ -279,7 +434,21 @@ public:
      *
      * @see neighbours(const Position2D& pos) const
      */
-    virtual std::vector<Position2D> neighbours(long x, long y) const;
+    std::vector<Position2D> neighbours(long x, long y) const;
+
+    /**
+     * Calls `func(const Position2D&)` for each walkable tile adjacent to the tile at
+     * the given position, in the same order as neighbours(), without allocating.
+     *
+     * The tiles of the interior of the map are checked without bounds checks.
+     *
+     * @param pos A 2D position.
+     * @param func Function to call with each neighbour.
+     *
+     * @throws LazarusException If the position is out of bounds.
+     */
+    template <typename Func>
+    void for_each_neighbour(const Position2D &pos, Func &&func) const;
 
     /**
      * Makes a rectangular area of tiles walkable and transparent.
@@ -295,15 +464,135 @@ public:
                     const Position2D &bottom_right,
                     float cost = 1);
 
+    /**
+     * Returns the number of walkable tiles in the rectangle between the two corners,
+     * both included. The parts of the rectangle out of the boundaries of the map are
+     * ignored.
+     */
+    size_t count_walkable(const Position2D &top_left,
+                          const Position2D &bottom_right) const;
+
+    /**
+     * Returns the number of transparent tiles in the rectangle between the two
+     * corners, both included. The parts of the rectangle out of the boundaries of
+     * the map are ignored.
+     */
+    size_t count_transparent(const Position2D &top_left,
+                             const Position2D &bottom_right) const;
+
+    /**
+     * Returns a mask with the walkable tiles of the map set.
+     */
+    const TileMask &get_walkable_mask() const;
+
+    /**
+     * Returns a mask with the transparent tiles of the map set.
+     */
+    const TileMask &get_transparent_mask() const;
+
+    /**
+     * Makes unwalkable every tile which is not set in the given mask. The tiles
+     * which stay walkable keep their cost.
+     *
+     * @throws LazarusException If the mask and the map have different dimensions.
+     */
+    void mask_walkable(const TileMask &mask);
+
+    /**
+     * Makes non-transparent every tile which is not set in the given mask.
+     *
+     * @throws LazarusException If the mask and the map have different dimensions.
+     */
+    void mask_transparency(const TileMask &mask);
+
+    /**
+     * Returns the generation of the map, a number which grows by one with each change
+     * made to the tiles of the map, starting from zero.
+     *
+     * Consumers which keep results computed from the map, like fields of view or
+     * paths, can keep the generation they were computed at, and later check what
+     * changed since then with get_changes_since().
+     */
+    uint64_t get_generation() const;
+
+    /**
+     * Appends the changes made after the given generation to the vector, from the
+     * oldest to the newest.
+     *
+     * Only the last changes are kept, at least __lz::ChangeLog::HISTORY of them.
+     *
+     * @return `false` if some of the changes after the given generation are no longer
+     * kept, in which case nothing is appended, and anything computed from the map at
+     * that generation should be computed again.
+     *
+     * @throws LazarusException If the generation is greater than the current one.
+     */
+    bool get_changes_since(uint64_t generation, std::vector<MapChange> &changes) const;
+
+    /**
+     * Subscribes a function to the changes made to the map, which is called with
+     * each change right after it is made.
+     *
+     * Setting a tile to the value it already had is not a change. Copies of the map
+     * keep its generation and its changes, but not its subscribers.
+     *
+     * @return An identifier of the subscription, to unsubscribe.
+     */
+    size_t subscribe(MapChangeListener listener);
+
+    /**
+     * Ends the subscription with the given identifier.
+     */
+    void unsubscribe(size_t id);
+
 private:
+    SquareGridMap(unsigned long width,
+                  unsigned long height,
+                  bool diagonals,
+                  __lz::TileBuffer<float> costs,
+                  TileMask walkable_tiles,
+                  TileMask transparent_tiles);
+
     bool diagonals = false;
     unsigned long width, height;
-    std::vector<float> costs;
-    std::vector<bool> transparencies;
+    __lz::TileBuffer<float> costs;  // Only meaningful for walkable tiles
+    TileMask walkable_tiles;
+    TileMask transparent_tiles;
+    __lz::ChangeLog changes;
+
+    friend class ChunkedGridMap;
+    friend class MapFile;
 };
 }  // namespace lz
 
 namespace __lz  // Meant only for internal use
 {
 void throw_out_of_bounds_exception(const lz::Position2D &pos);
+
+// Offsets of the tiles adjacent to a tile, in the order in which maps list them, with
+// the diagonal ones last
+inline constexpr long NEIGHBOUR_OFFSETS[8][2] =
+    {{-1, 0}, {1, 0}, {0, -1}, {0, 1}, {-1, -1}, {1, 1}, {1, -1}, {-1, 1}};
 }  // namespace __lz
+
+namespace lz
+{
+template <typename Func>
+void SquareGridMap::for_each_neighbour(const Position2D &pos, Func &&func) const
+{
+    if (is_out_of_bounds(pos))
+        // TODO: Log this case
+        __lz::throw_out_of_bounds_exception(pos);
+
+    size_t count = diagonals ? 8 : 4;
+    bool interior = pos.x > 0 && pos.y > 0 && pos.x + 1 < static_cast<long>(width) &&
+                    pos.y + 1 < static_cast<long>(height);
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        long x = pos.x + __lz::NEIGHBOUR_OFFSETS[idx][0];
+        long y = pos.y + __lz::NEIGHBOUR_OFFSETS[idx][1];
+        if (interior ? walkable_tiles.test_in_bounds(x, y) : walkable_tiles.test(x, y))
+            func(Position2D(x, y));
+    }
+}
+}  // namespace lz
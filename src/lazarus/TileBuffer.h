@@ -0,0 +1,108 @@
+#pragma once
+
+#include <lazarus/common.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace __lz  // Meant for internal use only
+{
+/**
+ * Array of values for the tiles of a map, which either owns its values or views
+ * values kept in memory by an owner, like a mapped file.
+ *
+ * Views are read-only. Copying a buffer always gives a buffer which owns a copy of
+ * the values, so that copies can be modified, while moving a view keeps it a view.
+ */
+template <typename T>
+class TileBuffer
+{
+public:
+    TileBuffer() = default;
+
+    TileBuffer(size_t size, const T &value)
+        : owned(size, value)
+        , items(owned.data())
+        , count(size)
+    {
+    }
+
+    /**
+     * Constructs a view of the given values, which are kept in memory while the
+     * owner lives.
+     */
+    TileBuffer(const T *items, size_t size, std::shared_ptr<const void> owner)
+        : items(items)
+        , count(size)
+        , owner(std::move(owner))
+    {
+    }
+
+    TileBuffer(const TileBuffer &other)
+        : owned(other.items, other.items + other.count)
+        , items(owned.data())
+        , count(other.count)
+    {
+    }
+
+    TileBuffer(TileBuffer &&other) noexcept
+        : owned(std::move(other.owned))
+        , items(other.items)
+        , count(other.count)
+        , owner(std::move(other.owner))
+    {
+        other.items = nullptr;
+        other.count = 0;
+    }
+
+    TileBuffer &operator=(TileBuffer other) noexcept
+    {
+        std::swap(owned, other.owned);
+        std::swap(items, other.items);
+        std::swap(count, other.count);
+        std::swap(owner, other.owner);
+        return *this;
+    }
+
+    const T *data() const
+    {
+        return items;
+    }
+
+    /**
+     * Returns the values to modify them.
+     *
+     * @throws LazarusException If the buffer is a view.
+     */
+    T *mutable_data()
+    {
+        if (owner)
+            throw LazarusException("Tried to modify a read-only map.");
+        return owned.data();
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool is_read_only() const
+    {
+        return owner != nullptr;
+    }
+
+    bool operator==(const TileBuffer &other) const
+    {
+        return count == other.count && std::equal(items, items + count, other.items);
+    }
+
+private:
+    std::vector<T> owned;
+    const T *items = nullptr;
+    size_t count = 0;
+    std::shared_ptr<const void> owner;  // Keeps the values of a view in memory
+};
+}  // namespace __lz
@@ -0,0 +1,198 @@
+#include <lazarus/AStarSearch.h>
+#include <lazarus/ChunkedGridMap.h>
+#include <lazarus/FOV.h>
+#include <lazarus/common.h>
+
+#include "catch/catch.hpp"
+
+#include <map>
+#include <vector>
+
+using namespace lz;
+
+namespace
+{
+const long AREA_SIZE = 200;
+
+// Tiles of a walled area with columns of walls which have a gap every few rows
+bool is_floor(long x, long y)
+{
+    if (x < 0 || y < 0 || x >= AREA_SIZE || y >= AREA_SIZE)
+        return false;
+    return x % 7 != 3 || y % 5 == 2;
+}
+
+void fill_area(const Position2D &chunk, SquareGridMap &tiles)
+{
+    long size = ChunkedGridMap::CHUNK_SIZE;
+    for (long y = 0; y < size; ++y)
+    {
+        for (long x = 0; x < size; ++x)
+        {
+            if (is_floor(chunk.x * size + x, chunk.y * size + y))
+            {
+                tiles.set_walkable(x, y, true);
+                tiles.set_transparency(x, y, true);
+            }
+        }
+    }
+}
+
+SquareGridMap make_area()
+{
+    SquareGridMap map(AREA_SIZE, AREA_SIZE);
+    for (long y = 0; y < AREA_SIZE; ++y)
+        for (long x = 0; x < AREA_SIZE; ++x)
+            if (is_floor(x, y))
+            {
+                map.set_walkable(x, y, true);
+                map.set_transparency(x, y, true);
+            }
+    return map;
+}
+}  // namespace
+
+TEST_CASE("chunked maps load chunks lazily", "[chunked_map]")
+{
+    int loads = 0;
+    ChunkedGridMap map(
+        [&](const Position2D &chunk, SquareGridMap &tiles) {
+            ++loads;
+            fill_area(chunk, tiles);
+        },
+        3 * ChunkedGridMap::CHUNK_BYTES);
+    REQUIRE(map.get_chunk_capacity() == 3);
+    REQUIRE(map.get_loaded_chunk_count() == 0);
+
+    SECTION("tiles are given by the provider")
+    {
+        REQUIRE(map.is_walkable(0, 0));
+        REQUIRE_FALSE(map.is_walkable(3, 0));
+        REQUIRE(map.is_transparent(3, 2));
+        REQUIRE(map.get_cost(11, 10) == 1);
+        REQUIRE_THROWS_AS(map.get_cost(3, 0), __lz::LazarusException);
+        REQUIRE(loads == 1);
+        REQUIRE(map.is_chunk_loaded(Position2D(0, 0)));
+    }
+    SECTION("chunks whose tiles do not have the size of a chunk are rejected")
+    {
+        ChunkedGridMap wrong_size(
+            [](const Position2D &, SquareGridMap &tiles) {
+                tiles = SquareGridMap(10, 10);
+            },
+            ChunkedGridMap::CHUNK_BYTES);
+        REQUIRE_THROWS_AS(wrong_size.is_walkable(0, 0), __lz::LazarusException);
+        REQUIRE(wrong_size.get_loaded_chunk_count() == 0);
+    }
+
+    SECTION("the map has no boundaries")
+    {
+        REQUIRE_FALSE(map.is_out_of_bounds(-1000, 1000000));
+        REQUIRE_FALSE(map.is_walkable(-1, -1));
+        REQUIRE(map.is_chunk_loaded(Position2D(-1, -1)));
+        REQUIRE(ChunkedGridMap::get_chunk_of(Position2D(-64, -65)) == Position2D(-1, -2));
+        REQUIRE(ChunkedGridMap::get_chunk_of(Position2D(63, 64)) == Position2D(0, 1));
+    }
+    SECTION("the least recently used chunk is unloaded")
+    {
+        map.is_walkable(0, 0);
+        map.is_walkable(64, 0);
+        map.is_walkable(128, 0);
+        map.is_walkable(1, 1);  // The first chunk is used again
+        map.is_walkable(192, 0);
+        REQUIRE(loads == 4);
+        REQUIRE(map.get_loaded_chunk_count() == 3);
+        REQUIRE(map.is_chunk_loaded(Position2D(0, 0)));
+        REQUIRE_FALSE(map.is_chunk_loaded(Position2D(1, 0)));
+        map.is_walkable(64, 0);
+        REQUIRE(loads == 5);
+    }
+    SECTION("neighbours cross the borders of the chunks")
+    {
+        REQUIRE(map.neighbours(Position2D(64, 64)).size() == 4);
+        REQUIRE(map.neighbours(0, 0).size() == 2);
+        REQUIRE(map.get_loaded_chunk_count() == 3);
+    }
+}
+
+TEST_CASE("chunked maps write modified chunks", "[chunked_map]")
+{
+    std::map<Position2D, SquareGridMap> saved;
+    ChunkedGridMap map(
+        [&](const Position2D &chunk, SquareGridMap &tiles) {
+            auto found = saved.find(chunk);
+            if (found != saved.end())
+                tiles = found->second;
+            else
+                fill_area(chunk, tiles);
+        },
+        ChunkedGridMap::CHUNK_BYTES);
+    map.set_writer([&](const Position2D &chunk, const SquareGridMap &tiles) {
+        saved.insert_or_assign(chunk, tiles);
+    });
+
+    SECTION("changes survive unloading the chunks")
+    {
+        map.set_walkable(3, 0, true);
+        map.set_cost(-5, -5, 4);
+        REQUIRE(saved.size() == 1);  // The first chunk was unloaded
+        map.is_walkable(1000, 1000);
+        REQUIRE(saved.size() == 2);
+        REQUIRE(map.is_walkable(3, 0));
+        REQUIRE(map.get_cost(-5, -5) == 4);
+    }
+    SECTION("the tiles of the chunks keep no history of their changes")
+    {
+        // Enough changes to fill the history of a map
+        for (long y = 0; y < ChunkedGridMap::CHUNK_SIZE; ++y)
+            for (long x = 0; x < ChunkedGridMap::CHUNK_SIZE; ++x)
+                map.set_transparency(x, y, (x + y) % 2 == 0);
+        map.flush();
+        const SquareGridMap &tiles = saved.at(Position2D(0, 0));
+        REQUIRE(tiles.get_generation() > __lz::ChangeLog::HISTORY);
+        std::vector<MapChange> changes;
+        REQUIRE_FALSE(tiles.get_changes_since(0, changes));
+        REQUIRE(changes.empty());
+    }
+    SECTION("chunks which are only read are not written")
+    {
+        map.is_walkable(0, 0);
+        map.is_walkable(100, 0);
+        map.unload_all();
+        REQUIRE(saved.empty());
+        REQUIRE(map.get_loaded_chunk_count() == 0);
+    }
+    SECTION("flushing writes the chunks once")
+    {
+        map.set_transparency(Position2D(3, 0), true);
+        map.flush();
+        REQUIRE(saved.size() == 1);
+        saved.clear();
+        map.unload_all();
+        REQUIRE(saved.empty());
+    }
+}
+
+TEST_CASE("searches on chunked maps", "[chunked_map]")
+{
+    SquareGridMap area = make_area();
+    ChunkedGridMap map(fill_area, 2 * ChunkedGridMap::CHUNK_BYTES);
+
+    SECTION("A* finds the same paths as on a single map")
+    {
+        Position2D origin(1, 1), goal(190, 150);
+        AStarSearch<Position2D, SquareGridMap> area_search(area, origin, goal);
+        AStarSearch<Position2D, ChunkedGridMap> chunked_search(map, origin, goal);
+        area_search.execute();
+        chunked_search.execute();
+        REQUIRE(chunked_search.get_state() == SearchState::SUCCESS);
+        REQUIRE(chunked_search.getPath() == area_search.getPath());
+        REQUIRE(map.get_loaded_chunk_count() == 2);
+    }
+    SECTION("the same tiles are in view as on a single map")
+    {
+        Position2D origin(128, 127);
+        REQUIRE(fov(origin, 20, map) == fov(origin, 20, area));
+        REQUIRE(los(origin, Position2D(128, 126), map));
+    }
+}
@@ -0,0 +1,200 @@
+#include <lazarus/ECS.h>
+#include <lazarus/common.h>
+
+#include "catch/catch.hpp"
+
+#include <vector>
+
+using namespace lz;
+
+namespace
+{
+struct Health
+{
+    Health(int points)
+        : points(points)
+    {
+    }
+
+    int points;
+};
+
+struct Poisoned
+{
+    Poisoned(int turns)
+        : turns(turns)
+    {
+    }
+
+    int turns;
+};
+
+// Updateable which poisons, from a parallel stage, the entities with health
+class PoisoningSystem : public Updateable
+{
+public:
+    virtual void update(ECSEngine &engine)
+    {
+        for (Entity *entity : engine.entities_with_components<Health>())
+            engine.commands().add_component<Poisoned>(*entity, Poisoned(3));
+    }
+};
+
+// Updateable which records how many entities were poisoned when it runs
+class CountingSystem : public Updateable
+{
+public:
+    static size_t poisoned;
+
+    virtual void update(ECSEngine &engine)
+    {
+        poisoned = engine.entities_with_components<Poisoned>().size();
+    }
+};
+
+size_t CountingSystem::poisoned = 0;
+}  // namespace
+
+TEST_CASE("recording commands", "[command_buffer]")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    Entity *entity = engine.add_entity();
+    entity->add_component<Health>(10);
+
+    SECTION("commands are only applied when requested")
+    {
+        engine.commands().create(Health(5), Poisoned(1));
+        engine.commands().add_component<Poisoned>(*entity, 2);
+        REQUIRE(engine.commands().size() == 2);
+        REQUIRE(engine.entities_with_components<Health, Poisoned>().empty());
+        engine.apply_commands();
+        REQUIRE(engine.commands().empty());
+        REQUIRE(engine.entities_with_components<Health, Poisoned>().size() == 2);
+        REQUIRE(entity->get<Poisoned>()->turns == 2);
+    }
+    SECTION("commands are applied when the engine updates")
+    {
+        engine.commands().remove_component<Health>(*entity);
+        engine.update();
+        REQUIRE_FALSE(entity->has<Health>());
+    }
+    SECTION("entities are created with their components")
+    {
+        for (int i = 0; i < 100; ++i)
+            engine.commands().create(Health(i));
+        engine.commands().create(Poisoned(5));
+        engine.apply_commands();
+        REQUIRE(engine.entities_with_components<Health>().size() == 101);
+        REQUIRE(engine.entities_with_components<Poisoned>().size() == 1);
+        std::vector<int> expected{10}, points;
+        for (int i = 0; i < 100; ++i)
+            expected.push_back(i);
+        for (Entity *created : engine.entities_with_components<Health>())
+            points.push_back(created->get<Health>()->points);
+        REQUIRE(points == expected);
+    }
+    SECTION("commands on the same component keep their order")
+    {
+        engine.commands().remove_component<Health>(*entity);
+        engine.commands().add_component<Health>(*entity, 20);
+        engine.commands().add_component<Poisoned>(*entity, 1);
+        engine.commands().remove_component<Poisoned>(*entity);
+        engine.apply_commands();
+        REQUIRE(entity->get<Health>()->points == 20);
+        REQUIRE_FALSE(entity->has<Poisoned>());
+    }
+    SECTION("entities of different archetypes gain the same component")
+    {
+        // Entities with and without health, recorded one after the other
+        std::vector<Entity *> entities;
+        for (int i = 0; i < 20; ++i)
+        {
+            entities.push_back(engine.add_entity());
+            if (i % 2 == 0)
+                entities.back()->add_component<Health>(i);
+        }
+        for (Entity *target : entities)
+            engine.commands().add_component<Poisoned>(*target, 2);
+        engine.apply_commands();
+        REQUIRE(engine.entities_with_components<Poisoned>().size() == 20);
+        REQUIRE(engine.entities_with_components<Health, Poisoned>().size() == 10);
+        for (int i = 0; i < 20; i += 2)
+            REQUIRE(entities[i]->get<Health>()->points == i);
+    }
+    SECTION("destroying entities")
+    {
+        engine.commands().destroy(*entity);
+        REQUIRE_FALSE(entity->is_deleted());
+        engine.apply_commands();
+        REQUIRE(entity->is_deleted());
+    }
+    SECTION("commands on entities which no longer exist are skipped")
+    {
+        Identifier id = entity->get_id();
+        engine.commands().add_component<Poisoned>(*entity, 1);
+        entity->mark_for_deletion();
+        engine.update();
+        REQUIRE(engine.get_entity(id) == nullptr);
+        REQUIRE(engine.entities_with_components<Poisoned>(true).empty());
+    }
+    SECTION("failed commands do not stop the rest")
+    {
+        Entity *other = engine.add_entity();
+        engine.commands().add_component<Health>(*entity, 1);
+        engine.commands().add_component<Health>(*other, 2);
+        REQUIRE_THROWS_AS(engine.apply_commands(), __lz::LazarusException);
+        REQUIRE(entity->get<Health>()->points == 10);
+        REQUIRE(other->get<Health>()->points == 2);
+        REQUIRE(engine.commands().empty());
+    }
+    SECTION("buffers can be discarded")
+    {
+        engine.commands().add_component<Poisoned>(*entity, 1);
+        engine.commands().clear();
+        engine.apply_commands();
+        REQUIRE_FALSE(entity->has<Poisoned>());
+    }
+}
+
+TEST_CASE("recording commands from parallel passes", "[command_buffer]")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    engine.set_thread_count(4);
+    const int num_entities = 1000;
+    engine.spawn(num_entities, Health(1));
+
+    SECTION("each task records its own commands")
+    {
+        engine.parallel_apply_to_each<Health>(
+            [&](Entity *entity, Health *health) {
+                engine.commands().add_component<Poisoned>(*entity, health->points);
+                engine.commands().create(Poisoned(-1));
+            },
+            16);
+        REQUIRE(engine.commands().size() == 2 * num_entities);
+        engine.apply_commands();
+        REQUIRE(engine.entities_with_components<Health, Poisoned>().size() ==
+                num_entities);
+        REQUIRE(engine.entities_with_components<Poisoned>().size() == 2 * num_entities);
+    }
+    SECTION("structural changes still throw during the pass")
+    {
+        REQUIRE_THROWS_AS(engine.parallel_apply_to_each<Health>(
+                              [&](Entity *entity, Health *) {
+                                  entity->add_component<Poisoned>(Poisoned(1));
+                              }),
+                          __lz::LazarusException);
+        REQUIRE_THROWS_AS(engine.parallel_apply_to_each<Health>(
+                              [&](Entity *, Health *) { engine.apply_commands(); }),
+                          __lz::LazarusException);
+    }
+    SECTION("commands of a parallel stage are applied before the next stage")
+    {
+        engine.add_updateable<PoisoningSystem>(SystemAccess().reads<Health>());
+        engine.add_updateable<CountingSystem>(
+            SystemAccess().reads<Poisoned>().after<PoisoningSystem>());
+        CountingSystem::poisoned = 0;
+        engine.update();
+        REQUIRE(CountingSystem::poisoned == num_entities);
+    }
+}
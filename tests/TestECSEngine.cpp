@@ -3,6 +3,15 @@
 
 #include "catch/catch.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
 using namespace lz;
 
 // Global variable to test systems
@@ -62,6 +71,229 @@ public:
     }
 };
 
+// Log of the updateables run, to test the scheduler
+std::mutex update_log_mutex;
+std::vector<int> update_log;
+
+template <int N>
+class LoggingSystem : public Updateable
+{
+public:
+    virtual void update(ECSEngine &engine)
+    {
+        std::lock_guard<std::mutex> lock(update_log_mutex);
+        update_log.push_back(N);
+    }
+};
+
+// Systems which wait for each other, to test that they run at the same time
+std::atomic<int> arrived{0};
+std::atomic<int> met{0};
+
+template <int N>
+class MeetingSystem : public Updateable
+{
+public:
+    virtual void update(ECSEngine &engine)
+    {
+        ++arrived;
+        auto start = std::chrono::steady_clock::now();
+        while (arrived < 2 &&
+               std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+            std::this_thread::yield();
+        if (arrived == 2)
+            ++met;
+    }
+};
+
+class SpawningSystem : public Updateable
+{
+public:
+    virtual void update(ECSEngine &engine)
+    {
+        engine.add_entity()->add_component<TestComponent>(1);
+    }
+};
+
+// Component whose copies start failing after a number of them have been made
+struct FailingComponent
+{
+    static int copies_left;
+
+    FailingComponent() = default;
+
+    FailingComponent(const FailingComponent &other)
+    {
+        if (copies_left-- <= 0)
+            throw std::runtime_error("copy failed");
+    }
+
+    FailingComponent(FailingComponent &&other) = default;
+};
+
+int FailingComponent::copies_left = 0;
+
+// Listener which deletes itself when it receives an event
+class SelfDeletingSystem : public EventListener<TestEvent>
+{
+public:
+    static bool alive;
+
+    SelfDeletingSystem()
+    {
+        alive = true;
+    }
+
+    ~SelfDeletingSystem()
+    {
+        alive = false;
+    }
+
+    virtual void receive(ECSEngine &engine, const TestEvent &event)
+    {
+        engine.delete_system<SelfDeletingSystem>();
+        // The system must outlive the call to its receive method
+        REQUIRE(alive);
+        x += event.num;
+    }
+};
+
+bool SelfDeletingSystem::alive = false;
+
+// Listener which adds a TestSystem when it receives an event
+class RecruitingSystem : public EventListener<TestEvent>
+{
+public:
+    virtual void receive(ECSEngine &engine, const TestEvent &event)
+    {
+        engine.add_system<TestSystem, TestEvent, TestEvent2>();
+        x += 1;
+    }
+};
+
+// Listener which emits a TestEvent2 for each TestEvent it receives
+class RelaySystem : public EventListener<TestEvent>
+{
+public:
+    virtual void receive(ECSEngine &engine, const TestEvent &event)
+    {
+        engine.emit(TestEvent2{event.num * 2});
+    }
+};
+
+// Listener which records the size of the batches of events it receives
+class BatchSystem : public EventListener<TestEvent>
+{
+public:
+    static std::vector<size_t> batches;
+
+    virtual void receive(ECSEngine &engine, const TestEvent &event)
+    {
+        batches.push_back(1);
+    }
+
+    virtual void receive_all(ECSEngine &engine, EventSpan<TestEvent> events)
+    {
+        batches.push_back(events.size());
+    }
+};
+
+std::vector<size_t> BatchSystem::batches;
+
+// Updateable which emits a TestEvent on each update
+class EmittingSystem : public Updateable
+{
+public:
+    virtual void update(ECSEngine &engine)
+    {
+        engine.emit(TestEvent{1});
+    }
+};
+
+// Updateable which records the value of x when it is updated
+class ObservingSystem : public Updateable
+{
+public:
+    static int observed;
+
+    virtual void update(ECSEngine &engine)
+    {
+        observed = x;
+    }
+};
+
+int ObservingSystem::observed = 0;
+
+// Listener which records the events it receives and the threads it receives them on
+class RecordingSystem : public EventListener<TestEvent>
+{
+public:
+    static std::vector<int> received;
+    static std::set<std::thread::id> threads;
+
+    virtual void receive(ECSEngine &engine, const TestEvent &event)
+    {
+        received.push_back(event.num);
+        threads.insert(std::this_thread::get_id());
+    }
+};
+
+std::vector<int> RecordingSystem::received;
+std::set<std::thread::id> RecordingSystem::threads;
+
+// Updateable which emits a TestEvent with its number on each update
+template <int N>
+class NumberEmittingSystem : public Updateable
+{
+public:
+    virtual void update(ECSEngine &engine)
+    {
+        engine.emit(TestEvent{N});
+    }
+};
+
+// Updateable which emits a TestEvent for each entity from a parallel pass
+class ParallelEmittingSystem : public Updateable
+{
+public:
+    virtual void update(ECSEngine &engine)
+    {
+        engine.parallel_apply_to_each<TestComponent>(
+            [&](Entity *, TestComponent *comp) { engine.emit(TestEvent{comp->num}); },
+            16);
+    }
+};
+
+// Updateable which records the components changed since its last run
+class ChangeWatchingSystem : public Updateable
+{
+public:
+    static std::vector<int> seen;
+
+    virtual void update(ECSEngine &engine)
+    {
+        seen.clear();
+        engine.view<Changed<const TestComponent>>().each(
+            [&](Entity *, const TestComponent *comp) { seen.push_back(comp->num); });
+    }
+};
+
+std::vector<int> ChangeWatchingSystem::seen;
+
+// Updateable which increments the components whose number is 1
+class IncrementingSystem : public Updateable
+{
+public:
+    virtual void update(ECSEngine &engine)
+    {
+        engine.view<const TestComponent>().each(
+            [&](Entity *entity, const TestComponent *comp) {
+                if (comp->num == 1)
+                    ++entity->get<TestComponent>()->num;
+            });
+    }
+};
+
 void addNumBy10(Entity *ent, TestComponent *comp)
 {
     comp->num += 10;
@@ -76,16 +308,78 @@ TEST_CASE("add entities to the engine")
         REQUIRE(entity != nullptr);
         Identifier id = entity->get_id();
         Entity *other = engine.add_entity();
-        REQUIRE(other->get_id() == id + 1);
+        REQUIRE(other->get_id() != id);
     }
     SECTION("add existing entity")
     {
         Entity entity;
         Identifier id = entity.get_id();
         REQUIRE_NOTHROW(engine.add_entity(entity));
+        REQUIRE(engine.get_entity(id) != nullptr);
         // Add new empty entity
         Entity *other = engine.add_entity();
-        REQUIRE(other->get_id() == id + 1);
+        REQUIRE(other->get_id() != id);
+    }
+}
+
+TEST_CASE("spawning entities")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    SECTION("create entities without components")
+    {
+        std::vector<Entity *> created = engine.create_entities(100);
+        REQUIRE(created.size() == 100);
+        std::set<Identifier> ids;
+        for (Entity *entity : created)
+        {
+            REQUIRE(engine.get_entity(entity->get_id()) == entity);
+            REQUIRE_FALSE(entity->has<TestComponent>());
+            ids.insert(entity->get_id());
+        }
+        REQUIRE(ids.size() == 100);
+    }
+    SECTION("spawn entities with components")
+    {
+        engine.add_entity()->add_component<TestComponent>(1);
+        std::vector<Entity *> spawned =
+            engine.spawn(5000, TestComponent(7), TestComponent2(8));
+        REQUIRE(spawned.size() == 5000);
+        for (Entity *entity : spawned)
+        {
+            REQUIRE(entity->get<TestComponent>()->num == 7);
+            REQUIRE(entity->get<TestComponent2>()->num == 8);
+        }
+        REQUIRE(engine.entities_with_components<TestComponent>().size() == 5001);
+        REQUIRE(engine.entities_with_components<TestComponent, TestComponent2>()
+                    .size() == 5000);
+
+        // Spawned entities behave like any other entity
+        spawned[10]->remove_component<TestComponent2>();
+        spawned[20]->mark_for_deletion();
+        engine.update();
+        REQUIRE(engine.entities_with_components<TestComponent2>().size() == 4998);
+        REQUIRE(engine.get_entity(spawned[10]->get_id())->has<TestComponent>());
+    }
+    SECTION("spawning with duplicated component types throws")
+    {
+        REQUIRE_THROWS_AS(engine.spawn(10, TestComponent(1), TestComponent(2)),
+                          __lz::LazarusException);
+        REQUIRE(engine.entities_with_components<TestComponent>().empty());
+    }
+    SECTION("entities spawned before a failing copy are kept")
+    {
+        FailingComponent::copies_left = 3;
+        REQUIRE_THROWS_AS(engine.spawn(10, TestComponent(1), FailingComponent()),
+                          std::runtime_error);
+        REQUIRE(engine.entities_with_components<TestComponent>().size() == 3);
+        REQUIRE(engine.entities_with_components<FailingComponent>().size() == 3);
+    }
+    SECTION("memory of destroyed entities is reused")
+    {
+        Entity *entity = engine.add_entity();
+        entity->mark_for_deletion();
+        engine.update();
+        REQUIRE(engine.add_entity() == entity);
     }
 }
 
@@ -106,11 +400,32 @@ TEST_CASE("get entity from identifier")
         Entity *ent_ptr = engine.get_entity(1512);
         REQUIRE(ent_ptr == nullptr);
     }
+    SECTION("get destroyed entity")
+    {
+        engine.get_entity(id)->mark_for_deletion();
+        engine.update();
+        REQUIRE(engine.get_entity(id) == nullptr);
+        // The standalone entity still holds the ID, so it is not recycled
+        Entity *other = engine.add_entity();
+        REQUIRE(other->get_id() != id);
+    }
+    SECTION("stale IDs are detected after their index is recycled")
+    {
+        Entity *temporary = engine.add_entity();
+        Identifier stale_id = temporary->get_id();
+        temporary->mark_for_deletion();
+        engine.update();
+        Entity *other = engine.add_entity();
+        REQUIRE(__lz::IdAllocator::index_of(other->get_id()) ==
+                __lz::IdAllocator::index_of(stale_id));
+        REQUIRE(engine.get_entity(stale_id) == nullptr);
+        REQUIRE(engine.get_entity(other->get_id()) == other);
+    }
 }
 
 TEST_CASE("entity management")
 {
-    ECSEngine engine;
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
     // Add one entity with TestComponent and TestComponent2
     Entity *entity = engine.add_entity();
     Identifier id1 = entity->get_id();
@@ -130,12 +445,12 @@ TEST_CASE("entity management")
         // Only entity 1 has TestComponent2
         entities = engine.entities_with_components<TestComponent2>();
         REQUIRE(entities.size() == 1);
-        REQUIRE(entities[0]->get_id() == id1);
+        REQUIRE((*entities.begin())->get_id() == id1);
 
         // Only entity 1 has both components
         entities = engine.entities_with_components<TestComponent, TestComponent2>();
         REQUIRE(entities.size() == 1);
-        REQUIRE(entities[0]->get_id() == id1);
+        REQUIRE((*entities.begin())->get_id() == id1);
     }
     SECTION("apply_to_each with lambda")
     {
@@ -172,6 +487,502 @@ TEST_CASE("entity management")
         comp = engine.get_entity(id2)->get<TestComponent>();
         REQUIRE(comp->num == 10);
     }
+    SECTION("apply_to_each with an std::function object")
+    {
+        std::function<void(Entity *, TestComponent *)> func = addNumBy10;
+        engine.apply_to_each<TestComponent>(std::move(func));
+        REQUIRE(engine.get_entity(id1)->get<TestComponent>()->num == 10);
+        REQUIRE(engine.get_entity(id2)->get<TestComponent>()->num == 10);
+    }
+    SECTION("apply_to_each with a move-only callable")
+    {
+        // Could not be wrapped in an std::function
+        auto increment = std::make_unique<int>(5);
+        engine.apply_to_each<TestComponent>(
+            [increment = std::move(increment)](Entity *ent, TestComponent *comp) {
+                comp->num += *increment;
+            });
+        REQUIRE(engine.get_entity(id1)->get<TestComponent>()->num == 5);
+        REQUIRE(engine.get_entity(id2)->get<TestComponent>()->num == 5);
+    }
+}
+
+TEST_CASE("iterating over many entities")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    const int num_entities = 10000;
+    for (int i = 0; i < num_entities; ++i)
+    {
+        Entity *entity = engine.add_entity();
+        entity->add_component<TestComponent>(i);
+        if (i % 2 == 0)
+            entity->add_component<TestComponent2>(i);
+    }
+    SECTION("entities in several chunks are all visited")
+    {
+        long total = 0;
+        engine.apply_to_each<TestComponent>(
+            [&](Entity *ent, TestComponent *comp) { total += comp->num; });
+        REQUIRE(total == (long)num_entities * (num_entities - 1) / 2);
+        REQUIRE(engine.entities_with_components<TestComponent2>().size() ==
+                num_entities / 2);
+    }
+    SECTION("removing components keeps the rest of the entities intact")
+    {
+        engine.apply_to_each<TestComponent, TestComponent2>(
+            [](Entity *ent, TestComponent *comp, TestComponent2 *comp2) {
+                REQUIRE(comp->num == comp2->num);
+            });
+        for (Entity *entity : engine.entities_with_components<TestComponent2>())
+            entity->remove_component<TestComponent>();
+        REQUIRE(engine.entities_with_components<TestComponent>().size() ==
+                num_entities / 2);
+        engine.apply_to_each<TestComponent>(
+            [](Entity *ent, TestComponent *comp) { REQUIRE(comp->num % 2 == 1); });
+    }
+    SECTION("removing the components the entities were found by")
+    {
+        size_t visited = 0;
+        for (Entity *entity : engine.entities_with_components<TestComponent2>())
+        {
+            entity->remove_component<TestComponent2>();
+            ++visited;
+        }
+        REQUIRE(visited == num_entities / 2);
+        REQUIRE(engine.entities_with_components<TestComponent2>().empty());
+    }
+    SECTION("structural changes during a pass throw")
+    {
+        // The entity would move to an archetype which also matches the pass
+        REQUIRE_THROWS_AS(engine.apply_to_each<TestComponent>(
+                              [](Entity *ent, TestComponent *comp) {
+                                  if (!ent->has<TestComponent2>())
+                                      ent->add_component<TestComponent2>(comp->num);
+                              }),
+                          __lz::LazarusException);
+        REQUIRE_THROWS_AS(
+            engine.apply_to_each<TestComponent2>(
+                [&](Entity *ent, TestComponent2 *comp) { engine.add_entity(); }),
+            __lz::LazarusException);
+        REQUIRE(engine.entities_with_components<TestComponent2>().size() ==
+                num_entities / 2);
+
+        // Changes recorded as commands are applied after the pass
+        engine.apply_to_each<TestComponent>([&](Entity *ent, TestComponent *comp) {
+            if (!ent->has<TestComponent2>())
+                engine.commands().add_component<TestComponent2>(*ent, comp->num);
+        });
+        engine.apply_commands();
+        REQUIRE(engine.entities_with_components<TestComponent2>().size() ==
+                num_entities);
+    }
+}
+
+TEST_CASE("parallel iteration")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    engine.set_thread_count(4);
+    const int num_entities = 10000;
+    for (int i = 0; i < num_entities; ++i)
+    {
+        Entity *entity = engine.add_entity();
+        entity->add_component<TestComponent>(0);
+        if (i % 3 == 0)
+            entity->add_component<TestComponent2>(i);
+    }
+
+    SECTION("every entity is visited exactly once")
+    {
+        size_t grain_size = GENERATE(1, 100, ECSEngine::DEFAULT_GRAIN_SIZE, 100000);
+        std::atomic<int> visited{0};
+        engine.parallel_apply_to_each<TestComponent>(
+            [&](Entity *ent, TestComponent *comp) {
+                comp->num++;
+                visited++;
+            },
+            grain_size);
+        REQUIRE(visited == num_entities);
+        engine.apply_to_each<TestComponent>(
+            [](Entity *ent, TestComponent *comp) { REQUIRE(comp->num == 1); });
+    }
+    SECTION("entities can be marked for deletion during the pass")
+    {
+        engine.parallel_apply_to_each<TestComponent, TestComponent2>(
+            [](Entity *ent, TestComponent *comp, TestComponent2 *comp2) {
+                ent->mark_for_deletion();
+            },
+            64);
+        engine.update();
+        REQUIRE(engine.entities_with_components<TestComponent>().size() ==
+                num_entities - (num_entities + 2) / 3);
+        REQUIRE(engine.entities_with_components<TestComponent2>().empty());
+    }
+    SECTION("structural changes during the pass throw")
+    {
+        REQUIRE_THROWS_AS(engine.parallel_apply_to_each<TestComponent2>(
+                              [&](Entity *ent, TestComponent2 *comp) {
+                                  ent->remove_component<TestComponent>();
+                              }),
+                          __lz::LazarusException);
+        REQUIRE_THROWS_AS(
+            engine.parallel_apply_to_each<TestComponent2>(
+                [&](Entity *ent, TestComponent2 *comp) { engine.add_entity(); }),
+            __lz::LazarusException);
+        // Nothing was changed, and the engine can be modified after the pass
+        REQUIRE(engine.entities_with_components<TestComponent>().size() == num_entities);
+        engine.add_entity()->add_component<TestComponent>(0);
+        REQUIRE(engine.entities_with_components<TestComponent>().size() ==
+                num_entities + 1);
+    }
+    SECTION("single thread")
+    {
+        engine.set_thread_count(1);
+        long total = 0;  // No synchronization needed
+        engine.parallel_apply_to_each<TestComponent2>(
+            [&](Entity *ent, TestComponent2 *comp) { total += comp->num; }, 10);
+        long expected = 0;
+        for (int i = 0; i < num_entities; i += 3)
+            expected += i;
+        REQUIRE(total == expected);
+    }
+}
+
+TEST_CASE("views")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    auto view = engine.view<TestComponent, TestComponent2>();
+    REQUIRE(view.size() == 0);
+
+    Entity *entity = engine.add_entity();
+    entity->add_component<TestComponent>(1);
+    SECTION("views are updated when components are added")
+    {
+        REQUIRE(view.size() == 0);
+        entity->add_component<TestComponent2>(2);
+        REQUIRE(view.size() == 1);
+        REQUIRE(*view.begin() == entity);
+        int sum = 0;
+        view.each([&](Entity *ent, TestComponent *comp, TestComponent2 *comp2) {
+            sum += comp->num + comp2->num;
+        });
+        REQUIRE(sum == 3);
+    }
+    SECTION("views are updated when components are removed")
+    {
+        entity->add_component<TestComponent2>(2);
+        entity->remove_component<TestComponent>();
+        REQUIRE(view.size() == 0);
+        REQUIRE(engine.view<TestComponent2>().size() == 1);
+    }
+    SECTION("views skip deleted entities unless asked otherwise")
+    {
+        entity->add_component<TestComponent2>(2);
+        entity->mark_for_deletion();
+        REQUIRE(view.size() == 0);
+        REQUIRE(engine.view<TestComponent, TestComponent2>(true).size() == 1);
+        engine.update();
+        REQUIRE(engine.view<TestComponent, TestComponent2>(true).size() == 0);
+    }
+    SECTION("view without component types includes every entity")
+    {
+        engine.add_entity();
+        REQUIRE(engine.view<>().size() == 2);
+    }
+}
+
+TEST_CASE("tracking changed components")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    std::vector<Entity *> entities = engine.spawn(3, TestComponent(0));
+    auto changed_nums = [&](ChangeTick since) {
+        std::vector<int> nums;
+        engine.view<Changed<const TestComponent>>().since(since).each(
+            [&](Entity *, const TestComponent *comp) { nums.push_back(comp->num); });
+        return nums;
+    };
+    // A view created outside of updateables matches all the components
+    REQUIRE(changed_nums(0).size() == 3);
+    engine.update();
+    ChangeTick tick = engine.get_change_tick();
+    REQUIRE(changed_nums(tick).empty());
+
+    SECTION("components are changed when accessed for writing")
+    {
+        entities[1]->get<TestComponent>()->num = 1;
+        REQUIRE(changed_nums(tick) == std::vector<int>{1});
+        engine.update();
+        tick = engine.get_change_tick();
+        static_cast<const Entity *>(entities[0])->get<TestComponent>();
+        entities[2]->get<const TestComponent>();
+        REQUIRE(changed_nums(tick).empty());
+    }
+    SECTION("added components are changed")
+    {
+        Entity *entity = engine.add_entity();
+        entity->add_component<TestComponent>(5);
+        entity->add_component<TestComponent2>(6);
+        REQUIRE(changed_nums(tick) == std::vector<int>{5});
+    }
+    SECTION("components keep their tick when their entity moves")
+    {
+        entities[1]->get<TestComponent>()->num = 1;
+        engine.update();
+        ChangeTick later = engine.get_change_tick();
+        entities[0]->add_component<TestComponent2>(2);
+        entities[2]->mark_for_deletion();
+        engine.update();
+        REQUIRE(changed_nums(tick) == std::vector<int>{1});
+        REQUIRE(changed_nums(later).empty());
+    }
+    SECTION("views with write access change the components they visit")
+    {
+        engine.view<const TestComponent>().each([](Entity *, const TestComponent *) {});
+        REQUIRE(changed_nums(tick).empty());
+        engine.view<TestComponent>().each([](Entity *, TestComponent *) {});
+        REQUIRE(changed_nums(tick).size() == 3);
+    }
+    SECTION("parallel passes change the components they visit")
+    {
+        engine.set_thread_count(4);
+        engine.spawn(1000, TestComponent(0));
+        engine.update();
+        tick = engine.get_change_tick();
+        engine.parallel_apply_to_each<TestComponent>(
+            [](Entity *, TestComponent *comp) { comp->num = 7; }, 16);
+        std::vector<int> nums = changed_nums(tick);
+        REQUIRE(nums == std::vector<int>(1003, 7));
+    }
+    SECTION("filters combine with other component types")
+    {
+        entities[0]->add_component<TestComponent2>(1);
+        entities[1]->add_component<TestComponent2>(2);
+        engine.update();
+        tick = engine.get_change_tick();
+        entities[1]->get<TestComponent>()->num = 3;
+        entities[2]->get<TestComponent>()->num = 4;
+        int sum = 0;
+        engine.view<Changed<TestComponent>, const TestComponent2>().since(tick).each(
+            [&](Entity *, TestComponent *comp, const TestComponent2 *comp2) {
+                sum += comp->num + comp2->num;
+            });
+        REQUIRE(sum == 5);
+    }
+    SECTION("updateables see the changes made since their last run")
+    {
+        engine.add_updateable<IncrementingSystem>(SystemAccess().writes<TestComponent>());
+        engine.add_updateable<ChangeWatchingSystem>(
+            SystemAccess().reads<TestComponent>().after<IncrementingSystem>());
+        engine.update();
+        REQUIRE(ChangeWatchingSystem::seen.size() == 3);
+        engine.update();
+        REQUIRE(ChangeWatchingSystem::seen.empty());
+
+        entities[1]->get<TestComponent>()->num = 1;
+        engine.update();
+        REQUIRE(ChangeWatchingSystem::seen == std::vector<int>{2});
+        engine.update();
+        REQUIRE(ChangeWatchingSystem::seen.empty());
+    }
+}
+
+TEST_CASE("sparse set storage backend")
+{
+    ECSEngine engine(StorageBackend::SparseSet);
+    SECTION("adding and removing components")
+    {
+        Entity *entity = engine.add_entity();
+        entity->add_component<TestComponent>(3);
+        entity->add_component<TestComponent2>(4);
+        REQUIRE(entity->has<TestComponent, TestComponent2>());
+        entity->remove_component<TestComponent>();
+        REQUIRE_FALSE(entity->has<TestComponent>());
+        REQUIRE(entity->get<TestComponent2>()->num == 4);
+    }
+    SECTION("adding an existing entity copies its components")
+    {
+        Entity entity;
+        entity.add_component<TestComponent>(8);
+        engine.add_entity(entity);
+        Entity *added = engine.get_entity(entity.get_id());
+        REQUIRE(added->get<TestComponent>()->num == 8);
+        REQUIRE_FALSE(added->has<TestComponent2>());
+    }
+    SECTION("indices of deleted entities are reused")
+    {
+        Entity *first = engine.add_entity();
+        first->add_component<TestComponent>(1);
+        first->mark_for_deletion();
+        engine.update();
+        Entity *second = engine.add_entity();
+        REQUIRE_FALSE(second->has<TestComponent>());
+        second->add_component<TestComponent>(2);
+        REQUIRE(engine.entities_with_components<TestComponent>().size() == 1);
+    }
+    SECTION("adding and removing components does not move the others")
+    {
+        Entity *first = engine.add_entity();
+        first->add_component<TestComponent>(1);
+        TestComponent *component = first->get<TestComponent>();
+        std::vector<Entity *> spawned = engine.spawn(10000, TestComponent(2));
+        for (int i = 0; i < 10000; ++i)
+            engine.add_entity()->add_component<TestComponent>(3);
+        REQUIRE(first->get<TestComponent>() == component);
+        REQUIRE(component->num == 1);
+
+        TestComponent *last = spawned.back()->get<TestComponent>();
+        for (size_t i = 0; i < spawned.size(); i += 2)
+            spawned[i]->remove_component<TestComponent>();
+        REQUIRE(engine.entities_with_components<TestComponent>().size() == 15001);
+        REQUIRE(first->get<TestComponent>()->num == 1);
+        REQUIRE(spawned.back()->get<TestComponent>() == last);
+        REQUIRE(last->num == 2);
+
+        // New components fill the holes left by the removed ones
+        for (size_t i = 0; i < spawned.size(); i += 2)
+            spawned[i]->add_component<TestComponent>(4);
+        REQUIRE(spawned.back()->get<TestComponent>() == last);
+        int sum = 0;
+        engine.apply_to_each<TestComponent>(
+            [&](Entity *, TestComponent *comp) { sum += comp->num; });
+        REQUIRE(sum == 1 + 5000 * 2 + 5000 * 4 + 10000 * 3);
+    }
+}
+
+TEST_CASE("forking engines")
+{
+    auto engine = std::make_unique<ECSEngine>(
+        GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    std::vector<Entity *> entities = engine->spawn(1000, TestComponent(0));
+    for (int i = 0; i < 1000; ++i)
+        entities[i]->get<TestComponent>()->num = i;
+    entities[0]->add_component<TestComponent2>(7);
+    entities[1]->mark_for_deletion();
+
+    auto sum_of = [](ECSEngine &engine) {
+        int sum = 0;
+        engine.apply_to_each<const TestComponent>(
+            [&](Entity *, const TestComponent *comp) { sum += comp->num; });
+        return sum;
+    };
+    const int initial_sum = 999 * 1000 / 2 - 1;
+
+    std::unique_ptr<ECSEngine> fork = engine->fork();
+    SECTION("the fork holds copies of the entities")
+    {
+        REQUIRE(fork->entities_with_components<TestComponent>().size() == 999);
+        REQUIRE(sum_of(*fork) == initial_sum);
+        Entity *copy = fork->get_entity(entities[0]->get_id());
+        REQUIRE(copy != entities[0]);
+        REQUIRE(copy->get<const TestComponent2>()->num == 7);
+        REQUIRE(fork->get_entity(entities[1]->get_id())->is_deleted());
+        REQUIRE(fork->get_pending_deletions() == 1);
+    }
+    SECTION("changes to either engine are not seen by the other")
+    {
+        fork->get_entity(entities[5]->get_id())->get<TestComponent>()->num += 1000;
+        fork->apply_to_each<TestComponent2>(
+            [](Entity *, TestComponent2 *comp) { comp->num = 8; });
+        entities[10]->get<TestComponent>()->num += 2000;
+        REQUIRE(sum_of(*engine) == initial_sum + 2000);
+        REQUIRE(sum_of(*fork) == initial_sum + 1000);
+        REQUIRE(entities[0]->get<const TestComponent2>()->num == 7);
+    }
+    SECTION("adding and removing entities and components")
+    {
+        fork->get_entity(entities[2]->get_id())->remove_component<TestComponent>();
+        fork->get_entity(entities[3]->get_id())->mark_for_deletion();
+        fork->add_entity()->add_component<TestComponent>(5000);
+        fork->update();
+        entities[4]->add_component<TestComponent2>(1);
+        engine->update();
+        REQUIRE(fork->entities_with_components<TestComponent>().size() == 998);
+        REQUIRE(sum_of(*fork) == initial_sum - 2 - 3 + 5000);
+        REQUIRE(engine->entities_with_components<TestComponent>().size() == 999);
+        REQUIRE(engine->entities_with_components<TestComponent2>().size() == 2);
+        REQUIRE(sum_of(*engine) == initial_sum);
+    }
+    SECTION("parallel passes over forks")
+    {
+        fork->set_thread_count(4);
+        fork->parallel_apply_to_each<TestComponent>(
+            [](Entity *, TestComponent *comp) { comp->num += 1; }, 16);
+        REQUIRE(sum_of(*fork) == initial_sum + 999);
+        REQUIRE(sum_of(*engine) == initial_sum);
+    }
+    SECTION("forks outlive the original engine")
+    {
+        std::unique_ptr<ECSEngine> second = fork->fork();
+        Identifier id = entities[6]->get_id();
+        engine.reset();
+        fork->get_entity(id)->get<TestComponent>()->num = 0;
+        REQUIRE(sum_of(*fork) == initial_sum - 6);
+        fork.reset();
+        REQUIRE(sum_of(*second) == initial_sum);
+    }
+    SECTION("forks can be used from different threads")
+    {
+        std::vector<std::unique_ptr<ECSEngine>> forks;
+        for (int i = 0; i < 4; ++i)
+            forks.push_back(engine->fork());
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i)
+        {
+            threads.emplace_back([&forks, i] {
+                for (int turn = 0; turn <= i; ++turn)
+                {
+                    forks[i]->apply_to_each<TestComponent>(
+                        [](Entity *, TestComponent *comp) { comp->num += 1; });
+                    forks[i]->add_entity()->add_component<TestComponent>(0);
+                }
+            });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+        for (int i = 0; i < 4; ++i)
+        {
+            int turns = i + 1;
+            // Each turn increments the entities added by the turns before it
+            int added = turns * (turns - 1) / 2;
+            REQUIRE(sum_of(*forks[i]) == initial_sum + 999 * turns + added);
+        }
+        REQUIRE(sum_of(*engine) == initial_sum);
+    }
+    SECTION("forking during a pass")
+    {
+        engine->apply_to_each<TestComponent>([&](Entity *, TestComponent *) {
+            REQUIRE_THROWS_AS(engine->fork(), __lz::LazarusException);
+        });
+        engine->set_thread_count(4);
+        std::atomic<int> forked{0};
+        engine->parallel_apply_to_each<const TestComponent>(
+            [&](Entity *, const TestComponent *) {
+                try
+                {
+                    engine->fork();
+                    ++forked;
+                }
+                catch (const __lz::LazarusException &)
+                {
+                }
+            },
+            100);
+        REQUIRE(forked == 0);
+        REQUIRE_NOTHROW(engine->fork());
+    }
+    SECTION("components are fetched again after forking")
+    {
+        Entity *entity = entities[5];
+        entity->get<TestComponent>();
+        std::unique_ptr<ECSEngine> second = engine->fork();
+        entity->get<TestComponent>()->num = 42;
+        REQUIRE(second->get_entity(entity->get_id())->get<const TestComponent>()->num == 5);
+        REQUIRE(sum_of(*second) == initial_sum);
+    }
+    SECTION("components which cannot be copied")
+    {
+        entities[0]->add_component<std::unique_ptr<int>>(new int(1));
+        REQUIRE_THROWS_AS(engine->fork(), __lz::LazarusException);
+    }
 }
 
 TEST_CASE("event management")
@@ -236,6 +1047,158 @@ TEST_CASE("event management")
         engine.emit(event);
         REQUIRE(x == 0);
     }
+    SECTION("deleting a system while it receives an event")
+    {
+        engine.add_system<SelfDeletingSystem, TestEvent>();
+        engine.add_system<TestSystem, TestEvent>();
+        engine.emit(event);
+        // The systems after the deleted one still receive the event
+        REQUIRE(x == 20);
+        REQUIRE_FALSE(SelfDeletingSystem::alive);
+        engine.emit(event);
+        REQUIRE(x == 30);
+        // The system can be added again
+        engine.add_system<SelfDeletingSystem, TestEvent>();
+        engine.emit(event);
+        REQUIRE(x == 50);
+    }
+    SECTION("deleting a system during nested emits")
+    {
+        engine.add_system<SelfDeletingSystem, TestEvent>();
+        engine.add_system<RelaySystem, TestEvent>();
+        engine.add_system<TestSystem, TestEvent2>();
+        engine.emit(event);
+        REQUIRE(x == -10);
+    }
+    SECTION("adding a system while emitting")
+    {
+        engine.add_system<RecruitingSystem, TestEvent>();
+        engine.emit(event);
+        // The new system only receives the next events
+        REQUIRE(x == 1);
+        engine.emit(event);
+        REQUIRE(x == 12);
+        engine.emit(event2);
+        REQUIRE(x == 7);
+    }
+    SECTION("emitting events while receiving one")
+    {
+        engine.add_system<RelaySystem, TestEvent>();
+        engine.add_system<TestSystem, TestEvent, TestEvent2>();
+        engine.emit(event);
+        REQUIRE(x == -10);
+    }
+}
+
+TEST_CASE("queued events")
+{
+    ECSEngine engine;
+    engine.set_event_delivery<TestEvent>(EventDelivery::Queued);
+    x = 0;
+    BatchSystem::batches.clear();
+    SECTION("events are delivered when the engine updates")
+    {
+        engine.add_system<TestSystem, TestEvent>();
+        engine.emit(TestEvent{1});
+        engine.emit(TestEvent{2});
+        REQUIRE(x == 0);
+        engine.update();
+        REQUIRE(x == 3);
+        engine.update();
+        REQUIRE(x == 3);
+    }
+    SECTION("listeners receive the queued events in a single batch")
+    {
+        engine.add_system<BatchSystem, TestEvent>();
+        for (int i = 0; i < 5; ++i)
+            engine.emit(TestEvent{i});
+        engine.deliver_queued_events();
+        REQUIRE(BatchSystem::batches == std::vector<size_t>{5});
+        engine.deliver_queued_events();
+        REQUIRE(BatchSystem::batches == std::vector<size_t>{5});
+    }
+    SECTION("events queued while delivering are delivered in the same delivery")
+    {
+        engine.set_event_delivery<TestEvent2>(EventDelivery::Queued);
+        engine.add_system<RelaySystem, TestEvent>();
+        engine.add_system<TestSystem, TestEvent2>();
+        engine.emit(TestEvent{1});
+        engine.emit(TestEvent{2});
+        engine.deliver_queued_events();
+        REQUIRE(x == -6);
+    }
+    SECTION("events are delivered after each stage of updateables")
+    {
+        engine.add_system<TestSystem, TestEvent>();
+        engine.add_updateable<EmittingSystem>();
+        engine.add_updateable<ObservingSystem>();
+        ObservingSystem::observed = 0;
+        engine.update();
+        REQUIRE(ObservingSystem::observed == 1);
+    }
+    SECTION("events of other types are still delivered immediately")
+    {
+        engine.add_system<TestSystem, TestEvent, TestEvent2>();
+        engine.emit(TestEvent{10});
+        engine.emit(TestEvent2{4});
+        REQUIRE(x == -4);
+        engine.deliver_queued_events();
+        REQUIRE(x == 6);
+    }
+    SECTION("switching back to immediate delivery")
+    {
+        engine.add_system<TestSystem, TestEvent>();
+        engine.set_event_delivery<TestEvent>(EventDelivery::Immediate);
+        engine.emit(TestEvent{10});
+        REQUIRE(x == 10);
+    }
+}
+
+TEST_CASE("emitting events from parallel passes")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    engine.set_thread_count(4);
+    engine.add_system<RecordingSystem, TestEvent>();
+    RecordingSystem::received.clear();
+    RecordingSystem::threads.clear();
+    const int num_entities = 1000;
+    std::vector<int> expected;
+    for (int i = 0; i < num_entities; ++i)
+    {
+        engine.add_entity()->add_component<TestComponent>(i);
+        expected.push_back(i);
+    }
+
+    SECTION("events are received in the order of the entities")
+    {
+        engine.parallel_apply_to_each<TestComponent>(
+            [&](Entity *, TestComponent *comp) { engine.emit(TestEvent{comp->num}); },
+            16);
+        REQUIRE(RecordingSystem::received == expected);
+        // Listeners are only called from the thread which started the pass
+        REQUIRE(RecordingSystem::threads ==
+                std::set<std::thread::id>{std::this_thread::get_id()});
+    }
+    SECTION("events are received in the order of the updateables in the stage")
+    {
+        SystemAccess access = SystemAccess().reads<TestComponent>();
+        engine.add_updateable<ParallelEmittingSystem>(access);
+        engine.add_updateable<NumberEmittingSystem<-1>>(access);
+        engine.add_updateable<NumberEmittingSystem<-2>>(access);
+        engine.update();
+        expected.push_back(-1);
+        expected.push_back(-2);
+        REQUIRE(RecordingSystem::received == expected);
+    }
+    SECTION("queued events emitted by parallel updateables")
+    {
+        engine.set_event_delivery<TestEvent>(EventDelivery::Queued);
+        SystemAccess access = SystemAccess().reads<TestComponent>();
+        engine.add_updateable<NumberEmittingSystem<1>>(access);
+        engine.add_updateable<NumberEmittingSystem<2>>(access);
+        engine.update();
+        REQUIRE(RecordingSystem::received == std::vector<int>{1, 2});
+    }
 }
 
 TEST_CASE("updateable management")
@@ -256,6 +1219,78 @@ TEST_CASE("updateable management")
     }
 }
 
+TEST_CASE("updateable scheduling")
+{
+    ECSEngine engine;
+    engine.set_thread_count(4);
+    update_log.clear();
+    SECTION("undeclared updateables run in order of insertion")
+    {
+        engine.add_updateable<LoggingSystem<1>>();
+        engine.add_updateable<LoggingSystem<2>>();
+        engine.add_updateable<LoggingSystem<3>>();
+        engine.update();
+        REQUIRE(update_log == std::vector<int>{1, 2, 3});
+    }
+    SECTION("conflicting updateables run in order of insertion")
+    {
+        engine.add_updateable<LoggingSystem<1>>(SystemAccess().writes<TestComponent>());
+        engine.add_updateable<LoggingSystem<2>>(SystemAccess().reads<TestComponent>());
+        engine.add_updateable<LoggingSystem<3>>(
+            SystemAccess().reads<TestComponent2>().writes<TestComponent>());
+        engine.update();
+        REQUIRE(update_log == std::vector<int>{1, 2, 3});
+    }
+    SECTION("ordering constraints")
+    {
+        engine.add_updateable<LoggingSystem<1>>(
+            SystemAccess().writes<TestComponent>().after<LoggingSystem<3>>());
+        engine.add_updateable<LoggingSystem<2>>(
+            SystemAccess().writes<TestComponent>().after<LoggingSystem<1>>());
+        engine.add_updateable<LoggingSystem<3>>(
+            SystemAccess().before<LoggingSystem<2>>());
+        engine.update();
+        REQUIRE(update_log == std::vector<int>{3, 1, 2});
+    }
+    SECTION("ordering constraints through other updateables")
+    {
+        // 1 conflicts with 3 and comes first, but has to run after it through 2
+        engine.add_updateable<LoggingSystem<1>>(
+            SystemAccess().writes<TestComponent>().after<LoggingSystem<2>>());
+        engine.add_updateable<LoggingSystem<2>>(SystemAccess().after<LoggingSystem<3>>());
+        engine.add_updateable<LoggingSystem<3>>(SystemAccess().writes<TestComponent>());
+        engine.update();
+        REQUIRE(update_log == std::vector<int>{3, 2, 1});
+    }
+    SECTION("cyclic ordering constraints")
+    {
+        engine.add_updateable<LoggingSystem<1>>(SystemAccess().after<LoggingSystem<3>>());
+        engine.add_updateable<LoggingSystem<2>>(SystemAccess().after<LoggingSystem<1>>());
+        engine.add_updateable<LoggingSystem<3>>(SystemAccess().after<LoggingSystem<2>>());
+        REQUIRE_THROWS_AS(engine.update(), __lz::LazarusException);
+    }
+    SECTION("updateables which do not conflict run at the same time")
+    {
+        arrived = 0;
+        met = 0;
+        engine.add_updateable<MeetingSystem<1>>(
+            SystemAccess().reads<TestComponent>().writes<TestComponent2>());
+        engine.add_updateable<MeetingSystem<2>>(SystemAccess().reads<TestComponent>());
+        engine.update();
+        REQUIRE(met == 2);
+    }
+    SECTION("only exclusive updateables can add entities")
+    {
+        engine.add_updateable<SpawningSystem>(SystemAccess().writes<TestComponent>());
+        REQUIRE_THROWS_AS(engine.update(), __lz::LazarusException);
+
+        ECSEngine other;
+        other.add_updateable<SpawningSystem>(SystemAccess().exclusive());
+        other.update();
+        REQUIRE(other.entities_with_components<TestComponent>().size() == 1);
+    }
+}
+
 TEST_CASE("garbage collector")
 {
     ECSEngine engine;
@@ -273,3 +1308,66 @@ TEST_CASE("garbage collector")
     engine.update();
     REQUIRE(engine.get_entity(id) == nullptr);
 }
+
+TEST_CASE("incremental garbage collection")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    const size_t num_entities = 20000;
+    std::vector<Entity *> spawned = engine.spawn(num_entities, TestComponent(1));
+    SECTION("only deleted entities are pending")
+    {
+        REQUIRE(engine.get_pending_deletions() == 0);
+        spawned[5]->mark_for_deletion();
+        spawned[5]->mark_for_deletion();  // Marking twice queues it once
+        spawned[7]->mark_for_deletion();
+        REQUIRE(engine.get_pending_deletions() == 2);
+        engine.update();
+        REQUIRE(engine.get_pending_deletions() == 0);
+        REQUIRE(engine.entities_with_components<TestComponent>(true).size() ==
+                num_entities - 2);
+    }
+    SECTION("collection can be spread over several updates")
+    {
+        for (Entity *entity : spawned)
+            entity->mark_for_deletion();
+        engine.set_garbage_collection_budget(std::chrono::nanoseconds(1));
+        engine.update();
+        size_t pending = engine.get_pending_deletions();
+        REQUIRE(pending > 0);
+        REQUIRE(pending < num_entities);
+        // Pending entities are still treated as deleted
+        REQUIRE(engine.entities_with_components<TestComponent>().empty());
+
+        int updates = 1;
+        while (engine.get_pending_deletions() > 0)
+        {
+            engine.update();
+            ++updates;
+        }
+        REQUIRE(updates > 1);
+        REQUIRE(engine.entities_with_components<TestComponent>(true).empty());
+    }
+    SECTION("deleted entities replaced before collection are kept")
+    {
+        Entity entity;
+        engine.add_entity(entity);
+        engine.get_entity(entity.get_id())->mark_for_deletion();
+        REQUIRE(engine.get_pending_deletions() == 1);
+        engine.add_entity(entity);
+        REQUIRE(engine.get_pending_deletions() == 0);
+        engine.update();
+        REQUIRE(engine.get_entity(entity.get_id()) != nullptr);
+        REQUIRE(engine.get_pending_deletions() == 0);
+    }
+    SECTION("deleted entities replaced by deleted ones are counted once")
+    {
+        Entity entity;
+        entity.mark_for_deletion();
+        engine.add_entity(entity);
+        engine.add_entity(entity);
+        REQUIRE(engine.get_pending_deletions() == 1);
+        engine.update();
+        REQUIRE(engine.get_entity(entity.get_id()) == nullptr);
+        REQUIRE(engine.get_pending_deletions() == 0);
+    }
+}
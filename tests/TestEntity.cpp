@@ -3,6 +3,11 @@
 
 #include "catch/catch.hpp"
 
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
 using namespace lz;
 
 // Component for testing purposes
@@ -44,7 +49,59 @@ TEST_CASE("entity creation")
     {
         Entity another;
         REQUIRE(entity.get_id() == id);  // The original entity's ID hasn't changed
-        REQUIRE(another.get_id() == id + 1);  // New entity gets new ID
+        REQUIRE(another.get_id() != id);  // New entity gets new ID
+        REQUIRE(another.get_id() != 0);
+    }
+    SECTION("ids of destroyed entities are recycled with a new generation")
+    {
+        Identifier old_id;
+        {
+            Entity temporary;
+            old_id = temporary.get_id();
+        }
+        Entity another;
+        using __lz::IdAllocator;
+        REQUIRE(IdAllocator::index_of(another.get_id()) == IdAllocator::index_of(old_id));
+        REQUIRE(IdAllocator::generation_of(another.get_id()) ==
+                IdAllocator::generation_of(old_id) + 1);
+        REQUIRE_FALSE(IdAllocator::get().is_alive(old_id));
+        REQUIRE(IdAllocator::get().is_alive(another.get_id()));
+    }
+    SECTION("ids are kept while a copy of the entity exists")
+    {
+        Identifier copied_id;
+        {
+            Entity *temporary = new Entity();
+            copied_id = temporary->get_id();
+            Entity copy(*temporary);
+            delete temporary;
+            REQUIRE(__lz::IdAllocator::get().is_alive(copied_id));
+        }
+        REQUIRE_FALSE(__lz::IdAllocator::get().is_alive(copied_id));
+    }
+    SECTION("entities can be created from several threads")
+    {
+        const int num_threads = 4;
+        const int per_thread = 1000;
+        std::vector<std::vector<std::unique_ptr<Entity>>> created(num_threads);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t)
+        {
+            threads.emplace_back([&created, t] {
+                for (int i = 0; i < per_thread; ++i)
+                    created[t].push_back(std::make_unique<Entity>());
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+
+        std::set<Identifier> ids;
+        for (auto &entities : created)
+        {
+            for (auto &created_entity : entities)
+                ids.insert(created_entity->get_id());
+        }
+        REQUIRE(ids.size() == num_threads * per_thread);
     }
     SECTION("entity has no components on creation")
     {
@@ -72,6 +129,12 @@ TEST_CASE("adding components")
     {
         REQUIRE_NOTHROW(entity.add_component<EmptyComponent>());
     }
+    SECTION("adding a component twice names the component type")
+    {
+        entity.add_component<TestComponent>(1);
+        REQUIRE_THROWS_WITH(entity.add_component<TestComponent>(2),
+                            Catch::Contains("TestComponent"));
+    }
     // Note: No need to test the case in which we try to add a component
     // that's not derived from BaseComponent, as that would not even compile
     // thanks to the static_assert in add_component
@@ -141,3 +204,37 @@ TEST_CASE("removing components from entities")
         REQUIRE(entity.has<TestComponent>());
     }
 }
+
+TEST_CASE("components keep their values when the entity changes archetype")
+{
+    Entity entity;
+    entity.add_component<TestComponent>(7);
+    entity.add_component<SecondTestComponent>("test", 3, true);
+    entity.add_component<EmptyComponent>();
+    SECTION("adding components")
+    {
+        REQUIRE(entity.get<TestComponent>()->num == 7);
+        REQUIRE(entity.get<SecondTestComponent>()->string == "test");
+        REQUIRE(entity.get<SecondTestComponent>()->num == 3);
+    }
+    SECTION("removing components")
+    {
+        entity.remove_component<TestComponent>();
+        REQUIRE_FALSE(entity.has<TestComponent>());
+        REQUIRE(entity.get<SecondTestComponent>()->string == "test");
+        entity.remove_component<EmptyComponent>();
+        REQUIRE(entity.get<SecondTestComponent>()->test_bool);
+    }
+}
+
+TEST_CASE("copying entities")
+{
+    Entity entity;
+    entity.add_component<TestComponent>(5);
+    Entity copy(entity);
+    REQUIRE(copy.get_id() == entity.get_id());
+    REQUIRE(copy.get<TestComponent>()->num == 5);
+    // The copy owns its own components
+    copy.get<TestComponent>()->num = 6;
+    REQUIRE(entity.get<TestComponent>()->num == 5);
+}
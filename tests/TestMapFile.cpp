@@ -0,0 +1,120 @@
+#include <lazarus/AStarSearch.h>
+#include <lazarus/MapFile.h>
+#include <lazarus/common.h>
+
+#include "catch/catch.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+using namespace lz;
+
+namespace
+{
+const std::string MAP_PATH = "lazarus_test_map.lzmap";
+
+// Map wider than a word, with rooms of different costs and a transparent wall
+SquareGridMap make_map()
+{
+    SquareGridMap map(100, 20, true);
+    map.carve_room(Position2D(1, 1), Position2D(40, 18));
+    map.carve_room(Position2D(42, 1), Position2D(98, 18), 2.5);
+    map.carve_room(Position2D(41, 10), Position2D(41, 10), 4);
+    map.set_transparency(41, 5, true);
+    return map;
+}
+
+void require_same_tiles(const SquareGridMap &map, const SquareGridMap &other)
+{
+    REQUIRE(map.get_width() == other.get_width());
+    REQUIRE(map.get_height() == other.get_height());
+    REQUIRE(map.get_walkable_mask() == other.get_walkable_mask());
+    REQUIRE(map.get_transparent_mask() == other.get_transparent_mask());
+    for (long y = 0; y < static_cast<long>(map.get_height()); ++y)
+        for (long x = 0; x < static_cast<long>(map.get_width()); ++x)
+            if (map.is_walkable(x, y))
+                REQUIRE(map.get_cost(x, y) == other.get_cost(x, y));
+}
+}  // namespace
+
+TEST_CASE("map files", "[map_file]")
+{
+    SquareGridMap map = make_map();
+
+    SECTION("opened maps view the saved tiles")
+    {
+        MapFile::save(map, MAP_PATH);
+        SquareGridMap opened = MapFile::open(MAP_PATH);
+        REQUIRE(opened.is_read_only());
+        require_same_tiles(map, opened);
+        REQUIRE(opened.neighbours(1, 1).size() == 3);  // Diagonals are kept
+
+        AStarSearch<Position2D, SquareGridMap> search(
+            opened, Position2D(1, 1), Position2D(98, 18));
+        search.execute();
+        REQUIRE(search.get_state() == SearchState::SUCCESS);
+        REQUIRE(search.getPath()[39] == Position2D(41, 10));
+        std::remove(MAP_PATH.c_str());
+    }
+    SECTION("opened maps can't be modified, but their copies can")
+    {
+        MapFile::save(map, MAP_PATH);
+        SquareGridMap opened = MapFile::open(MAP_PATH);
+        std::remove(MAP_PATH.c_str());  // The mapping outlives the file name
+        REQUIRE_THROWS_AS(opened.set_walkable(0, 0, true), __lz::LazarusException);
+        REQUIRE_THROWS_AS(opened.set_transparency(0, 0, true), __lz::LazarusException);
+        REQUIRE_THROWS_AS(opened.carve_room(Position2D(0, 0), Position2D(1, 1)),
+                          __lz::LazarusException);
+        REQUIRE_FALSE(opened.is_walkable(0, 0));
+
+        SquareGridMap copy = opened;
+        REQUIRE_FALSE(copy.is_read_only());
+        copy.set_walkable(0, 0, true);
+        REQUIRE(copy.is_walkable(0, 0));
+        REQUIRE_FALSE(opened.is_walkable(0, 0));
+    }
+    SECTION("maps can be written to and read from streams")
+    {
+        std::stringstream stream;
+        MapFile::save(map, stream);
+        SquareGridMap loaded = MapFile::load(stream);
+        REQUIRE_FALSE(loaded.is_read_only());
+        require_same_tiles(map, loaded);
+    }
+    SECTION("invalid map files are rejected")
+    {
+        std::stringstream stream;
+        MapFile::save(map, stream);
+        std::string file = stream.str();
+
+        std::stringstream truncated(file.substr(0, file.size() - 1));
+        REQUIRE_THROWS_AS(MapFile::load(truncated), __lz::LazarusException);
+        std::stringstream header_only(file.substr(0, 16));
+        REQUIRE_THROWS_AS(MapFile::load(header_only), __lz::LazarusException);
+        file[0] = 'X';
+        std::stringstream corrupted(file);
+        REQUIRE_THROWS_AS(MapFile::load(corrupted), __lz::LazarusException);
+        REQUIRE_THROWS_AS(MapFile::open("lazarus_missing_map.lzmap"),
+                          __lz::LazarusException);
+    }
+    SECTION("map files with tiles past the end of the rows are rejected")
+    {
+        std::stringstream stream;
+        MapFile::save(map, stream);
+        std::string file = stream.str();
+
+        // The walkable mask follows the costs, each layer aligned to 64 bytes. Each
+        // row of 100 tiles takes two words, and the second one holds 36 tiles.
+        size_t walkable = (64 + 100 * 20 * sizeof(float) + 63) / 64 * 64;
+        uint64_t word;
+        std::memcpy(&word, &file[walkable + sizeof(uint64_t)], sizeof(word));
+        REQUIRE(word >> 36 == 0);
+        word |= 1ULL << 63;
+        std::memcpy(&file[walkable + sizeof(uint64_t)], &word, sizeof(word));
+        std::stringstream padded(file);
+        REQUIRE_THROWS_WITH(MapFile::load(padded), "The file is not a valid map file.");
+    }
+}
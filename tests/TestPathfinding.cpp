@@ -5,6 +5,33 @@
 
 using namespace lz;
 
+namespace
+{
+// Map which only lists the neighbours of its tiles, and so is searched through them
+class ListingMap
+{
+public:
+    explicit ListingMap(const SquareGridMap &map)
+        : map(map)
+    {
+    }
+
+    std::vector<Position2D> neighbours(const Position2D &pos) const
+    {
+        ++listed;
+        return map.neighbours(pos);
+    }
+
+    float get_cost(const Position2D &pos) const
+    {
+        return map.get_cost(pos);
+    }
+
+    const SquareGridMap &map;
+    mutable int listed = 0;
+};
+}  // namespace
+
 TEST_CASE("A* on grid map")
 {
     // Make the following hard-coded map:
@@ -88,4 +115,13 @@ TEST_CASE("A* on grid map")
         REQUIRE(path[1] == Position2D(3, 4));
         REQUIRE(path[2] == Position2D(2, 4));
     }
+    SECTION("A* on maps which only list the neighbours")
+    {
+        ListingMap listing_map(map);
+        AStarSearch<Position2D, ListingMap> astar_search(
+            listing_map, Position2D(1, 3), Position2D(4, 3));
+        REQUIRE_NOTHROW(astar_search.execute());
+        REQUIRE(astar_search.getPath().size() == 5);
+        REQUIRE(listing_map.listed > 0);
+    }
 }
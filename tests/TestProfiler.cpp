@@ -0,0 +1,206 @@
+#include <lazarus/ECS.h>
+#include <lazarus/common.h>
+
+#include "catch/catch.hpp"
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace lz;
+
+namespace
+{
+struct Health
+{
+    int points;
+};
+
+struct Hit
+{
+    int damage;
+};
+
+// Hits every entity with health on each update
+class HittingSystem : public Updateable
+{
+public:
+    void update(ECSEngine &engine) override
+    {
+        engine.apply_to_each<Health>([&](Entity *, Health *health) {
+            engine.emit(Hit{1});
+            health->points -= 1;
+        });
+    }
+};
+
+// Checks the health of every entity in parallel on each update
+class CheckingSystem : public Updateable
+{
+public:
+    void update(ECSEngine &engine) override
+    {
+        engine.parallel_apply_to_each<const Health>([](Entity *, const Health *) {}, 8);
+    }
+};
+
+class HitCounter : public EventListener<Hit>
+{
+public:
+    void receive(ECSEngine &, const Hit &event) override
+    {
+        total += event.damage;
+    }
+
+    int total = 0;
+};
+
+size_t count_occurrences(const std::string &text, const std::string &pattern)
+{
+    size_t count = 0;
+    for (size_t pos = text.find(pattern); pos != std::string::npos;
+         pos = text.find(pattern, pos + 1))
+        ++count;
+    return count;
+}
+}  // namespace
+
+TEST_CASE("profiling engines", "[profiler]")
+{
+    ECSEngine engine;
+    engine.set_thread_count(4);
+    engine.spawn(100, Health{10});
+    engine.add_updateable<HittingSystem>();
+    engine.add_updateable<CheckingSystem>();
+    engine.add_system<HitCounter, Hit>();
+    Profiler &profiler = engine.get_profiler();
+
+    SECTION("the profiler is disabled by default")
+    {
+        engine.update();
+        REQUIRE_FALSE(profiler.is_enabled());
+        REQUIRE_FALSE(profiler.is_listener_timing());
+        REQUIRE(profiler.get_frame_count() == 0);
+        REQUIRE(profiler.get_system_profile<HittingSystem>().calls == 0);
+    }
+    SECTION("updateables and their passes are measured")
+    {
+        profiler.set_enabled(true);
+        engine.update();
+        engine.update();
+        REQUIRE(profiler.get_frame_count() == 2);
+        REQUIRE(profiler.get_frame_times().size() == 2);
+
+        Profiler::SystemProfile hitting = profiler.get_system_profile<HittingSystem>();
+        REQUIRE(hitting.calls == 2);
+        REQUIRE(hitting.entities == 200);
+        REQUIRE(hitting.time.count() > 0);
+        REQUIRE(profiler.get_system_profile<CheckingSystem>().entities == 200);
+    }
+    SECTION("events are counted by type")
+    {
+        profiler.set_enabled(true);
+        profiler.set_listener_timing(true);
+        engine.update();
+        Profiler::EventProfile hits = profiler.get_event_profile<Hit>();
+        REQUIRE(hits.emitted == 100);
+        REQUIRE(hits.received == 100);
+        REQUIRE(profiler.get_system_profile<HitCounter>().calls == 100);
+
+        engine.set_event_delivery<Hit>(EventDelivery::Queued);
+        engine.update();
+        hits = profiler.get_event_profile<Hit>();
+        REQUIRE(hits.emitted == 200);
+        REQUIRE(hits.received == 200);
+        // The queued events are received in a single batch
+        REQUIRE(profiler.get_system_profile<HitCounter>().calls == 101);
+    }
+    SECTION("deliveries are measured as a whole without listener timing")
+    {
+        profiler.set_enabled(true);
+        engine.update();
+        Profiler::EventProfile hits = profiler.get_event_profile<Hit>();
+        REQUIRE(hits.emitted == 100);
+        REQUIRE(hits.received == 100);
+        REQUIRE(hits.time.count() > 0);
+        REQUIRE(profiler.get_system_profile<HitCounter>().calls == 0);
+
+        std::stringstream trace;
+        profiler.write_chrome_trace(trace);
+        REQUIRE(count_occurrences(trace.str(), "\"cat\":\"delivery\"") == 100);
+        REQUIRE(count_occurrences(trace.str(), "\"cat\":\"listener\"") == 0);
+    }
+    SECTION("reports name the systems and event types")
+    {
+        profiler.set_enabled(true);
+        profiler.set_listener_timing(true);
+        engine.update();
+        std::stringstream report;
+        profiler.write_report(report);
+        REQUIRE(report.str().find("Frames: 1") != std::string::npos);
+        REQUIRE(report.str().find("HittingSystem") != std::string::npos);
+        REQUIRE(report.str().find("HitCounter") != std::string::npos);
+        REQUIRE(report.str().find("Hit ") != std::string::npos);
+    }
+    SECTION("traces are exported in the format of Chrome")
+    {
+        profiler.set_enabled(true);
+        profiler.set_listener_timing(true);
+        engine.update();
+        std::stringstream trace;
+        profiler.write_chrome_trace(trace);
+        std::string json = trace.str();
+        REQUIRE(json.rfind("{\"traceEvents\":[", 0) == 0);
+        // A frame, two updateables, two passes and a hundred listener calls
+        REQUIRE(count_occurrences(json, "\"ph\":\"X\"") == 105);
+        REQUIRE(count_occurrences(json, "\"cat\":\"frame\"") == 1);
+        REQUIRE(json.find("apply_to_each<const") != std::string::npos);
+    }
+    SECTION("measurements can be discarded")
+    {
+        profiler.set_enabled(true);
+        engine.update();
+        profiler.reset();
+        REQUIRE(profiler.get_frame_count() == 0);
+        REQUIRE(profiler.get_system_profile<HittingSystem>().calls == 0);
+        REQUIRE(profiler.get_event_profile<Hit>().emitted == 0);
+    }
+}
+
+TEST_CASE("profiler traces keep the last calls", "[profiler]")
+{
+    Profiler profiler(4);
+    static const std::string name = "pass";
+    for (int i = 0; i < 10; ++i)
+        profiler.record_pass(name, 1, Profiler::Clock::now());
+    std::stringstream trace;
+    profiler.write_chrome_trace(trace);
+    REQUIRE(count_occurrences(trace.str(), "\"name\":\"pass\"") == 4);
+}
+
+TEST_CASE("profilers merge the measurements of each thread", "[profiler]")
+{
+    Profiler profiler(1000);
+    static const std::string name = "Hit";
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < 4; ++thread)
+    {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 1000; ++i)
+            {
+                profiler.record_emit(__lz::get_event_id<Hit>(), name);
+                profiler.record_pass(name, 1, Profiler::Clock::now());
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    REQUIRE(profiler.get_event_profile<Hit>().emitted == 4000);
+    std::stringstream trace;
+    profiler.write_chrome_trace(trace);
+    REQUIRE(count_occurrences(trace.str(), "\"name\":\"Hit\"") == 1000);
+    profiler.reset();
+    REQUIRE(profiler.get_event_profile<Hit>().emitted == 0);
+}
@@ -0,0 +1,188 @@
+#include <lazarus/ECS.h>
+#include <lazarus/common.h>
+
+#include "catch/catch.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <sstream>
+#include <vector>
+
+using namespace lz;
+
+namespace
+{
+struct Location
+{
+    int x, y;
+};
+
+struct Stamina
+{
+    double value;
+};
+
+struct Name
+{
+    char text[12];
+};
+
+// Not registered in the snapshots
+struct Temporary
+{
+    int value;
+};
+
+struct WideStamina
+{
+    double value;
+    double max;
+};
+
+SnapshotRegistry make_registry()
+{
+    SnapshotRegistry registry;
+    registry.add<Location>("Location");
+    registry.add<Stamina>("Stamina");
+    registry.add<Name>("Name");
+    return registry;
+}
+}  // namespace
+
+TEST_CASE("saving and loading snapshots", "[snapshot]")
+{
+    ECSEngine engine(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+    SnapshotRegistry registry = make_registry();
+
+    std::vector<Entity *> walkers = engine.spawn(100, Location{1, 2});
+    for (int i = 0; i < 100; ++i)
+        walkers[i]->get<Location>()->x = i;
+    Entity *hero = engine.add_entity();
+    hero->add_component<Location>(Location{5, 5});
+    hero->add_component<Stamina>(Stamina{0.5});
+    hero->add_component<Name>(Name{"hero"});
+    hero->add_component<Temporary>(Temporary{1});
+    Entity *empty = engine.add_entity();
+    walkers[0]->mark_for_deletion();
+
+    SECTION("entities are restored with their registered components")
+    {
+        ECSEngine loaded(GENERATE(StorageBackend::Archetype, StorageBackend::SparseSet));
+        std::vector<char> snapshot = registry.save(engine);
+        auto entities = registry.load(loaded, snapshot.data(), snapshot.size());
+        REQUIRE(entities.size() == 101);
+        REQUIRE(loaded.entities_with_components<>().size() == 101);
+        REQUIRE(loaded.entities_with_components<Location>().size() == 100);
+        REQUIRE(loaded.entities_with_components<Temporary>().empty());
+
+        std::map<Identifier, Entity *> by_saved_id;
+        for (const auto &entity : entities)
+        {
+            REQUIRE(loaded.get_entity(entity.entity->get_id()) == entity.entity);
+            by_saved_id[entity.saved_id] = entity.entity;
+        }
+        REQUIRE(by_saved_id.count(walkers[0]->get_id()) == 0);
+        for (int i = 1; i < 100; ++i)
+        {
+            const Location *location =
+                by_saved_id.at(walkers[i]->get_id())->get<const Location>();
+            REQUIRE(location->x == i);
+            REQUIRE(location->y == 2);
+        }
+        Entity *loaded_hero = by_saved_id.at(hero->get_id());
+        REQUIRE(loaded_hero->get<Stamina>()->value == 0.5);
+        REQUIRE(std::string(loaded_hero->get<Name>()->text) == "hero");
+        REQUIRE_FALSE(by_saved_id.at(empty->get_id())->has<Location>());
+    }
+    SECTION("snapshots can be written to and read from streams")
+    {
+        std::stringstream stream;
+        registry.save(engine, stream);
+        ECSEngine loaded;
+        auto entities = registry.load(loaded, stream);
+        REQUIRE(entities.size() == 101);
+        REQUIRE(loaded.entities_with_components<Location, Stamina, Name>().size() == 1);
+    }
+    SECTION("snapshots do not need to be aligned in memory")
+    {
+        std::vector<char> snapshot = registry.save(engine);
+        std::vector<char> shifted(snapshot.size() + 1);
+        std::copy(snapshot.begin(), snapshot.end(), shifted.begin() + 1);
+        ECSEngine loaded;
+        registry.load(loaded, shifted.data() + 1, snapshot.size());
+        int sum = 0;
+        loaded.apply_to_each<Location>([&](Entity *, Location *location) {
+            sum += location->x;
+        });
+        REQUIRE(sum == 99 * 100 / 2 + 5);
+    }
+    SECTION("types which are not registered when loading are skipped")
+    {
+        std::vector<char> snapshot = registry.save(engine);
+        SnapshotRegistry partial;
+        partial.add<Name>("Name");
+        ECSEngine loaded;
+        REQUIRE(partial.load(loaded, snapshot.data(), snapshot.size()).size() == 101);
+        REQUIRE(loaded.entities_with_components<Location>().empty());
+        REQUIRE(loaded.entities_with_components<Name>().size() == 1);
+    }
+    SECTION("invalid snapshots are rejected")
+    {
+        std::vector<char> snapshot = registry.save(engine);
+        ECSEngine loaded;
+        REQUIRE_THROWS_AS(registry.load(loaded, snapshot.data(), snapshot.size() - 1),
+                          __lz::LazarusException);
+        REQUIRE_THROWS_AS(registry.load(loaded, snapshot.data(), 4),
+                          __lz::LazarusException);
+        snapshot[0] = 'X';
+        REQUIRE_THROWS_AS(registry.load(loaded, snapshot.data(), snapshot.size()),
+                          __lz::LazarusException);
+        REQUIRE(loaded.entities_with_components<>().empty());
+    }
+    SECTION("snapshots holding a type twice are rejected")
+    {
+        // A type table with the same name twice
+        SnapshotRegistry renamed;
+        renamed.add<Location>("Place1");
+        renamed.add<Stamina>("Place2");
+        std::vector<char> snapshot = renamed.save(engine);
+        std::string contents(snapshot.begin(), snapshot.end());
+        snapshot[contents.find("Place2") + 5] = '1';
+        ECSEngine loaded;
+        REQUIRE_THROWS_WITH(renamed.load(loaded, snapshot.data(), snapshot.size()),
+                            "The snapshot is corrupted");
+
+        // A group with the same type twice: after the header and the three types, the
+        // group starts with its size and number of types, then the types it holds
+        ECSEngine single;
+        Entity *entity = single.add_entity();
+        entity->add_component<Location>(Location{1, 1});
+        entity->add_component<Stamina>(Stamina{1.0});
+        snapshot = registry.save(single);
+        size_t second_type = 32 + 3 * 16 + 16 + sizeof(std::uint32_t);
+        std::uint32_t type;
+        std::memcpy(&type, &snapshot[second_type], sizeof(type));
+        REQUIRE(type == 1);
+        type = 0;
+        std::memcpy(&snapshot[second_type], &type, sizeof(type));
+        REQUIRE_THROWS_WITH(registry.load(loaded, snapshot.data(), snapshot.size()),
+                            "The snapshot is corrupted");
+        REQUIRE(loaded.entities_with_components<>().empty());
+    }
+    SECTION("types must keep their size")
+    {
+        std::vector<char> snapshot = registry.save(engine);
+        SnapshotRegistry changed;
+        changed.add<WideStamina>("Stamina");
+        ECSEngine loaded;
+        REQUIRE_THROWS_AS(changed.load(loaded, snapshot.data(), snapshot.size()),
+                          __lz::LazarusException);
+    }
+    SECTION("types and names are registered once")
+    {
+        REQUIRE_THROWS_AS(registry.add<Location>("Place"), __lz::LazarusException);
+        REQUIRE_THROWS_AS(registry.add<Temporary>("Name"), __lz::LazarusException);
+    }
+}
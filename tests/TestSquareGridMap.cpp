@@ -252,6 +252,33 @@ TEST_CASE("neighbours")
     }
 }
 
+TEST_CASE("iterating over neighbours")
+{
+    SquareGridMap map(6, 5, GENERATE(false, true));
+    map.carve_room(Position2D(0, 0), Position2D(5, 4));
+    map.set_walkable(2, 2, false);
+    map.set_walkable(4, 1, false);
+    SECTION("the neighbours are the listed ones, in the same order")
+    {
+        for (long y = 0; y < 5; ++y)
+        {
+            for (long x = 0; x < 6; ++x)
+            {
+                std::vector<Position2D> visited;
+                map.for_each_neighbour(Position2D(x, y), [&](const Position2D &pos) {
+                    visited.push_back(pos);
+                });
+                REQUIRE(visited == map.neighbours(x, y));
+            }
+        }
+    }
+    SECTION("neighbours of out of bounds tile throws an exception")
+    {
+        REQUIRE_THROWS_AS(map.for_each_neighbour(Position2D(6, 0), [](auto) {}),
+                          __lz::LazarusException);
+    }
+}
+
 TEST_CASE("carve_room")
 {
     const int width{5};
@@ -290,3 +317,282 @@ TEST_CASE("carve_room")
                 REQUIRE_FALSE(map.is_walkable(x, y));  // No changes made
     }
 }
+
+TEST_CASE("tile masks")
+{
+    // Wide enough for rows to span several words, with padding in the last one
+    const long width{150};
+    const long height{4};
+    TileMask mask(width, height);
+    SECTION("tiles are cleared by default")
+    {
+        REQUIRE(mask.count() == 0);
+        REQUIRE(TileMask(width, height, true).count() == width * height);
+    }
+    SECTION("setting single tiles")
+    {
+        mask.set(Position2D(63, 1), true);
+        mask.set(Position2D(64, 1), true);
+        mask.set(Position2D(149, 3), true);
+        REQUIRE(mask.test(63, 1));
+        REQUIRE(mask.test(Position2D(64, 1)));
+        REQUIRE(mask.test(149, 3));
+        REQUIRE_FALSE(mask.test(65, 1));
+        REQUIRE(mask.count() == 3);
+        mask.set(Position2D(64, 1), false);
+        REQUIRE_FALSE(mask.test(64, 1));
+        REQUIRE(mask.count() == 2);
+    }
+    SECTION("out of bounds tiles")
+    {
+        REQUIRE_FALSE(TileMask(width, height, true).test(-1, 0));
+        REQUIRE_FALSE(TileMask(width, height, true).test(width, 0));
+        REQUIRE_FALSE(TileMask(width, height, true).test(0, height));
+        REQUIRE_THROWS_AS(mask.set(Position2D(width, 0), true), __lz::LazarusException);
+        REQUIRE_THROWS_AS(mask.set(Position2D(0, -1), true), __lz::LazarusException);
+    }
+    SECTION("filling and counting rectangles across words")
+    {
+        mask.fill(Position2D(10, 1), Position2D(140, 2), true);
+        REQUIRE(mask.count() == 131 * 2);
+        REQUIRE(mask.count(Position2D(0, 0), Position2D(width - 1, height - 1)) ==
+                131 * 2);
+        REQUIRE(mask.count(Position2D(60, 0), Position2D(70, 1)) == 11);
+        REQUIRE(mask.count(Position2D(-5, -5), Position2D(10, 10)) == 2);
+        REQUIRE(mask.count(Position2D(5, 5), Position2D(1, 1)) == 0);
+        REQUIRE_FALSE(mask.test(9, 1));
+        REQUIRE_FALSE(mask.test(141, 2));
+
+        mask.fill(Position2D(64, 0), Position2D(127, 3), false);
+        REQUIRE(mask.count() == (54 + 13) * 2);
+        REQUIRE_THROWS_AS(mask.fill(Position2D(0, 0), Position2D(width, 0), true),
+                          __lz::LazarusException);
+    }
+    SECTION("combining masks")
+    {
+        TileMask other(width, height);
+        mask.fill(Position2D(0, 0), Position2D(99, 3), true);
+        other.fill(Position2D(50, 0), Position2D(149, 1), true);
+        TileMask both = mask;
+        both &= other;
+        REQUIRE(both.count() == 50 * 2);
+        TileMask any = mask;
+        any |= other;
+        REQUIRE(any.count() == 100 * 4 + 50 * 2);
+        REQUIRE_THROWS_AS(mask &= TileMask(width, height + 1), __lz::LazarusException);
+    }
+    SECTION("finding the bounds of the set tiles")
+    {
+        Position2D top_left(-1, -1), bottom_right(-1, -1);
+        REQUIRE_FALSE(mask.find_bounds(top_left, bottom_right));
+        REQUIRE(top_left == Position2D(-1, -1));
+        REQUIRE(bottom_right == Position2D(-1, -1));
+
+        mask.set(Position2D(70, 2), true);
+        REQUIRE(mask.find_bounds(top_left, bottom_right));
+        REQUIRE(top_left == Position2D(70, 2));
+        REQUIRE(bottom_right == Position2D(70, 2));
+
+        // Tiles in the last word of the rows, next to the padding
+        mask.set(Position2D(128, 1), true);
+        mask.set(Position2D(width - 1, 3), true);
+        REQUIRE(mask.find_bounds(top_left, bottom_right));
+        REQUIRE(top_left == Position2D(70, 1));
+        REQUIRE(bottom_right == Position2D(width - 1, 3));
+    }
+    SECTION("inverting keeps the padding clear")
+    {
+        mask.set(Position2D(0, 0), true);
+        mask.invert();
+        REQUIRE(mask.count() == width * height - 1);
+        REQUIRE_FALSE(mask.test(0, 0));
+        mask.invert();
+        TileMask expected(width, height);
+        expected.set(Position2D(0, 0), true);
+        REQUIRE(mask == expected);
+    }
+}
+
+TEST_CASE("map masks")
+{
+    SquareGridMap map(100, 10);
+    map.carve_room(Position2D(10, 2), Position2D(79, 7), 3);
+    SECTION("counting tiles")
+    {
+        REQUIRE(map.count_walkable(Position2D(0, 0), Position2D(99, 9)) == 70 * 6);
+        REQUIRE(map.count_transparent(Position2D(0, 0), Position2D(19, 2)) == 10);
+        REQUIRE(map.get_walkable_mask().count() == 70 * 6);
+        REQUIRE(map.get_transparent_mask() == map.get_walkable_mask());
+    }
+    SECTION("negative costs carve rooms which are only transparent")
+    {
+        map.carve_room(Position2D(0, 0), Position2D(99, 0), -1);
+        REQUIRE(map.count_walkable(Position2D(0, 0), Position2D(99, 0)) == 0);
+        REQUIRE(map.count_transparent(Position2D(0, 0), Position2D(99, 0)) == 100);
+    }
+    SECTION("rooms out of bounds leave the map unchanged")
+    {
+        REQUIRE_THROWS_AS(map.carve_room(Position2D(90, 0), Position2D(100, 0)),
+                          __lz::LazarusException);
+        REQUIRE(map.count_walkable(Position2D(0, 0), Position2D(99, 9)) == 70 * 6);
+    }
+    SECTION("masking walkability keeps the costs")
+    {
+        TileMask mask(100, 10);
+        mask.fill(Position2D(0, 0), Position2D(49, 9), true);
+        map.mask_walkable(mask);
+        REQUIRE(map.count_walkable(Position2D(0, 0), Position2D(99, 9)) == 40 * 6);
+        REQUIRE_FALSE(map.is_walkable(50, 2));
+        REQUIRE(map.is_transparent(50, 2));
+        REQUIRE(map.get_cost(49, 2) == 3.0_a);
+        REQUIRE_THROWS_AS(map.get_cost(50, 2), __lz::LazarusException);
+    }
+    SECTION("masking transparency")
+    {
+        TileMask mask(100, 10, true);
+        mask.set(Position2D(10, 2), false);
+        map.mask_transparency(mask);
+        REQUIRE_FALSE(map.is_transparent(10, 2));
+        REQUIRE(map.is_walkable(10, 2));
+        REQUIRE_THROWS_AS(map.mask_transparency(TileMask(10, 100)),
+                          __lz::LazarusException);
+    }
+}
+
+TEST_CASE("map changes")
+{
+    SquareGridMap map(100, 10);
+    map.carve_room(Position2D(10, 2), Position2D(79, 7));
+    REQUIRE(map.get_generation() == 1);
+    std::vector<MapChange> received;
+    size_t id = map.subscribe([&](const MapChange &change) {
+        received.push_back(change);
+    });
+
+    SECTION("each change advances the generation and reaches the subscribers")
+    {
+        map.set_walkable(0, 0, true);
+        map.set_transparency(1, 0, true);
+        map.set_cost(Position2D(10, 2), 3);
+        REQUIRE(map.get_generation() == 4);
+        REQUIRE(received.size() == 3);
+
+        REQUIRE(received[0].generation == 2);
+        REQUIRE(received[0].walkability);
+        REQUIRE(received[0].costs);
+        REQUIRE_FALSE(received[0].transparency);
+        REQUIRE(received[0].left == 0);
+        REQUIRE(received[0].bottom == 0);
+        REQUIRE(received[1].transparency);
+        REQUIRE_FALSE(received[1].walkability);
+        REQUIRE(received[2].costs);
+        REQUIRE_FALSE(received[2].walkability);
+        REQUIRE(received[2].intersects(Position2D(5, 0), Position2D(10, 2)));
+        REQUIRE_FALSE(received[2].intersects(Position2D(11, 0), Position2D(20, 20)));
+    }
+    SECTION("setting tiles to what they were is not a change")
+    {
+        map.set_walkable(10, 2, true);
+        map.set_transparency(10, 2, true);
+        map.set_cost(10, 2, 1);
+        map.set_walkable(0, 0, false);
+        map.set_cost(0, 0, -5);  // Unwalkable tiles have no cost
+        map.carve_room(Position2D(5, 5), Position2D(1, 1));
+        REQUIRE(map.get_generation() == 1);
+        REQUIRE(received.empty());
+    }
+    SECTION("changes can be queried since a generation")
+    {
+        map.set_walkable(0, 0, true);
+        map.set_walkable(1, 0, true);
+        std::vector<MapChange> changes;
+        REQUIRE(map.get_changes_since(1, changes));
+        REQUIRE(changes.size() == 2);
+        REQUIRE(changes[1].left == 1);
+        changes.clear();
+        REQUIRE(map.get_changes_since(3, changes));
+        REQUIRE(changes.empty());
+        REQUIRE_THROWS_AS(map.get_changes_since(4, changes), __lz::LazarusException);
+    }
+    SECTION("old changes are forgotten")
+    {
+        for (size_t idx = 0; idx < 2 * __lz::ChangeLog::HISTORY; ++idx)
+            map.set_cost(10, 2, idx + 2);
+        std::vector<MapChange> changes;
+        REQUIRE_FALSE(map.get_changes_since(0, changes));
+        REQUIRE(changes.empty());
+        uint64_t recent = map.get_generation() - __lz::ChangeLog::HISTORY;
+        REQUIRE(map.get_changes_since(recent, changes));
+        REQUIRE(changes.size() == __lz::ChangeLog::HISTORY);
+    }
+    SECTION("masks change the bounds of the tiles they clear")
+    {
+        TileMask mask(100, 10, true);
+        mask.fill(Position2D(70, 3), Position2D(90, 4), false);
+        map.mask_walkable(mask);
+        REQUIRE(received.size() == 1);
+        REQUIRE(received[0].left == 70);
+        REQUIRE(received[0].right == 79);
+        REQUIRE(received[0].top == 3);
+        REQUIRE(received[0].bottom == 4);
+        REQUIRE(received[0].walkability);
+        map.mask_walkable(mask);
+        REQUIRE(received.size() == 1);
+    }
+    SECTION("maps made from prefabs have no changes")
+    {
+        SquareGridMap prefab_map({{0, 1, 1}, {1, 0, 1}});
+        REQUIRE(prefab_map.get_generation() == 0);
+        REQUIRE(prefab_map.is_walkable(1, 0));
+        REQUIRE(prefab_map.is_transparent(0, 1));
+        REQUIRE(prefab_map.get_cost(2, 1) == 1.);
+        REQUIRE_FALSE(prefab_map.is_walkable(1, 1));
+    }
+    SECTION("unsubscribed listeners are not called")
+    {
+        map.unsubscribe(id);
+        map.set_walkable(0, 0, true);
+        REQUIRE(received.empty());
+    }
+    SECTION("listeners can subscribe and unsubscribe while they are called")
+    {
+        map.unsubscribe(id);
+        int calls = 0;
+        size_t self = map.subscribe([&](const MapChange &) {
+            ++calls;
+            map.unsubscribe(self);
+        });
+        size_t later = 0;
+        map.subscribe([&](const MapChange &) { map.unsubscribe(later); });
+        later = map.subscribe([&](const MapChange &change) {
+            received.push_back(change);
+        });
+        bool subscribed = false;
+        map.subscribe([&](const MapChange &) {
+            if (!subscribed)
+                map.subscribe([&](const MapChange &change) {
+                    received.push_back(change);
+                });
+            subscribed = true;
+        });
+
+        // The listener unsubscribed by the one before it is not called, and the
+        // one subscribed only receives the next changes
+        map.set_walkable(0, 0, true);
+        REQUIRE(calls == 1);
+        REQUIRE(received.empty());
+        map.set_walkable(1, 0, true);
+        REQUIRE(calls == 1);
+        REQUIRE(received.size() == 1);
+        REQUIRE(received[0].generation == 3);
+    }
+    SECTION("copies keep the generation but not the subscribers")
+    {
+        SquareGridMap copy = map;
+        REQUIRE(copy.get_generation() == 1);
+        copy.set_walkable(0, 0, true);
+        REQUIRE(copy.get_generation() == 2);
+        REQUIRE(map.get_generation() == 1);
+        REQUIRE(received.empty());
+    }
+}
@@ -0,0 +1,47 @@
+#include <lazarus/ECS/ThreadPool.h>
+#include <lazarus/common.h>
+
+#include "catch/catch.hpp"
+
+#include <atomic>
+#include <vector>
+
+using namespace __lz;
+
+TEST_CASE("thread pool runs every task once", "[thread_pool]")
+{
+    ThreadPool pool(GENERATE(0, 1, 3));
+    const size_t num_tasks = 1000;
+    std::vector<std::atomic<int>> runs(num_tasks);
+    pool.parallel_for(num_tasks, [&](size_t task) { ++runs[task]; });
+    for (auto &count : runs)
+        REQUIRE(count == 1);
+
+    SECTION("nested batches")
+    {
+        std::atomic<int> total{0};
+        pool.parallel_for(10, [&](size_t) {
+            pool.parallel_for(10, [&](size_t task) { total += task; });
+        });
+        REQUIRE(total == 450);
+    }
+    SECTION("empty batches")
+    {
+        pool.parallel_for(0, [](size_t) { FAIL("No task should run"); });
+    }
+}
+
+TEST_CASE("thread pool rethrows exceptions of the tasks", "[thread_pool]")
+{
+    ThreadPool pool(2);
+    std::atomic<int> runs{0};
+    REQUIRE_THROWS_AS(pool.parallel_for(100,
+                                        [&](size_t task) {
+                                            ++runs;
+                                            if (task == 50)
+                                                throw LazarusException("task failed");
+                                        }),
+                      LazarusException);
+    // The rest of the tasks still ran
+    REQUIRE(runs == 100);
+}